@@ -7,10 +7,18 @@
    long presses and short presses. 
 
  Notes
+   Press lengths are worked out from the events' time stamps 
+   (ES_GetEventTime), the time of the edges rather than of the dispatch, so 
+   they don't change with how long the events waited in the queue. The 
+   difference of two us stamps only holds for gaps under ~71.6 minutes, a
+   longer gap aliases to gap mod 2^32 us and could come out as a bounce. So
+   the ES timer tick (ms, good for 49 days) of the last edge is kept as
+   well, and a gap over LONG_GAP_LEN by that count is clamped to it.
 ****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
 #include "ButtonService.h"
 #include "ES_framework.h"
+#include "ES_Timers.h"
 #include "IAQ_util.h"
 
 /*----------------------------- Module Defines ----------------------------*/
@@ -20,6 +28,8 @@
 #define DB_RELEASE_TIMER_LEN 2000  // set at much longer so e-screen has enough time for full-refresh
 #define LG_BUTTON_LEN 1500  // time length to hold down button to trigger as long press
 #define TIMEOUT_LEN 10000  
+#define LONG_GAP_LEN 60000  // ms, longer than any press, well short of the us stamps' range
+#define US_PER_MS 1000UL
 
 typedef enum{
   START_SM_STATE,
@@ -29,7 +39,7 @@ typedef enum{
 
 
 /*---------------------------- Module Functions ---------------------------*/
-
+static void IRAM_ATTR buttonEdgeISR(void);
 
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t MyPriority;
@@ -54,6 +64,10 @@ static statusState_t currStatusState = START_SM_STATE;
 bool InitButtonService(uint8_t Priority)
 {
   MyPriority = Priority;
+  ES_Trace_WatchState(MyPriority, &currStatusState, sizeof(currStatusState));
+
+  // only look at the button pin after it has changed
+  attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), buttonEdgeISR, CHANGE); 
 
   return true; 
 }
@@ -96,48 +110,58 @@ ES_Event_t RunButtonService(ES_Event_t ThisEvent)
 {
   ES_Event_t ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
-  static unsigned long timeStamp = 0; 
+  static uint32_t timeStamp = 0;  // us, time of the last edge acted on
+  static uint32_t timeStampTick = 0;  // ES timer tick (ms) it was handled at
+  uint32_t eventTime = ES_GetEventTime(&ThisEvent); 
+  uint32_t currTick = ES_Timer_GetTime(); 
+  uint32_t elapsed_time = (eventTime - timeStamp) / US_PER_MS; 
+  if(currTick - timeStampTick > LONG_GAP_LEN)
+  {
+    elapsed_time = LONG_GAP_LEN;  // the us difference may have aliased
+  }
 
   switch (currStatusState)
   {
     case START_SM_STATE:
     {
-      unsigned long elapsed_time = millis() - timeStamp; 
       if((elapsed_time > DB_RELEASE_TIMER_LEN) && ThisEvent.EventType == ES_HW_BUTTON_EVENT && ThisEvent.EventParam == BT_PRESS)
       {
-        timeStamp = millis(); 
+        timeStamp = eventTime; 
+        timeStampTick = currTick; 
         currStatusState = WAIT_SM_STATE; 
       }
       break;
     }
     case WAIT_SM_STATE:
     {
-      unsigned long elapsed_time = millis() - timeStamp; 
       if((elapsed_time > DB_PRESS_TIMER_LEN) && (elapsed_time < LG_BUTTON_LEN) && ThisEvent.EventType == ES_HW_BUTTON_EVENT && ThisEvent.EventParam == BT_RELEASE)
       {
-        ES_Event_t newEvent; 
+        ES_Event_t newEvent = {}; 
         newEvent.EventType = ES_SW_BUTTON_PRESS; 
         newEvent.EventParam = SHORT_BT_PRESS;
-        // printf("Short bt press: %lu\n", elapsed_time); 
+        // printf("Short bt press: %u\n", elapsed_time); 
         PostMainService(newEvent); 
 
         currStatusState = START_SM_STATE; 
-        timeStamp = millis(); 
+        timeStamp = eventTime; 
+        timeStampTick = currTick; 
       }  
       else if((elapsed_time >= LG_BUTTON_LEN) && (elapsed_time < TIMEOUT_LEN) && ThisEvent.EventType == ES_HW_BUTTON_EVENT && ThisEvent.EventParam == BT_RELEASE)
       {
-        ES_Event_t newEvent; 
+        ES_Event_t newEvent = {}; 
         newEvent.EventType = ES_SW_BUTTON_PRESS; 
         newEvent.EventParam = LONG_BT_PRESS;
         PostMainService(newEvent); 
 
         currStatusState = START_SM_STATE; 
-        timeStamp = millis(); 
+        timeStamp = eventTime; 
+        timeStampTick = currTick; 
       }  
       else if(elapsed_time > TIMEOUT_LEN) // in case we ever get stuck here, user will just have to press again 
       {
         currStatusState = START_SM_STATE; 
-        timeStamp = millis(); 
+        timeStamp = eventTime; 
+        timeStampTick = currTick; 
       }
       
       break;
@@ -154,7 +178,7 @@ bool EventCheckerButton(){
   
   if(currVal != lastVal)
   {
-    ES_Event_t newEvent;
+    ES_Event_t newEvent = {};
     newEvent.EventType = ES_HW_BUTTON_EVENT; 
 
     if(currVal > lastVal) 
@@ -177,6 +201,10 @@ bool EventCheckerButton(){
 /***************************************************************************
  private functions
  ***************************************************************************/
+static void IRAM_ATTR buttonEdgeISR(void)
+{
+  ES_SetEventPending(BUTTON_EVENT_SRC); 
+}
 
 /*------------------------------- Footnotes -------------------------------*/
 /*------------------------------ End of file ------------------------------*/
@@ -11,42 +11,87 @@
 #include "CO2_Service.h"
 #include "ES_framework.h"
 #include "ES_Timers.h"
+#include "ES_Hsm.h"
+#include "UartFrameDriver.h"
 
 /*----------------------------- Module Defines ----------------------------*/
+// index into CO2States, parents first
 typedef enum{
+  TOP_STATE = 0,    // takes the mode change in every state
   START_STATE,
   SEND_STATE,
-  START_SM_STATE,
-  SENSOR_NUM_STATE, 
-  SENSOR_HIGH_VAL_STATE,
-  SENSOR_LOW_VAL_STATE,
-  EMPTY_STATE,
-  CHECKSUM_STATE
+  READ_STATE        // waiting on the reply to a request
 } statusState_t; 
 
 // #define DEBUG_SENSOR
 
 #define START_BYTE 0XFF
 #define SENSOR_NUM 0X86
-#define NUM_OF_EMPTY_BYTES 4
+#define READ_RESPONSE_LEN 9  // start, sensor num, CO2 hi/lo, 4 empty bytes, checksum
 #define MAX_RETRY_READS 2
 #define CO2_WARMUP_TIME 180000U
 #define CO2_POLLING_TIME 1000
 
 /*---------------------------- Module Functions ---------------------------*/
-bool retryRead(uint8_t *retryAttempts, uint8_t *checkSumVal);
 uint8_t getCheckSum(uint8_t readSum);
 void clearSerial2Buffer();
+static void serial2RxCallback(void);
+static bool isValidFrame(const uint8_t *frame, uint8_t len);
+static void setMode(ES_Event_t ThisEvent);
+static void startWarmup(ES_Event_t ThisEvent);
+static void sendRequest(ES_Event_t ThisEvent);
+static void endRequest(ES_Event_t ThisEvent);
+static bool isFinalReading(ES_Event_t ThisEvent);
+static bool isReading(ES_Event_t ThisEvent);
+static void finishReadings(ES_Event_t ThisEvent);
+static void storeReading(ES_Event_t ThisEvent);
+static uint16_t getReading(ES_Event_t ThisEvent);
+static bool canRetry(ES_Event_t ThisEvent);
+static void retryRead(ES_Event_t ThisEvent);
+static void giveUp(ES_Event_t ThisEvent);
 
 
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t MyPriority;
-static statusState_t currStatusState = START_STATE;
+static ES_Hsm_t CO2Hsm;
+static uint8_t retryAttempts = 0; 
 static IAQmode_t CO2_mode = STREAM_MODE; 
 static uint8_t numReads = 0; 
 static bool sensorConnected = false; 
 static runAvg_t CO2RunAvg = {.runAvgSum=0, .buff={0}, .oldestIdx=0};
 
+static const UartFrameFormat_t CO2FrameFormats[] = {
+  {.Header=START_BYTE, .LenIndex=0, .Len=READ_RESPONSE_LEN, .IsValid=isValidFrame}
+};
+static UartFrameDriver_t CO2Frames; 
+
+static constexpr ES_HsmTransition_t TopTransitions[] = {
+  // event         target       param             guard           action
+  {IAQ_MODE_EVENT, ES_HSM_NONE, ES_HSM_ANY_PARAM, NULL,           setMode}   // sent to all the sensors by MainService
+};
+static constexpr ES_HsmTransition_t StartTransitions[] = {
+  {ES_READ_SENSOR, SEND_STATE,  ES_HSM_ANY_PARAM, NULL,           startWarmup}
+};
+static constexpr ES_HsmTransition_t SendTransitions[] = {
+  {ES_READ_SENSOR, READ_STATE,  ES_HSM_ANY_PARAM, NULL,           NULL},
+  {ES_TIMEOUT,     READ_STATE,  CO2_TIMER_NUM,    NULL,           NULL}
+};
+static constexpr ES_HsmTransition_t ReadTransitions[] = {
+  {ES_SERIAL2,     START_STATE, ES_HSM_ANY_PARAM, isFinalReading, finishReadings},
+  {ES_SERIAL2,     SEND_STATE,  ES_HSM_ANY_PARAM, isReading,      storeReading},
+  {ES_TIMEOUT,     SEND_STATE,  CO2_TIMER_NUM,    canRetry,       retryRead},
+  {ES_TIMEOUT,     START_STATE, CO2_TIMER_NUM,    NULL,           giveUp}
+};
+
+static constexpr ES_HsmState_t CO2States[] = {
+  // parent      transitions                            entry        exit
+  {ES_HSM_NONE,  ES_HSM_TRANSITIONS(TopTransitions),    NULL,        NULL},        // TOP_STATE
+  {TOP_STATE,    ES_HSM_TRANSITIONS(StartTransitions),  NULL,        NULL},        // START_STATE
+  {TOP_STATE,    ES_HSM_TRANSITIONS(SendTransitions),   NULL,        NULL},        // SEND_STATE
+  {TOP_STATE,    ES_HSM_TRANSITIONS(ReadTransitions),   sendRequest, endRequest}   // READ_STATE
+};
+ES_HSM_CHECK(CO2States);
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -66,11 +111,20 @@ static runAvg_t CO2RunAvg = {.runAvgSum=0, .buff={0}, .oldestIdx=0};
 bool InitCO2Service(uint8_t Priority)
 {
   MyPriority = Priority;
+  ES_Event_t ThisEvent = {.EventType=ES_INIT};
+  if(!ES_Hsm_Start(&CO2Hsm, CO2States, START_STATE, ThisEvent))
+  {
+    return false;
+  }
+  ES_Trace_WatchState(MyPriority, &CO2Hsm.Current, sizeof(CO2Hsm.Current));
 
   Serial2.begin(9600, SERIAL_8N1, 15, 32, false, 20000UL);
   while (!Serial2) {
     ;
   } 
+  Serial2.onReceive(serial2RxCallback);  // only check Serial2 once bytes arrive
+  UartFrame_Init(&CO2Frames, &Serial2, CO2FrameFormats, ARRAY_SIZE(CO2FrameFormats), 
+      PostCO2Service, ES_SERIAL2); 
 
   memset(CO2RunAvg.buff, 0, sizeof(CO2RunAvg.buff));
   
@@ -116,174 +170,25 @@ ES_Event_t RunCO2Service(ES_Event_t ThisEvent)
   // Serial.printf("CO2 event: %d %d\n", ThisEvent.EventType, ThisEvent.EventParam);
   ES_Event_t ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
-  static uint8_t retryAttempts = 0; 
-  static uint16_t sensorVal = 0; 
-  static uint8_t checkSumVal = 0; 
 
   #ifdef DEBUG_SENSOR
   if(ThisEvent.EventType == ES_SERIAL2)
   {
-    printf("CO2 D: %x\n", ThisEvent.EventParam);
+    printf("CO2 frame\n");
   }
   #endif
 
-
-  if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == CO2_TIMER_NUM && currStatusState != START_STATE && currStatusState != SEND_STATE)
-  {
-    retryRead(&retryAttempts, &checkSumVal);
-    return ReturnEvent; 
-  }
-
-
-  switch (currStatusState)
+  if(ES_Hsm_Dispatch(&CO2Hsm, ThisEvent) == ES_HSM_TOO_DEEP)
   {
-    case START_STATE: 
-    {
-      if(ThisEvent.EventType == ES_READ_SENSOR)
-      {
-        ES_Timer_InitTimer(CO2_TIMER_NUM, CO2_WARMUP_TIME);
-        currStatusState = SEND_STATE; 
-      }
-      break;
-    }
-    case SEND_STATE:
-    {
-      if(ThisEvent.EventType == ES_READ_SENSOR || (ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == CO2_TIMER_NUM))
-      {
-        clearSerial2Buffer(); 
-        Serial2.write(0xFF);
-        Serial2.write(0x01); 
-        Serial2.write(0x86);
-        Serial2.write(0x79);
-
-        currStatusState = START_SM_STATE; 
-        ES_Timer_InitTimer(CO2_TIMER_NUM, CO2_POLLING_TIME);
-        checkSumVal = 0;  // just to be safe 
-      }
-
-      break;
-    }
-    case START_SM_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL2 && ThisEvent.EventParam == START_BYTE)
-      {
-        currStatusState = SENSOR_NUM_STATE; 
-      }
-      
-      break;
-    }
-    case SENSOR_NUM_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL2 && ThisEvent.EventParam == SENSOR_NUM)
-      {
-        currStatusState = SENSOR_HIGH_VAL_STATE; 
-        checkSumVal += (uint8_t)ThisEvent.EventParam; 
-      }
-      
-      break;
-    }
-    case SENSOR_HIGH_VAL_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL2)
-      {
-        currStatusState = SENSOR_LOW_VAL_STATE;
-        sensorVal = ThisEvent.EventParam << 8;  
-        checkSumVal += (uint8_t)ThisEvent.EventParam; 
-      }
-      
-      break;
-    }
-    case SENSOR_LOW_VAL_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL2)
-      {
-        currStatusState = EMPTY_STATE;
-        ThisEvent.EventParam &= 0xFF;  // clear out top byte just to be safe
-        sensorVal |= ThisEvent.EventParam;  
-        checkSumVal += (uint8_t)ThisEvent.EventParam; 
-      }
-      
-      break;
-    }
-    case EMPTY_STATE:
-    {
-      static uint8_t counter = 0; 
-      if(ThisEvent.EventType == ES_SERIAL2)
-      {
-        counter++; 
-        checkSumVal += (uint8_t)ThisEvent.EventParam; 
-        if(counter == NUM_OF_EMPTY_BYTES)
-        {
-          currStatusState = CHECKSUM_STATE; 
-          counter = 0; 
-        }
-        else if(counter > NUM_OF_EMPTY_BYTES)
-        {
-          counter = 0; 
-          IAQ_PRINTF("Too many empty bytes from CO2 reading");
-          retryRead(&retryAttempts, &checkSumVal); 
-        }
-      }
-      
-      break;
-    }
-
-    case CHECKSUM_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL2)
-      {
-        if(ThisEvent.EventParam == getCheckSum(checkSumVal))
-        {
-          sensorConnected = true; 
-          updateRunAvg(&CO2RunAvg, sensorVal); 
-          if(CO2_mode == STREAM_MODE)
-            numReads = 0; 
-          else
-            numReads++;
-
-          if(numReads >= RUN_AVG_BUFFER_LEN * 2)
-          {
-            retryAttempts = 0; 
-            numReads = 0; 
-            updateCO2Val(sensorVal); 
-            IAQ_PRINTF("Avg CO2: %d\n", sensorVal); 
-
-            currStatusState = START_STATE; 
-            ES_Timer_StopTimer(CO2_TIMER_NUM);
-          }
-          else
-          {
-            currStatusState = SEND_STATE; 
-          }
-          
-          checkSumVal = 0;           
-        }
-        else
-        {
-          retryRead(&retryAttempts, &checkSumVal); 
-        }
-      }
-      
-      break;
-    }
+    ReturnEvent.EventType = ES_ERROR;
   }
-
   return ReturnEvent;
 }
 
 
+// posts an ES_SERIAL2 event for every whole frame received from the sensor
 bool EventCheckerCO2(){
-  if(Serial2.available())
-  {
-    ES_Event_t newEvent; 
-    newEvent.EventType = ES_SERIAL2; 
-    newEvent.EventParam = Serial2.read(); 
-    PostCO2Service(newEvent); 
-
-    return true; 
-  }
-
-  return false; 
+  return UartFrame_Receive(&CO2Frames); 
 }
 
 
@@ -311,36 +216,115 @@ void getCO2Avg(int16_t *CO2Avg)
 /***************************************************************************
  private functions
  ***************************************************************************/
+// runs in the UART driver's task when bytes have been received
+static void serial2RxCallback(void)
+{
+  ES_SetEventPending(CO2_EVENT_SRC); 
+}
 
-bool retryRead(uint8_t *retryAttempts, uint8_t *checkSumVal)
+//*********************************
+// CO2States guards and actions
+//*********************************
+static void setMode(ES_Event_t ThisEvent)
 {
-  if(retryAttempts == NULL || checkSumVal == NULL)
-    return false; 
+  setModeCO2((IAQmode_t)ThisEvent.EventParam); 
+}
 
-  sensorConnected = false; 
-  if(CO2_mode == STREAM_MODE)
-  {
-    *retryAttempts = 0;  // in stream mode don't need to stop trying
-  }
+static void startWarmup(ES_Event_t ThisEvent)
+{
+  ES_Timer_InitTimer(CO2_TIMER_NUM, CO2_WARMUP_TIME);
+}
 
-  *checkSumVal = 0; 
-  currStatusState = SEND_STATE; 
-  if(*retryAttempts >= MAX_RETRY_READS)
-  {
+// entry to READ_STATE
+static void sendRequest(ES_Event_t ThisEvent)
+{
+  clearSerial2Buffer(); 
+  Serial2.write(0xFF);
+  Serial2.write(0x01); 
+  Serial2.write(0x86);
+  Serial2.write(0x79);
+
+  // polls from the first read on, a retry doesn't move the period
+  if(ES_Timer_IsRunning(CO2_TIMER_NUM) != ES_Timer_ACTIVE)
+    ES_Timer_InitPeriodic(CO2_TIMER_NUM, CO2_POLLING_TIME);
+
+  // UART2 can't wake the ESP32 from light sleep, so stay awake while the
+  // reply is coming in
+  ES_SetIdleInhibit(MyPriority, true);
+}
+
+// exit from READ_STATE
+static void endRequest(ES_Event_t ThisEvent)
+{
+  ES_SetIdleInhibit(MyPriority, false);
+}
+
+// the reply that completes an auto mode average
+static bool isFinalReading(ES_Event_t ThisEvent)
+{
+  return isReading(ThisEvent) && CO2_mode != STREAM_MODE && numReads + 1 >= RUN_AVG_BUFFER_LEN * 2; 
+}
+
+static bool isReading(ES_Event_t ThisEvent)
+{
+  return UartFrame_Get(ThisEvent, NULL) != NULL; 
+}
+
+static void finishReadings(ES_Event_t ThisEvent)
+{
+  storeReading(ThisEvent); 
+  uint16_t sensorVal = getReading(ThisEvent); 
+
+  retryAttempts = 0; 
+  numReads = 0; 
+  ES_Timer_StopTimer(CO2_TIMER_NUM);
+  updateCO2Val(sensorVal); 
+  IAQ_PRINTF("Avg CO2: %d\n", sensorVal); 
+}
+
+static void storeReading(ES_Event_t ThisEvent)
+{
+  sensorConnected = true; 
+  updateRunAvg(&CO2RunAvg, getReading(ThisEvent)); 
+  if(CO2_mode == STREAM_MODE)
     numReads = 0; 
-    *retryAttempts = 0; 
-    currStatusState = START_STATE; 
-    ES_Timer_StopTimer(CO2_TIMER_NUM);
-    updateCO2Val(-1); 
-    IAQ_PRINTF("Could not read from CO2 sensor\n");
-    return false; 
-  }
+  else
+    numReads++;
+}
+
+// CO2 ppm in a reply frame
+static uint16_t getReading(ES_Event_t ThisEvent)
+{
+  const uint8_t *frame = UartFrame_Get(ThisEvent, NULL); 
+  return ((uint16_t)frame[2] << 8) | frame[3]; 
+}
+
+// in stream mode don't need to stop trying
+static bool canRetry(ES_Event_t ThisEvent)
+{
+  return CO2_mode == STREAM_MODE || retryAttempts < MAX_RETRY_READS; 
+}
+
+static void retryRead(ES_Event_t ThisEvent)
+{
+  sensorConnected = false; 
+  if(CO2_mode == STREAM_MODE)
+    retryAttempts = 0; 
 
   IAQ_PRINTF("Retrying CO2\n");
-  *retryAttempts = *retryAttempts + 1; 
+  retryAttempts++; 
   ES_Event_t newEvent = {.EventType=ES_READ_SENSOR};
   PostCO2Service(newEvent);
-  return true; 
+}
+
+static void giveUp(ES_Event_t ThisEvent)
+{
+  sensorConnected = false; 
+  numReads = 0; 
+  retryAttempts = 0; 
+  ES_Timer_StopTimer(CO2_TIMER_NUM);
+  updateCO2Val(-1); 
+  IAQ_PRINTF("Could not read from CO2 sensor\n");
 }
 
 uint8_t getCheckSum(uint8_t readSum)
@@ -349,6 +333,17 @@ uint8_t getCheckSum(uint8_t readSum)
   return (readSum + 1);
 }
 
+// checksum covers every byte but the start byte and itself
+static bool isValidFrame(const uint8_t *frame, uint8_t len)
+{
+  uint8_t sum = 0; 
+  for(uint8_t i=1; i < len-1; i++)
+  {
+    sum += frame[i]; 
+  }
+  return frame[1] == SENSOR_NUM && frame[len-1] == getCheckSum(sum); 
+}
+
 void clearSerial2Buffer()
 {
   while(Serial2.available())
@@ -356,6 +351,7 @@ void clearSerial2Buffer()
     IAQ_PRINTF("Cleared data CO2\n");
     Serial2.read(); 
   }
+  UartFrame_Reset(&CO2Frames); 
 }
 /*------------------------------- Footnotes -------------------------------*/
 /*------------------------------ End of file ------------------------------*/
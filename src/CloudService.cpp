@@ -8,6 +8,9 @@
    as they come in.  
 
  Notes
+   Run by the worker task (ES_WORKER_SERVICES), so writing to influx doesn't 
+   hold up the other services. MainService hands over the readings with 
+   updateCloudSensorVals from the loop task, they are copied under ES_Lock.
 ****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
 
@@ -65,6 +68,7 @@ void stopCloudSM();
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t MyPriority;
 Point sensor("IAQ_Readings");  // Data point
+static IAQsensorVals_t cloudReads;  // latest readings from MainService, guarded by ES_Lock
 RTC_DATA_ATTR time_t lastTmStamp = 0;  
 
 // InfluxDB client instance with preconfigured InfluxCloud certificate
@@ -91,9 +95,11 @@ statusState_t currSMState = START_CONNECTION;
 bool InitCloudService(uint8_t Priority)
 {
   MyPriority = Priority;
+  ES_Trace_WatchState(MyPriority, &currSMState, sizeof(currSMState));
 
   // configure client
   client.setConnectionParamsV1(INFLUXDB_URL, INFLUXDB_DB_NAME, INFLUXDB_USER, INFLUXDB_PWD, nullptr);
+  client.setHTTPOptions(HTTPOptions().httpReadTimeout(CLOUD_HTTP_TIMEOUT));
 
   // Add tags to cloud data
   sensor.clearTags(); 
@@ -185,13 +191,13 @@ ES_Event_t RunCloudService(ES_Event_t ThisEvent)
       if (ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == WIFI_TIMER_NUM)
       {
         static uint8_t tmoutCounts = 0; 
-        if(WiFi.status() == WL_CONNECTED)
+        if(ES_Trace_Input(WIFI_STATUS_INPUT, WiFi.status()) == WL_CONNECTED)
         {
           IAQ_PRINTF("Connected\n");
           tmoutCounts = 0; 
           wifiRetries = 0; 
 
-          if(timeForResync())  
+          if(ES_Trace_Input(RESYNC_DUE_INPUT, timeForResync()))  
           {
             IAQ_PRINTF("Syncing time"); 
             configTzTime(TZ_INFO, "pool.ntp.org");
@@ -233,7 +239,7 @@ ES_Event_t RunCloudService(ES_Event_t ThisEvent)
       if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == WIFI_TIMER_NUM)
       {
         static uint8_t tmCount = 0; 
-        if(time(nullptr) < 1599000000UL)
+        if(!ES_Trace_Input(TIME_SYNCED_INPUT, time(nullptr) >= 1599000000UL))
         {
           // time not synced yet 
           tmCount++; 
@@ -291,21 +297,18 @@ ES_Event_t RunCloudService(ES_Event_t ThisEvent)
       break;
     }
   }
+
+  // keep out of light sleep while the WiFi is up so the connection isn't dropped
+  ES_SetIdleInhibit(MyPriority, currSMState != START_CONNECTION);
   return ReturnEvent;
 }
 
 
 void updateCloudSensorVals(IAQsensorVals_t *sensorReads)
 {
-  sensor.clearFields(); // Clear fields for reusing the point. Tags will remain untouched
-  sensor.addField("eCO2", sensorReads->eCO2); 
-  sensor.addField("CO2", sensorReads->CO2); 
-  sensor.addField("PM25", sensorReads->PM25); 
-  sensor.addField("PM10", sensorReads->PM10); 
-  sensor.addField("tVOC", sensorReads->tVOC); 
-  sensor.addField("tm", sensorReads->temp); 
-  sensor.addField("rh", sensorReads->rh); 
-  sensor.addField("bat", getBatVolt()); 
+  ES_Lock(); 
+  cloudReads = *sensorReads; 
+  ES_Unlock(); 
 }
 
 /***************************************************************************
@@ -332,6 +335,20 @@ void setupDataPt()
 
 bool publishDataPt()
 {
+  ES_Lock(); 
+  IAQsensorVals_t reads = cloudReads; 
+  ES_Unlock(); 
+
+  sensor.clearFields(); // Clear fields for reusing the point. Tags will remain untouched
+  sensor.addField("eCO2", reads.eCO2); 
+  sensor.addField("CO2", reads.CO2); 
+  sensor.addField("PM25", reads.PM25); 
+  sensor.addField("PM10", reads.PM10); 
+  sensor.addField("tVOC", reads.tVOC); 
+  sensor.addField("tm", reads.temp); 
+  sensor.addField("rh", reads.rh); 
+  sensor.addField("bat", getBatVolt()); 
+
   time_t tnow = time(nullptr);
   sensor.setTime(tnow);  
   IAQ_PRINTF("Writing to influx: ");
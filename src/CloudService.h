@@ -6,6 +6,13 @@
 #include "ePaperDriver.h"
 #include <stdbool.h>
 
+// Longest one write to InfluxDB can hold up CloudService's run: the TCP and TLS
+// connect, bounded by HTTPClient's connect timeout, then the wait for the
+// server's reply, bounded by the client's HTTP read timeout
+#define CLOUD_CONNECT_TIMEOUT 5000U  // ms, HTTPClient's default, the client keeps it
+#define CLOUD_HTTP_TIMEOUT 5000U  // ms, set in InitCloudService
+#define CLOUD_WRITE_MAX_TIME (CLOUD_CONNECT_TIMEOUT + CLOUD_HTTP_TIMEOUT)
+
 // Public Function Prototypes
 bool InitCloudService(uint8_t Priority);
 bool PostCloudService(ES_Event_t ThisEvent);
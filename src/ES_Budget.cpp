@@ -0,0 +1,182 @@
+/****************************************************************************
+ Module
+     ES_Budget.c
+ Description
+     Run budget checker for the Events & Services framework. ES_Run takes
+     the cycle counter before and after every run function, and a run that
+     took longer than its service's SERV_n_RUN_BUDGET is counted as an
+     overrun, with the time it went over. The longest run of each service
+     is kept with its event, so a report points at the blocking code.
+ Notes
+     Only built with ES_BUDGET_ENABLE. The cycle counter wraps after 2^32
+     cycles (~53 s at 80MHz), longer runs come out short.
+*****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ES_Configure.h"
+
+#ifdef ES_BUDGET_ENABLE
+#include "ES_Budget.h"
+#include "ES_Port.h"
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#ifdef ES_PORT_POSIX
+#define ES_BUDGET_PRINTF printf
+#else
+#include <HardwareSerial.h>
+#define ES_BUDGET_PRINTF Serial.printf
+#endif
+
+/*---------------------------- Module Functions ---------------------------*/
+
+/*---------------------------- Module Variables ---------------------------*/
+static ES_BudgetStats_t BudgetStats[NUM_SERVICES];
+static uint32_t CyclesPerUs = 1;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+   ES_Budget_Reset
+ Parameters
+   const uint32_t * : the services' run budgets in us, one per service
+ Returns
+   None
+ Description
+   Clears all the stats and sets the budgets. Called by ES_Initialize
+ Notes
+   Picks up the CPU clock, so call it again after changing the CPU frequency
+****************************************************************************/
+void ES_Budget_Reset(const uint32_t *Budgets)
+{
+  memset(BudgetStats, 0, sizeof(BudgetStats));
+  for(uint8_t i = 0; i < NUM_SERVICES; i++)
+    BudgetStats[i].Budget = Budgets[i];
+  CyclesPerUs = _HW_GetCyclesPerUs();
+  if(CyclesPerUs == 0)
+    CyclesPerUs = 1;
+}
+
+/****************************************************************************
+ Function
+   ES_Budget_StartRun
+ Parameters
+   None
+ Returns
+   uint32_t : time stamp to hand to ES_Budget_EndRun
+ Description
+   Called just before a run function
+ Notes
+****************************************************************************/
+uint32_t ES_Budget_StartRun(void)
+{
+  return _HW_GetCycleCount();
+}
+
+/****************************************************************************
+ Function
+   ES_Budget_EndRun
+ Parameters
+   uint8_t : service that ran
+   const ES_Event_t * : the event it was given
+   uint32_t : time stamp from ES_Budget_StartRun
+ Returns
+   None
+ Description
+   Called once the run function returns. Checks the run time against the
+   service's budget
+ Notes
+****************************************************************************/
+void ES_Budget_EndRun(uint8_t ServiceNum, const ES_Event_t *ThisEvent, uint32_t StartTime)
+{
+  if(ServiceNum >= NUM_SERVICES)
+    return;
+
+  uint32_t runTime = (_HW_GetCycleCount() - StartTime) / CyclesPerUs;
+  ES_BudgetStats_t *stats = &BudgetStats[ServiceNum];
+  stats->NumRuns++;
+  if(runTime > stats->Budget)
+  {
+    stats->NumOverruns++;
+    stats->OverrunTime += runTime - stats->Budget;
+  }
+  if(runTime > stats->MaxRunTime)
+  {
+    stats->MaxRunTime = runTime;
+    stats->WorstEvent = ThisEvent->EventType;
+    stats->WorstParam = ThisEvent->EventParam;
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_Budget_GetStats
+ Parameters
+   uint8_t : service number
+   ES_BudgetStats_t * : filled in with the service's stats
+ Returns
+   bool : false if there is no such service
+ Description
+   Gives the stats gathered for a service since the last reset
+ Notes
+****************************************************************************/
+bool ES_Budget_GetStats(uint8_t ServiceNum, ES_BudgetStats_t *Stats)
+{
+  if(ServiceNum >= NUM_SERVICES || Stats == NULL)
+    return false;
+
+  *Stats = BudgetStats[ServiceNum];
+  return true;
+}
+
+/****************************************************************************
+ Function
+   ES_Budget_Print
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Lists the services that have run over their budget over Serial (stdout
+   on the host), the most time over budget first, with the longest run and
+   the event type/param that caused it
+ Notes
+****************************************************************************/
+void ES_Budget_Print(void)
+{
+  uint8_t order[NUM_SERVICES];
+  uint8_t numOver = 0;
+  for(uint8_t i = 0; i < NUM_SERVICES; i++)
+  {
+    if(BudgetStats[i].NumOverruns == 0)
+      continue;
+
+    // insertion sort, most time over budget first
+    uint8_t pos = numOver++;
+    while(pos > 0 && BudgetStats[order[pos - 1]].OverrunTime < BudgetStats[i].OverrunTime)
+    {
+      order[pos] = order[pos - 1];
+      pos--;
+    }
+    order[pos] = i;
+  }
+
+  if(numOver == 0)
+  {
+    ES_BUDGET_PRINTF("ES run budgets: no overruns\n");
+    return;
+  }
+
+  ES_BUDGET_PRINTF("ES run budget overruns, times in us\n");
+  ES_BUDGET_PRINTF("serv   budget     runs  overruns       max  total over  worst event\n");
+  for(uint8_t i = 0; i < numOver; i++)
+  {
+    const ES_BudgetStats_t *stats = &BudgetStats[order[i]];
+    ES_BUDGET_PRINTF("%4u  %7u  %7u  %8u  %8u  %10llu  %u/%u\n", order[i], stats->Budget,
+        stats->NumRuns, stats->NumOverruns, stats->MaxRunTime,
+        (unsigned long long)stats->OverrunTime, stats->WorstEvent, stats->WorstParam);
+  }
+}
+
+#endif /* ES_BUDGET_ENABLE */
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
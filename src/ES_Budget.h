@@ -0,0 +1,48 @@
+/****************************************************************************
+ Module
+    ES_Budget.h
+ Description
+    header file for the run budget checker. Turned on with ES_BUDGET_ENABLE
+    in ES_Configure.h, otherwise every function here compiles to nothing.
+    Every dispatch is timed against its service's SERV_n_RUN_BUDGET, and the
+    ones that run over are counted along with the event behind the worst.
+ Notes
+    All times are in us. The worker's services are timed by the worker task,
+    so their stats may be mid update when read from the loop
+*****************************************************************************/
+#ifndef ES_Budget_H
+#define ES_Budget_H
+
+#include "ES_Event.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+  uint32_t Budget;            // SERV_n_RUN_BUDGET
+  uint32_t NumRuns;
+  uint32_t NumOverruns;       // runs that took longer than Budget
+  uint32_t MaxRunTime;
+  uint64_t OverrunTime;       // total time spent past the budget
+  ES_EventType_t WorstEvent;  // type and param of the event behind MaxRunTime
+  uint16_t WorstParam;
+}ES_BudgetStats_t;
+
+#ifdef ES_BUDGET_ENABLE
+// used by the framework
+void ES_Budget_Reset(const uint32_t *Budgets);
+uint32_t ES_Budget_StartRun(void);
+void ES_Budget_EndRun(uint8_t ServiceNum, const ES_Event_t *ThisEvent, uint32_t StartTime);
+
+// used by the application
+bool ES_Budget_GetStats(uint8_t ServiceNum, ES_BudgetStats_t *Stats);
+void ES_Budget_Print(void);
+#else
+static inline void ES_Budget_Reset(const uint32_t *Budgets) {}
+static inline uint32_t ES_Budget_StartRun(void) { return 0; }
+static inline void ES_Budget_EndRun(uint8_t ServiceNum, const ES_Event_t *ThisEvent, uint32_t StartTime) {}
+static inline bool ES_Budget_GetStats(uint8_t ServiceNum, ES_BudgetStats_t *Stats) { return false; }
+static inline void ES_Budget_Print(void) {}
+#endif
+
+#endif /* ES_Budget_H */
@@ -11,6 +11,15 @@
 #ifndef ES_CONFIGURE_H
 #define ES_CONFIGURE_H
 
+// the host builds (ES_Port_Posix) have their own configurations, see
+// [env:native] and [env:native_test] in platformio.ini
+#ifdef ES_PORT_POSIX
+#ifdef ES_UNIT_TEST
+#include "host/test/ES_Configure_Test.h"
+#else
+#include "host/ES_Configure_Host.h"
+#endif
+#else
 
 /********************** Pin Configuration ***********************************/ 
 /****************************************************************************/
@@ -35,26 +44,66 @@ typedef enum
   ES_SUCCESS,               /* used to indicate something was successful */ 
   /* User-defined events start here */
   ES_SERIAL,
-  ES_SERIAL1,
-  ES_SERIAL2,
-  ES_I2C,
+  ES_SERIAL1,                /* whole frame received on Serial1, frame is in the payload (UartFrame_Get) */
+  ES_SERIAL2,                /* whole frame received on Serial2, frame is in the payload (UartFrame_Get) */
+  ES_I2C,                    /* I2C response in the payload, param is the number of bytes */
   ES_HW_BUTTON_EVENT,         /* when physical button pressed (1) or released (0)*/
   ES_SW_BUTTON_PRESS,          /* short button press (0) and long button press (1)*/
   ES_READ_SENSOR,               /* command to send to sensor to read its value(s) */
-  COMMSM_SEND,
   SENSORS_READ_EVENT,
   CLOUD_PUB_EVENT,
   CLOUD_UPDATED_EVENT,
+  IAQ_MODE_EVENT,            /* sensors switch to the IAQmode_t in param */
+  ES_NUM_EVENT_TYPES         /* keep last, number of event types */
 }ES_EventType_t;
 
+// names of the event types above, in the same order, for tools that print
+// them (the simulator's trace export). Keep in step with ES_EventType_t
+#define ES_EVENT_NAMES "ES_NO_EVENT", "ES_ERROR", "ES_INIT", "ES_TIMEOUT", "ES_FAIL", \
+    "ES_SUCCESS", "ES_SERIAL", "ES_SERIAL1", "ES_SERIAL2", "ES_I2C", "ES_HW_BUTTON_EVENT", \
+    "ES_SW_BUTTON_PRESS", "ES_READ_SENSOR", "SENSORS_READ_EVENT", \
+    "CLOUD_PUB_EVENT", "CLOUD_UPDATED_EVENT", "IAQ_MODE_EVENT"
 
-/****************************************************************************/
-// add all event checker functions here (comma separated)
-// the functions at the beginning of the list are checked first 
 
-//EventCheckerKeyBoard, EventCheckerButton
-#define EVENT_CHECKER_LIST EventCheckerButton, EventCheckerCO2, EventCheckerHPM, EventChecker_SVM30,
+/****************************************************************************/
+// add all event checkers here as ES_CHECKER(function, min interval, weight,
+// service) (comma separated, no trailing comma). The min interval is the least
+// time in ms between two calls to the checker, so a busy source can't have its
+// checker called on every pass. The weight is how many times in a row it may
+// be called in one pass while it keeps finding events (ES_CHECKERS_WEIGHTED).
+// The service is the one the checker's events are for, the checker is never
+// called if that service's probe fails (SERV_n_PROBE).
+// ES_GetCheckerStats counts each checker's hits and misses to tune them by
+
+// ES_CHECKER(EventCheckerKeyBoard, 0, 1, ...), ES_CHECKER(EventCheckerButton, 0, 1, ...)
+#define EVENT_CHECKER_LIST \
+  ES_CHECKER(EventCheckerButton, 0, 1, BUTTON_SERV_NUM), \
+  ES_CHECKER(EventCheckerCO2, 5, 2, CO2_SERV_NUM), \
+  ES_CHECKER(EventCheckerHPM, 5, 2, HPM_SERV_NUM), \
+  ES_CHECKER(EventChecker_SVM30, 0, 1, SVM30_SERV_NUM)
+
+// ES_CHECKERS_ROUND_ROBIN: a pass stops at the first checker with an event
+//   and the next one starts after it, so one event is found per pass
+// ES_CHECKERS_WEIGHTED: every pending checker is called on each pass, up to
+//   its weight times. Both start after the last checker that found an event
+#define ES_CHECKER_SCHEDULING ES_CHECKERS_WEIGHTED
+
+// Event sources let an ISR or driver callback mark an event checker as having
+// work pending (ES_SetEventPending). Only checkers that are pending get called,
+// so the loop can block while nothing is happening. Source n wakes up the nth
+// function in EVENT_CHECKER_LIST, so keep the two lists in the same order
+typedef enum
+{
+  BUTTON_EVENT_SRC = 0,     /* button GPIO edge interrupt */
+  CO2_EVENT_SRC,            /* Serial2 receive callback */
+  HPM_EVENT_SRC,            /* Serial1 receive callback */
+  SVM30_EVENT_SRC,          /* I2C read completed */
+  ES_NUM_EVENT_SOURCES      /* keep last */
+}ES_EventSource_t;
 
+// As a fallback in case a source misses an interrupt, every event checker is
+// still polled at this interval (ms). Set to 0 to poll all checkers every pass
+#define EVENT_CHECKER_POLL_PERIOD 50
 
 
 /****************************** Timers **************************************/ 
@@ -66,7 +115,7 @@ typedef enum
 #define TIMER_UNUSED ((pPostFunc)0)
 #define TIMER0_RESP_FUNC PostCO2Service
 #define TIMER1_RESP_FUNC PostHPMService
-#define TIMER2_RESP_FUNC PostHPMService
+#define TIMER2_RESP_FUNC TIMER_UNUSED
 #define TIMER3_RESP_FUNC PostMainService
 #define TIMER4_RESP_FUNC PostSVM30Service
 #define TIMER5_RESP_FUNC PostSVM30Service
@@ -83,13 +132,99 @@ typedef enum
 
 #define CO2_TIMER_NUM 0
 #define HPM_TIMER_NUM 1
-#define COMMSM_TIMER_NUM 2
 #define MAIN_SERV_TIMER_NUM 3
 #define SVM30_TIMER_NUM 4
 #define SVM30_TIMER2_NUM 5
 #define WIFI_TIMER_NUM 6
 #define BAT_TIMER_NUM 7
 
+// Ticks (ms) each timer's timeouts may be late by, so the ~1s sensor and
+// battery polls that were started at slightly different times go off together
+// in one wakeup rather than one each. Add a line per timer with
+// ES_TIMER_SLACK(timer number, slack), timers that aren't listed go off on
+// time. Never more than a quarter of the time the timer is started with
+#define ES_TIMER_SLACKS \
+  ES_TIMER_SLACK(CO2_TIMER_NUM, 50) \
+  ES_TIMER_SLACK(HPM_TIMER_NUM, 50) \
+  ES_TIMER_SLACK(SVM30_TIMER_NUM, 50) \
+  ES_TIMER_SLACK(BAT_TIMER_NUM, 250)
+
+// Total number of timers. The numbered timers above that are unused, and the
+// ones past 15, are handed out by ES_Timer_Alloc
+#define ES_TIMER_POOL_SIZE 32
+
+
+/****************************** Payloads ************************************/
+// Events that need to carry more than EventParam borrow a block from the
+// payload pool (see ES_Payload.h). ES_PAYLOAD_POOL_SIZE can be at most 32
+#define ES_PAYLOAD_SIZE 16
+#define ES_PAYLOAD_POOL_SIZE 8
+
+
+/****************************** Idle ****************************************/
+// When every queue is empty, ES_Run idles until the next ES timer deadline.
+// If that is at least ES_LIGHT_SLEEP_MIN_TIME ms away and no service has
+// inhibited it (ES_SetIdleInhibit), the ESP32 goes into light sleep. Otherwise
+// the loop just blocks. Idle periods are capped at ES_IDLE_MAX_TIME ms
+#define ES_LIGHT_SLEEP_MIN_TIME 20
+#define ES_IDLE_MAX_TIME 10000U
+// Wake sources used during light sleep. Only UART0 and UART1 can wake the
+// ESP32 and the first bytes are lost doing so, so services waiting on a reply
+// over a UART should inhibit light sleep until it arrives
+#define ES_WAKE_GPIO BUTTON_PIN
+#define ES_WAKE_UART 1
+
+
+/****************************** Time Stamps *********************************/
+// Stamps every ES_Event_t with the us time it happened (see ES_GetEventTime):
+// when its event source signalled if an event checker posted it, otherwise
+// when it was posted. Costs 4 bytes in every queue slot, comment out to
+// turn it off
+#define ES_TIMESTAMP_ENABLE
+
+
+/****************************** Profiler ************************************/
+// Uncomment to have ES_Run time how long every event waits in its queue and
+// how long its run function takes (see ES_Profiler.h). Costs a time stamp in
+// every ES_Event_t and a few us per event
+// #define ES_PROFILER_ENABLE
+
+
+/****************************** Run Budgets *********************************/
+// Times every run function against its service's SERV_n_RUN_BUDGET and counts
+// the runs that go over, with the event behind the longest (see ES_Budget.h).
+// Costs 2 cycle counter reads per event, comment out to turn it off
+#define ES_BUDGET_ENABLE
+// Puts the loop task on the ESP's task watchdog, which resets the chip if a
+// single run function blocks for this many seconds. Has to be longer than
+// ES_IDLE_MAX_TIME. Comment out to leave the loop task off the watchdog
+#ifndef ES_PORT_SIM
+#define ES_WATCHDOG_TIMEOUT 15
+#endif
+
+
+/****************************** Trace ***************************************/
+// Uncomment to record every post, dispatch, timer start and stop and state
+// change in a ring of ES_TRACE_LEN 8 byte records in RTC memory, which
+// survives deep sleep (see ES_Trace.h). ES_TRACE_LEN must be a power of 2.
+// The device's ring is 4KB of the 8KB of RTC slow memory and keeps the start
+// of the last boot; the simulator's holds a day of boots for -d | -r
+// #define ES_TRACE_ENABLE
+#ifdef ES_PORT_SIM
+#define ES_TRACE_LEN 262144
+#else
+#define ES_TRACE_LEN 512
+#endif
+
+// What the services read from outside the framework and act on, recorded
+// with ES_Trace_Input so a replay hands the run functions the same values
+#define WIFI_STATUS_INPUT 0
+#define TIME_SYNCED_INPUT 1
+#define RESYNC_DUE_INPUT 2
+#define BAT_VOLT_INPUT 3
+#define WAKE_CAUSE_INPUT 4
+#define ES_TRACE_NUM_INPUTS 5
+
 
 /********************************Services********************************************/
 // The maximum number of services sets an upper bound on the number of
@@ -101,23 +236,41 @@ typedef enum
 // This macro determines that number of services that are *actually* used in
 // a particular application. It will vary in value from 1 to MAX_NUM_SERVICES
 #define NUM_SERVICES 6
-#define QUEUE_SIZE 20  // min value should be NUM_SERVICES
-// Note: queue sizes for individual services are not implemented yet. Currently there's just 1 queue, whose size
-//       is defined by QUEUE_SIZE 
+// Each service has its own queue, sized by SERV_n_QUEUE_SIZE below, so a burst
+// of events for one service can't crowd out the events of another. Queue
+// sizes must be a power of 2
+// A service with a SERV_n_PROBE is only initialized and run if its probe
+// finds its hardware in ES_Initialize, so one build works on units fitted
+// with fewer sensors. ES_PROBE_SETUP is called once before the probes, to
+// power up what they talk to. Leave it undefined if there's nothing to do
+#define ES_PROBE_SETUP powerUpSensors
+// A failed probe is remembered over deep sleep, so a missing sensor is only
+// probed for again at power on and every ES_PROBE_RECHECK_BOOTS boots (every
+// 4 h at one boot per 15 min). Leave it undefined to probe on every boot
+#define ES_PROBE_RECHECK_BOOTS 16
 
 /****************************************************************************/
 // These are the definitions for Service 0, the lowest priority service.
 // Every Events and Services application must have a Service 0. Further
 // services are added in numeric sequence (1,2,3,...) with increasing
-// priorities
+// priorities. When more than one service has events waiting, ES_Run always
+// dispatches to the highest numbered one first, so the services that must
+// respond quickly (button, battery monitoring) sit at the top and the chatty
+// sensor services below them.
 // the header file with the public function prototypes
-#define SERV_0_HEADER "MainService.h"
+#define SERV_0_HEADER "CloudService.h"
 // the name of the Init function
-#define SERV_0_INIT InitMainService
+#define SERV_0_INIT InitCloudService
 // the name of the run function
-#define SERV_0_RUN RunMainService
+#define SERV_0_RUN RunCloudService
 // How big should this services Queue be?
-// #define SERV_0_QUEUE_SIZE 5
+#define SERV_0_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_0_RUN_BUDGET 5000000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_0_PROBE ES_NO_PROBE
+// the number other modules refer to this service by
+#define CLOUD_SERV_NUM 0
 
 /****************************************************************************/
 // The following sections are used to define the parameters for each of the
@@ -127,13 +280,19 @@ typedef enum
 // These are the definitions for Service 1
 #if NUM_SERVICES > 1
 // the header file with the public function prototypes
-#define SERV_1_HEADER "ButtonService.h"
+#define SERV_1_HEADER "SVM30Service.h"
 // the name of the Init function
-#define SERV_1_INIT InitButtonService
+#define SERV_1_INIT InitSVM30Service
 // the name of the run function
-#define SERV_1_RUN RunButtonService
+#define SERV_1_RUN RunSVM30Service
 // How big should this services Queue be?
-// #define SERV_1_QUEUE_SIZE 3
+#define SERV_1_QUEUE_SIZE 8
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_1_RUN_BUDGET 5000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_1_PROBE ProbeSVM30Service
+// the number other modules refer to this service by
+#define SVM30_SERV_NUM 1
 #endif
 
 /****************************************************************************/
@@ -146,7 +305,13 @@ typedef enum
 // the name of the run function
 #define SERV_2_RUN RunCO2Service
 // How big should this services Queue be?
-// #define SERV_2_QUEUE_SIZE 3
+#define SERV_2_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_2_RUN_BUDGET 2000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_2_PROBE ES_NO_PROBE
+// the number other modules refer to this service by
+#define CO2_SERV_NUM 2
 #endif
 
 /****************************************************************************/
@@ -159,33 +324,51 @@ typedef enum
 // the name of the run function
 #define SERV_3_RUN RunHPMService
 // How big should this services Queue be?
-// #define SERV_3_QUEUE_SIZE 3
+#define SERV_3_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_3_RUN_BUDGET 2000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_3_PROBE ProbeHPMService
+// the number other modules refer to this service by
+#define HPM_SERV_NUM 3
 #endif
 
 /****************************************************************************/
 // These are the definitions for Service 4
 #if NUM_SERVICES > 4
 // the header file with the public function prototypes
-#define SERV_4_HEADER "SVM30Service.h"
+#define SERV_4_HEADER "MainService.h"
 // the name of the Init function
-#define SERV_4_INIT InitSVM30Service
+#define SERV_4_INIT InitMainService
 // the name of the run function
-#define SERV_4_RUN RunSVM30Service
+#define SERV_4_RUN RunMainService
 // How big should this services Queue be?
-// #define SERV_4_QUEUE_SIZE 3
+#define SERV_4_QUEUE_SIZE 8
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_4_RUN_BUDGET 50000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_4_PROBE ES_NO_PROBE
+// the number other modules refer to this service by
+#define MAIN_SERV_NUM 4
 #endif
 
 /****************************************************************************/
 // These are the definitions for Service 5
 #if NUM_SERVICES > 5
 // the header file with the public function prototypes
-#define SERV_5_HEADER "CloudService.h"
+#define SERV_5_HEADER "ButtonService.h"
 // the name of the Init function
-#define SERV_5_INIT InitCloudService
+#define SERV_5_INIT InitButtonService
 // the name of the run function
-#define SERV_5_RUN RunCloudService
+#define SERV_5_RUN RunButtonService
 // How big should this services Queue be?
-#define SERV_5_QUEUE_SIZE 3
+#define SERV_5_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_5_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_5_PROBE ES_NO_PROBE
+// the number other modules refer to this service by
+#define BUTTON_SERV_NUM 5
 #endif
 
 /****************************************************************************/
@@ -198,7 +381,11 @@ typedef enum
 // the name of the run function
 #define SERV_6_RUN RunTestHarnessService6
 // How big should this services Queue be?
-#define SERV_6_QUEUE_SIZE 3
+#define SERV_6_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_6_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_6_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -211,7 +398,11 @@ typedef enum
 // the name of the run function
 #define SERV_7_RUN RunTestHarnessService7
 // How big should this services Queue be?
-#define SERV_7_QUEUE_SIZE 3
+#define SERV_7_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_7_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_7_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -224,7 +415,11 @@ typedef enum
 // the name of the run function
 #define SERV_8_RUN RunTestHarnessService8
 // How big should this services Queue be?
-#define SERV_8_QUEUE_SIZE 3
+#define SERV_8_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_8_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_8_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -237,7 +432,11 @@ typedef enum
 // the name of the run function
 #define SERV_9_RUN RunTestHarnessService9
 // How big should this services Queue be?
-#define SERV_9_QUEUE_SIZE 3
+#define SERV_9_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_9_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_9_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -250,7 +449,11 @@ typedef enum
 // the name of the run function
 #define SERV_10_RUN RunTestHarnessService10
 // How big should this services Queue be?
-#define SERV_10_QUEUE_SIZE 3
+#define SERV_10_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_10_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_10_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -263,7 +466,11 @@ typedef enum
 // the name of the run function
 #define SERV_11_RUN RunTestHarnessService11
 // How big should this services Queue be?
-#define SERV_11_QUEUE_SIZE 3
+#define SERV_11_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_11_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_11_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -276,7 +483,11 @@ typedef enum
 // the name of the run function
 #define SERV_12_RUN RunTestHarnessService12
 // How big should this services Queue be?
-#define SERV_12_QUEUE_SIZE 3
+#define SERV_12_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_12_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_12_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -289,7 +500,11 @@ typedef enum
 // the name of the run function
 #define SERV_13_RUN RunTestHarnessService13
 // How big should this services Queue be?
-#define SERV_13_QUEUE_SIZE 3
+#define SERV_13_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_13_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_13_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -302,7 +517,11 @@ typedef enum
 // the name of the run function
 #define SERV_14_RUN RunTestHarnessService14
 // How big should this services Queue be?
-#define SERV_14_QUEUE_SIZE 3
+#define SERV_14_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_14_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_14_PROBE ES_NO_PROBE
 #endif
 
 /****************************************************************************/
@@ -315,7 +534,74 @@ typedef enum
 // the name of the run function
 #define SERV_15_RUN RunTestHarnessService15
 // How big should this services Queue be?
-#define SERV_15_QUEUE_SIZE 3
+#define SERV_15_QUEUE_SIZE 4
+// the longest its run function should take in us (see ES_BUDGET_ENABLE)
+#define SERV_15_RUN_BUDGET 1000
+// the function that checks its hardware is there, ES_NO_PROBE if it needn't be
+#define SERV_15_PROBE ES_NO_PROBE
+#endif
+
+
+/****************************** Post Lists **********************************/
+// The services each ES_PostListnn multicasts to, by service number. Leave a
+// list empty if it isn't used. A multicast event takes a single slot in the
+// multicast queue, however many services it goes to
+#define POST_LIST_00 HPM_SERV_NUM, SVM30_SERV_NUM, CO2_SERV_NUM   /* sensors */
+#define POST_LIST_01
+#define POST_LIST_02
+#define POST_LIST_03
+#define POST_LIST_04
+#define POST_LIST_05
+#define POST_LIST_06
+#define POST_LIST_07
+
+// Services subscribed to an event type, used by ES_PostAll. Add a line per
+// event type with ES_SUBSCRIBE(event type, service numbers...). Event types 
+// that aren't listed go to every service
+#define ES_SUBSCRIPTIONS \
+  ES_SUBSCRIBE(IAQ_MODE_EVENT, HPM_SERV_NUM, SVM30_SERV_NUM, CO2_SERV_NUM) \
+  ES_SUBSCRIBE(ES_READ_SENSOR, HPM_SERV_NUM, SVM30_SERV_NUM, CO2_SERV_NUM)
+
+// number of multicast events that can be waiting at once, a power of 2
+#define ES_MULTICAST_QUEUE_SIZE 4
+
+
+/****************************** Queues **************************************/
+// What posting an event does if it can't simply go on the end of the queue,
+// by event type. Add a line per event type with ES_QUEUE_POLICY(event type,
+// policy), event types that aren't listed are ES_QUEUE_REJECT:
+//   ES_QUEUE_REJECT       the post fails if the queue is full
+//   ES_QUEUE_COALESCE     an event with the same type and param that is still
+//                         waiting is replaced by the new one, in its place
+//   ES_QUEUE_DROP_OLDEST  if the queue is full, its oldest event of the same
+//                         type is dropped, the post fails if there isn't one
+// COALESCE and DROP_OLDEST can be combined with |. ES_GetQueueStats counts
+// what each queue did. Timeouts and read requests must get through, a lost
+// one stalls a state machine until its backup timer, so they push out the
+// stalest of their kind (a newer one is right behind it). Other events are
+// never dropped for them
+#define ES_QUEUE_POLICIES \
+  ES_QUEUE_POLICY(ES_TIMEOUT, ES_QUEUE_COALESCE | ES_QUEUE_DROP_OLDEST) \
+  ES_QUEUE_POLICY(ES_READ_SENSOR, ES_QUEUE_COALESCE | ES_QUEUE_DROP_OLDEST) \
+  ES_QUEUE_POLICY(IAQ_MODE_EVENT, ES_QUEUE_COALESCE)
+
+
+/****************************** Worker **************************************/
+// The services in ES_WORKER_SERVICES (one bit per service number) run in a
+// second FreeRTOS task pinned to ES_WORKER_CORE instead of the loop task, so
+// a run function that blocks for seconds (CloudService's TLS handshake and
+// HTTP POST) doesn't hold up the sensors, the button or the display. Posts
+// between the two tasks go through lock free rings of ES_WORKER_QUEUE_SIZE
+// events each way, a power of 2. See "Worker task" in README.md for what is
+// and isn't ordered. The simulator runs every service in the loop
+#ifndef ES_PORT_SIM
+#define ES_WORKER_ENABLE
 #endif
+#define ES_WORKER_SERVICES (1U << CLOUD_SERV_NUM)
+#define ES_WORKER_QUEUE_SIZE 8
+#define ES_WORKER_CORE 0
+#define ES_WORKER_STACK_SIZE 8192
+#define ES_WORKER_PRIORITY 1
 
+#endif /* ES_PORT_POSIX */
 #endif
\ No newline at end of file
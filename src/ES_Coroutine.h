@@ -0,0 +1,86 @@
+/****************************************************************************
+ Module
+    ES_Coroutine.h
+ Description
+    Stackless coroutines for services that talk to a device, so a protocol
+    can be written as straight line code (send a command, wait for the reply
+    or a timeout, retry...) instead of a state per step. The service's run
+    function resumes its coroutine with every event it gets, and the
+    coroutine runs on to its next await and returns, so each event is still
+    handled to completion before the next one is dispatched.
+ Notes
+    Built on a switch on the line of the await to resume at, as in
+    protothreads, so a coroutine's whole state is its ES_Co_t, 2 bytes of
+    static memory, and nothing is ever allocated. That means:
+     - local variables don't survive an await, anything needed across one
+       goes in a static
+     - a local with an initializer can't be in scope of a later await, the
+       compiler won't jump past it, so declare those in a block of their own
+     - one await per line, and none inside a switch of the coroutine's own
+    An await always returns first, the event that got the coroutine to it
+    never satisfies it. So the init function runs the coroutine once (with
+    ES_INIT) to leave it waiting at its first await for the first event.
+*****************************************************************************/
+#ifndef ES_COROUTINE_H
+#define ES_COROUTINE_H
+
+#include "ES_Event.h"
+#include "ES_Timers.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+  uint16_t Resume;          // line of the await to resume at, 0 to start from the top
+}ES_Co_t;
+
+typedef enum
+{
+  ES_CO_WAITING = 0,        // stopped at an await, resume it with the next event
+  ES_CO_DONE                // ran off the end or returned, starts over when called again
+}ES_CoStatus_t;
+
+// starts the coroutine over from the top the next time it is called
+static inline void ES_Co_Reset(ES_Co_t *Co)
+{
+  Co->Resume = 0;
+}
+
+// true if Event is the timeout of Timer
+static inline bool ES_Co_IsTimeout(ES_Event_t Event, ES_TimerHandle_t Timer)
+{
+  return Event.EventType == ES_TIMEOUT && Event.EventParam == Timer;
+}
+
+// opens and closes the body of a coroutine, a function returning ES_CoStatus_t
+#define ES_CO_BEGIN(Co) switch((Co)->Resume) { case 0:
+#define ES_CO_END(Co) } (Co)->Resume = 0; return ES_CO_DONE
+
+// leaves the coroutine, it starts over when called again
+#define ES_CO_RETURN(Co) do { (Co)->Resume = 0; return ES_CO_DONE; } while(0)
+
+// returns, then carries on from here with the first event that makes Cond true
+#define ES_CO_AWAIT(Co, Cond) \
+  do { (Co)->Resume = __LINE__; return ES_CO_WAITING; \
+       case __LINE__: if(!(Cond)) return ES_CO_WAITING; } while(0)
+
+// starts Timer for Ms and waits for its timeout
+#define ES_CO_AWAIT_TIMER(Co, Event, Timer, Ms) \
+  do { ES_Timer_InitTimer((Timer), (Ms)); \
+       ES_CO_AWAIT(Co, ES_Co_IsTimeout((Event), (Timer))); } while(0)
+
+// waits for an event of Type, giving up when Timer runs out after Ms, and
+// stops the timer if the event came first. ES_Co_IsTimeout(Event, Timer)
+// afterwards tells which it was
+#define ES_CO_AWAIT_EVENT(Co, Event, Type, Timer, Ms) \
+  do { ES_Timer_InitTimer((Timer), (Ms)); \
+       ES_CO_AWAIT(Co, (Event).EventType == (Type) || ES_Co_IsTimeout((Event), (Timer))); \
+       if((Event).EventType == (Type)) ES_Timer_StopTimer(Timer); } while(0)
+
+// runs the coroutine Call (whose ES_Co_t is Child) from the top, with the
+// current event and then every event after it, until it is done
+#define ES_CO_CALL(Co, Child, Call) \
+  do { ES_Co_Reset(Child); (Co)->Resume = __LINE__; \
+       case __LINE__: if((Call) == ES_CO_WAITING) return ES_CO_WAITING; } while(0)
+
+#endif /* ES_COROUTINE_H */
@@ -0,0 +1,79 @@
+/****************************************************************************
+ Module
+    ES_CrossQueue.h
+ Description
+    Lock free single producer, single consumer ring of events, used by the
+    framework to hand posts between the loop task and the worker task (see
+    ES_WORKER_ENABLE in ES_Configure.h). One task only ever pushes and the
+    other only ever pops, so neither ever waits on the other.
+ Notes
+    Head and Tail count up freely and are only masked when a slot is used,
+    so the ring is full when they are Capacity apart. Each is written by one
+    side only, with release stores that publish the slot to the other side.
+    The capacity must be a power of 2.
+*****************************************************************************/
+#ifndef ES_CROSSQUEUE_H
+#define ES_CROSSQUEUE_H
+
+#include "ES_Event.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+  ES_Event_t Event;
+  bool Multicast;           // Event.ServiceNum is a post list, not a service
+}ES_CrossSlot_t;
+
+typedef struct
+{
+  uint32_t Head;            // next slot to pop, only written by the consumer
+  uint32_t Tail;            // next slot to push, only written by the producer
+  uint8_t Capacity;
+  ES_CrossSlot_t *Slots;
+}ES_CrossQueue_t;
+
+// empties the ring, only while neither side is using it
+static inline void ES_CrossQueue_Init(ES_CrossQueue_t *Queue)
+{
+  Queue->Head = 0;
+  Queue->Tail = 0;
+}
+
+// producer side, false if the ring is full
+static inline bool ES_CrossQueue_Push(ES_CrossQueue_t *Queue, const ES_Event_t *Event, bool Multicast)
+{
+  uint32_t tail = Queue->Tail;
+  if((uint32_t)(tail - __atomic_load_n(&Queue->Head, __ATOMIC_ACQUIRE)) >= Queue->Capacity)
+  {
+    return false;
+  }
+  ES_CrossSlot_t *slot = &Queue->Slots[tail & (Queue->Capacity - 1)];
+  slot->Event = *Event;
+  slot->Multicast = Multicast;
+  __atomic_store_n(&Queue->Tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// consumer side, false if the ring is empty
+static inline bool ES_CrossQueue_Pop(ES_CrossQueue_t *Queue, ES_Event_t *Event, bool *Multicast)
+{
+  uint32_t head = Queue->Head;
+  if(head == __atomic_load_n(&Queue->Tail, __ATOMIC_ACQUIRE))
+  {
+    return false;
+  }
+  const ES_CrossSlot_t *slot = &Queue->Slots[head & (Queue->Capacity - 1)];
+  *Event = slot->Event;
+  *Multicast = slot->Multicast;
+  __atomic_store_n(&Queue->Head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// either side, only a hint to the producer since the consumer may pop meanwhile
+static inline bool ES_CrossQueue_IsEmpty(ES_CrossQueue_t *Queue)
+{
+  return __atomic_load_n(&Queue->Head, __ATOMIC_ACQUIRE) == __atomic_load_n(&Queue->Tail, __ATOMIC_ACQUIRE);
+}
+
+#endif /* ES_CROSSQUEUE_H */
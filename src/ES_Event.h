@@ -19,6 +19,14 @@ typedef struct ES_Event
   ES_EventType_t EventType;      // what kind of event?
   uint16_t EventParam;          // parameter value for use w/ this event
   uint8_t ServiceNum;           // Just call the right post function and the framework handels this 
+  uint8_t Payload;              // handle of a payload block (ES_Payload.h), 0 for none
+  uint8_t TimerGen;             // ES_TIMEOUT only, which start of the timer it came from
+#ifdef ES_TIMESTAMP_ENABLE
+  uint32_t TimeStamp;           // us (ES_GetTimeUs) when it happened, see ES_GetEventTime
+#endif
+#ifdef ES_PROFILER_ENABLE
+  uint32_t EnqueueTime;         // cycle count when it was posted (ES_Profiler.h)
+#endif
 }ES_Event_t;
 
 
@@ -0,0 +1,216 @@
+/****************************************************************************
+ Module
+     ES_Hsm.c
+ Description
+     source file for the table driven hierarchical state machines, see
+     ES_Hsm.h. Dispatch walks from the current state up its parents and
+     scans each one's transition table for the first match.
+ Notes
+     Nothing here knows about a particular service. The tables are const
+     and the only state kept per machine is its current state
+*****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ES_Hsm.h"
+#include <stddef.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+
+/*---------------------------- Module Functions ---------------------------*/
+static const ES_HsmTransition_t *ES_Hsm_Find(const ES_Hsm_t *Hsm, ES_Event_t ThisEvent, uint8_t *Source);
+static uint8_t ES_Hsm_CommonParent(const ES_HsmState_t *States, uint8_t State1, uint8_t State2);
+static uint8_t ES_Hsm_PathFrom(const ES_HsmState_t *States, uint8_t Outer, uint8_t Target, uint8_t *Path);
+static void ES_Hsm_Enter(ES_Hsm_t *Hsm, const uint8_t *Path, uint8_t Depth, ES_Event_t ThisEvent);
+
+/*---------------------------- Module Variables ---------------------------*/
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+   ES_Hsm_Start
+ Parameters
+   ES_Hsm_t * : the machine
+   const ES_HsmState_t * : its table of states
+   uint8_t : the state to start in
+   ES_Event_t : handed to the entry actions, usually ES_INIT
+ Returns
+   bool : false if the initial state is more than ES_HSM_MAX_DEPTH states
+          in, nothing is entered and the machine is in no state
+ Description
+   Enters the initial state, running the entry actions of its outermost
+   parent first and its own last
+ Notes
+   Called from the service's init function, which should fail if this does
+****************************************************************************/
+bool ES_Hsm_Start(ES_Hsm_t *Hsm, const ES_HsmState_t *States, uint8_t Initial, ES_Event_t ThisEvent)
+{
+  uint8_t path[ES_HSM_MAX_DEPTH];
+  uint8_t depth = ES_Hsm_PathFrom(States, ES_HSM_NONE, Initial, path);
+
+  Hsm->States = States;
+  Hsm->Current = ES_HSM_NONE;
+  if(depth == 0)
+  {
+    return false;
+  }
+  ES_Hsm_Enter(Hsm, path, depth, ThisEvent);
+  return true;
+}
+
+/****************************************************************************
+ Function
+   ES_Hsm_Dispatch
+ Parameters
+   ES_Hsm_t * : the machine
+   ES_Event_t : the event
+ Returns
+   ES_HsmResult_t : ES_HSM_NOT_TAKEN if no transition of the current state
+          or its parents matched the event, ES_HSM_TOO_DEEP if the one that
+          did has a target too deep to enter
+ Description
+   Takes the first transition that matches the event, looking at the
+   current state's transitions first and then each parent's in turn: runs
+   the exit actions up to the innermost state that holds both its source
+   and its target, then its action, then the entry actions down to the
+   target
+ Notes
+   The exit and entry actions see the event that caused the transition.
+   The path down to the target is worked out before any action runs, so a
+   target that is too deep leaves the machine where it was
+****************************************************************************/
+ES_HsmResult_t ES_Hsm_Dispatch(ES_Hsm_t *Hsm, ES_Event_t ThisEvent)
+{
+  uint8_t source;
+  const ES_HsmTransition_t *transition = ES_Hsm_Find(Hsm, ThisEvent, &source);
+  if(transition == NULL)
+  {
+    return ES_HSM_NOT_TAKEN;
+  }
+  if(transition->Target == ES_HSM_NONE)
+  {
+    if(transition->Action != NULL)
+      transition->Action(ThisEvent);
+    return ES_HSM_TAKEN;
+  }
+
+  // a transition to its own state, or from a state into one of its
+  // substates or parents, leaves and enters the outer one again
+  const ES_HsmState_t *states = Hsm->States;
+  uint8_t outer = ES_Hsm_CommonParent(states, source, transition->Target);
+  if(outer == source || outer == transition->Target)
+  {
+    outer = states[outer].Parent;
+  }
+  uint8_t path[ES_HSM_MAX_DEPTH];
+  uint8_t depth = ES_Hsm_PathFrom(states, outer, transition->Target, path);
+  if(depth == 0)
+  {
+    return ES_HSM_TOO_DEEP;
+  }
+
+  while(Hsm->Current != outer)
+  {
+    const ES_HsmState_t *state = &states[Hsm->Current];
+    if(state->Exit != NULL)
+      state->Exit(ThisEvent);
+    Hsm->Current = state->Parent;
+  }
+  if(transition->Action != NULL)
+    transition->Action(ThisEvent);
+  ES_Hsm_Enter(Hsm, path, depth, ThisEvent);
+  return ES_HSM_TAKEN;
+}
+
+/****************************************************************************
+ Function
+   ES_Hsm_IsIn
+ Parameters
+   const ES_Hsm_t * : the machine
+   uint8_t : a state
+ Returns
+   bool : true if the current state is the state or one of its substates
+ Description
+   For the code around a machine that only cares about a parent state
+ Notes
+****************************************************************************/
+bool ES_Hsm_IsIn(const ES_Hsm_t *Hsm, uint8_t State)
+{
+  for(uint8_t state = Hsm->Current; state != ES_HSM_NONE; state = Hsm->States[state].Parent)
+  {
+    if(state == State)
+      return true;
+  }
+  return false;
+}
+
+
+//*********************************
+// private functions
+//*********************************
+// the first transition matching the event, from the current state up, and
+// the state it belongs to
+static const ES_HsmTransition_t *ES_Hsm_Find(const ES_Hsm_t *Hsm, ES_Event_t ThisEvent, uint8_t *Source)
+{
+  for(uint8_t state = Hsm->Current; state != ES_HSM_NONE; state = Hsm->States[state].Parent)
+  {
+    const ES_HsmState_t *entry = &Hsm->States[state];
+    for(uint8_t i = 0; i < entry->NumTransitions; i++)
+    {
+      const ES_HsmTransition_t *transition = &entry->Transitions[i];
+      if(transition->EventType == ThisEvent.EventType
+          && (transition->EventParam == ES_HSM_ANY_PARAM || transition->EventParam == ThisEvent.EventParam)
+          && (transition->Guard == NULL || transition->Guard(ThisEvent)))
+      {
+        *Source = state;
+        return transition;
+      }
+    }
+  }
+  return NULL;
+}
+
+// the innermost state that holds both states (or is one of them),
+// ES_HSM_NONE if they have no parent in common
+static uint8_t ES_Hsm_CommonParent(const ES_HsmState_t *States, uint8_t State1, uint8_t State2)
+{
+  for(uint8_t outer1 = State1; outer1 != ES_HSM_NONE; outer1 = States[outer1].Parent)
+  {
+    for(uint8_t outer2 = State2; outer2 != ES_HSM_NONE; outer2 = States[outer2].Parent)
+    {
+      if(outer1 == outer2)
+        return outer1;
+    }
+  }
+  return ES_HSM_NONE;
+}
+
+// fills Path with the states from Target up to just inside Outer and
+// returns how many there are, 0 if that is more than ES_HSM_MAX_DEPTH
+static uint8_t ES_Hsm_PathFrom(const ES_HsmState_t *States, uint8_t Outer, uint8_t Target, uint8_t *Path)
+{
+  uint8_t depth = 0;
+  for(uint8_t state = Target; state != Outer; state = States[state].Parent)
+  {
+    if(depth == ES_HSM_MAX_DEPTH)
+    {
+      return 0;
+    }
+    Path[depth++] = state;
+  }
+  return depth;
+}
+
+// runs the entry actions of the states on a path from ES_Hsm_PathFrom,
+// outermost first
+static void ES_Hsm_Enter(ES_Hsm_t *Hsm, const uint8_t *Path, uint8_t Depth, ES_Event_t ThisEvent)
+{
+  while(Depth > 0)
+  {
+    uint8_t state = Path[--Depth];
+    Hsm->Current = state;
+    if(Hsm->States[state].Entry != NULL)
+      Hsm->States[state].Entry(ThisEvent);
+  }
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,129 @@
+/****************************************************************************
+ Module
+    ES_Hsm.h
+ Description
+    Table driven hierarchical state machines for services. A service lists
+    its states in a constexpr table, each with its parent, entry and exit
+    actions and its own table of transitions, and its run function hands
+    every event to ES_Hsm_Dispatch. The transitions of a state are tried
+    first, then those of its parent and so on up, so a transition every
+    substate shares (a timeout, a button press...) is written once, in the
+    parent.
+ Notes
+    A transition matches on the event type and, unless it is
+    ES_HSM_ANY_PARAM, the param (e.g. a timer number), then its guard if it
+    has one. The first match in table order wins, so put a guarded
+    transition ahead of an unguarded one for the same event.
+    ES_HSM_ANY_PARAM is the param 0xFFFF, so 0xFFFF can't be matched on by
+    itself: a transition written for it matches every param. Events whose
+    param can really be 0xFFFF need a guard to pick it out. ES_HSM_CHECK
+    can't tell the two apart. The params in use here (timer and service
+    numbers, modes) never get that high.
+    Taking a transition runs the exit actions from the current state up to
+    the innermost state that holds both the source and the target, then
+    the transition's action, then the entry actions down to the target.
+    A transition to its own state or a parent of it leaves and enters that
+    state again. A target is always the state to end up in, there are no
+    initial transitions into a parent state. A transition with target
+    ES_HSM_NONE just runs its action.
+    A state's parent has to come before it in the table, which ES_HSM_CHECK
+    checks at compile time along with the targets and that no state is
+    nested deeper than ES_HSM_MAX_DEPTH. A table that isn't checked is
+    still never entered part of the way: a state too deep to enter makes
+    ES_Hsm_Start fail, and ES_Hsm_Dispatch returns ES_HSM_TOO_DEEP without
+    running any action, which the service should pass on as ES_ERROR.
+*****************************************************************************/
+#ifndef ES_HSM_H
+#define ES_HSM_H
+
+#include "ES_Event.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ES_HSM_NONE 0xFF          // no parent, or no target (an internal transition)
+#define ES_HSM_ANY_PARAM 0xFFFF   // a transition for every param of its event type
+#define ES_HSM_MAX_DEPTH 8        // most nested a state can be
+
+typedef bool ES_HsmGuard_t(ES_Event_t ThisEvent);
+typedef void ES_HsmAction_t(ES_Event_t ThisEvent);
+
+// the byte wide fields go first so the tables pack to 3 (transitions) and 4
+// (states) words each
+typedef struct
+{
+  uint8_t EventType;          // an ES_EventType_t
+  uint8_t Target;             // state to end up in, ES_HSM_NONE to stay put
+  uint16_t EventParam;        // or ES_HSM_ANY_PARAM, which is also 0xFFFF
+  ES_HsmGuard_t *Guard;       // taken only if it returns true, NULL to always take it
+  ES_HsmAction_t *Action;     // may be NULL
+}ES_HsmTransition_t;
+
+typedef struct
+{
+  uint8_t Parent;             // ES_HSM_NONE for a top level state
+  uint8_t NumTransitions;
+  const ES_HsmTransition_t *Transitions;
+  ES_HsmAction_t *Entry;      // may be NULL
+  ES_HsmAction_t *Exit;       // may be NULL
+}ES_HsmState_t;
+
+static_assert(ES_NUM_EVENT_TYPES <= 0x100, "ES_HsmTransition_t keeps event types in a byte");
+
+typedef struct
+{
+  const ES_HsmState_t *States;
+  uint8_t Current;            // a state number, watch it with ES_Trace_WatchState
+}ES_Hsm_t;
+
+// what ES_Hsm_Dispatch did with an event
+typedef enum
+{
+  ES_HSM_NOT_TAKEN = 0,       // no transition matched
+  ES_HSM_TAKEN,
+  ES_HSM_TOO_DEEP             // the target is more than ES_HSM_MAX_DEPTH states in, nothing ran
+}ES_HsmResult_t;
+
+// a state's transitions for ES_HsmState_t, from a constexpr array of them
+#define ES_HSM_TRANSITIONS(Transitions) (uint8_t)(sizeof(Transitions) / sizeof((Transitions)[0])), Transitions
+
+// compile time check of a constexpr table of states
+#define ES_HSM_CHECK(States) \
+  static_assert(ES_Hsm_StatesValid(States, sizeof(States) / sizeof((States)[0])), \
+      "a state's parent must come before it, no deeper than ES_HSM_MAX_DEPTH, and targets must be states")
+
+// enters Initial and every parent of it, top down, running their entry
+// actions. false if Initial is nested too deep, nothing is entered then
+bool ES_Hsm_Start(ES_Hsm_t *Hsm, const ES_HsmState_t *States, uint8_t Initial, ES_Event_t ThisEvent);
+
+// takes the first transition that matches the event
+ES_HsmResult_t ES_Hsm_Dispatch(ES_Hsm_t *Hsm, ES_Event_t ThisEvent);
+
+static inline uint8_t ES_Hsm_GetState(const ES_Hsm_t *Hsm)
+{
+  return Hsm->Current;
+}
+
+// true if the machine is in State or one of its substates
+bool ES_Hsm_IsIn(const ES_Hsm_t *Hsm, uint8_t State);
+
+// used by ES_HSM_CHECK
+constexpr uint8_t ES_Hsm_Depth(const ES_HsmState_t *States, uint8_t State)
+{
+  return (States[State].Parent == ES_HSM_NONE) ? 1 : 1 + ES_Hsm_Depth(States, States[State].Parent);
+}
+
+constexpr bool ES_Hsm_TransitionsValid(const ES_HsmTransition_t *Transitions, uint8_t Num, uint8_t NumStates)
+{
+  return Num == 0 || ((Transitions->Target == ES_HSM_NONE || Transitions->Target < NumStates)
+      && ES_Hsm_TransitionsValid(Transitions + 1, Num - 1, NumStates));
+}
+
+constexpr bool ES_Hsm_StatesValid(const ES_HsmState_t *States, uint8_t NumStates, uint8_t State = 0)
+{
+  return State >= NumStates || ((States[State].Parent == ES_HSM_NONE || States[State].Parent < State)
+      && ES_Hsm_Depth(States, State) <= ES_HSM_MAX_DEPTH
+      && ES_Hsm_TransitionsValid(States[State].Transitions, States[State].NumTransitions, NumStates)
+      && ES_Hsm_StatesValid(States, NumStates, State + 1));
+}
+
+#endif /* ES_HSM_H */
@@ -0,0 +1,199 @@
+/****************************************************************************
+ Module
+     ES_Payload.c
+ Description
+     Fixed size pool of payload blocks that events can carry when 16 bits of 
+     EventParam aren't enough (whole sensor frames, reading structs...). An 
+     event refers to its block by a 1 based handle in ES_Event_t.Payload. 
+     
+     Blocks are reference counted. ES_Payload_Alloc hands out a block with 1 
+     reference that belongs to the event it is posted with, and the framework 
+     releases that reference once the service's run function returns. A 
+     service that wants to keep the data longer calls ES_Payload_Retain and 
+     later ES_Payload_Release. 
+ Notes
+     Alloc and release are lock free (atomic compare and swap on a bitmap of 
+     free blocks) so they can be used from ISRs and other tasks as well.
+*****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ES_Payload.h"
+#include <stddef.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#if ES_PAYLOAD_POOL_SIZE > 32
+#error "ES_PAYLOAD_POOL_SIZE must be 32 or less"
+#endif
+
+#define ALL_BLOCKS_FREE ((ES_PAYLOAD_POOL_SIZE == 32) ? 0xFFFFFFFFUL : ((1UL << ES_PAYLOAD_POOL_SIZE) - 1))
+
+/*---------------------------- Module Functions ---------------------------*/
+
+/*---------------------------- Module Variables ---------------------------*/
+static uint32_t PayloadBlocks[ES_PAYLOAD_POOL_SIZE][(ES_PAYLOAD_SIZE + 3) / 4];
+static uint32_t RefCounts[ES_PAYLOAD_POOL_SIZE];
+
+// bit n is set while block n is free
+static uint32_t FreeBlocks = ALL_BLOCKS_FREE;
+
+static uint32_t NumInUse = 0;
+static uint32_t HighWater = 0;
+static uint32_t NumAllocFails = 0;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+   ES_Payload_Init
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Marks every block as free, called by ES_Initialize
+ Notes
+****************************************************************************/
+void ES_Payload_Init(void)
+{
+  for(uint8_t i=0; i < ES_PAYLOAD_POOL_SIZE; i++)
+  {
+    RefCounts[i] = 0;
+  }
+  NumInUse = 0;
+  HighWater = 0;
+  NumAllocFails = 0;
+  __atomic_store_n(&FreeBlocks, ALL_BLOCKS_FREE, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************
+ Function
+   ES_Payload_Alloc
+ Parameters
+   None
+ Returns
+   uint8_t : handle of the block, ES_NO_PAYLOAD if the pool is empty
+ Description
+   Takes a free block of ES_PAYLOAD_SIZE bytes out of the pool with 1 
+   reference, which is passed on to the event it is posted with. 
+ Notes
+   Blocks are not cleared
+****************************************************************************/
+uint8_t ES_Payload_Alloc(void)
+{
+  uint32_t freeBlocks = __atomic_load_n(&FreeBlocks, __ATOMIC_RELAXED);
+  uint8_t block;
+  do
+  {
+    if(freeBlocks == 0)
+    {
+      __atomic_add_fetch(&NumAllocFails, 1, __ATOMIC_RELAXED);
+      return ES_NO_PAYLOAD;
+    }
+    block = (uint8_t)__builtin_ctz(freeBlocks);
+  }while(!__atomic_compare_exchange_n(&FreeBlocks, &freeBlocks, freeBlocks & ~(1UL << block), 
+          true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  __atomic_store_n(&RefCounts[block], 1, __ATOMIC_RELAXED);
+
+  // keep track of the most blocks ever in use
+  uint32_t inUse = __atomic_add_fetch(&NumInUse, 1, __ATOMIC_RELAXED);
+  uint32_t highWater = __atomic_load_n(&HighWater, __ATOMIC_RELAXED);
+  while(inUse > highWater && 
+        !__atomic_compare_exchange_n(&HighWater, &highWater, inUse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+    ;
+  }
+
+  return block + 1;
+}
+
+/****************************************************************************
+ Function
+   ES_Payload_Get
+ Parameters
+   uint8_t : handle of the block
+ Returns
+   void * : the block's data, NULL if the handle isn't valid
+ Description
+   Gives access to the ES_PAYLOAD_SIZE bytes of a block
+ Notes
+****************************************************************************/
+void *ES_Payload_Get(uint8_t Handle)
+{
+  if(Handle == ES_NO_PAYLOAD || Handle > ES_PAYLOAD_POOL_SIZE)
+  {
+    return NULL;
+  }
+  return PayloadBlocks[Handle - 1];
+}
+
+/****************************************************************************
+ Function
+   ES_Payload_Retain
+ Parameters
+   uint8_t : handle of the block
+ Returns
+   None
+ Description
+   Adds a reference to a block, so it stays allocated after the event that 
+   brought it has been handled, or so it can be posted to another service
+ Notes
+****************************************************************************/
+void ES_Payload_Retain(uint8_t Handle)
+{
+  if(Handle == ES_NO_PAYLOAD || Handle > ES_PAYLOAD_POOL_SIZE)
+  {
+    return;
+  }
+  __atomic_add_fetch(&RefCounts[Handle - 1], 1, __ATOMIC_RELAXED);
+}
+
+/****************************************************************************
+ Function
+   ES_Payload_Release
+ Parameters
+   uint8_t : handle of the block
+ Returns
+   None
+ Description
+   Drops a reference to a block and puts it back in the pool once the last 
+   one is gone
+ Notes
+****************************************************************************/
+void ES_Payload_Release(uint8_t Handle)
+{
+  if(Handle == ES_NO_PAYLOAD || Handle > ES_PAYLOAD_POOL_SIZE)
+  {
+    return;
+  }
+  uint8_t block = Handle - 1;
+  if(__atomic_sub_fetch(&RefCounts[block], 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    __atomic_sub_fetch(&NumInUse, 1, __ATOMIC_RELAXED);
+    __atomic_or_fetch(&FreeBlocks, 1UL << block, __ATOMIC_RELEASE);
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_Payload_GetStats
+ Parameters
+   ES_PayloadStats_t * : filled with the pool's usage
+ Returns
+   None
+ Description
+   Reports how many blocks are in use, the most that have ever been in use 
+   at once and how many allocations failed, for sizing ES_PAYLOAD_POOL_SIZE
+ Notes
+****************************************************************************/
+void ES_Payload_GetStats(ES_PayloadStats_t *Stats)
+{
+  if(Stats == NULL)
+  {
+    return;
+  }
+  Stats->InUse = (uint8_t)__atomic_load_n(&NumInUse, __ATOMIC_RELAXED);
+  Stats->HighWater = (uint8_t)__atomic_load_n(&HighWater, __ATOMIC_RELAXED);
+  Stats->NumAllocFails = (uint16_t)__atomic_load_n(&NumAllocFails, __ATOMIC_RELAXED);
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,37 @@
+/****************************************************************************
+ Module
+    ES_Payload.h
+ Description
+    header file for the event payload pool of the ES Event Framework
+ Notes
+    
+*****************************************************************************/
+#ifndef ES_PAYLOAD_H
+#define ES_PAYLOAD_H
+
+#include "ES_Configure.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// payload handle of an event that doesn't carry one
+#define ES_NO_PAYLOAD 0
+
+typedef struct
+{
+  uint8_t InUse;          // blocks currently allocated
+  uint8_t HighWater;      // most blocks ever allocated at once
+  uint16_t NumAllocFails; // allocations that found the pool empty
+}ES_PayloadStats_t;
+
+
+// These are to be used by the services
+uint8_t ES_Payload_Alloc(void);
+void *ES_Payload_Get(uint8_t Handle);
+void ES_Payload_Retain(uint8_t Handle);
+void ES_Payload_Release(uint8_t Handle);
+void ES_Payload_GetStats(ES_PayloadStats_t *Stats);
+
+// This one is used by the framework
+void ES_Payload_Init(void);
+
+#endif   /* ES_PAYLOAD_H */
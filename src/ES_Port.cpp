@@ -17,10 +17,27 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <esp32-hal-timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <esp_task_wdt.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <HardwareSerial.h>
+#include <Esp.h>
+#include <esp32-hal-cpu.h>
 
+#include "ES_Configure.h"
 #include "ES_Port.h"
 #include "ES_Timers.h"
 
+// hw timer counts per us, the counter runs at 40MHz
+#define COUNTS_PER_US 40
+// number of RX edges needed to wake up from light sleep through a UART
+#define UART_WAKE_THRESHOLD 3
+
 // #define SYS_TICK_DEBUG
 #ifdef SYS_TICK_DEBUG
     #define DEBUG_PIN 21
@@ -36,13 +53,43 @@
 // code so cannot post directly to the queues from within the interrupt resp.
 static volatile uint8_t TickCount;
 
-// Global tick count to monitor number of SysTick Interrupts
-// make uint16_t on 8 and 16 bit processors so to not overly burden them
-static volatile uint32_t SysTickCounter = 0;
+// The framework runs tickless. Hw timer 0 counts up freely and is never
+// reloaded, so it doubles as the time base for _HW_GetTickCount. Its alarm is
+// only programmed for the earliest ES timer deadline, so there are no
+// interrupts at all while waiting out a long timer.
+static hw_timer_t *SysTimer = NULL;
+
+// number of hw timer counts in 1 framework tick (the TimerRate_t value)
+static uint32_t CountsPerTick = ES_Timer_RATE_1mS;
+
+// idle accounting, see _HW_Get_Idle_Stats
+static uint64_t LightSleepTime = 0;
+static uint64_t WaitTime = 0;
+static uint32_t NumLightSleeps = 0;
 
 // need mux in order to synchronize between main loop and timer ISR
 portMUX_TYPE timerMux = portMUX_INITIALIZER_UNLOCKED;
 
+// Each bit flags an event source (ISR or driver callback) that has work for
+// its event checker. Set by _HW_Signal_Event_Source, cleared by the main loop
+static volatile uint32_t PendingSources = 0;
+
+// Task running ES_Run. It blocks on a task notification between events and
+// is woken up by the tick interrupt or an event source
+static TaskHandle_t LoopTaskHandle = NULL;
+
+#ifdef ES_WORKER_ENABLE
+// Task running the worker's services (ES_WorkerLoop in ES_framework.c), 
+// pinned to ES_WORKER_CORE. It blocks on a task notification like the loop
+static TaskHandle_t WorkerTaskHandle = NULL;
+static void (*WorkerLoopFunc)(void) = NULL;
+
+// recursive mutex shared by the loop and worker tasks, see _HW_Lock
+static SemaphoreHandle_t WorkerLock = NULL;
+
+static void WorkerTask(void *Arg);
+#endif
+
 
 /****************************************************************************
  Function
@@ -52,13 +99,13 @@ portMUX_TYPE timerMux = portMUX_INITIALIZER_UNLOCKED;
  Returns
      None.
  Description
-     interrupt response routine for the tick interrupt that will allow the
-     framework timers to run.
+     interrupt response routine for the timer alarm that will allow the
+     framework timers to run. The alarm is programmed for the next ES timer
+     deadline, so this fires once per deadline rather than every tick.
  Notes
      this does not actually post events
      but simply sets a flag to indicate that the interrupt has occurred.
      the framework response is handled below in _HW_Process_Pending_Ints. 
-     Loop() runs at period of ~3us. 
 
 ****************************************************************************/
 void IRAM_ATTR SysTickIntHandler(void)
@@ -66,9 +113,18 @@ void IRAM_ATTR SysTickIntHandler(void)
     portENTER_CRITICAL_ISR(&timerMux);
     /* Interrupt automatically cleared by hardware */
     ++TickCount;          /* flag that it occurred and needs a response */
-    ++SysTickCounter;     // keep the free running time going
     portEXIT_CRITICAL(&timerMux);
 
+    if(LoopTaskHandle != NULL)
+    {
+      BaseType_t taskWoken = pdFALSE;
+      vTaskNotifyGiveFromISR(LoopTaskHandle, &taskWoken);
+      if(taskWoken == pdTRUE)
+      {
+        portYIELD_FROM_ISR();
+      }
+    }
+
     #ifdef SYS_TICK_DEBUG
     pinState ^= 0x01; 
     digitalWrite(DEBUG_PIN, pinState); 
@@ -84,27 +140,99 @@ void IRAM_ATTR SysTickIntHandler(void)
  Returns
      None.
  Description
-     Initializes a hardware timer to go off at provided Rate. When timer goes off, 
-     its handler, SysTickIntHandler, is called.  
+     Starts a hardware timer counting freely. Rate sets how many of its counts
+     make up 1 framework tick. No alarm is set until the first ES timer is 
+     started with _HW_Timer_SetAlarm. When the alarm goes off, its handler, 
+     SysTickIntHandler, is called.  
  Notes
-     modify as required to port to other timer hardware
+     modify as required to port to other timer hardware. Must be called from
+     the task that runs ES_Run since that is the task _HW_Wait_For_Event blocks
 
 ****************************************************************************/
 void _HW_Timer_Init(TimerRate_t Rate)
 {   
+    LoopTaskHandle = xTaskGetCurrentTaskHandle();
+    #ifdef ES_WORKER_ENABLE
+    if(WorkerLock == NULL)
+    {
+      WorkerLock = xSemaphoreCreateRecursiveMutex();
+    }
+    #endif
+
     #ifdef SYS_TICK_DEBUG
     pinMode(DEBUG_PIN, OUTPUT); 
     #endif
 
+    CountsPerTick = Rate; 
+
     // timer will increment the 64-bit counter at 40MHz. 2 is lowest val for pre-scaler 
-    hw_timer_t *timer = timerBegin(0, 2, true); //using hw timer 0, prescaler of 0, count up
+    SysTimer = timerBegin(0, 2, true); //using hw timer 0, prescaler of 0, count up
+
+    timerAttachInterrupt(SysTimer, &SysTickIntHandler, true);
+}
+
+/****************************************************************************
+ Function
+     _HW_Timer_SetAlarm
+ Parameters
+     uint32_t Tick, the absolute tick count (as returned by _HW_GetTickCount)
+     at which the alarm should go off
+ Returns
+     None.
+ Description
+     Programs the hardware timer alarm for the given tick, replacing any alarm
+     that was already set. If that tick has already been reached, or is reached
+     before the alarm is enabled, the alarm is flagged as pending right away 
+     instead.
+ Notes
+     The counter is never reloaded, so the alarm value is an absolute count.
+****************************************************************************/
+void _HW_Timer_SetAlarm(uint32_t Tick)
+{
+  uint64_t currCount = timerRead(SysTimer);
+  uint64_t currTick = currCount / CountsPerTick;
+  int32_t ticksLeft = (int32_t)(Tick - (uint32_t)currTick);
+
+  if(ticksLeft > 0)
+  {
+    uint64_t alarmCount = (currTick + ticksLeft) * CountsPerTick;
+    timerAlarmWrite(SysTimer, alarmCount, false);
+    timerAlarmEnable(SysTimer);
 
-    timerAttachInterrupt(timer, &SysTickIntHandler, true);
+    // with a tick or less to go, being preempted between reading the counter
+    // and enabling the alarm can leave the alarm behind the counter, where it
+    // would never fire
+    if(timerRead(SysTimer) < alarmCount)
+    {
+      return;
+    }
+  }
 
-    timerAlarmWrite(timer, Rate, true); // alarm will go off after Rate number of counts
+  timerAlarmDisable(SysTimer);
+  portENTER_CRITICAL_ISR(&timerMux);
+  ++TickCount;
+  portEXIT_CRITICAL_ISR(&timerMux);
+  if(LoopTaskHandle != NULL)
+  {
+    xTaskNotifyGive(LoopTaskHandle);  // don't let ES_Run block on it
+  }
+}
 
-    timerAlarmEnable(timer); // timer is on now
-    
+/****************************************************************************
+ Function
+     _HW_Timer_ClearAlarm
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Turns the alarm off when no ES timers are running. The counter keeps
+     going so _HW_GetTickCount stays correct.
+ Notes
+****************************************************************************/
+void _HW_Timer_ClearAlarm(void)
+{
+  timerAlarmDisable(SysTimer);
 }
 
 
@@ -114,10 +242,10 @@ void _HW_Timer_Init(TimerRate_t Rate)
  Parameters
     none
  Returns
-    uint16_t   count of number of system ticks that have occurred.
+    uint32_t   count of number of system ticks that have occurred.
  Description
-    wrapper for access to SysTickCounter, needed to move increment of tick
-    counter to this module to keep the timer ticking during blocking code
+    derives the tick count from the free running hardware counter, so it 
+    stays correct during blocking code and while no alarm is set
  Notes
 
  Author
@@ -125,7 +253,11 @@ void _HW_Timer_Init(TimerRate_t Rate)
 ****************************************************************************/
 uint32_t _HW_GetTickCount(void)
 {
-  return SysTickCounter;
+  if(SysTimer == NULL)
+  {
+    return 0;
+  }
+  return (uint32_t)(timerRead(SysTimer) / CountsPerTick);
 }
 
 
@@ -152,18 +284,265 @@ uint32_t _HW_GetTickCount(void)
 ****************************************************************************/
 bool _HW_Process_Pending_Ints(void)
 {
-  while (TickCount > 0)
+  if (TickCount > 0)
   {
-    /* call the framework tick response to actually run the timers */
-    ES_Timer_Tick_Resp();  // With 40MHz clock rate, and alarm value of 40,000-1, this is called every 1ms
-
     portENTER_CRITICAL_ISR(&timerMux);
-    TickCount--;
-    portEXIT_CRITICAL(&timerMux);
+    TickCount = 0;
+    portEXIT_CRITICAL_ISR(&timerMux);
+
+    /* call the framework tick response to expire every timer that is due and
+       program the alarm for the next deadline */
+    ES_Timer_Tick_Resp();
   }
   return true;  // always return true to allow loop test in ES_Run to proceed
 }
 
+/****************************************************************************
+ Function
+     _HW_Signal_Event_Source
+ Parameters
+     uint8_t Source, number of the event source that has work pending
+ Returns
+     None.
+ Description
+     Flags an event source as pending and wakes up the task running ES_Run
+     so that the matching event checker gets called on its next pass.
+ Notes
+     Can be called from an ISR or from a driver callback running in another
+     task (the UART receive callbacks run in their own task).
+****************************************************************************/
+void IRAM_ATTR _HW_Signal_Event_Source(uint8_t Source)
+{
+  portENTER_CRITICAL_ISR(&timerMux);
+  PendingSources |= (1UL << Source);
+  portEXIT_CRITICAL_ISR(&timerMux);
+
+  if(LoopTaskHandle == NULL)
+  {
+    return;
+  }
+
+  if(xPortInIsrContext())
+  {
+    BaseType_t taskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(LoopTaskHandle, &taskWoken);
+    if(taskWoken == pdTRUE)
+    {
+      portYIELD_FROM_ISR();
+    }
+  }
+  else
+  {
+    xTaskNotifyGive(LoopTaskHandle);
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Take_Event_Sources
+ Parameters
+     none
+ Returns
+     uint32_t, one bit set for each source signalled since the last call
+ Description
+     Atomically reads and clears the pending event source flags.
+ Notes
+****************************************************************************/
+uint32_t _HW_Take_Event_Sources(void)
+{
+  portENTER_CRITICAL_ISR(&timerMux);
+  uint32_t sources = PendingSources;
+  PendingSources = 0;
+  portEXIT_CRITICAL_ISR(&timerMux);
+  return sources;
+}
+
+/****************************************************************************
+ Function
+     _HW_Wait_For_Event
+ Parameters
+     uint32_t MaxWaitTicks, longest time to block for in ms
+ Returns
+     None.
+ Description
+     Blocks the task running ES_Run until a tick interrupt or an event source
+     wakes it up, or MaxWaitTicks goes by. Lets FreeRTOS run its idle task
+     instead of spinning through loop().
+ Notes
+     A notification given before this is called is not lost, it just makes
+     this return right away.
+****************************************************************************/
+void _HW_Wait_For_Event(uint32_t MaxWaitTicks)
+{
+  if(LoopTaskHandle == NULL)
+  {
+    return;
+  }
+  int64_t startTime = esp_timer_get_time();
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MaxWaitTicks));
+  WaitTime += esp_timer_get_time() - startTime;
+}
+
+/****************************************************************************
+ Function
+     _HW_Ints_Pending
+ Parameters
+     none
+ Returns
+     bool, true if the timer alarm or an event source is waiting to be handled
+ Description
+     Lets the framework check that there is really nothing to do before idling
+ Notes
+****************************************************************************/
+bool _HW_Ints_Pending(void)
+{
+  return (TickCount > 0) || (PendingSources != 0);
+}
+
+/****************************************************************************
+ Function
+     _HW_Light_Sleep
+ Parameters
+     uint32_t MaxSleepTicks, longest time to sleep for
+ Returns
+     None.
+ Description
+     Puts the ESP32 into light sleep until MaxSleepTicks go by, the button
+     pin changes level or data arrives on the wake UART. Since the hw timer
+     counter is stopped during light sleep, it is moved forward by the time
+     slept on the way out so ES timer deadlines and _HW_GetTickCount stay
+     correct.
+ Notes
+     The timer alarm can't wake us from light sleep, so the sleep timer is 
+     used for the next deadline instead.
+****************************************************************************/
+void _HW_Light_Sleep(uint32_t MaxSleepTicks)
+{
+  if(_HW_Ints_Pending())
+  {
+    return;
+  }
+
+  Serial.flush();  // don't cut off a debug printf mid-line
+
+  uint64_t sleepTime = ((uint64_t)MaxSleepTicks * CountsPerTick) / COUNTS_PER_US;
+  esp_sleep_enable_timer_wakeup(sleepTime);
+
+  // wake up on the button going to the opposite level it is at now. The pin's
+  // edge interrupt is off while its type is set to level for the wakeup
+  gpio_intr_disable((gpio_num_t)ES_WAKE_GPIO);
+  gpio_wakeup_enable((gpio_num_t)ES_WAKE_GPIO, 
+      digitalRead(ES_WAKE_GPIO) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+
+  uart_set_wakeup_threshold(ES_WAKE_UART, UART_WAKE_THRESHOLD);
+  esp_sleep_enable_uart_wakeup(ES_WAKE_UART);
+
+  int64_t startTime = esp_timer_get_time();
+  uint64_t startCount = timerRead(SysTimer);
+
+  esp_light_sleep_start();
+
+  uint64_t timeSlept = esp_timer_get_time() - startTime;
+  uint64_t countsCounted = timerRead(SysTimer) - startCount;
+  if(countsCounted < timeSlept * COUNTS_PER_US)
+  {
+    timerWrite(SysTimer, startCount + timeSlept * COUNTS_PER_US);
+  }
+  LightSleepTime += timeSlept;
+  NumLightSleeps++;
+
+  // back to the button's normal edge interrupt
+  gpio_wakeup_disable((gpio_num_t)ES_WAKE_GPIO);
+  gpio_set_intr_type((gpio_num_t)ES_WAKE_GPIO, GPIO_INTR_ANYEDGE);
+  gpio_intr_enable((gpio_num_t)ES_WAKE_GPIO);
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+
+  // a deadline may have been passed while the counter was stopped, so let
+  // the timer module check them all and reprogram the alarm
+  portENTER_CRITICAL_ISR(&timerMux);
+  ++TickCount;
+  portEXIT_CRITICAL_ISR(&timerMux);
+}
+
+/****************************************************************************
+ Function
+     _HW_Get_Idle_Stats
+ Parameters
+     ES_IdleStats_t *Stats, filled in with the time spent idle and running
+ Returns
+     None.
+ Description
+     Reports how long the device has spent in light sleep, blocked waiting
+     and running since boot, so the power savings can be measured.
+ Notes
+****************************************************************************/
+void _HW_Get_Idle_Stats(ES_IdleStats_t *Stats)
+{
+  if(Stats == NULL)
+  {
+    return;
+  }
+  uint64_t totalTime = esp_timer_get_time();
+  Stats->LightSleepTime = LightSleepTime;
+  Stats->WaitTime = WaitTime;
+  Stats->RunTime = totalTime - LightSleepTime - WaitTime;
+  Stats->NumLightSleeps = NumLightSleeps;
+}
+
+/****************************************************************************
+ Function
+     _HW_GetTimeUs
+ Parameters
+     None.
+ Returns
+     uint32_t, us since boot, wrapping after ~71 minutes
+ Description
+     Time stamps for ES_Event_t, taken when an event source signals and when
+     an event is posted
+ Notes
+     Read from esp_timer rather than hw timer 0, since timerRead isn't in
+     IRAM and this is called from the button's ISR. The port moves hw timer 0
+     forward after light sleep, so the two keep in step with each other.
+****************************************************************************/
+uint32_t IRAM_ATTR _HW_GetTimeUs(void)
+{
+  return (uint32_t)esp_timer_get_time();
+}
+
+/****************************************************************************
+ Function
+     _HW_GetCycleCount
+ Parameters
+     None.
+ Returns
+     uint32_t, the CPU cycle counter
+ Description
+     Fine grained time stamps for the profiler
+ Notes
+     Wraps every 2^32 cycles and doesn't count during light sleep
+****************************************************************************/
+uint32_t IRAM_ATTR _HW_GetCycleCount(void)
+{
+  return ESP.getCycleCount();
+}
+
+/****************************************************************************
+ Function
+     _HW_GetCyclesPerUs
+ Parameters
+     None.
+ Returns
+     uint32_t, CPU cycles in 1us at the current CPU frequency
+ Description
+     Converts _HW_GetCycleCount differences to time
+ Notes
+****************************************************************************/
+uint32_t _HW_GetCyclesPerUs(void)
+{
+  return getCpuFrequencyMhz();
+}
+
 /****************************************************************************
  Function
      ConsoleInit
@@ -182,4 +561,191 @@ void ConsoleInit(void)
   return;
 }
 
+#ifdef ES_WATCHDOG_TIMEOUT
+/****************************************************************************
+ Function
+     _HW_Watchdog_Init
+ Parameters
+     uint32_t TimeoutSecs, how long the calling task may go without a feed
+ Returns
+     None.
+ Description
+     Puts the calling task (the one running ES_Run) on the ESP's task 
+     watchdog, which panics and resets the chip with a backtrace of the task 
+     if it isn't fed for TimeoutSecs
+ Notes
+     The Arduino core has already started the task watchdog for the idle
+     tasks, this sets its timeout for all of them
+****************************************************************************/
+void _HW_Watchdog_Init(uint32_t TimeoutSecs)
+{
+  esp_task_wdt_init(TimeoutSecs, true);
+  esp_task_wdt_add(NULL);
+}
+
+/****************************************************************************
+ Function
+     _HW_Watchdog_Feed
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Resets the task watchdog for the calling task
+ Notes
+****************************************************************************/
+void _HW_Watchdog_Feed(void)
+{
+  esp_task_wdt_reset();
+}
+#endif /* ES_WATCHDOG_TIMEOUT */
+
+#ifdef ES_WORKER_ENABLE
+/****************************************************************************
+ Function
+     _HW_Worker_Start
+ Parameters
+     void (*WorkerLoop)(void), the worker task's main function, never returns
+ Returns
+     None.
+ Description
+     Creates the worker task on ES_WORKER_CORE. The Arduino loop task runs on
+     the other core, so a worker service blocked on the network doesn't take
+     any time from the loop's services.
+ Notes
+     Only the first call does anything
+****************************************************************************/
+void _HW_Worker_Start(void (*WorkerLoop)(void))
+{
+  if(WorkerTaskHandle != NULL)
+  {
+    return;
+  }
+  WorkerLoopFunc = WorkerLoop;
+  xTaskCreatePinnedToCore(WorkerTask, "ES_Worker", ES_WORKER_STACK_SIZE, NULL, 
+      ES_WORKER_PRIORITY, &WorkerTaskHandle, ES_WORKER_CORE);
+}
+
+/****************************************************************************
+ Function
+     _HW_In_Worker
+ Parameters
+     none
+ Returns
+     bool, true if called from the worker task
+ Description
+     Lets the framework pick the right queues for a post
+ Notes
+****************************************************************************/
+bool _HW_In_Worker(void)
+{
+  return (WorkerTaskHandle != NULL) && (xTaskGetCurrentTaskHandle() == WorkerTaskHandle);
+}
+
+/****************************************************************************
+ Function
+     _HW_Worker_Wait
+ Parameters
+     uint32_t MaxWaitTicks, longest time to block for in ms
+ Returns
+     None.
+ Description
+     Blocks the worker task until _HW_Worker_Signal or MaxWaitTicks goes by
+ Notes
+     A signal given before this is called makes it return right away
+****************************************************************************/
+void _HW_Worker_Wait(uint32_t MaxWaitTicks)
+{
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MaxWaitTicks));
+}
+
+/****************************************************************************
+ Function
+     _HW_Worker_Signal
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Wakes up the worker task once the loop task has posted to it
+ Notes
+     Does nothing before the worker is started, it takes what was posted
+     when it starts
+****************************************************************************/
+void _HW_Worker_Signal(void)
+{
+  if(WorkerTaskHandle != NULL)
+  {
+    xTaskNotifyGive(WorkerTaskHandle);
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Loop_Signal
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Wakes up the task running ES_Run once the worker task has posted to it
+ Notes
+****************************************************************************/
+void _HW_Loop_Signal(void)
+{
+  if(LoopTaskHandle != NULL)
+  {
+    xTaskNotifyGive(LoopTaskHandle);
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Lock
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Takes the lock shared by the loop and worker tasks, used by the timers
+     and ES_Lock. Recursive, so a task holding it can take it again
+ Notes
+     A mutex rather than timerMux, the timers post and notify tasks while
+     holding it. Only held for a few us at a time
+****************************************************************************/
+void _HW_Lock(void)
+{
+  if(WorkerLock != NULL)
+  {
+    xSemaphoreTakeRecursive(WorkerLock, portMAX_DELAY);
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Unlock
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Gives back the lock taken by _HW_Lock
+ Notes
+****************************************************************************/
+void _HW_Unlock(void)
+{
+  if(WorkerLock != NULL)
+  {
+    xSemaphoreGiveRecursive(WorkerLock);
+  }
+}
+
+// FreeRTOS task function of the worker
+static void WorkerTask(void *Arg)
+{
+  WorkerLoopFunc();
+  vTaskDelete(NULL);
+}
+#endif /* ES_WORKER_ENABLE */
+
 
@@ -15,12 +15,22 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 
+// The host build (ES_Port_Posix.c) doesn't have Arduino.h, so stand in for
+// the bits of it the framework uses
+#ifdef ES_PORT_POSIX
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#endif
 
 /* 
-   These values will be used to set the hw timer alarm. 
-   Values assume a 80MHz clock rate with pre-scaler val 2, so sysTick counter
-   will increment every 1us.
+   These values set how many hw timer counts make up 1 framework tick. 
+   Values assume a 80MHz clock rate with pre-scaler val 2, so the free running 
+   hw counter increments at 40MHz.
  */
 typedef enum
 {
@@ -30,12 +40,61 @@ typedef enum
 }TimerRate_t;
 
 
+// time spent idle vs running, all times in us
+typedef struct
+{
+  uint64_t LightSleepTime;   // time spent in light sleep
+  uint64_t WaitTime;         // time spent blocked waiting without sleeping
+  uint64_t RunTime;          // everything else since boot
+  uint32_t NumLightSleeps;
+  uint32_t NumWakeups;       // times ES_Run came out of idle, filled in by the framework
+  uint32_t NumTimerAlarms;   // timer alarms that posted a timeout (ES_Timer_GetNumAlarms)
+}ES_IdleStats_t;
+
+
 // prototypes for the hardware specific routines
 void _HW_Timer_Init(TimerRate_t Rate);
+void _HW_Timer_SetAlarm(uint32_t Tick);
+void _HW_Timer_ClearAlarm(void);
 bool _HW_Process_Pending_Ints(void);
 uint32_t _HW_GetTickCount(void);
 void ConsoleInit(void);
 
+// event source signalling, safe to call from an ISR or another task
+void _HW_Signal_Event_Source(uint8_t Source);
+uint32_t _HW_Take_Event_Sources(void);
+void _HW_Wait_For_Event(uint32_t MaxWaitTicks);
+bool _HW_Ints_Pending(void);
+
+// idle support
+void _HW_Light_Sleep(uint32_t MaxSleepTicks);
+void _HW_Get_Idle_Stats(ES_IdleStats_t *Stats);
+
+// event time stamps, safe to call from an ISR
+uint32_t _HW_GetTimeUs(void);
+
+// profiler time stamps
+uint32_t _HW_GetCycleCount(void);
+uint32_t _HW_GetCyclesPerUs(void);
+
+// worker task, only with ES_WORKER_ENABLE
+void _HW_Worker_Start(void (*WorkerLoop)(void));
+bool _HW_In_Worker(void);
+void _HW_Worker_Wait(uint32_t MaxWaitTicks);
+void _HW_Worker_Signal(void);
+void _HW_Loop_Signal(void);
+void _HW_Lock(void);
+void _HW_Unlock(void);
+
+// task watchdog on the loop task, only with ES_WATCHDOG_TIMEOUT
+void _HW_Watchdog_Init(uint32_t TimeoutSecs);
+void _HW_Watchdog_Feed(void);
+
+#ifdef ES_PORT_POSIX
+// host only, jumps the clock ahead for the timer wheel unit tests
+void _HW_Skip_To_Tick(uint32_t Tick);
+#endif
+
 
 
 #endif
@@ -0,0 +1,138 @@
+/****************************************************************************
+ Module
+     ES_PostList.c
+ Description
+     source file for the module to post events to lists of services. The
+     lists are set up in ES_Configure.h (POST_LIST_nn and ES_SUBSCRIPTIONS)
+     and turned into service bit masks at compile time.
+
+     A multicast event is put in the framework's multicast queue once and
+     handed to each service on its list when it is dispatched, rather than
+     being copied into every service's queue.
+ Notes
+
+*****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ES_PostList.h"
+#include "ES_framework.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define ALL_SERVICES ((uint16_t)((1UL << NUM_SERVICES) - 1))
+
+#define CHECK_POST_LIST(mask) \
+  static_assert(((mask) & ~ALL_SERVICES) == 0, #mask " has a service that doesn't exist")
+
+/*---------------------------- Module Functions ---------------------------*/
+static bool ES_PostToList(uint8_t WhichList, ES_Event_t ThisEvent);
+static constexpr uint16_t ES_SubscribersOf(ES_EventType_t EventType);
+
+/*---------------------------- Module Variables ---------------------------*/
+static const uint16_t PostListMasks[] = {
+  ES_ServiceMask(POST_LIST_00),
+  ES_ServiceMask(POST_LIST_01),
+  ES_ServiceMask(POST_LIST_02),
+  ES_ServiceMask(POST_LIST_03),
+  ES_ServiceMask(POST_LIST_04),
+  ES_ServiceMask(POST_LIST_05),
+  ES_ServiceMask(POST_LIST_06),
+  ES_ServiceMask(POST_LIST_07)
+};
+
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_00));
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_01));
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_02));
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_03));
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_04));
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_05));
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_06));
+CHECK_POST_LIST(ES_ServiceMask(POST_LIST_07));
+
+#define ES_SUBSCRIBE(Type, ...) CHECK_POST_LIST(ES_ServiceMask(__VA_ARGS__));
+ES_SUBSCRIPTIONS
+#undef ES_SUBSCRIBE
+
+/*------------------------------ Module Code ------------------------------*/
+bool ES_PostList00(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(0, ThisEvent);
+}
+
+bool ES_PostList01(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(1, ThisEvent);
+}
+
+bool ES_PostList02(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(2, ThisEvent);
+}
+
+bool ES_PostList03(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(3, ThisEvent);
+}
+
+bool ES_PostList04(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(4, ThisEvent);
+}
+
+bool ES_PostList05(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(5, ThisEvent);
+}
+
+bool ES_PostList06(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(6, ThisEvent);
+}
+
+bool ES_PostList07(ES_Event_t ThisEvent)
+{
+  return ES_PostToList(7, ThisEvent);
+}
+
+/****************************************************************************
+ Function
+   ES_PostList_GetMask
+ Parameters
+   ES_Event_t : a multicast event, its ServiceNum says which list it went to
+ Returns
+   uint16_t : bit n set for every service n the event goes to
+ Description
+   Used by the framework to fan out a multicast event when it is dispatched
+ Notes
+****************************************************************************/
+uint16_t ES_PostList_GetMask(ES_Event_t ThisEvent)
+{
+  if(ThisEvent.ServiceNum == ES_SUBSCRIBERS_LIST)
+  {
+    return ES_SubscribersOf(ThisEvent.EventType);
+  }
+  if(ThisEvent.ServiceNum < ARRAY_SIZE(PostListMasks))
+  {
+    return PostListMasks[ThisEvent.ServiceNum];
+  }
+  return 0;
+}
+
+//*********************************
+// private functions
+//*********************************
+static bool ES_PostToList(uint8_t WhichList, ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = WhichList;
+  return ES_PostMulticast(ThisEvent);
+}
+
+// Each ES_SUBSCRIBE entry becomes a compare in a single expression. Event
+// types without an entry go to every service
+#define ES_SUBSCRIBE(Type, ...) (EventType == (Type)) ? ES_ServiceMask(__VA_ARGS__) :
+static constexpr uint16_t ES_SubscribersOf(ES_EventType_t EventType)
+{
+  return ES_SUBSCRIPTIONS ALL_SERVICES;
+}
+#undef ES_SUBSCRIBE
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
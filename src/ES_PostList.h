@@ -11,11 +11,28 @@
 #define ES_PostList_H
 
 #include "ES_Event.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 typedef bool PostFunc_t (ES_Event_t);
 
 typedef PostFunc_t (*pPostFunc);
 
+// ServiceNum of a multicast event that goes to the subscribers of its type
+#define ES_SUBSCRIBERS_LIST 0xFF
+
+// Builds the bit mask of a list of service numbers at compile time
+constexpr uint16_t ES_ServiceMask()
+{
+  return 0;
+}
+
+template<typename... Rest>
+constexpr uint16_t ES_ServiceMask(uint8_t First, Rest... Others)
+{
+  return (uint16_t)((1U << First) | ES_ServiceMask(Others...));
+}
+
 bool  ES_PostList00(ES_Event_t);
 bool  ES_PostList01(ES_Event_t);
 bool  ES_PostList02(ES_Event_t);
@@ -25,4 +42,7 @@ bool  ES_PostList05(ES_Event_t);
 bool  ES_PostList06(ES_Event_t);
 bool  ES_PostList07(ES_Event_t);
 
+// used by the framework to fan out a multicast event
+uint16_t ES_PostList_GetMask(ES_Event_t ThisEvent);
+
 #endif // ES_PostList_H
@@ -0,0 +1,281 @@
+/****************************************************************************
+ Module
+     ES_Profiler.c
+ Description
+     Dispatch profiler for the Events & Services framework. Every event is
+     stamped with the cycle counter when it is posted, and ES_Run times it
+     again when it is handed to the run function and when that returns. The
+     time spent waiting in the queue and in the run function go into log2
+     histograms per service, along with counters per service and per event
+     type and the high-water mark and failed posts of every queue.
+ Notes
+     Only built with ES_PROFILER_ENABLE. The cycle counter wraps after
+     2^32 cycles (~53 s at 80MHz), longer times come out short.
+*****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ES_Configure.h"
+
+#ifdef ES_PROFILER_ENABLE
+#include "ES_Profiler.h"
+#include "ES_Port.h"
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#ifdef ES_PORT_POSIX
+#define ES_PROFILER_PRINTF printf
+#else
+#include <HardwareSerial.h>
+#define ES_PROFILER_PRINTF Serial.printf
+#endif
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint32_t ES_Profiler_ToUs(uint32_t Cycles);
+static void ES_Profiler_AddToHist(uint32_t *Hist, uint32_t Time);
+static void ES_Profiler_PrintHist(const char *Name, const uint32_t *Hist);
+
+/*---------------------------- Module Variables ---------------------------*/
+static ES_ServiceProfile_t ServiceProfiles[NUM_SERVICES + 1];  // + multicast queue
+static ES_EventProfile_t EventProfiles[ES_NUM_EVENT_TYPES];
+static uint32_t CyclesPerUs = 1;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+   ES_Profiler_Reset
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Clears all the stats. Called by ES_Initialize
+ Notes
+   Picks up the CPU clock, so call it again after changing the CPU frequency
+****************************************************************************/
+void ES_Profiler_Reset(void)
+{
+  memset(ServiceProfiles, 0, sizeof(ServiceProfiles));
+  memset(EventProfiles, 0, sizeof(EventProfiles));
+  CyclesPerUs = _HW_GetCyclesPerUs();
+  if(CyclesPerUs == 0)
+    CyclesPerUs = 1;
+}
+
+/****************************************************************************
+ Function
+   ES_Profiler_Stamp
+ Parameters
+   ES_Event_t * : event about to be put in a queue
+ Returns
+   None
+ Description
+   Notes the time the event was posted
+ Notes
+****************************************************************************/
+void ES_Profiler_Stamp(ES_Event_t *ThisEvent)
+{
+  ThisEvent->EnqueueTime = _HW_GetCycleCount();
+}
+
+/****************************************************************************
+ Function
+   ES_Profiler_Posted
+ Parameters
+   uint8_t : service whose queue the event went to, ES_PROFILER_MULTICAST for
+             the multicast queue
+   bool : whether the event made it into the queue
+   uint8_t : number of events in the queue afterwards
+ Returns
+   None
+ Description
+   Keeps the queue high-water marks and counts failed posts
+ Notes
+****************************************************************************/
+void ES_Profiler_Posted(uint8_t ServiceNum, bool Success, uint8_t QueueLen)
+{
+  if(ServiceNum > ES_PROFILER_MULTICAST)
+    return;
+
+  ES_ServiceProfile_t *profile = &ServiceProfiles[ServiceNum];
+  if(!Success)
+    profile->NumDropped++;
+  else if(QueueLen > profile->QueueHighWater)
+    profile->QueueHighWater = QueueLen;
+}
+
+/****************************************************************************
+ Function
+   ES_Profiler_StartRun
+ Parameters
+   None
+ Returns
+   uint32_t : time stamp to hand to ES_Profiler_EndRun
+ Description
+   Called just before a run function
+ Notes
+****************************************************************************/
+uint32_t ES_Profiler_StartRun(void)
+{
+  return _HW_GetCycleCount();
+}
+
+/****************************************************************************
+ Function
+   ES_Profiler_EndRun
+ Parameters
+   uint8_t : service that ran
+   const ES_Event_t * : the event it was given
+   uint32_t : time stamp from ES_Profiler_StartRun
+ Returns
+   None
+ Description
+   Called once the run function returns. Adds the event's queue wait and
+   run time to the service's and event type's stats
+ Notes
+****************************************************************************/
+void ES_Profiler_EndRun(uint8_t ServiceNum, const ES_Event_t *ThisEvent, uint32_t StartTime)
+{
+  uint32_t now = _HW_GetCycleCount();
+  uint32_t waitTime = ES_Profiler_ToUs(StartTime - ThisEvent->EnqueueTime);
+  uint32_t runTime = ES_Profiler_ToUs(now - StartTime);
+
+  if(ServiceNum < NUM_SERVICES)
+  {
+    ES_ServiceProfile_t *profile = &ServiceProfiles[ServiceNum];
+    profile->NumEvents++;
+    profile->TotalRunTime += runTime;
+    if(runTime > profile->MaxRunTime)
+      profile->MaxRunTime = runTime;
+    ES_Profiler_AddToHist(profile->WaitHist, waitTime);
+    ES_Profiler_AddToHist(profile->RunHist, runTime);
+  }
+
+  if(ThisEvent->EventType < ES_NUM_EVENT_TYPES)
+  {
+    ES_EventProfile_t *profile = &EventProfiles[ThisEvent->EventType];
+    profile->NumEvents++;
+    profile->TotalRunTime += runTime;
+    if(runTime > profile->MaxRunTime)
+      profile->MaxRunTime = runTime;
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_Profiler_GetService
+ Parameters
+   uint8_t : service number, or ES_PROFILER_MULTICAST for the multicast queue
+   ES_ServiceProfile_t * : filled in with the service's stats
+ Returns
+   bool : false if there is no such service
+ Description
+   Gives the stats gathered for a service since the last reset
+ Notes
+****************************************************************************/
+bool ES_Profiler_GetService(uint8_t ServiceNum, ES_ServiceProfile_t *Profile)
+{
+  if(ServiceNum > ES_PROFILER_MULTICAST || Profile == NULL)
+    return false;
+
+  *Profile = ServiceProfiles[ServiceNum];
+  return true;
+}
+
+/****************************************************************************
+ Function
+   ES_Profiler_GetEvent
+ Parameters
+   ES_EventType_t : the event type
+   ES_EventProfile_t * : filled in with the event type's stats
+ Returns
+   bool : false if there is no such event type
+ Description
+   Gives the stats gathered for an event type, over all services
+ Notes
+****************************************************************************/
+bool ES_Profiler_GetEvent(ES_EventType_t EventType, ES_EventProfile_t *Profile)
+{
+  if(EventType >= ES_NUM_EVENT_TYPES || Profile == NULL)
+    return false;
+
+  *Profile = EventProfiles[EventType];
+  return true;
+}
+
+/****************************************************************************
+ Function
+   ES_Profiler_Print
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Dumps all the stats over Serial (stdout on the host)
+ Notes
+   Histograms are printed from bin 0 up to the last bin that isn't empty
+****************************************************************************/
+void ES_Profiler_Print(void)
+{
+  ES_PROFILER_PRINTF("ES profile, times in us\n");
+  ES_PROFILER_PRINTF("serv   events  dropped  hiwater      max     total\n");
+  for(uint8_t i = 0; i <= ES_PROFILER_MULTICAST; i++)
+  {
+    const ES_ServiceProfile_t *profile = &ServiceProfiles[i];
+    if(i == ES_PROFILER_MULTICAST)
+      ES_PROFILER_PRINTF("mcast ");
+    else
+      ES_PROFILER_PRINTF("%4u  ", i);
+    ES_PROFILER_PRINTF("%7u  %7u  %7u  %7u  %8llu\n", profile->NumEvents, profile->NumDropped,
+        profile->QueueHighWater, profile->MaxRunTime, (unsigned long long)profile->TotalRunTime);
+    if(i < ES_PROFILER_MULTICAST)
+    {
+      ES_Profiler_PrintHist("  wait", profile->WaitHist);
+      ES_Profiler_PrintHist("  run ", profile->RunHist);
+    }
+  }
+
+  ES_PROFILER_PRINTF("event  events      max     total\n");
+  for(uint8_t i = 0; i < ES_NUM_EVENT_TYPES; i++)
+  {
+    const ES_EventProfile_t *profile = &EventProfiles[i];
+    if(profile->NumEvents != 0)
+    {
+      ES_PROFILER_PRINTF("%5u  %6u  %7u  %8llu\n", i, profile->NumEvents,
+          profile->MaxRunTime, (unsigned long long)profile->TotalRunTime);
+    }
+  }
+}
+
+
+//*********************************
+// private functions
+//*********************************
+static uint32_t ES_Profiler_ToUs(uint32_t Cycles)
+{
+  return Cycles / CyclesPerUs;
+}
+
+static void ES_Profiler_AddToHist(uint32_t *Hist, uint32_t Time)
+{
+  uint8_t bin = (Time == 0) ? 0 : (uint8_t)(31 - __builtin_clz(Time));
+  if(bin >= ES_PROFILER_HIST_BINS)
+    bin = ES_PROFILER_HIST_BINS - 1;
+  Hist[bin]++;
+}
+
+static void ES_Profiler_PrintHist(const char *Name, const uint32_t *Hist)
+{
+  int8_t last = ES_PROFILER_HIST_BINS - 1;
+  while(last >= 0 && Hist[last] == 0)
+    last--;
+  if(last < 0)
+    return;
+
+  ES_PROFILER_PRINTF("%s:", Name);
+  for(int8_t bin = 0; bin <= last; bin++)
+    ES_PROFILER_PRINTF(" %u", Hist[bin]);
+  ES_PROFILER_PRINTF("\n");
+}
+
+#endif /* ES_PROFILER_ENABLE */
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,66 @@
+/****************************************************************************
+ Module
+    ES_Profiler.h
+ Description
+    header file for the dispatch profiler. Turned on with ES_PROFILER_ENABLE
+    in ES_Configure.h, otherwise every function here compiles to nothing.
+ Notes
+    All times are in us. With ES_WORKER_ENABLE only the loop task's 
+    services are profiled
+*****************************************************************************/
+#ifndef ES_Profiler_H
+#define ES_Profiler_H
+
+#include "ES_Event.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// bin n of a histogram counts times of 2^n to 2^(n+1)-1 us, bin 0 also
+// counts 0 us and the last bin everything longer
+#define ES_PROFILER_HIST_BINS 24
+
+// the multicast queue's row in the service stats, only the queue stats are used
+#define ES_PROFILER_MULTICAST NUM_SERVICES
+
+typedef struct
+{
+  uint32_t NumEvents;         // events handed to the run function
+  uint32_t NumDropped;        // posts that failed because the queue was full
+  uint8_t QueueHighWater;
+  uint32_t MaxRunTime;
+  uint64_t TotalRunTime;
+  uint32_t WaitHist[ES_PROFILER_HIST_BINS];  // from post to dispatch
+  uint32_t RunHist[ES_PROFILER_HIST_BINS];   // in the run function
+}ES_ServiceProfile_t;
+
+typedef struct
+{
+  uint32_t NumEvents;
+  uint32_t MaxRunTime;
+  uint64_t TotalRunTime;
+}ES_EventProfile_t;
+
+#ifdef ES_PROFILER_ENABLE
+// used by the framework
+void ES_Profiler_Reset(void);
+void ES_Profiler_Stamp(ES_Event_t *ThisEvent);
+void ES_Profiler_Posted(uint8_t ServiceNum, bool Success, uint8_t QueueLen);
+uint32_t ES_Profiler_StartRun(void);
+void ES_Profiler_EndRun(uint8_t ServiceNum, const ES_Event_t *ThisEvent, uint32_t StartTime);
+
+// used by the application
+bool ES_Profiler_GetService(uint8_t ServiceNum, ES_ServiceProfile_t *Profile);
+bool ES_Profiler_GetEvent(ES_EventType_t EventType, ES_EventProfile_t *Profile);
+void ES_Profiler_Print(void);
+#else
+static inline void ES_Profiler_Reset(void) {}
+static inline void ES_Profiler_Stamp(ES_Event_t *ThisEvent) {}
+static inline void ES_Profiler_Posted(uint8_t ServiceNum, bool Success, uint8_t QueueLen) {}
+static inline uint32_t ES_Profiler_StartRun(void) { return 0; }
+static inline void ES_Profiler_EndRun(uint8_t ServiceNum, const ES_Event_t *ThisEvent, uint32_t StartTime) {}
+static inline bool ES_Profiler_GetService(uint8_t ServiceNum, ES_ServiceProfile_t *Profile) { return false; }
+static inline bool ES_Profiler_GetEvent(ES_EventType_t EventType, ES_EventProfile_t *Profile) { return false; }
+static inline void ES_Profiler_Print(void) {}
+#endif
+
+#endif /* ES_Profiler_H */
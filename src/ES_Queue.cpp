@@ -4,6 +4,14 @@
  Description
      source file for the event queueing of the Events & Services framework
  Notes
+     Queues are rings with a power of 2 capacity, so indexes wrap with a
+     mask. When an event is posted, ES_QUEUE_POLICIES in ES_Configure.h
+     says whether it may replace an identical event that is still waiting
+     (ES_QUEUE_COALESCE) and whether a full queue drops its oldest event
+     to make room (ES_QUEUE_DROP_OLDEST) rather than failing the post.
+     Only a waiting event of the same type as the new one is ever dropped,
+     if none is waiting the post fails after all.
+     Events that are replaced or dropped have their payloads released.
 
 *****************************************************************************/
 //Potential improvement: convert array of events to array of pointers that point events
@@ -16,11 +24,13 @@
 
 
 /*----------------------------- Module Defines ----------------------------*/
-
+#define ES_QueueIndex(thisQueue, i) ((uint8_t)((i) & ((thisQueue)->capacity - 1)))
 
 
 /*---------------------------- Module Functions ---------------------------*/
 static bool ES_isFull(ES_Queue_t *thisQueue); 
+static bool ES_DropOldest(ES_Queue_t *thisQueue, ES_EventType_t EventType); 
+static constexpr uint8_t ES_QueuePolicyOf(ES_EventType_t EventType); 
 
 
 /*---------------------------- Module Variables ---------------------------*/
@@ -31,36 +41,60 @@ static bool ES_isFull(ES_Queue_t *thisQueue);
 void ES_InitQueue(ES_Queue_t *thisQueue){
     thisQueue->front_idx = 0; 
     thisQueue->num_events = 0; 
+    thisQueue->stats = ES_QueueStats_t(); 
 }
 
 
 bool ES_EnQueueEnd(ES_Queue_t *thisQueue, ES_Event_t newEvent){
+    uint8_t policy = ES_QueuePolicyOf(newEvent.EventType); 
+
+    if(policy & ES_QUEUE_COALESCE){
+        for(uint8_t i = 0; i < thisQueue->num_events; i++){
+            ES_Event_t *waiting = &thisQueue->events_arr[ES_QueueIndex(thisQueue, thisQueue->front_idx + i)]; 
+            if(waiting->EventType == newEvent.EventType && waiting->EventParam == newEvent.EventParam 
+                && waiting->ServiceNum == newEvent.ServiceNum){
+                ES_Payload_Release(waiting->Payload); 
+                *waiting = newEvent;   // keeps its place in the queue
+                thisQueue->stats.Coalesced++; 
+                return true; 
+            }
+        }
+    }
+
     if(ES_isFull(thisQueue)){
-        return false; 
+        if(!(policy & ES_QUEUE_DROP_OLDEST)){
+            thisQueue->stats.Rejected++; 
+            return false; 
+        }
+        if(!ES_DropOldest(thisQueue, newEvent.EventType)){
+            thisQueue->stats.Rejected++; 
+            return false; 
+        }
     }
-    uint8_t nextIdx = (thisQueue->front_idx + thisQueue->num_events) % thisQueue->capacity; 
+
+    uint8_t nextIdx = ES_QueueIndex(thisQueue, thisQueue->front_idx + thisQueue->num_events); 
     thisQueue->events_arr[nextIdx] = newEvent; 
     thisQueue->num_events++; 
+    if(thisQueue->num_events > thisQueue->stats.HighWater){
+        thisQueue->stats.HighWater = thisQueue->num_events; 
+    }
     return true; 
 }
 
 
 bool ES_EnQueueFront(ES_Queue_t *thisQueue, ES_Event_t newEvent){
     if(ES_isFull(thisQueue)){
+        thisQueue->stats.Rejected++; 
         return false; 
     }
 
-    uint8_t nextIdx; 
-    if(thisQueue->front_idx != 0){
-        nextIdx = thisQueue->front_idx - 1;
-    }
-    else{
-        nextIdx = thisQueue->capacity - 1; 
-    }
+    uint8_t nextIdx = ES_QueueIndex(thisQueue, thisQueue->front_idx - 1); 
     thisQueue->events_arr[nextIdx] = newEvent; 
     thisQueue->num_events++; 
     thisQueue->front_idx = nextIdx; 
-
+    if(thisQueue->num_events > thisQueue->stats.HighWater){
+        thisQueue->stats.HighWater = thisQueue->num_events; 
+    }
     return true; 
 }
 
@@ -71,12 +105,23 @@ bool ES_DeQueue(ES_Queue_t *thisQueue, ES_Event_t *topEvent){
     }
 
     *topEvent = thisQueue->events_arr[thisQueue->front_idx];
-    thisQueue->front_idx = (thisQueue->front_idx + 1) % thisQueue->capacity; 
+    thisQueue->front_idx = ES_QueueIndex(thisQueue, thisQueue->front_idx + 1); 
     thisQueue->num_events--; 
     return true;
 }
 
 
+// like ES_DeQueue, but the event stays in the queue
+bool ES_PeekQueue(ES_Queue_t *thisQueue, ES_Event_t *topEvent){
+    if(ES_isEmpty(thisQueue)){
+        return false; 
+    }
+
+    *topEvent = thisQueue->events_arr[thisQueue->front_idx];
+    return true;
+}
+
+
 bool ES_isEmpty(ES_Queue_t *thisQueue){
     return thisQueue->num_events == 0; 
 }
@@ -90,6 +135,36 @@ static bool ES_isFull(ES_Queue_t *thisQueue){
     return thisQueue->num_events >= thisQueue->capacity; 
 }
 
+// Takes the oldest waiting event of the given type out of the queue and
+// releases its payload. The events ahead of it move up a place, so the rest
+// keep their order. Returns false if there is none
+static bool ES_DropOldest(ES_Queue_t *thisQueue, ES_EventType_t EventType){
+    for(uint8_t i = 0; i < thisQueue->num_events; i++){
+        uint8_t idx = ES_QueueIndex(thisQueue, thisQueue->front_idx + i); 
+        if(thisQueue->events_arr[idx].EventType == EventType){
+            ES_Payload_Release(thisQueue->events_arr[idx].Payload); 
+            for(; i > 0; i--){
+                uint8_t prevIdx = ES_QueueIndex(thisQueue, idx - 1); 
+                thisQueue->events_arr[idx] = thisQueue->events_arr[prevIdx]; 
+                idx = prevIdx; 
+            }
+            thisQueue->front_idx = ES_QueueIndex(thisQueue, thisQueue->front_idx + 1); 
+            thisQueue->num_events--; 
+            thisQueue->stats.DroppedOldest++; 
+            return true; 
+        }
+    }
+    return false; 
+}
+
+// Each ES_QUEUE_POLICY entry becomes a compare in a single expression. Event
+// types without an entry are rejected when the queue is full
+#define ES_QUEUE_POLICY(Type, Policy) (EventType == (Type)) ? (uint8_t)(Policy) :
+static constexpr uint8_t ES_QueuePolicyOf(ES_EventType_t EventType){
+    return ES_QUEUE_POLICIES ES_QUEUE_REJECT; 
+}
+#undef ES_QUEUE_POLICY
+
 /*------------------------------- Footnotes -------------------------------*/
 /*------------------------------ End of file ------------------------------*/
 
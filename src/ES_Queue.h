@@ -4,18 +4,37 @@
  Description
     header file for use with the top level functions of the ES Event Framework
  Notes
-   
+    Queue capacities must be a power of 2. What ES_EnQueueEnd does with an
+    event that can't just go on the end is set per event type by
+    ES_QUEUE_POLICIES in ES_Configure.h
 *****************************************************************************/
 #ifndef ES_QUEUE_H
 #define ES_QUEUE_H
 
+#include "ES_Event.h"
 #include <stdbool.h>
+#include <stdint.h>
+
+// queue policies, ES_QUEUE_COALESCE and ES_QUEUE_DROP_OLDEST can be combined
+#define ES_QUEUE_REJECT 0         // fail the post when the queue is full
+#define ES_QUEUE_COALESCE 1       // replace a waiting event with the same type and param
+#define ES_QUEUE_DROP_OLDEST 2    // when full, drop the oldest event of the same type to make room
+
+// what happened to the posts that didn't simply go on the end
+typedef struct
+{
+  uint32_t Coalesced;       // replaced a waiting event
+  uint32_t DroppedOldest;   // waiting events dropped to make room
+  uint32_t Rejected;        // posts that failed because the queue was full
+  uint8_t HighWater;        // most events waiting at once
+}ES_QueueStats_t;
 
 // main structure for holding all events 
 typedef struct ES_Queue 
 { 
     uint8_t front_idx, num_events, capacity; 
     ES_Event_t* events_arr; 
+    ES_QueueStats_t stats; 
 }ES_Queue_t; 
 
 
@@ -23,6 +42,7 @@ void ES_InitQueue(ES_Queue_t *thisQueue);
 bool ES_EnQueueEnd(ES_Queue_t *thisQueue, ES_Event_t newEvent);
 bool ES_EnQueueFront(ES_Queue_t *thisQueue, ES_Event_t newEvent); 
 bool ES_DeQueue(ES_Queue_t *thisQueue, ES_Event_t *topEvent);
+bool ES_PeekQueue(ES_Queue_t *thisQueue, ES_Event_t *topEvent);
 bool ES_isEmpty(ES_Queue_t *thisQueue); 
 
 #endif
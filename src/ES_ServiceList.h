@@ -0,0 +1,183 @@
+/****************************************************************************
+ Module
+     ES_ServiceList.h
+ Description
+     compile time tables of the services and event checkers. ES_framework.c
+     builds an ES_ServiceList from the SERV_n defines in ES_Configure.h and
+     an ES_CheckerList from EVENT_CHECKER_LIST, so a missing init or run
+     function or run budget, a missing checker or one with no weight or no
+     service, a queue size that isn't a power of 2 or too many services or
+     checkers is a compile error rather than an ES_Initialize failure
+ Notes
+     The run and checker functions are template arguments, so ES_Run calls
+     them directly (a compare per service ahead of it) instead of through a
+     table of function pointers, and the compiler can inline them when it
+     can see them
+*****************************************************************************/
+#ifndef ES_ServiceList_H
+#define ES_ServiceList_H
+
+#include "ES_Event.h"
+#include "ES_Queue.h"
+#include "ES_PostList.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef bool ES_InitFunc_t(uint8_t);
+typedef ES_Event_t ES_RunFunc_t(ES_Event_t);
+typedef bool ES_CheckerFunc_t(void);
+typedef bool ES_ProbeFunc_t(void);
+
+// SERV_n_PROBE of a service that doesn't need its hardware to be there
+#define ES_NO_PROBE nullptr
+
+// One service: its init and run functions, the size of its queue, the
+// longest its run function should take in us (see ES_Budget.h) and the
+// function ES_Initialize asks whether its hardware is there, if any
+template<ES_InitFunc_t *InitFunc, ES_RunFunc_t *RunFunc, uint8_t QueueLen, uint32_t Budget,
+    ES_ProbeFunc_t *ProbeFunc>
+struct ES_Service
+{
+  static_assert(InitFunc != nullptr, "a service has no init function");
+  static_assert(RunFunc != nullptr, "a service has no run function");
+  static_assert(QueueLen > 0, "every service needs room for at least 1 event in its queue");
+  static_assert((QueueLen & (QueueLen - 1)) == 0 && QueueLen <= 128, "queue sizes must be a power of 2");
+  static_assert(Budget > 0, "every service needs a run budget");
+
+  static constexpr uint8_t QueueSize = QueueLen;
+  static constexpr uint32_t RunBudget = Budget;
+  static ES_Event_t Queue[QueueLen];
+
+  static inline bool Probe(void) { return ProbeFunc == nullptr || ProbeFunc(); }
+  static inline bool Init(uint8_t Priority) { return InitFunc(Priority); }
+  static inline ES_Event_t Run(ES_Event_t ThisEvent) { return RunFunc(ThisEvent); }
+};
+
+template<ES_InitFunc_t *InitFunc, ES_RunFunc_t *RunFunc, uint8_t QueueLen, uint32_t Budget,
+    ES_ProbeFunc_t *ProbeFunc>
+ES_Event_t ES_Service<InitFunc, RunFunc, QueueLen, Budget, ProbeFunc>::Queue[QueueLen];
+
+// Services from number Num on, the recursion behind ES_ServiceList
+template<uint8_t Num, typename... Services>
+struct ES_ServiceChain
+{
+  static inline uint16_t Probe(uint16_t Absent) { return 0; }
+  static inline bool Init(uint16_t Present) { return true; }
+  static inline ES_Event_t Run(uint8_t ServiceNum, ES_Event_t ThisEvent)
+  {
+    ThisEvent.EventType = ES_ERROR;   // no such service
+    return ThisEvent;
+  }
+};
+
+template<uint8_t Num, typename Service, typename... Rest>
+struct ES_ServiceChain<Num, Service, Rest...>
+{
+  // bit n set if service n's hardware answered, or it has no probe. The
+  // services in Absent aren't asked again
+  static inline uint16_t Probe(uint16_t Absent)
+  {
+    return ((((Absent >> Num) & 1) == 0 && Service::Probe()) ? (uint16_t)(1U << Num) : 0)
+        | ES_ServiceChain<Num + 1, Rest...>::Probe(Absent);
+  }
+  // initializes the services in Present, in priority order
+  static inline bool Init(uint16_t Present)
+  {
+    return (((Present >> Num) & 1) == 0 || Service::Init(Num))
+        && ES_ServiceChain<Num + 1, Rest...>::Init(Present);
+  }
+  static inline ES_Event_t Run(uint8_t ServiceNum, ES_Event_t ThisEvent)
+  {
+    if(ServiceNum == Num)
+      return Service::Run(ThisEvent);
+    return ES_ServiceChain<Num + 1, Rest...>::Run(ServiceNum, ThisEvent);
+  }
+};
+
+// The services in priority order, service n is the nth type
+template<typename... Services>
+struct ES_ServiceList : ES_ServiceChain<0, Services...>
+{
+  static constexpr uint8_t Count = sizeof...(Services);
+  static ES_Queue_t Queues[sizeof...(Services)];
+  static const uint32_t RunBudgets[sizeof...(Services)];
+};
+
+template<typename... Services>
+ES_Queue_t ES_ServiceList<Services...>::Queues[sizeof...(Services)] =
+    {{0, 0, Services::QueueSize, Services::Queue}...};
+
+template<typename... Services>
+const uint32_t ES_ServiceList<Services...>::RunBudgets[sizeof...(Services)] =
+    {Services::RunBudget...};
+
+// How ES_Run shares its passes between the event checkers that have work
+// pending, set with ES_CHECKER_SCHEDULING in ES_Configure.h
+typedef enum
+{
+  ES_CHECKERS_ROUND_ROBIN = 0,  // a pass stops at the first checker that finds an
+                                // event, the next pass starts at the one after it
+  ES_CHECKERS_WEIGHTED          // every pending checker is called each pass, up to
+                                // its weight times in a row while it finds events
+}ES_CheckerScheduling_t;
+
+// One event checker: its function, the least time in ms between two calls to
+// it, its weight (see ES_CheckerScheduling_t) and the service it posts to,
+// which it is dropped along with when that service's probe fails
+template<ES_CheckerFunc_t *CheckFunc, uint16_t Interval, uint8_t Weight, uint8_t Serv>
+struct ES_Checker
+{
+  static_assert(CheckFunc != nullptr, "an event checker is missing");
+  static_assert(Weight > 0, "every event checker needs a weight of at least 1");
+  static_assert(Serv < NUM_SERVICES, "an event checker's service has to be one of the services");
+
+  static constexpr uint16_t MinInterval = Interval;
+  static constexpr uint8_t CheckWeight = Weight;
+  static constexpr uint8_t ServiceNum = Serv;
+
+  static inline bool Check(void) { return CheckFunc(); }
+};
+
+// Event checkers from number Num on, the recursion behind ES_CheckerList
+template<uint8_t Num, typename... Checkers>
+struct ES_CheckerChain
+{
+  static inline bool Check(uint8_t CheckerNum) { return false; }
+};
+
+template<uint8_t Num, typename Checker, typename... Rest>
+struct ES_CheckerChain<Num, Checker, Rest...>
+{
+  static inline bool Check(uint8_t CheckerNum)
+  {
+    if(CheckerNum == Num)
+      return Checker::Check();
+    return ES_CheckerChain<Num + 1, Rest...>::Check(CheckerNum);
+  }
+};
+
+// The event checkers, checker n is the nth type and bit n of PendingCheckers
+template<typename... Checkers>
+struct ES_CheckerList : ES_CheckerChain<0, Checkers...>
+{
+  static_assert(sizeof...(Checkers) <= 32, "at most 32 event checkers, one per bit of PendingCheckers");
+  static constexpr uint8_t Count = sizeof...(Checkers);
+  static constexpr uint16_t ServiceMask = ES_ServiceMask(Checkers::ServiceNum...);
+  static const uint16_t MinIntervals[sizeof...(Checkers)];
+  static const uint8_t Weights[sizeof...(Checkers)];
+  static const uint8_t ServiceNums[sizeof...(Checkers)];
+};
+
+template<typename... Checkers>
+const uint16_t ES_CheckerList<Checkers...>::MinIntervals[sizeof...(Checkers)] =
+    {Checkers::MinInterval...};
+
+template<typename... Checkers>
+const uint8_t ES_CheckerList<Checkers...>::Weights[sizeof...(Checkers)] =
+    {Checkers::CheckWeight...};
+
+template<typename... Checkers>
+const uint8_t ES_CheckerList<Checkers...>::ServiceNums[sizeof...(Checkers)] =
+    {Checkers::ServiceNum...};
+
+#endif /* ES_ServiceList_H */
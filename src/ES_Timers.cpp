@@ -3,17 +3,49 @@
      ES_Timers.c
 
  Description
-     This is a module implementing  8 16 bit timers all using the RTI
-     timebase. This module has been taken from Ed Carryer's Events & Services Framework
+     This is a module implementing a pool of 32 bit software timers all using
+     the RTI timebase. This module has been taken from Ed Carryer's Events &
+     Services Framework
 
  Notes
      Everything is done in terms of RTI Ticks, which can change from
      application to application.
+     The timers are tickless: each running timer keeps the absolute tick at
+     which it expires and the hardware alarm is only programmed for the
+     earliest of them, rather than decrementing every timer on every tick.
+
+     A periodic timer's next deadline is worked out from its last one rather
+     than from when the service got round to the timeout, so it doesn't
+     drift by the dispatch latency.
+
+     Running timers are kept in a hierarchical timing wheel (see footnote),
+     so starting, stopping and expiring a timer take the same time no matter
+     how many timers are running.
+
+     Every start or stop of a timer bumps its generation, which goes out in
+     the TimerGen of its timeouts. A timeout still waiting in a queue when the
+     timer is stopped or restarted is stale, and the framework drops it
+     (ES_Timer_IsStale) before it gets to the service.
+
+     A timer can be given some slack (ES_TIMER_SLACKS, ES_Timer_SetSlack),
+     ticks it may go off late by. It is filed in the wheel at its deadline
+     plus the slack, and whenever the alarm goes off every timer with slack
+     whose deadline has been reached expires with the ones that are due, so
+     timers that run out close together share one wakeup. The running timers
+     with slack are also kept on a list of their own in deadline order, so
+     only the ones that can go off early are looked at.
+
+     Timers come out of a pool of ES_TIMER_POOL_SIZE. The first 16 are the
+     numbered timers set up with the TIMERn_RESP_FUNC defines, the rest are
+     handed out by ES_Timer_Alloc. A timer's number and its handle are the
+     same thing and are what its ES_TIMEOUT event carries in EventParam.
+
+     Safe to use from the worker task (ES_WORKER_ENABLE) as well.
 
 ****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
 #include "ES_ServicesHeaders.h"
-#include "ES_Framework.h"
+#include "ES_framework.h"
 #include "ES_Event.h"
 #include "ES_PostList.h"
 #include "ES_Timers.h"
@@ -22,62 +54,97 @@
 /*--------------------------- External Variables --------------------------*/
 
 /*----------------------------- Module Defines ----------------------------*/
-#define BITS_PER_BYTE 8
-#define BITS_PER_NYBBLE 4
-#define ISOLATE_LS_NYBBLE 0X0F
+#define NUM_NUMBERED_TIMERS 16
 
-/*------------------------------ Module Types -----------------------------*/
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1U << WHEEL_SLOT_BITS)
+#define WHEEL_SPAN_BITS (WHEEL_LEVELS * WHEEL_SLOT_BITS)  // 2^24 ticks, ~4.6 hours
 
-/*
-   the size of Tflag sets the number of timers, uint8 = 8, uint16 = 16 ...)
-   to add more timers, you will need to change the data type and modify
-   the initialization of TMR_TimerArray and TMR_MaskArray
-*/
+// the lists a timer can be on: one per wheel slot, then the timers too far
+// out for the wheel and the timers that have expired but not been posted
+#define OVERFLOW_LIST (WHEEL_LEVELS * WHEEL_SLOTS)
+#define DUE_LIST (OVERFLOW_LIST + 1)
+#define NUM_LISTS (DUE_LIST + 1)
+#define NOT_LISTED 0xFFFF
+
+#if ES_TIMER_POOL_SIZE < NUM_NUMBERED_TIMERS || ES_TIMER_POOL_SIZE > 254
+#error ES_TIMER_POOL_SIZE must be between 16 and 254
+#endif
 
-typedef uint16_t Tflag_t; // create the number of timers as 16, each bit being 1 sw timer
+/*------------------------------ Module Types -----------------------------*/
+// With ES_WORKER_ENABLE the worker task starts and stops timers as well as
+// the loop task, so the public functions hold the port's lock while they
+// run. It is recursive, since they call each other and the timeouts are
+// posted with it held
+#ifdef ES_WORKER_ENABLE
+struct TimerLock_t
+{
+  TimerLock_t() { _HW_Lock(); }
+  ~TimerLock_t() { _HW_Unlock(); }
+};
+#define TIMER_LOCK() TimerLock_t timerLock
+#else
+#define TIMER_LOCK()
+#endif
 
 typedef uint32_t Timer_t; // sets size of timers to 32 bits
 
-/*---------------------------- Module Functions ---------------------------*/
-uint8_t ES_GetMSBitSet(uint16_t Val2Check);
+typedef struct
+{
+  Timer_t Deadline;     // absolute tick the timer expires at
+  Timer_t Expiry;       // latest tick it may expire at, Deadline plus slack
+  Timer_t Time;         // ticks from start to expiry
+  Timer_t Period;       // ticks between expiries, 0 for a one shot timer
+  uint16_t Overruns;    // periods a periodic timer has missed
+  uint16_t Slack;       // ticks it may expire late by to share a wakeup
+  pPostFunc PostFunc;   // TIMER_UNUSED while the timer is free
+  uint16_t List;        // list the timer is on, NOT_LISTED while stopped
+  uint8_t Gen;          // bumped on every start and stop
+  bool SlackListed;     // on the slack list
+  ES_TimerHandle_t Next;
+  ES_TimerHandle_t Prev;
+  ES_TimerHandle_t SlackNext;
+  ES_TimerHandle_t SlackPrev;
+}ES_TimerEntry_t;
 
+/*---------------------------- Module Functions ---------------------------*/
+static void ES_Timer_ProgramAlarm(void);
+static void ListAdd(ES_TimerHandle_t Timer, uint16_t List);
+static void ListRemove(ES_TimerHandle_t Timer);
+static void WheelInsert(ES_TimerHandle_t Timer);
+static uint8_t WheelNextSlot(uint8_t Level, bool *NextTurn);
+static bool WheelNextTick(Timer_t *Tick);
+static void WheelAdvance(Timer_t Now);
+static void WheelCascade(uint16_t List);
+static bool IsValidTimer(ES_TimerHandle_t Timer);
+static void ES_Timer_NextPeriod(ES_TimerHandle_t Timer, Timer_t CurrTime);
+static void SetExpiry(ES_TimerHandle_t Timer);
+static void SlackAdd(ES_TimerHandle_t Timer);
+static void SlackRemove(ES_TimerHandle_t Timer);
+static void ExpireEarly(Timer_t Now);
 
 /*---------------------------- Module Variables ---------------------------*/
+static ES_TimerEntry_t TimerPool[ES_TIMER_POOL_SIZE];
 
-/*
-  this table is used to go from an unsigned 4bit value to the most significant
-  bit that is set in that nybble. It is used in the determination of priorities
-  from the Ready variable and in determining active timers in
-  the timer interrupt response. Index into the array with (ByteVal-1) to get
-  the correct MS Bit num.
-*/
-uint8_t const Nybble2MSBitNum[15] = {
-  0U, 1U, 1U, 2U, 2U, 2U, 2U, 3U, 3U, 3U, 3U, 3U, 3U, 3U, 3U
-};
+// first timer on each list, ES_TIMER_INVALID if the list is empty
+static ES_TimerHandle_t ListHeads[NUM_LISTS];
 
-static Timer_t TMR_TimerArray[sizeof(Tflag_t) * BITS_PER_BYTE] =
-{
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0,
-  0x0
-};
+// bit n set when slot n of a wheel level has timers on it
+static uint64_t SlotsInUse[WHEEL_LEVELS];
 
-static Tflag_t TMR_ActiveFlags;
+// tick the wheel has been turned up to, every timer due by then is posted
+static Timer_t WheelTime;
 
-static pPostFunc const Timer2PostFunc[sizeof(Tflag_t) * BITS_PER_BYTE] = 
+// timers in the wheel that may expire before their expiry, earliest deadline
+// first, linked through SlackNext
+static ES_TimerHandle_t SlackHead;
+
+static ES_TimerHandle_t FreeTimers;  // free timers, linked through Next
+static uint8_t NumRunning;
+static uint32_t NumAlarms;           // alarms that posted a timeout
+
+static constexpr pPostFunc Timer2PostFunc[NUM_NUMBERED_TIMERS] =
 {
   TIMER0_RESP_FUNC,
   TIMER1_RESP_FUNC,
@@ -97,6 +164,15 @@ static pPostFunc const Timer2PostFunc[sizeof(Tflag_t) * BITS_PER_BYTE] =
   TIMER15_RESP_FUNC
 };
 
+// Each ES_TIMER_SLACKS entry becomes a compare in a single expression,
+// numbered timers without an entry get no slack
+#define ES_TIMER_SLACK(Num, Slack) (Timer == (Num)) ? (uint16_t)(Slack) :
+static constexpr uint16_t SlackOf(ES_TimerHandle_t Timer)
+{
+  return ES_TIMER_SLACKS 0;
+}
+#undef ES_TIMER_SLACK
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -108,7 +184,8 @@ static pPostFunc const Timer2PostFunc[sizeof(Tflag_t) * BITS_PER_BYTE] =
      None.
  Description
      Initializes the timer module by setting up the tick at the requested
-    rate
+    rate, reserving the numbered timers that have a post function and
+    putting the rest of the pool on the free list
  Notes
      None.
  Author
@@ -118,6 +195,109 @@ void ES_Timer_Init(TimerRate_t Rate)
 {
   // call the hardware init routine
   _HW_Timer_Init(Rate);
+
+  for (uint16_t i = 0; i < NUM_LISTS; i++)
+  {
+    ListHeads[i] = ES_TIMER_INVALID;
+  }
+  for (uint8_t i = 0; i < WHEEL_LEVELS; i++)
+  {
+    SlotsInUse[i] = 0;
+  }
+  SlackHead = ES_TIMER_INVALID;
+
+  // build the free list back to front so ES_Timer_Alloc hands out the
+  // lowest free timer first
+  FreeTimers = ES_TIMER_INVALID;
+  for (int16_t i = ES_TIMER_POOL_SIZE - 1; i >= 0; i--)
+  {
+    TimerPool[i].Time = 0;
+    TimerPool[i].Period = 0;
+    TimerPool[i].Overruns = 0;
+    TimerPool[i].Slack = (i < NUM_NUMBERED_TIMERS) ? SlackOf(i) : 0;
+    TimerPool[i].Gen = 0;
+    TimerPool[i].List = NOT_LISTED;
+    TimerPool[i].SlackListed = false;
+    TimerPool[i].Prev = ES_TIMER_INVALID;
+    TimerPool[i].PostFunc = (i < NUM_NUMBERED_TIMERS) ? Timer2PostFunc[i] : TIMER_UNUSED;
+    if (TimerPool[i].PostFunc == TIMER_UNUSED)
+    {
+      TimerPool[i].Next = FreeTimers;
+      FreeTimers = i;
+    }
+    else
+    {
+      TimerPool[i].Next = ES_TIMER_INVALID;
+    }
+  }
+
+  NumRunning = 0;
+  NumAlarms = 0;
+  WheelTime = ES_Timer_GetTime();
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_Alloc
+ Parameters
+     pPostFunc PostFunc, post function of the service the timer belongs to
+ Returns
+     ES_TimerHandle_t, handle of the new timer or ES_TIMER_INVALID if the
+     pool is used up
+ Description
+     Takes a timer from the pool for a service that needs more timeouts than
+     it has numbered timers. The handle is used like a timer number with
+     ES_Timer_InitTimer and friends and comes back in the EventParam of the
+     timer's ES_TIMEOUT events.
+ Notes
+     Usually called from the service's init function. The timer stays the
+     service's until ES_Timer_Free is called.
+****************************************************************************/
+ES_TimerHandle_t ES_Timer_Alloc(pPostFunc PostFunc)
+{
+  TIMER_LOCK();
+  ES_TimerHandle_t Timer = FreeTimers;
+  if ((PostFunc == TIMER_UNUSED) || (Timer == ES_TIMER_INVALID))
+  {
+    return ES_TIMER_INVALID;
+  }
+  FreeTimers = TimerPool[Timer].Next;
+
+  TimerPool[Timer].PostFunc = PostFunc;
+  TimerPool[Timer].Time = 0;
+  TimerPool[Timer].Period = 0;
+  TimerPool[Timer].Overruns = 0;
+  TimerPool[Timer].List = NOT_LISTED;
+  TimerPool[Timer].Next = ES_TIMER_INVALID;
+  TimerPool[Timer].Prev = ES_TIMER_INVALID;
+  return Timer;
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_Free
+ Parameters
+     ES_TimerHandle_t Timer, a timer from ES_Timer_Alloc
+ Returns
+     ES_Timer_ERR if the timer isn't allocated, ES_Timer_OK otherwise
+ Description
+     Stops the timer and gives it back to the pool.
+ Notes
+     A timeout it has already posted is dropped.
+****************************************************************************/
+ES_TimerReturn_t ES_Timer_Free(ES_TimerHandle_t Timer)
+{
+  TIMER_LOCK();
+  if (!IsValidTimer(Timer))
+  {
+    return ES_Timer_ERR;
+  }
+  ES_Timer_StopTimer(Timer);
+  ES_Timer_SetSlack(Timer, 0);
+  TimerPool[Timer].PostFunc = TIMER_UNUSED;
+  TimerPool[Timer].Next = FreeTimers;
+  FreeTimers = Timer;
+  return ES_Timer_OK;
 }
 
 /****************************************************************************
@@ -130,23 +310,24 @@ void ES_Timer_Init(TimerRate_t Rate)
      ES_Timer_ERR if requested timer does not exist or has no service
      ES_Timer_OK  otherwise
  Description
-     sets the time for a timer, but does not make it active.
+     sets the time for a timer, but does not make it active. The timer
+     becomes a one shot timer.
  Notes
      None.
  Author
      J. Edward Carryer, 02/24/97 17:11
 ****************************************************************************/
-ES_TimerReturn_t ES_Timer_SetTimer(uint8_t Num, uint32_t NewTime)
+ES_TimerReturn_t ES_Timer_SetTimer(ES_TimerHandle_t Num, uint32_t NewTime)
 {
-  /* tried to set a timer that doesn't exist */
-  if ((Num >= ARRAY_SIZE(TMR_TimerArray)) ||
-      /* tried to set a timer without a service */
-      (Timer2PostFunc[Num] == TIMER_UNUSED) ||
+  TIMER_LOCK();
+  /* tried to set a timer that doesn't exist or has no service */
+  if (!IsValidTimer(Num) ||
       (NewTime == 0))   /* no time being set */
   {
     return ES_Timer_ERR;
   }
-  TMR_TimerArray[Num] = NewTime;
+  TimerPool[Num].Time = NewTime;
+  TimerPool[Num].Period = 0;
   return ES_Timer_OK;
 }
 
@@ -158,23 +339,43 @@ ES_TimerReturn_t ES_Timer_SetTimer(uint8_t Num, uint32_t NewTime)
  Returns
      ES_Timer_ERR for error ES_Timer_OK for success
  Description
-     simply sets the active flag in TMR_ActiveFlags to (re)start a
-     stopped timer.
+     (re)starts a timer with the time set on it: works out its deadline and
+     puts it in the timer wheel.
  Notes
      None.
  Author
      J. Edward Carryer, 02/24/97 14:45
 ****************************************************************************/
-ES_TimerReturn_t ES_Timer_StartTimer(uint8_t Num)
+ES_TimerReturn_t ES_Timer_StartTimer(ES_TimerHandle_t Num)
 {
+  TIMER_LOCK();
   /* tried to set a timer that doesn't exist */
-  if ((Num >= ARRAY_SIZE(TMR_TimerArray)) ||
+  if (!IsValidTimer(Num) ||
       /* tried to set a timer with no time on it */
-      (TMR_TimerArray[Num] == 0))
+      (TimerPool[Num].Time == 0))
   {
     return ES_Timer_ERR;
   }
-  bitSet(TMR_ActiveFlags, Num);  // set timer as active
+  if (TimerPool[Num].List != NOT_LISTED)
+  {
+    ListRemove(Num);
+  }
+  else
+  {
+    // an idle wheel hasn't been turned, catch it up so new timers go in
+    // the lowest level they can
+    if (NumRunning == 0)
+    {
+      WheelTime = ES_Timer_GetTime();
+    }
+    NumRunning++;
+  }
+  TimerPool[Num].Gen++;
+  TimerPool[Num].Deadline = ES_Timer_GetTime() + TimerPool[Num].Time;
+  SetExpiry(Num);
+  WheelInsert(Num);
+  ES_Timer_ProgramAlarm();
+  ES_Trace_TimerStart(Num, TimerPool[Num].Time);
 
   return ES_Timer_OK;
 }
@@ -187,20 +388,30 @@ ES_TimerReturn_t ES_Timer_StartTimer(uint8_t Num)
  Returns
      ES_Timer_ERR for error (timer doesn't exist) ES_Timer_OK for success.
  Description
-     simply clears the bit in TMR_ActiveFlags associated with this
-     timer. This will cause it to stop counting.
+     simply takes the timer out of the timer wheel. This will cause it to
+     stop counting. The alarm is moved to the next timer so it doesn't wake
+     us up for nothing. A timeout the timer already posted won't be
+     delivered either, even if the timer had stopped.
  Notes
      None.
  Author
      J. Edward Carryer, 02/24/97 14:48
 ****************************************************************************/
-ES_TimerReturn_t ES_Timer_StopTimer(uint8_t Num)
+ES_TimerReturn_t ES_Timer_StopTimer(ES_TimerHandle_t Num)
 {
-  if (Num >= ARRAY_SIZE(TMR_TimerArray))
+  TIMER_LOCK();
+  if (Num >= ES_TIMER_POOL_SIZE)
   {
     return ES_Timer_ERR;    /* tried to set a timer that doesn't exist */
   }
-  bitClear(TMR_ActiveFlags, Num);  // set timer as inactive
+  TimerPool[Num].Gen++;
+  if (TimerPool[Num].List != NOT_LISTED)
+  {
+    ListRemove(Num);
+    NumRunning--;
+    ES_Timer_ProgramAlarm();
+  }
+  ES_Trace_TimerStop(Num);
   return ES_Timer_OK;
 }
 
@@ -220,22 +431,165 @@ ES_TimerReturn_t ES_Timer_StopTimer(uint8_t Num)
  Author
      J. Edward Carryer, 02/24/97 14:51
 ****************************************************************************/
-ES_TimerReturn_t ES_Timer_InitTimer(uint8_t Num, uint32_t NewTime)
+ES_TimerReturn_t ES_Timer_InitTimer(ES_TimerHandle_t Num, uint32_t NewTime)
 {
-  /* tried to set a timer that doesn't exist */
-  if ((Num >= ARRAY_SIZE(TMR_TimerArray)) ||
-      /* tried to set a timer without a service */
-      (Timer2PostFunc[Num] == TIMER_UNUSED) ||
-      /* tried to set a timer without putting any time on it */
-      (NewTime == 0))
+  TIMER_LOCK();
+  if (ES_Timer_SetTimer(Num, NewTime) != ES_Timer_OK)
   {
     return ES_Timer_ERR;
   }
-  TMR_TimerArray[Num] = NewTime;
-  bitSet(TMR_ActiveFlags, Num);  // set timer as active
+  return ES_Timer_StartTimer(Num);
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_InitPeriodic
+ Parameters
+     ES_TimerHandle_t Num, the timer to start
+     uint32_t Period, the number of ticks between timeouts
+ Returns
+     ES_Timer_ERR if the requested timer does not exist, ES_Timer_OK otherwise.
+ Description
+     Starts a timer that posts an ES_TIMEOUT every Period ticks until it is
+     stopped, so the service doesn't restart it on every timeout. Each
+     deadline is the last one plus Period, however late the timeout was
+     handled.
+ Notes
+     If the loop falls more than a whole period behind, the missed timeouts
+     are not posted. They are counted instead, see ES_Timer_GetOverruns.
+     ES_Timer_InitTimer or ES_Timer_SetTimer make it a one shot timer again.
+****************************************************************************/
+ES_TimerReturn_t ES_Timer_InitPeriodic(ES_TimerHandle_t Num, uint32_t Period)
+{
+  TIMER_LOCK();
+  if (ES_Timer_SetTimer(Num, Period) != ES_Timer_OK)
+  {
+    return ES_Timer_ERR;
+  }
+  TimerPool[Num].Period = Period;
+  TimerPool[Num].Overruns = 0;
+  return ES_Timer_StartTimer(Num);
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_GetOverruns
+ Parameters
+     ES_TimerHandle_t Num, a periodic timer
+ Returns
+     uint16_t, number of timeouts the timer has skipped since it was started
+     with ES_Timer_InitPeriodic
+ Description
+     Shows whether a periodic service is keeping up with its period
+ Notes
+     Stops counting at 0xFFFF
+****************************************************************************/
+uint16_t ES_Timer_GetOverruns(ES_TimerHandle_t Num)
+{
+  TIMER_LOCK();
+  if (Num >= ES_TIMER_POOL_SIZE)
+  {
+    return 0;
+  }
+  return TimerPool[Num].Overruns;
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_IsRunning
+ Parameters
+     ES_TimerHandle_t Num, the timer to check
+ Returns
+     ES_Timer_ACTIVE if the timer is counting, ES_Timer_NOT_ACTIVE if not
+     and ES_Timer_ERR if it doesn't exist
+ Description
+     Lets a service check whether a timeout is still on its way
+ Notes
+     None.
+****************************************************************************/
+ES_TimerReturn_t ES_Timer_IsRunning(ES_TimerHandle_t Num)
+{
+  TIMER_LOCK();
+  if (Num >= ES_TIMER_POOL_SIZE)
+  {
+    return ES_Timer_ERR;
+  }
+  return (TimerPool[Num].List != NOT_LISTED) ? ES_Timer_ACTIVE : ES_Timer_NOT_ACTIVE;
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_SetSlack
+ Parameters
+     ES_TimerHandle_t Num, the timer
+     uint16_t Slack, ticks its timeouts may be late by, 0 for none
+ Returns
+     ES_Timer_ERR if the timer isn't in use, ES_Timer_OK otherwise
+ Description
+     Lets the timer go off up to Slack ticks late, so its timeout can be
+     posted along with another timer's instead of waking the device on its
+     own. The numbered timers start with their ES_TIMER_SLACKS entry, timers
+     from ES_Timer_Alloc with none.
+ Notes
+     Takes effect the next time the timer is started or its period comes
+     round. The slack used is never more than a quarter of the timer's time,
+     and a periodic timer's later deadlines still count from its earlier
+     ones, not from when they went off.
+****************************************************************************/
+ES_TimerReturn_t ES_Timer_SetSlack(ES_TimerHandle_t Num, uint16_t Slack)
+{
+  TIMER_LOCK();
+  if (!IsValidTimer(Num))
+  {
+    return ES_Timer_ERR;
+  }
+  TimerPool[Num].Slack = Slack;
   return ES_Timer_OK;
 }
 
+/****************************************************************************
+ Function
+     ES_Timer_GetNumAlarms
+ Parameters
+     None.
+ Returns
+     uint32_t, number of times the alarm has gone off and posted at least
+     one timeout since ES_Timer_Init
+ Description
+     Counts the wakeups the timers cost, so the effect of their slack can be
+     seen
+ Notes
+     None.
+****************************************************************************/
+uint32_t ES_Timer_GetNumAlarms(void)
+{
+  return __atomic_load_n(&NumAlarms, __ATOMIC_RELAXED);
+}
+
+/****************************************************************************
+ Function
+     ES_Timer_IsStale
+ Parameters
+     ES_Event_t ThisEvent, an event about to be handed to a service
+ Returns
+     bool, true if it is a timeout from a timer that has been stopped or
+     restarted since it was posted
+ Description
+     Used by the framework to drop timeouts that were already in a queue
+     when the service changed its mind, so they don't cause a spurious
+     retry.
+ Notes
+     None.
+****************************************************************************/
+bool ES_Timer_IsStale(ES_Event_t ThisEvent)
+{
+  // called for every event, so it doesn't take the lock. A timer being
+  // restarted by the other task at the same time is a race either way
+  return (ThisEvent.EventType == ES_TIMEOUT) &&
+      (ThisEvent.EventParam < ES_TIMER_POOL_SIZE) &&
+      (ThisEvent.TimerGen != __atomic_load_n(&TimerPool[ThisEvent.EventParam].Gen, __ATOMIC_RELAXED));
+}
+
 /****************************************************************************
  Function
      ES_Timer_GetTime
@@ -248,7 +602,8 @@ ES_TimerReturn_t ES_Timer_InitTimer(uint8_t Num, uint32_t NewTime)
       the library timers. Can be used to determine how long between 2 events.
  Notes
      this functionality is ancient, though this implementation in the library
-     is new.
+     is new. Comes from the free running hardware counter, so it is correct
+     even though there is no periodic tick.
  Author
      J. Edward Carryer, 06/01/04 08:04
 ****************************************************************************/
@@ -257,6 +612,62 @@ uint32_t ES_Timer_GetTime(void)
   return _HW_GetTickCount();
 }
 
+/****************************************************************************
+ Function
+     ES_Timer_GetNextDeadline
+ Parameters
+     uint32_t *Deadline, set to the tick by which the next timer must expire
+ Returns
+     bool, false if no timers are running
+ Description
+     Finds the earliest deadline plus slack of all active timers. Lets the
+     framework know how long it can idle for.
+ Notes
+     Every timer on a lower wheel level expires before any timer on a
+     higher one, so only the first used slot of the lowest used level is
+     looked through.
+****************************************************************************/
+bool ES_Timer_GetNextDeadline(uint32_t *Deadline)
+{
+  TIMER_LOCK();
+  uint16_t List = NOT_LISTED;
+
+  if (ListHeads[DUE_LIST] != ES_TIMER_INVALID)
+  {
+    *Deadline = WheelTime;
+    return true;
+  }
+
+  for (uint8_t Level = 0; Level < WHEEL_LEVELS; Level++)
+  {
+    if (SlotsInUse[Level] != 0)
+    {
+      bool NextTurn;
+      List = Level * WHEEL_SLOTS + WheelNextSlot(Level, &NextTurn);
+      break;
+    }
+  }
+  if (List == NOT_LISTED)
+  {
+    if (ListHeads[OVERFLOW_LIST] == ES_TIMER_INVALID)
+    {
+      return false;
+    }
+    List = OVERFLOW_LIST;
+  }
+
+  ES_TimerHandle_t Timer = ListHeads[List];
+  *Deadline = TimerPool[Timer].Expiry;
+  for (Timer = TimerPool[Timer].Next; Timer != ES_TIMER_INVALID; Timer = TimerPool[Timer].Next)
+  {
+    if ((TimerPool[Timer].Expiry - WheelTime) < (*Deadline - WheelTime))
+    {
+      *Deadline = TimerPool[Timer].Expiry;
+    }
+  }
+  return true;
+}
+
 /****************************************************************************
  Function
      ES_Timer_Tick_Resp
@@ -266,75 +677,352 @@ uint32_t ES_Timer_GetTime(void)
      None.
  Description
      This is the new Tick response routine to support the timer module.
-     It will increment time, to maintain the functionality of the
-     GetTime() timer and it will check through the active timers,
-     decrementing each active timers count, if the count goes to 0, it
-     will post an event to the corresponding SM and clear the active flag to
-     prevent further counting.
+     It is called when the hardware alarm goes off and turns the timer wheel
+     up to the current time. Each timer whose deadline plus slack has been
+     reached, and each timer with slack whose deadline has been reached,
+     posts an event to the corresponding SM. One shot timers are stopped and
+     periodic ones are put back in the wheel for their next deadline. The
+     alarm is then programmed for the next deadline.
  Notes
-     Called from _Timer_Int_Resp in ES_Port.c.
+     Called from _HW_Process_Pending_Ints in ES_Port.c.
  Author
      J. Edward Carryer, 02/24/97 15:06
 ****************************************************************************/
 void ES_Timer_Tick_Resp(void)
 {
-  static Tflag_t  NeedsProcessing;
-  static uint8_t  NextTimer2Process;
-  static ES_Event_t NewEvent;
+  TIMER_LOCK();
+  ES_Event_t NewEvent = {.EventType=ES_TIMEOUT};
+  Timer_t CurrTime = ES_Timer_GetTime();
+
+  WheelAdvance(CurrTime);
+  ExpireEarly(CurrTime);
+  if (ListHeads[DUE_LIST] != ES_TIMER_INVALID)
+  {
+    __atomic_store_n(&NumAlarms, NumAlarms + 1, __ATOMIC_RELAXED);
+  }
 
-  if (TMR_ActiveFlags != 0) /* if !=0 , then at least 1 timer is active */
+  while (ListHeads[DUE_LIST] != ES_TIMER_INVALID)
   {
-    // start by getting a list of all the active timers
-    NeedsProcessing = TMR_ActiveFlags;
-    do
+    ES_TimerHandle_t Timer = ListHeads[DUE_LIST];
+    /* stop counting first so the service can restart it */
+    ListRemove(Timer);
+    if (TimerPool[Timer].Period != 0)
     {
-      // find the MSB that is set
-      NextTimer2Process = ES_GetMSBitSet(NeedsProcessing);
-      /* decrement that timer, check if timed out */
-      if (--TMR_TimerArray[NextTimer2Process] == 0)
-      {
-        NewEvent.EventType  = ES_TIMEOUT;
-        NewEvent.EventParam = NextTimer2Process;
-        /* post the timeout event to the right Service */
-        Timer2PostFunc[NextTimer2Process](NewEvent);
-        /* and stop counting */
-        bitClear(TMR_ActiveFlags, NextTimer2Process);
-      }
-      // mark off the active timer that we just processed
-      bitClear(NeedsProcessing, NextTimer2Process); 
-    } while (NeedsProcessing != 0);
+      ES_Timer_NextPeriod(Timer, CurrTime);
+    }
+    else
+    {
+      NumRunning--;
+    }
+    NewEvent.EventParam = Timer;
+    NewEvent.TimerGen = TimerPool[Timer].Gen;
+    /* post the timeout event to the right Service */
+    TimerPool[Timer].PostFunc(NewEvent);
   }
+  ES_Timer_ProgramAlarm();
 }
 
 
 /***************************************************************************
  private functions
  ***************************************************************************/
-uint8_t ES_GetMSBitSet(uint16_t Val2Check)
+// points the hardware alarm at the earliest deadline, or turns it off
+static void ES_Timer_ProgramAlarm(void)
+{
+  uint32_t NextDeadline;
+  if (ES_Timer_GetNextDeadline(&NextDeadline))
+  {
+    _HW_Timer_SetAlarm(NextDeadline);
+  }
+  else
+  {
+    _HW_Timer_ClearAlarm();
+  }
+}
+
+// moves a periodic timer's deadline on by whole periods until it is in the
+// future, counting any periods that were missed, and puts it back in the wheel
+static void ES_Timer_NextPeriod(ES_TimerHandle_t Timer, Timer_t CurrTime)
+{
+  ES_TimerEntry_t *ThisTimer = &TimerPool[Timer];
+  Timer_t Late = CurrTime - ThisTimer->Deadline;
+  Timer_t Missed = Late / ThisTimer->Period;
+
+  if (Missed != 0)
+  {
+    Timer_t Overruns = ThisTimer->Overruns + Missed;
+    ThisTimer->Overruns = (Overruns > UINT16_MAX) ? UINT16_MAX : Overruns;
+  }
+  ThisTimer->Deadline += (Missed + 1) * ThisTimer->Period;
+  SetExpiry(Timer);
+  WheelInsert(Timer);
+}
+
+// sets the tick the timer is filed at, its deadline plus its slack, but no
+// more than a quarter of its time late
+static void SetExpiry(ES_TimerHandle_t Timer)
+{
+  ES_TimerEntry_t *ThisTimer = &TimerPool[Timer];
+  Timer_t Slack = ThisTimer->Time / 4;
+
+  if (ThisTimer->Slack < Slack)
+  {
+    Slack = ThisTimer->Slack;
+  }
+  ThisTimer->Expiry = ThisTimer->Deadline + Slack;
+}
+
+// puts a timer filed in the wheel with slack on the slack list, behind the
+// ones whose deadline is no later. Walks the list, which only holds the
+// running timers with slack
+static void SlackAdd(ES_TimerHandle_t Timer)
+{
+  Timer_t Deadline = TimerPool[Timer].Deadline - WheelTime;
+  ES_TimerHandle_t Prev = ES_TIMER_INVALID;
+  ES_TimerHandle_t Next = SlackHead;
+
+  while ((Next != ES_TIMER_INVALID) && ((TimerPool[Next].Deadline - WheelTime) <= Deadline))
+  {
+    Prev = Next;
+    Next = TimerPool[Next].SlackNext;
+  }
+  TimerPool[Timer].SlackListed = true;
+  TimerPool[Timer].SlackPrev = Prev;
+  TimerPool[Timer].SlackNext = Next;
+  if (Prev != ES_TIMER_INVALID)
+  {
+    TimerPool[Prev].SlackNext = Timer;
+  }
+  else
+  {
+    SlackHead = Timer;
+  }
+  if (Next != ES_TIMER_INVALID)
+  {
+    TimerPool[Next].SlackPrev = Timer;
+  }
+}
+
+static void SlackRemove(ES_TimerHandle_t Timer)
+{
+  ES_TimerHandle_t Next = TimerPool[Timer].SlackNext;
+  ES_TimerHandle_t Prev = TimerPool[Timer].SlackPrev;
+
+  if (Prev != ES_TIMER_INVALID)
+  {
+    TimerPool[Prev].SlackNext = Next;
+  }
+  else
+  {
+    SlackHead = Next;
+  }
+  if (Next != ES_TIMER_INVALID)
+  {
+    TimerPool[Next].SlackPrev = Prev;
+  }
+  TimerPool[Timer].SlackListed = false;
+}
+
+// moves every running timer with slack whose deadline has been reached onto
+// the due list, so it goes off with the timers that woke us up. The slack
+// list is in deadline order, so this stops at the first one still to come
+static void ExpireEarly(Timer_t Now)
+{
+  while ((SlackHead != ES_TIMER_INVALID) && ((int32_t)(TimerPool[SlackHead].Deadline - Now) <= 0))
+  {
+    ES_TimerHandle_t Timer = SlackHead;
+    ListRemove(Timer);
+    ListAdd(Timer, DUE_LIST);
+  }
+}
+
+static bool IsValidTimer(ES_TimerHandle_t Timer)
+{
+  return (Timer < ES_TIMER_POOL_SIZE) && (TimerPool[Timer].PostFunc != TIMER_UNUSED);
+}
+
+// A timer with slack is on the slack list while it is filed in the wheel or
+// the overflow list, and comes off it when it is due or taken out
+static void ListAdd(ES_TimerHandle_t Timer, uint16_t List)
 {
-  int8_t  LoopCntr;
-  uint8_t Nybble2Test;
-  uint8_t ReturnVal = 128; // this is the error return value
+  ES_TimerHandle_t Head = ListHeads[List];
+  TimerPool[Timer].List = List;
+  TimerPool[Timer].Prev = ES_TIMER_INVALID;
+  TimerPool[Timer].Next = Head;
+  if (Head != ES_TIMER_INVALID)
+  {
+    TimerPool[Head].Prev = Timer;
+  }
+  ListHeads[List] = Timer;
 
-  // loop through the parameter, nybble by nybble
-  for (LoopCntr = sizeof(Val2Check) * (BITS_PER_BYTE / BITS_PER_NYBBLE) - 1;
-      LoopCntr >= 0; LoopCntr--)
+  if (List < OVERFLOW_LIST)
   {
-    // move a nybble into the 4 LSB positions for lookup
-    Nybble2Test = (uint8_t)
-        ((Val2Check >> (uint8_t)(LoopCntr * BITS_PER_NYBBLE)) &
-        ISOLATE_LS_NYBBLE);
-    if (Nybble2Test != 0)
+    SlotsInUse[List / WHEEL_SLOTS] |= 1ULL << (List % WHEEL_SLOTS);
+  }
+  if (List == DUE_LIST)
+  {
+    if (TimerPool[Timer].SlackListed)
     {
-      // lookup the bit num & adjust for the number of shifts to get there
-      ReturnVal = Nybble2MSBitNum[Nybble2Test - 1] +
-          (LoopCntr * BITS_PER_NYBBLE);
-      break;
+      SlackRemove(Timer);
+    }
+  }
+  else if (!TimerPool[Timer].SlackListed && (TimerPool[Timer].Expiry != TimerPool[Timer].Deadline))
+  {
+    SlackAdd(Timer);
+  }
+}
+
+static void ListRemove(ES_TimerHandle_t Timer)
+{
+  uint16_t List = TimerPool[Timer].List;
+  ES_TimerHandle_t Next = TimerPool[Timer].Next;
+  ES_TimerHandle_t Prev = TimerPool[Timer].Prev;
+
+  if (Prev != ES_TIMER_INVALID)
+  {
+    TimerPool[Prev].Next = Next;
+  }
+  else
+  {
+    ListHeads[List] = Next;
+  }
+  if (Next != ES_TIMER_INVALID)
+  {
+    TimerPool[Next].Prev = Prev;
+  }
+  TimerPool[Timer].List = NOT_LISTED;
+  TimerPool[Timer].Next = ES_TIMER_INVALID;
+  TimerPool[Timer].Prev = ES_TIMER_INVALID;
+  if (TimerPool[Timer].SlackListed)
+  {
+    SlackRemove(Timer);
+  }
+
+  if ((List < OVERFLOW_LIST) && (ListHeads[List] == ES_TIMER_INVALID))
+  {
+    SlotsInUse[List / WHEEL_SLOTS] &= ~(1ULL << (List % WHEEL_SLOTS));
+  }
+}
+
+// A timer goes in the lowest level whose higher digits it shares with the
+// wheel time, in the slot given by its own digit at that level
+static void WheelInsert(ES_TimerHandle_t Timer)
+{
+  Timer_t Deadline = TimerPool[Timer].Expiry;
+
+  if ((int32_t)(Deadline - WheelTime) <= 0)
+  {
+    ListAdd(Timer, DUE_LIST);
+    return;
+  }
+  for (uint8_t Level = 0; Level < WHEEL_LEVELS; Level++)
+  {
+    uint8_t UpperShift = (Level + 1) * WHEEL_SLOT_BITS;
+    if ((Deadline >> UpperShift) == (WheelTime >> UpperShift))
+    {
+      uint8_t Slot = (Deadline >> (Level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1);
+      ListAdd(Timer, Level * WHEEL_SLOTS + Slot);
+      return;
+    }
+  }
+  ListAdd(Timer, OVERFLOW_LIST);
+}
+
+// The first used slot after the wheel's current slot on a level, which
+// must have one in use. Used slots are kept ahead of the current one, but if
+// none are (e.g. the current slot is 63) the search goes round to the level's
+// next turn rather than handing ctz a 0
+static uint8_t WheelNextSlot(uint8_t Level, bool *NextTurn)
+{
+  uint8_t CurrSlot = (WheelTime >> (Level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1);
+  uint64_t Ahead = SlotsInUse[Level] & ~((2ULL << CurrSlot) - 1);  // 0 for slot 63
+  *NextTurn = (Ahead == 0);
+  return __builtin_ctzll(*NextTurn ? SlotsInUse[Level] : Ahead);
+}
+
+// Finds the next tick at which the wheel has something to do: the expiry
+// of a level 0 slot or the cascade of a higher level slot
+static bool WheelNextTick(Timer_t *Tick)
+{
+  for (uint8_t Level = 0; Level < WHEEL_LEVELS; Level++)
+  {
+    if (SlotsInUse[Level] != 0)
+    {
+      uint8_t Shift = Level * WHEEL_SLOT_BITS;
+      uint8_t UpperShift = Shift + WHEEL_SLOT_BITS;
+      bool NextTurn;
+      Timer_t Slot = WheelNextSlot(Level, &NextTurn);
+      *Tick = (((WheelTime >> UpperShift) + NextTurn) << UpperShift) | (Slot << Shift);
+      return true;
+    }
+  }
+  if (ListHeads[OVERFLOW_LIST] != ES_TIMER_INVALID)
+  {
+    *Tick = ((WheelTime >> WHEEL_SPAN_BITS) + 1) << WHEEL_SPAN_BITS;
+    return true;
+  }
+  return false;
+}
+
+// Turns the wheel up to Now, only stopping at ticks where a slot has timers,
+// and moves every timer that is due onto the due list
+static void WheelAdvance(Timer_t Now)
+{
+  Timer_t Tick;
+
+  while (WheelNextTick(&Tick) && ((int32_t)(Tick - Now) <= 0))
+  {
+    WheelTime = Tick;
+    if ((Tick & ((1UL << WHEEL_SPAN_BITS) - 1)) == 0)
+    {
+      WheelCascade(OVERFLOW_LIST);
+    }
+    for (uint8_t Level = WHEEL_LEVELS - 1; Level > 0; Level--)
+    {
+      uint8_t Shift = Level * WHEEL_SLOT_BITS;
+      if ((Tick & ((1UL << Shift) - 1)) == 0)
+      {
+        WheelCascade(Level * WHEEL_SLOTS + ((Tick >> Shift) & (WHEEL_SLOTS - 1)));
+      }
     }
+    WheelCascade(Tick & (WHEEL_SLOTS - 1));
+  }
+  if ((int32_t)(Now - WheelTime) > 0)
+  {
+    WheelTime = Now;
+  }
+}
+
+// re-files every timer on a list against the current wheel time. The list
+// is taken off first, overflow timers that are still too far out go back on
+static void WheelCascade(uint16_t List)
+{
+  ES_TimerHandle_t Timer = ListHeads[List];
+
+  ListHeads[List] = ES_TIMER_INVALID;
+  if (List < OVERFLOW_LIST)
+  {
+    SlotsInUse[List / WHEEL_SLOTS] &= ~(1ULL << (List % WHEEL_SLOTS));
+  }
+  while (Timer != ES_TIMER_INVALID)
+  {
+    ES_TimerHandle_t Next = TimerPool[Timer].Next;
+    WheelInsert(Timer);
+    Timer = Next;
   }
-  return ReturnVal;
 }
 
 /*------------------------------- Footnotes -------------------------------*/
+/*
+  The timer wheel has 4 levels of 64 slots, each level counting one base 64
+  digit of the tick. A timer sits in the lowest level whose higher digits
+  match the wheel time's, in the slot of its own digit there. Level 0 slots
+  are the exact tick a timer expires, a slot on a higher level is emptied
+  into the levels below it when the wheel time reaches the start of that
+  slot. Timers more than 2^24 ticks out wait on the overflow list, which is
+  re-filed every time the top digit of the wheel time changes.
+  Starting and stopping is a list insert or unlink and a bit in the level's
+  slot map, a timer cascades at most 3 times before it expires, and the
+  slot maps let the wheel skip straight to the next tick with work to do.
+*/
 /*------------------------------ End of file ------------------------------*/
-
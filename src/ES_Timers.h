@@ -16,6 +16,7 @@
 #define ES_Timers_H
 
 #include "ES_Port.h"
+#include "ES_PostList.h"
 
 typedef enum
 {
@@ -25,13 +26,26 @@ typedef enum
   ES_Timer_NOT_ACTIVE = 0
 }ES_TimerReturn_t;
 
+// A timer's handle is also its number, the numbered timers are 0-15
+typedef uint8_t ES_TimerHandle_t;
+#define ES_TIMER_INVALID ((ES_TimerHandle_t)0xFF)
+
 
 // These are to be used by the services 
-ES_TimerReturn_t ES_Timer_InitTimer(uint8_t Num, uint32_t NewTime);
-ES_TimerReturn_t ES_Timer_SetTimer(uint8_t Num, uint32_t NewTime);
-ES_TimerReturn_t ES_Timer_StartTimer(uint8_t Num);
-ES_TimerReturn_t ES_Timer_StopTimer(uint8_t Num);
+ES_TimerReturn_t ES_Timer_InitTimer(ES_TimerHandle_t Num, uint32_t NewTime);
+ES_TimerReturn_t ES_Timer_SetTimer(ES_TimerHandle_t Num, uint32_t NewTime);
+ES_TimerReturn_t ES_Timer_StartTimer(ES_TimerHandle_t Num);
+ES_TimerReturn_t ES_Timer_StopTimer(ES_TimerHandle_t Num);
+ES_TimerReturn_t ES_Timer_InitPeriodic(ES_TimerHandle_t Num, uint32_t Period);
+uint16_t ES_Timer_GetOverruns(ES_TimerHandle_t Num);
+ES_TimerReturn_t ES_Timer_IsRunning(ES_TimerHandle_t Num);
+ES_TimerReturn_t ES_Timer_SetSlack(ES_TimerHandle_t Num, uint16_t Slack);
+ES_TimerHandle_t ES_Timer_Alloc(pPostFunc PostFunc);
+ES_TimerReturn_t ES_Timer_Free(ES_TimerHandle_t Timer);
 uint32_t ES_Timer_GetTime(void);
+bool ES_Timer_IsStale(ES_Event_t ThisEvent);
+bool ES_Timer_GetNextDeadline(uint32_t *Deadline);
+uint32_t ES_Timer_GetNumAlarms(void);
 
 // These two are used by the framework
 void ES_Timer_Init(TimerRate_t Rate);
@@ -0,0 +1,330 @@
+/****************************************************************************
+ Module
+     ES_Trace.c
+ Description
+     Event trace recorder for the Events & Services framework. The framework
+     adds an 8 byte record (see ES_Trace.h) to a ring for every boot, post,
+     timer start and stop and the start and end of every dispatch, and
+     whenever a service's watched state variable has changed after its run
+     function. The ring is in RTC memory, so it holds the last ES_TRACE_LEN
+     records across deep sleep and can be dumped over Serial long after a
+     failure. The simulator replays a dump into the services (see
+     src/host/sim/SimReplay.cpp), feeding them the inputs they recorded
+     with ES_Trace_Input.
+ Notes
+     Only built with ES_TRACE_ENABLE. Records only carry the cycle count,
+     which stops in light sleep and wraps every 2^32 cycles. A SYNC record
+     with the tick count goes in at boot, after light sleep and every
+     ES_TRACE_SYNC_PERIOD ticks, so times can be pieced back together as
+     long as the loop never runs for 2^32 cycles without idling.
+*****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "ES_Configure.h"
+
+#ifdef ES_TRACE_ENABLE
+#include "ES_framework.h"
+#include "ES_Trace.h"
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+// ticks between SYNCs while the cycle counter keeps running, well inside
+// the 2^32 cycles (~18 s at 240MHz) it takes to wrap
+#define ES_TRACE_SYNC_PERIOD 10000U
+
+static_assert(ES_TRACE_MULTICAST < ES_TRACE_INPUT, "service numbers and ES_TRACE_MULTICAST must fit in Num");
+static_assert(ES_TRACE_NUM_INPUTS <= 32, "one bit per input in InputsRecorded");
+
+#ifdef ES_PORT_POSIX
+#define ES_TRACE_PRINTF printf
+#else
+#include <HardwareSerial.h>
+#define ES_TRACE_PRINTF Serial.printf
+#endif
+
+typedef struct
+{
+  const void *State;      // NULL if the service isn't watched
+  uint8_t Size;
+  uint32_t LastValue;
+}ES_TraceWatch_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint32_t ES_Trace_ReadState(const ES_TraceWatch_t *Watch);
+
+/*---------------------------- Module Variables ---------------------------*/
+RTC_DATA_ATTR ES_TraceRecord_t ES_TraceRing[ES_TRACE_LEN];
+RTC_DATA_ATTR uint32_t ES_TraceHead = 0;
+RTC_DATA_ATTR uint32_t ES_TraceBootHead = 0;   // index of the boot's BOOT record
+RTC_DATA_ATTR uint32_t ES_TraceDropped = 0;    // records the boot couldn't fit
+static RTC_DATA_ATTR uint16_t BootCount = 0;
+
+bool ES_TraceSyncDue = false;
+static uint32_t LastSyncTick;
+static ES_TraceWatch_t Watches[NUM_SERVICES];
+
+// each input's value in its last record this boot
+static uint16_t InputValues[(ES_TRACE_NUM_INPUTS > 0) ? ES_TRACE_NUM_INPUTS : 1];
+static uint32_t InputsRecorded;
+static uint16_t (*InputSource)(uint8_t Input, uint16_t Value) = NULL;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+   ES_Trace_Boot
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Marks the start of a boot in the trace and forgets the watched states and
+   inputs of the last one. Called by ES_Initialize before the services' init
+   functions
+ Notes
+   From here on the boot's records can overwrite the last boot's, but not
+   its own BOOT record
+****************************************************************************/
+void ES_Trace_Boot(void)
+{
+  memset(Watches, 0, sizeof(Watches));
+  InputsRecorded = 0;
+  BootCount++;
+  ES_TraceBootHead = ES_TraceHead;
+  ES_TraceDropped = 0;
+  ES_TraceSyncDue = false;
+  ES_Trace_Record(ES_TRACE_BOOT, 0, (uint8_t)_HW_GetCyclesPerUs(), BootCount);
+  ES_Trace_Sync();
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_Sync
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Records the tick count, so the cycle counts of the records after it can
+   be turned into time since boot
+ Notes
+   Called from ES_Trace_Record when a sync is due, don't call it directly
+****************************************************************************/
+void ES_Trace_Sync(void)
+{
+  ES_TraceSyncDue = false;
+  uint32_t ticks = _HW_GetTickCount();
+  LastSyncTick = ticks;
+  ES_Trace_Record(ES_TRACE_SYNC, (uint8_t)(ticks >> 24), (uint8_t)(ticks >> 16), (uint16_t)ticks);
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_Idled
+ Parameters
+   bool : true if the idle was a light sleep
+ Returns
+   None
+ Description
+   Called by ES_Idle once it is done. The cycle counter stops in light
+   sleep and may be close to wrapping after a long wait, so in either case
+   the next record is preceded by a SYNC
+ Notes
+   Idles with nothing to show for them don't fill the ring with SYNCs
+****************************************************************************/
+void ES_Trace_Idled(bool LightSlept)
+{
+  if(LightSlept || (uint32_t)(_HW_GetTickCount() - LastSyncTick) >= ES_TRACE_SYNC_PERIOD)
+    ES_TraceSyncDue = true;
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_WatchState
+ Parameters
+   uint8_t : the service number
+   const void * : the service's state variable
+   uint8_t : sizeof the state variable, at most 4
+ Returns
+   None
+ Description
+   Has the framework record a STATE whenever the variable has changed after
+   one of the service's run functions. Call it from the init function, the
+   current state is recorded straight away
+ Notes
+   Only the bottom 16 bits of the state make it into the record
+****************************************************************************/
+void ES_Trace_WatchState(uint8_t ServiceNum, const void *State, uint8_t Size)
+{
+  if(ServiceNum >= NUM_SERVICES || Size > sizeof(uint32_t))
+    return;
+
+  ES_TraceWatch_t *watch = &Watches[ServiceNum];
+  watch->State = State;
+  watch->Size = Size;
+  watch->LastValue = ES_Trace_ReadState(watch);
+  ES_Trace_Record(ES_TRACE_STATE, ServiceNum, 0, (uint16_t)watch->LastValue);
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_Input
+ Parameters
+   uint8_t : which input, below ES_TRACE_NUM_INPUTS (see ES_Configure.h)
+   uint16_t : the value the service just read
+ Returns
+   uint16_t : the value, or the one the input source substituted for it
+ Description
+   Records a value a service read from outside the framework and acts on,
+   like the WiFi status or the battery voltage, so the simulator's replay
+   can hand the run function the value the device read. Wrap the read in
+   it: if(ES_Trace_Input(BAT_VOLT_INPUT, getBatVolt()) < BAT_LOW_THRES)
+ Notes
+   Only records the value if it differs from the input's last record in
+   this boot, a reading that is polled every second costs nothing while it
+   stays the same
+****************************************************************************/
+uint16_t ES_Trace_Input(uint8_t Input, uint16_t Value)
+{
+#ifdef ES_WORKER_ENABLE
+  if(_HW_In_Worker())
+    return Value;   // not traced, and InputValues belongs to the loop task
+#endif
+  if(Input >= ES_TRACE_NUM_INPUTS)
+    return Value;
+
+  if(InputSource != NULL)
+    Value = InputSource(Input, Value);
+  if(!(InputsRecorded & (1UL << Input)) || InputValues[Input] != Value)
+  {
+    InputsRecorded |= 1UL << Input;
+    InputValues[Input] = Value;
+    ES_Trace_Record(ES_TRACE_STATE, ES_TRACE_INPUT, Input, Value);
+  }
+  return Value;
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_SetInputSource
+ Parameters
+   uint16_t (*)(uint8_t, uint16_t) : called by ES_Trace_Input with the input
+   and the value read, returns the value to use instead. NULL for none
+ Returns
+   None
+ Description
+   Lets the simulator's replay feed the services the dump's inputs
+ Notes
+****************************************************************************/
+void ES_Trace_SetInputSource(uint16_t (*Source)(uint8_t Input, uint16_t Value))
+{
+  InputSource = Source;
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_Done
+ Parameters
+   uint8_t : the service that just ran
+ Returns
+   None
+ Description
+   Records the service's state if it has changed, then the end of the
+   dispatch. Everything between a DISPATCH and its DONE was done by the run
+   function
+ Notes
+   Called by the framework after every run function
+****************************************************************************/
+void ES_Trace_Done(uint8_t ServiceNum)
+{
+  ES_TraceWatch_t *watch = &Watches[ServiceNum];
+  if(watch->State != NULL)
+  {
+    uint32_t value = ES_Trace_ReadState(watch);
+    if(value != watch->LastValue)
+    {
+      watch->LastValue = value;
+      ES_Trace_Record(ES_TRACE_STATE, ServiceNum, 0, (uint16_t)value);
+    }
+  }
+  ES_Trace_Record(ES_TRACE_DONE, ServiceNum, 0, 0);
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_GetHead
+ Parameters
+   None
+ Returns
+   uint32_t : number of records ever added, the index of the next one
+ Description
+   With ES_Trace_Get, lets the application or the simulator read the
+   records added since a given point
+ Notes
+****************************************************************************/
+uint32_t ES_Trace_GetHead(void)
+{
+  return ES_TraceHead;
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_Get
+ Parameters
+   uint32_t : index of the record, counting from the first ever added
+   ES_TraceRecord_t * : filled in with the record
+ Returns
+   bool : false if the record hasn't been added yet or has been overwritten
+ Description
+   Reads a record out of the ring
+ Notes
+****************************************************************************/
+bool ES_Trace_Get(uint32_t Index, ES_TraceRecord_t *Record)
+{
+  if(Record == NULL || (uint32_t)(ES_TraceHead - Index - 1) >= ES_TRACE_LEN)
+    return false;
+
+  *Record = ES_TraceRing[Index & (ES_TRACE_LEN - 1)];
+  return true;
+}
+
+/****************************************************************************
+ Function
+   ES_Trace_Dump
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Prints the ring over Serial (stdout on the host), oldest record first,
+   one record per line as 16 hex digits: time, kind and num, type, param
+ Notes
+   The lines between "ES trace begin" and "ES trace end" are what the
+   simulator's replay reads, so the dump can be cut out of any serial log.
+   The begin line also says how many of the last boot's records didn't fit
+****************************************************************************/
+void ES_Trace_Dump(void)
+{
+  uint32_t numRecords = (ES_TraceHead < ES_TRACE_LEN) ? ES_TraceHead : ES_TRACE_LEN;
+
+  ES_TRACE_PRINTF("ES trace begin %u, %u dropped\n", numRecords, ES_TraceDropped);
+  for(uint32_t i = ES_TraceHead - numRecords; i != ES_TraceHead; i++)
+  {
+    const ES_TraceRecord_t *record = &ES_TraceRing[i & (ES_TRACE_LEN - 1)];
+    ES_TRACE_PRINTF("%08x%02x%02x%04x\n", record->Time, record->KindNum, record->Type, record->Param);
+  }
+  ES_TRACE_PRINTF("ES trace end\n");
+}
+
+
+//*********************************
+// private functions
+//*********************************
+static uint32_t ES_Trace_ReadState(const ES_TraceWatch_t *Watch)
+{
+  uint32_t value = 0;
+  memcpy(&value, Watch->State, Watch->Size);  // the ESP32 and hosts are little endian
+  return value;
+}
+
+#endif /* ES_TRACE_ENABLE */
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,171 @@
+/****************************************************************************
+ Module
+    ES_Trace.h
+ Description
+    header file for the event trace recorder. Turned on with ES_TRACE_ENABLE
+    in ES_Configure.h, otherwise every function here compiles to nothing.
+ Notes
+    Each record is 8 bytes: the cycle count, what happened, a service or
+    timer number, an event type and a parameter. What goes in the fields
+    depends on the kind of record:
+
+    kind          Num              Type            Param
+    BOOT          0                cycles per us   boot number
+    SYNC          ticks since boot (ms): bits 24-28 in Num, 16-23 in Type,
+                  0-15 in Param
+    POST          service *        event type      event param
+    DISPATCH      service          event type      event param
+    DONE          service          0               0
+    TIMER_START   time bits 16-20  timer           time bits 0-15
+    TIMER_STOP    0                timer           0
+    STATE         service          0               new state
+    INPUT **      ES_TRACE_INPUT   input           value
+
+    * ES_TRACE_MULTICAST for the multicast queue. Timer times are in ticks
+    and stop at 2^21-1 (~35 min at 1 ms).
+    ** a STATE record with Num ES_TRACE_INPUT, what a service read from
+    outside the framework (ES_Trace_Input). Only recorded when the value
+    differs from the input's last record in the boot.
+
+    A boot's records never overwrite its own BOOT record. Once a boot has
+    filled the ring the rest of its records are dropped and counted, so a
+    dump always has the start of the last boot, which is what the replay
+    needs.
+
+    With ES_WORKER_ENABLE only the loop task is recorded: the posts to the
+    worker's services are, their dispatches and timer starts aren't.
+*****************************************************************************/
+#ifndef ES_Trace_H
+#define ES_Trace_H
+
+#include "ES_Event.h"
+#include "ES_Port.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+  ES_TRACE_BOOT = 0,        // ES_Initialize
+  ES_TRACE_SYNC,            // ties the cycle count to the tick count
+  ES_TRACE_POST,            // event posted to a queue, even if it was full
+  ES_TRACE_DISPATCH,        // event handed to a run function
+  ES_TRACE_DONE,            // the run function returned
+  ES_TRACE_TIMER_START,
+  ES_TRACE_TIMER_STOP,
+  ES_TRACE_STATE,           // a watched state variable changed
+  ES_TRACE_NUM_KINDS
+}ES_TraceKind_t;
+
+// the multicast queue's number in POST records
+#define ES_TRACE_MULTICAST NUM_SERVICES
+// Num of the STATE records that are inputs
+#define ES_TRACE_INPUT 0x1F
+
+#define ES_TRACE_NUM_BITS 5
+#define ES_TRACE_NUM_MASK ((1U << ES_TRACE_NUM_BITS) - 1)
+
+typedef struct
+{
+  uint32_t Time;            // _HW_GetCycleCount
+  uint8_t KindNum;          // kind in the top 3 bits, Num in the bottom 5
+  uint8_t Type;
+  uint16_t Param;
+}ES_TraceRecord_t;
+
+// unpack KindNum, for tools that read records back
+static inline ES_TraceKind_t ES_Trace_Kind(const ES_TraceRecord_t *Record)
+{
+  return (ES_TraceKind_t)(Record->KindNum >> ES_TRACE_NUM_BITS);
+}
+
+static inline uint8_t ES_Trace_Num(const ES_TraceRecord_t *Record)
+{
+  return Record->KindNum & ES_TRACE_NUM_MASK;
+}
+
+#ifdef ES_TRACE_ENABLE
+#if (ES_TRACE_LEN & (ES_TRACE_LEN - 1)) != 0
+#error ES_TRACE_LEN must be a power of 2
+#endif
+
+// the ring, kept in RTC memory by ES_Trace.c. Only the inline functions
+// below should touch these
+extern ES_TraceRecord_t ES_TraceRing[ES_TRACE_LEN];
+extern uint32_t ES_TraceHead;
+extern uint32_t ES_TraceBootHead;
+extern uint32_t ES_TraceDropped;
+extern bool ES_TraceSyncDue;
+
+void ES_Trace_Sync(void);
+
+// used by the framework
+void ES_Trace_Boot(void);
+void ES_Trace_Idled(bool LightSlept);
+void ES_Trace_Done(uint8_t ServiceNum);
+
+// adds a record, a handful of stores plus the cycle count
+static inline void ES_Trace_Record(ES_TraceKind_t Kind, uint8_t Num, uint8_t Type, uint16_t Param)
+{
+#ifdef ES_WORKER_ENABLE
+  if(_HW_In_Worker())
+    return;   // only the loop task is traced, the ring has a single writer
+#endif
+  if(ES_TraceSyncDue)
+    ES_Trace_Sync();
+  if(ES_TraceHead - ES_TraceBootHead >= ES_TRACE_LEN)
+  {
+    ES_TraceDropped++;  // keep the boot's start
+    return;
+  }
+  ES_TraceRecord_t *record = &ES_TraceRing[ES_TraceHead++ & (ES_TRACE_LEN - 1)];
+  record->Time = _HW_GetCycleCount();
+  record->KindNum = (uint8_t)((Kind << ES_TRACE_NUM_BITS) | (Num & ES_TRACE_NUM_MASK));
+  record->Type = Type;
+  record->Param = Param;
+}
+
+static inline void ES_Trace_Post(uint8_t ServiceNum, const ES_Event_t *ThisEvent)
+{
+  ES_Trace_Record(ES_TRACE_POST, ServiceNum, ThisEvent->EventType, ThisEvent->EventParam);
+}
+
+static inline void ES_Trace_Dispatch(uint8_t ServiceNum, const ES_Event_t *ThisEvent)
+{
+  ES_Trace_Record(ES_TRACE_DISPATCH, ServiceNum, ThisEvent->EventType, ThisEvent->EventParam);
+}
+
+static inline void ES_Trace_TimerStart(uint8_t Timer, uint32_t Time)
+{
+  if(Time > 0x1FFFFF)
+    Time = 0x1FFFFF;
+  ES_Trace_Record(ES_TRACE_TIMER_START, (uint8_t)(Time >> 16), Timer, (uint16_t)Time);
+}
+
+static inline void ES_Trace_TimerStop(uint8_t Timer)
+{
+  ES_Trace_Record(ES_TRACE_TIMER_STOP, 0, Timer, 0);
+}
+
+// used by the application
+void ES_Trace_WatchState(uint8_t ServiceNum, const void *State, uint8_t Size);
+uint16_t ES_Trace_Input(uint8_t Input, uint16_t Value);
+void ES_Trace_SetInputSource(uint16_t (*Source)(uint8_t Input, uint16_t Value));
+uint32_t ES_Trace_GetHead(void);
+bool ES_Trace_Get(uint32_t Index, ES_TraceRecord_t *Record);
+void ES_Trace_Dump(void);
+#else
+static inline void ES_Trace_Boot(void) {}
+static inline void ES_Trace_Idled(bool LightSlept) {}
+static inline void ES_Trace_Done(uint8_t ServiceNum) {}
+static inline void ES_Trace_Post(uint8_t ServiceNum, const ES_Event_t *ThisEvent) {}
+static inline void ES_Trace_Dispatch(uint8_t ServiceNum, const ES_Event_t *ThisEvent) {}
+static inline void ES_Trace_TimerStart(uint8_t Timer, uint32_t Time) {}
+static inline void ES_Trace_TimerStop(uint8_t Timer) {}
+static inline void ES_Trace_WatchState(uint8_t ServiceNum, const void *State, uint8_t Size) {}
+static inline uint16_t ES_Trace_Input(uint8_t Input, uint16_t Value) { return Value; }
+static inline uint32_t ES_Trace_GetHead(void) { return 0; }
+static inline bool ES_Trace_Get(uint32_t Index, ES_TraceRecord_t *Record) { return false; }
+static inline void ES_Trace_Dump(void) {}
+#endif
+
+#endif /* ES_Trace_H */
@@ -5,88 +5,198 @@
      source file for the core functions of the Events & Services framework. 
      The framework first runs through all the init functions of all services. 
      It then keep checking the eventChecker functions and the Queue to see 
-     if there are any events. When there is an event, the appropriate run 
-     function of a service is called. Currently, there is 1 queue so all events 
-     are handeled in a LIFO manner without regard to priority of the service. 
+     if there are any events. Each service has its own queue and a bit in the 
+     Ready variable that is set whenever its queue holds events. ES_Run always 
+     dispatches to the highest priority ready service first. 
  Notes
-
+     With ES_WORKER_ENABLE the services in ES_WORKER_SERVICES are run by a 
+     second task, the worker, which has its own Ready bits and is handed the 
+     events posted to its services through a lock free ring (and hands back 
+     the ones its services post through another), see ES_WorkerLoop. 
 *****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
 #include "ES_Port.h"
 #include "ES_framework.h"
 #include "ES_Queue.h"
 #include "ES_Timers.h"
+#include "ES_PostList.h"
+#include "ES_ServiceList.h"
+#include "ES_CrossQueue.h"
 
 #include <stdio.h>
+#include <string.h>
 
 /*----------------------------- Module Defines ----------------------------*/
-typedef struct ES_service
-{
-  bool (*init_funct)(uint8_t);
-  ES_Event_t (*run_funct)(ES_Event_t);
-}ES_service_t; 
-
-/*---------------------------- Module Functions ---------------------------*/
-bool ES_ScanEventCheckers();
-
-/*---------------------------- Module Variables ---------------------------*/
-/****************************************************************************/
-static bool (* const eventCheckerFuncts[])(void) = {EVENT_CHECKER_LIST};
-
-
-// Main queue for all services
-static ES_Event_t eventsList[QUEUE_SIZE];
-static ES_Queue_t Queue; 
-
+static_assert(NUM_SERVICES >= 1 && NUM_SERVICES <= MAX_NUM_SERVICES, "NUM_SERVICES must be 1 to MAX_NUM_SERVICES");
+static_assert(MAX_NUM_SERVICES <= 16, "Ready and IdleInhibit have one bit per service");
+static_assert(ES_MULTICAST_QUEUE_SIZE > 0 && (ES_MULTICAST_QUEUE_SIZE & (ES_MULTICAST_QUEUE_SIZE - 1)) == 0
+    && ES_MULTICAST_QUEUE_SIZE <= 128, "ES_MULTICAST_QUEUE_SIZE must be a power of 2");
+#ifdef ES_WORKER_ENABLE
+static_assert((ES_WORKER_SERVICES >> NUM_SERVICES) == 0, "ES_WORKER_SERVICES has a bit for a service that doesn't exist");
+static_assert(ES_WORKER_QUEUE_SIZE > 0 && (ES_WORKER_QUEUE_SIZE & (ES_WORKER_QUEUE_SIZE - 1)) == 0
+    && ES_WORKER_QUEUE_SIZE <= 128, "ES_WORKER_QUEUE_SIZE must be a power of 2");
+#endif
+#ifdef ES_WATCHDOG_TIMEOUT
+static_assert(ES_WATCHDOG_TIMEOUT * 1000UL > ES_IDLE_MAX_TIME, "the watchdog would go off while ES_Run idles");
+#endif
 
-static ES_service_t const servicesList[NUM_SERVICES] = {
-  {SERV_0_INIT, SERV_0_RUN}
+// The services in priority order (see ES_ServiceList.h), each with its queue
+typedef ES_ServiceList<
+  ES_Service<SERV_0_INIT, SERV_0_RUN, SERV_0_QUEUE_SIZE, SERV_0_RUN_BUDGET, SERV_0_PROBE>
 #if NUM_SERVICES > 1
-  ,{SERV_1_INIT, SERV_1_RUN}
+  ,ES_Service<SERV_1_INIT, SERV_1_RUN, SERV_1_QUEUE_SIZE, SERV_1_RUN_BUDGET, SERV_1_PROBE>
 #endif
 #if NUM_SERVICES > 2
-  ,{SERV_2_INIT, SERV_2_RUN}
+  ,ES_Service<SERV_2_INIT, SERV_2_RUN, SERV_2_QUEUE_SIZE, SERV_2_RUN_BUDGET, SERV_2_PROBE>
 #endif
 #if NUM_SERVICES > 3
-  ,{SERV_3_INIT, SERV_3_RUN}
+  ,ES_Service<SERV_3_INIT, SERV_3_RUN, SERV_3_QUEUE_SIZE, SERV_3_RUN_BUDGET, SERV_3_PROBE>
 #endif
 #if NUM_SERVICES > 4
-  ,{SERV_4_INIT, SERV_4_RUN}
+  ,ES_Service<SERV_4_INIT, SERV_4_RUN, SERV_4_QUEUE_SIZE, SERV_4_RUN_BUDGET, SERV_4_PROBE>
 #endif
 #if NUM_SERVICES > 5
-  ,{SERV_5_INIT, SERV_5_RUN}
+  ,ES_Service<SERV_5_INIT, SERV_5_RUN, SERV_5_QUEUE_SIZE, SERV_5_RUN_BUDGET, SERV_5_PROBE>
 #endif
 #if NUM_SERVICES > 6
-  ,{SERV_6_INIT, SERV_6_RUN}
+  ,ES_Service<SERV_6_INIT, SERV_6_RUN, SERV_6_QUEUE_SIZE, SERV_6_RUN_BUDGET, SERV_6_PROBE>
 #endif
 #if NUM_SERVICES > 7
-  ,{SERV_7_INIT, SERV_7_RUN}
+  ,ES_Service<SERV_7_INIT, SERV_7_RUN, SERV_7_QUEUE_SIZE, SERV_7_RUN_BUDGET, SERV_7_PROBE>
 #endif
 #if NUM_SERVICES > 8
-  ,{SERV_8_INIT, SERV_8_RUN}
+  ,ES_Service<SERV_8_INIT, SERV_8_RUN, SERV_8_QUEUE_SIZE, SERV_8_RUN_BUDGET, SERV_8_PROBE>
 #endif
 #if NUM_SERVICES > 9
-  ,{SERV_9_INIT, SERV_9_RUN}
+  ,ES_Service<SERV_9_INIT, SERV_9_RUN, SERV_9_QUEUE_SIZE, SERV_9_RUN_BUDGET, SERV_9_PROBE>
 #endif
 #if NUM_SERVICES > 10
-  ,{SERV_10_INIT, SERV_10_RUN}
+  ,ES_Service<SERV_10_INIT, SERV_10_RUN, SERV_10_QUEUE_SIZE, SERV_10_RUN_BUDGET, SERV_10_PROBE>
 #endif
 #if NUM_SERVICES > 11
-  ,{SERV_11_INIT, SERV_11_RUN}
+  ,ES_Service<SERV_11_INIT, SERV_11_RUN, SERV_11_QUEUE_SIZE, SERV_11_RUN_BUDGET, SERV_11_PROBE>
 #endif
 #if NUM_SERVICES > 12
-  ,{SERV_12_INIT, SERV_12_RUN}
+  ,ES_Service<SERV_12_INIT, SERV_12_RUN, SERV_12_QUEUE_SIZE, SERV_12_RUN_BUDGET, SERV_12_PROBE>
 #endif
 #if NUM_SERVICES > 13
-  ,{SERV_13_INIT, SERV_13_RUN}
+  ,ES_Service<SERV_13_INIT, SERV_13_RUN, SERV_13_QUEUE_SIZE, SERV_13_RUN_BUDGET, SERV_13_PROBE>
 #endif
 #if NUM_SERVICES > 14
-  ,{SERV_14_INIT, SERV_14_RUN}
+  ,ES_Service<SERV_14_INIT, SERV_14_RUN, SERV_14_QUEUE_SIZE, SERV_14_RUN_BUDGET, SERV_14_PROBE>
 #endif
 #if NUM_SERVICES > 15
-  ,{SERV_15_INIT, SERV_15_RUN}
+  ,ES_Service<SERV_15_INIT, SERV_15_RUN, SERV_15_QUEUE_SIZE, SERV_15_RUN_BUDGET, SERV_15_PROBE>
+#endif
+> Services; 
+
+#define ES_CHECKER(Func, MinInterval, Weight, ServiceNum) ES_Checker<Func, MinInterval, Weight, ServiceNum>
+typedef ES_CheckerList<EVENT_CHECKER_LIST> EventCheckers; 
+#undef ES_CHECKER
+static_assert(ES_NUM_EVENT_SOURCES <= EventCheckers::Count, "event source n wakes up the nth event checker"); 
+static_assert((EventCheckers::ServiceMask >> NUM_SERVICES) == 0, "an event checker posts to a service that doesn't exist"); 
+
+/*---------------------------- Module Functions ---------------------------*/
+bool ES_ScanEventCheckers();
+static bool ES_RunChecker(uint8_t CheckerNum, uint32_t CurrTime);
+static uint32_t ES_TimeToNextChecker(void);
+static uint32_t ES_TakeEventSources(void);
+static bool ES_EnqueuePost(ES_Event_t ThisEvent);
+static bool ES_EnqueueMulticast(ES_Event_t ThisEvent);
+static inline void ES_StampEvent(ES_Event_t *ThisEvent);
+static inline uint8_t ES_GetHighestReady(uint16_t ReadyFlags);
+static void ES_Idle(void);
+static bool ES_DispatchMulticast(ES_Event_t ThisEvent);
+static bool ES_MulticastIsNext(void);
+static inline void ES_FeedWatchdog(void);
+#ifdef ES_WORKER_ENABLE
+static bool ES_PostCross(ES_CrossQueue_t *Queue, ES_Event_t ThisEvent, bool Multicast);
+static void ES_TakeWorkerPosts(void);
+static void ES_WorkerLoop(void);
+static bool ES_WorkerPost(ES_Event_t ThisEvent);
+static void ES_WorkerTakePosts(void);
+static void ES_WorkerDispatch(uint8_t ServiceNum, ES_Event_t ThisEvent);
+#endif
+
+/*---------------------------- Module Variables ---------------------------*/
+/****************************************************************************/
+// Event checkers that have work pending, bit n for the nth checker. Set by
+// the event sources and the fallback poll, cleared once a checker comes up empty
+static uint32_t PendingCheckers;
+
+// Services whose probe found their hardware (or that have none), bit n for 
+// service n, and the checkers of those services. Set by ES_Initialize, the 
+// rest are never initialized, posted to, dispatched to or called
+static uint16_t PresentServices;
+static uint32_t ActiveCheckers;
+
+#ifdef ES_PROBE_RECHECK_BOOTS
+// Services whose probe failed, and the boots since they were last probed. 
+// Kept over deep sleep so a unit without a sensor doesn't wait on it every 
+// boot, both start at 0 on power on so everything is probed then
+static RTC_DATA_ATTR uint16_t AbsentServices = 0; 
+static RTC_DATA_ATTR uint8_t BootsSinceProbe = 0; 
+#endif
+
+// Tick before which each checker is held off by its minimum interval, its
+// counts for ES_GetCheckerStats, and the checker the next scan starts at
+static uint32_t CheckerNextTime[EventCheckers::Count];
+static ES_CheckerStats_t CheckerStats[EventCheckers::Count];
+static uint8_t NextChecker;
+
+#ifdef ES_TIMESTAMP_ENABLE
+// Time each event source last signalled (ES_SetEventPending). An event posted
+// by a checker whose source has signalled since it last came up empty is
+// stamped with that time rather than the time of the post, so it carries 
+// when the edge or the bytes came in
+static uint32_t SourceTimes[ES_NUM_EVENT_SOURCES];
+static uint32_t SignalledCheckers; 
+static uint32_t CheckerTime; 
+static bool InChecker; 
+#endif
+
+
+// Each bit in Ready is set when the queue of the service with that priority
+// holds at least 1 event. The highest set bit is the next service to run
+static uint16_t Ready;
+
+// Bit n is set while service n is waiting on something that light sleep would
+// break (e.g. a UART reply), see ES_SetIdleInhibit. Updated atomically since 
+// the worker's services set their bits too
+static uint32_t IdleInhibit;
+
+// times ES_Idle has slept or waited and come back, see ES_GetIdleStats
+static uint32_t NumWakeups;
+
+// One queue per service, indexed by the service's priority
+static ES_Queue_t * const EventQueues = Services::Queues; 
+
+// Multicast events (ES_PostListnn, ES_PostAll) wait here, each one only once
+// however many services it goes to. The one at the front is dispatched once no
+// service above the highest one on its list is ready, see ES_MulticastIsNext
+static ES_Event_t MulticastQueueArr[ES_MULTICAST_QUEUE_SIZE];
+static ES_Queue_t MulticastQueue = {0, 0, ES_MULTICAST_QUEUE_SIZE, MulticastQueueArr};
+
+#ifdef ES_WORKER_ENABLE
+// Posts from the loop task to the worker's services, and from the worker 
+// task to the loop's services and the multicast queue. Each ring has one 
+// producer and one consumer
+static ES_CrossSlot_t ToWorkerSlots[ES_WORKER_QUEUE_SIZE];
+static ES_CrossQueue_t ToWorker = {0, 0, ES_WORKER_QUEUE_SIZE, ToWorkerSlots};
+static ES_CrossSlot_t ToLoopSlots[ES_WORKER_QUEUE_SIZE];
+static ES_CrossQueue_t ToLoop = {0, 0, ES_WORKER_QUEUE_SIZE, ToLoopSlots};
+
+// The worker's Ready bits, only used by the worker task
+static uint16_t WorkerReady;
+
+// Set while the worker task has something to do, light sleep would stop it
+static bool WorkerBusy;
+
+// Set by the worker task when one of its run functions returns ES_ERROR
+static bool WorkerFailed;
 #endif
-};
+
+
 /****************************************************************************/
 
 
@@ -97,35 +207,85 @@ static ES_service_t const servicesList[NUM_SERVICES] = {
    ES_Initialize
  Parameters
  Returns
-   ES_Return_t : FailedPointer if any of the function pointers are NULL
-                 FailedInit if any of the initialization functions failed
+   ES_Return_t : FailedInit if any of the initialization functions failed
  Description
-   Initialize all the services and tests for NULL pointers in the array
+   Probes for the hardware of the services that have a SERV_n_PROBE, then 
+   initializes the services that were found in priority order
+ Notes
+   Missing init or run functions and empty queues are caught at compile 
+   time (ES_ServiceList.h), so FailedPointer and FailedIndex aren't returned.
+   A service whose probe fails is left out for the rest of the boot, along
+   with its event checkers, see ES_IsServicePresent. With 
+   ES_PROBE_RECHECK_BOOTS, it is also left out without being probed on the 
+   boots after, until power on or every ES_PROBE_RECHECK_BOOTS boots
 ****************************************************************************/
 ES_Return_t ES_Initialize(TimerRate_t Rate)
 {
-  if(QUEUE_SIZE < NUM_SERVICES){
-    return FailedIndex;
+  for(uint8_t i=0; i<NUM_SERVICES; i++){
+    ES_InitQueue(&EventQueues[i]); 
   }
+  ES_InitQueue(&MulticastQueue); 
+  Ready = 0; 
+  PendingCheckers = 0; 
+  memset(CheckerNextTime, 0, sizeof(CheckerNextTime)); 
+  memset(CheckerStats, 0, sizeof(CheckerStats)); 
+  NextChecker = 0; 
+#ifdef ES_TIMESTAMP_ENABLE
+  SignalledCheckers = 0; 
+  InChecker = false; 
+#endif
+  IdleInhibit = 0; 
+#ifdef ES_WORKER_ENABLE
+  ES_CrossQueue_Init(&ToWorker); 
+  ES_CrossQueue_Init(&ToLoop); 
+  WorkerReady = 0; 
+  WorkerBusy = false; 
+  WorkerFailed = false; 
+#endif
 
+  ES_Payload_Init(); 
+  ES_Profiler_Reset(); 
+  ES_Budget_Reset(Services::RunBudgets); 
   ES_Timer_Init(Rate); 
-  
-  Queue.events_arr = eventsList; 
-  Queue.capacity = QUEUE_SIZE; 
-  ES_InitQueue(&Queue); 
+  ES_Trace_Boot(); 
 
-  // first make sure all services have an init and run function that don't point to null
-  for(uint8_t i=0; i<NUM_SERVICES; i++){
-    if(!(servicesList[i].init_funct) || !(servicesList[i].run_funct)){
-      return FailedPointer; 
+#ifdef ES_PROBE_SETUP
+  ES_PROBE_SETUP(); 
+#endif
+#ifdef ES_PROBE_RECHECK_BOOTS
+  uint16_t absent = 0; 
+  if(AbsentServices != 0 && ++BootsSinceProbe < ES_PROBE_RECHECK_BOOTS){
+    absent = AbsentServices; 
+  }
+  else{
+    BootsSinceProbe = 0; 
+  }
+  PresentServices = Services::Probe(absent); 
+  AbsentServices = ~PresentServices & ((1U << NUM_SERVICES) - 1); 
+#else
+  PresentServices = Services::Probe(0); 
+#endif
+  ActiveCheckers = 0; 
+  for(uint8_t i=0; i<EventCheckers::Count; i++){
+    if(bitRead(PresentServices, EventCheckers::ServiceNums[i])){
+      ActiveCheckers |= 1UL << i; 
     }
+  }
 
-    bool returnVal = (servicesList[i].init_funct)(i);
-    if(returnVal == false){
-      return FailedInit; 
-    }
+  if(!Services::Init(PresentServices)){
+    return FailedInit; 
   }
 
+#ifdef ES_WATCHDOG_TIMEOUT
+  // after the init functions, some of them wait on hardware
+  _HW_Watchdog_Init(ES_WATCHDOG_TIMEOUT); 
+#endif
+
+#ifdef ES_WORKER_ENABLE
+  // the worker's services were initialized by this task, whatever they 
+  // posted is waiting for it in ToWorker
+  _HW_Worker_Start(ES_WorkerLoop); 
+#endif
   return Success;
 }
 
@@ -137,12 +297,21 @@ ES_Return_t ES_Initialize(TimerRate_t Rate)
  Returns
    ES_Return_t : FailedRun is any of the run functions failed during execution
  Description
-   This is the main framework function. It calls the appropriate run function when 
-   it detects the Queue isn't empty or one of the event checkers returned a true.
-   Currently, there is 1 queue so all events are handeled in a LIFO manner without 
-   regard to priority of the service.  
+   This is the main framework function. It runs the pending event checkers once 
+   and then dispatches events until every service queue is empty. The highest 
+   priority ready service is always served first, so a flood of events for a low 
+   priority service only delays a higher priority one by a single run function 
+   call. When there's nothing left to do, it idles (see ES_Idle) until a timer 
+   or an event source wakes it up. 
  Notes
-   
+   Events within a single service's queue are handled in FIFO order.
+   Timeouts from a timer that has been stopped or restarted since they were
+   posted are dropped without calling the run function.
+   Posts from the worker task are taken out of ToLoop on every pass, and a
+   run function of the worker's returning ES_ERROR fails ES_Run as well.
+   With ES_WATCHDOG_TIMEOUT the task watchdog is fed on every pass and after
+   every run function, so only a single run function (or a hung checker)
+   that blocks for that long resets the chip.
 ****************************************************************************/
 
 ES_Return_t ES_Run(void)
@@ -150,19 +319,60 @@ ES_Return_t ES_Run(void)
   static ES_Event_t ThisEvent = {.EventType=ES_NO_EVENT, .EventParam=0, .ServiceNum=0};
   static ES_Return_t returnEvent = Success; 
 
+  ES_FeedWatchdog(); 
   _HW_Process_Pending_Ints();  // process framework hw timer
+#ifdef ES_WORKER_ENABLE
+  if(__atomic_load_n(&WorkerFailed, __ATOMIC_ACQUIRE))
+  {
+    ThisEvent.EventType = ES_ERROR; 
+    returnEvent = FailedRun; 
+    return returnEvent; 
+  }
+  ES_TakeWorkerPosts(); 
+#endif
 
   // go through all event checkers until there's an event 
-  if(ThisEvent.EventType != ES_ERROR && (ES_ScanEventCheckers() || !ES_isEmpty(&Queue)))
+  if(ThisEvent.EventType != ES_ERROR 
+      && (ES_ScanEventCheckers() || Ready != 0 || !ES_isEmpty(&MulticastQueue)))
   {
-    // if queue isn't empty, process all events there until it's empty 
-    while(!ES_isEmpty(&Queue))
+    // keep going until every service queue is empty, highest priority first
+    while(Ready != 0 || !ES_isEmpty(&MulticastQueue))
     {
-      if(ES_DeQueue(&Queue, &ThisEvent) == false)
+      if(ES_MulticastIsNext() && ES_DeQueue(&MulticastQueue, &ThisEvent))
+      {
+        if(ES_DispatchMulticast(ThisEvent) == false)
+        {
+          ThisEvent.EventType = ES_ERROR; 
+          returnEvent = FailedRun; 
+          return returnEvent; 
+        }
+        continue; 
+      }
+
+      uint8_t HighestPrior = ES_GetHighestReady(Ready); 
+      if(ES_DeQueue(&EventQueues[HighestPrior], &ThisEvent) == false)
       {
-        break;
+        bitClear(Ready, HighestPrior);  // shouldn't happen, but don't spin on it
+        continue;
       } 
-      ThisEvent = servicesList[ThisEvent.ServiceNum].run_funct(ThisEvent);
+      if(ES_isEmpty(&EventQueues[HighestPrior]))
+      {
+        bitClear(Ready, HighestPrior); 
+      }
+      if(ES_Timer_IsStale(ThisEvent))
+      {
+        continue;  // the timer was stopped or restarted after this timeout was posted
+      }
+      ES_Event_t RunEvent = ThisEvent; 
+      ES_Trace_Dispatch(HighestPrior, &ThisEvent); 
+      uint32_t startTime = ES_Profiler_StartRun(); 
+      uint32_t budgetStart = ES_Budget_StartRun(); 
+      ThisEvent = Services::Run(HighestPrior, ThisEvent);
+      ES_Budget_EndRun(HighestPrior, &RunEvent, budgetStart); 
+      ES_Profiler_EndRun(HighestPrior, &RunEvent, startTime); 
+      ES_Trace_Done(HighestPrior); 
+      ES_FeedWatchdog(); 
+      ES_Payload_Release(RunEvent.Payload);  // the event is done with, a service that wants it keeps its own reference
       if(ThisEvent.EventType == ES_ERROR)
       {
         returnEvent = FailedRun;   
@@ -170,25 +380,343 @@ ES_Return_t ES_Run(void)
       }
     }
   }
+
+  ES_Idle(); 
   return returnEvent; 
 }
 
+#ifdef ES_TRACE_ENABLE
+/****************************************************************************
+ Function
+   ES_ReplayEvent
+ Parameters
+   ES_Event_t : the event, ServiceNum says which service gets it
+ Returns
+   ES_Return_t : FailedRun if the run function returned ES_ERROR
+ Description
+   Hands an event straight to a service's run function the way ES_Run 
+   would, then throws away everything the service posted. Used by the 
+   simulator to replay a trace one dispatch at a time, with the posts 
+   only showing up in the new trace
+ Notes
+   Only built with ES_TRACE_ENABLE
+****************************************************************************/
+ES_Return_t ES_ReplayEvent(ES_Event_t ThisEvent)
+{
+  uint8_t ServiceNum = ThisEvent.ServiceNum; 
+  if(ServiceNum >= NUM_SERVICES)
+  {
+    return FailedIndex; 
+  }
+
+  ES_Trace_Dispatch(ServiceNum, &ThisEvent); 
+  ES_EventType_t result = Services::Run(ServiceNum, ThisEvent).EventType; 
+  ES_Trace_Done(ServiceNum); 
+
+  ES_Event_t Dropped; 
+  for(uint8_t i=0; i<NUM_SERVICES; i++){
+    while(ES_DeQueue(&EventQueues[i], &Dropped)){
+      ES_Payload_Release(Dropped.Payload); 
+    }
+  }
+  while(ES_DeQueue(&MulticastQueue, &Dropped)){
+    ES_Payload_Release(Dropped.Payload); 
+  }
+  Ready = 0; 
+
+  return (result == ES_ERROR) ? FailedRun : Success; 
+}
+#endif /* ES_TRACE_ENABLE */
+
+/****************************************************************************
+ Function
+   ES_SetIdleInhibit
+ Parameters
+   uint8_t : the service number asking
+   bool : true to keep the device out of light sleep, false to allow it again
+ Returns
+   None
+ Description
+   Lets a service keep the device out of light sleep while it waits on 
+   something that sleeping would break, like a sensor reply on a UART that 
+   can't wake the ESP32. The framework still blocks between events.
+ Notes
+   Can be called from the worker's services as well
+****************************************************************************/
+void ES_SetIdleInhibit(uint8_t ServiceNum, bool Inhibit)
+{
+  if(ServiceNum >= NUM_SERVICES)
+  {
+    return; 
+  }
+  if(Inhibit)
+  {
+    __atomic_fetch_or(&IdleInhibit, 1UL << ServiceNum, __ATOMIC_RELAXED); 
+  }
+  else
+  {
+    __atomic_fetch_and(&IdleInhibit, ~(1UL << ServiceNum), __ATOMIC_RELAXED); 
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_GetIdleStats
+ Parameters
+   ES_IdleStats_t * : filled with the time spent in light sleep, waiting 
+                      and running since boot
+ Returns
+   None
+ Description
+   Reports the idle vs run time of the framework so the power savings of 
+   light sleep can be measured, and how often the loop and the timer alarm 
+   woke up
+ Notes
+****************************************************************************/
+void ES_GetIdleStats(ES_IdleStats_t *Stats)
+{
+  _HW_Get_Idle_Stats(Stats); 
+  if(Stats != NULL)
+  {
+    Stats->NumWakeups = NumWakeups; 
+    Stats->NumTimerAlarms = ES_Timer_GetNumAlarms(); 
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_GetQueueStats
+ Parameters
+   uint8_t : the service number, or ES_QUEUE_MULTICAST for the multicast 
+             queue
+   ES_QueueStats_t * : filled with the queue's counts since ES_Initialize
+ Returns
+   bool : false if there is no such queue
+ Description
+   Reports how many posts to a queue replaced a waiting event, dropped the 
+   oldest one or failed because it was full (see ES_QUEUE_POLICIES), and 
+   the most events it has held
+ Notes
+****************************************************************************/
+bool ES_GetQueueStats(uint8_t ServiceNum, ES_QueueStats_t *Stats)
+{
+  if(ServiceNum > ES_QUEUE_MULTICAST || Stats == NULL)
+  {
+    return false; 
+  }
+  *Stats = (ServiceNum == ES_QUEUE_MULTICAST) ? MulticastQueue.stats : EventQueues[ServiceNum].stats; 
+  return true; 
+}
+
+/****************************************************************************
+ Function
+   ES_IsServicePresent
+ Parameters
+   uint8_t : the service number
+ Returns
+   bool : true if the service was initialized and takes posts
+ Description
+   Tells whether a service's probe found its hardware in ES_Initialize, so 
+   other services can leave out the ones that weren't, e.g. not wait on 
+   readings from a sensor the unit was built without
+ Notes
+   Always true for a service without a SERV_n_PROBE
+****************************************************************************/
+bool ES_IsServicePresent(uint8_t ServiceNum)
+{
+  return ServiceNum < NUM_SERVICES && bitRead(PresentServices, ServiceNum); 
+}
+
+/****************************************************************************
+ Function
+   ES_WaitWorkerIdle
+ Parameters
+   uint32_t : the longest time to wait for, in ms
+ Returns
+   bool : true if the worker is idle, false if it was still busy at the end
+ Description
+   Blocks the loop task until the worker task has finished its dispatch and 
+   nothing is waiting for it in ToWorker, e.g. before pulling the WiFi out 
+   from under a worker service and going into deep sleep
+ Notes
+   Only called from the loop task, which is also the only one that posts to 
+   ToWorker, so the worker can't be handed more work meanwhile. Polls every 
+   tick, the worker doesn't signal when it goes idle. Always true without 
+   ES_WORKER_ENABLE
+****************************************************************************/
+bool ES_WaitWorkerIdle(uint32_t MaxWait)
+{
+#ifdef ES_WORKER_ENABLE
+  uint32_t startTime = ES_Timer_GetTime(); 
+  while(__atomic_load_n(&WorkerBusy, __ATOMIC_SEQ_CST) || !ES_CrossQueue_IsEmpty(&ToWorker))
+  {
+    if(ES_Timer_GetTime() - startTime >= MaxWait)
+    {
+      return false; 
+    }
+    _HW_Wait_For_Event(1); 
+  }
+#endif
+  return true; 
+}
+
+/****************************************************************************
+ Function
+   ES_GetCheckerStats
+ Parameters
+   uint8_t : the checker's place in EVENT_CHECKER_LIST
+   ES_CheckerStats_t * : filled with the checker's counts since ES_Initialize
+ Returns
+   bool : false if there is no such checker
+ Description
+   Reports how often an event checker found an event, came up empty and was 
+   held off by its minimum interval, so checkers that cost more polls than 
+   they are worth can have their interval raised
+ Notes
+****************************************************************************/
+bool ES_GetCheckerStats(uint8_t CheckerNum, ES_CheckerStats_t *Stats)
+{
+  if(CheckerNum >= EventCheckers::Count || Stats == NULL)
+  {
+    return false; 
+  }
+  *Stats = CheckerStats[CheckerNum]; 
+  return true; 
+}
+
+/****************************************************************************
+ Function
+   ES_Idle
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Called once every queue is empty. Works out how long it is until the next 
+   ES timer expires and light sleeps for that long if it is at least 
+   ES_LIGHT_SLEEP_MIN_TIME ms and no service inhibits it. Otherwise it just 
+   blocks until a tick, an event source or the next fallback poll.
+ Notes
+   The event sources can't all wake the device from light sleep (e.g. UART2), 
+   so every checker is polled once on the way out. Light sleep would stop the 
+   worker task as well, so it is only used while the worker has nothing to do.
+****************************************************************************/
+static void ES_Idle(void)
+{
+  uint32_t checkerWait = ES_TimeToNextChecker(); 
+  if(Ready != 0 || !ES_isEmpty(&MulticastQueue) || checkerWait == 0 || _HW_Ints_Pending())
+  {
+    return; 
+  }
+#ifdef ES_WORKER_ENABLE
+  if(!ES_CrossQueue_IsEmpty(&ToLoop))
+  {
+    return; 
+  }
+  bool workerIdle = !__atomic_load_n(&WorkerBusy, __ATOMIC_SEQ_CST) && ES_CrossQueue_IsEmpty(&ToWorker); 
+#else
+  bool workerIdle = true; 
+#endif
+
+  uint32_t idleTime = ES_IDLE_MAX_TIME; 
+  uint32_t deadline; 
+  if(ES_Timer_GetNextDeadline(&deadline))
+  {
+    int32_t timeLeft = (int32_t)(deadline - ES_Timer_GetTime()); 
+    if(timeLeft <= 0)
+    {
+      return; 
+    }
+    if((uint32_t)timeLeft < idleTime)
+    {
+      idleTime = (uint32_t)timeLeft; 
+    }
+  }
+  if(checkerWait < idleTime)
+  {
+    idleTime = checkerWait; 
+  }
+
+  if(__atomic_load_n(&IdleInhibit, __ATOMIC_RELAXED) == 0 && workerIdle && idleTime >= ES_LIGHT_SLEEP_MIN_TIME)
+  {
+    _HW_Light_Sleep(idleTime); 
+    PendingCheckers = ActiveCheckers; 
+    ES_Trace_Idled(true); 
+  }
+  else
+  {
+    if(idleTime > EVENT_CHECKER_POLL_PERIOD)
+    {
+      idleTime = EVENT_CHECKER_POLL_PERIOD; 
+    }
+    _HW_Wait_For_Event(idleTime); 
+    ES_Trace_Idled(false); 
+  }
+  NumWakeups++; 
+}
+
 /****************************************************************************
  Function
    ES_PostAll
  Parameters
    ES_Event : The Event to be posted
  Returns
-   boolean : False if any of the post functions failed during execution
+   boolean : False if the multicast queue is full
+ Description
+   posts to all of the services subscribed to the event's type (see 
+   ES_SUBSCRIPTIONS in ES_Configure.h), or to every service if its type has 
+   no subscriptions
+ Notes
+   The event only takes one slot, in the multicast queue
+****************************************************************************/
+bool ES_PostAll(ES_Event_t ThisEvent)  
+{
+  ThisEvent.ServiceNum = ES_SUBSCRIBERS_LIST; 
+  return ES_PostMulticast(ThisEvent); 
+}
+
+/****************************************************************************
+ Function
+   ES_PostMulticast
+ Parameters
+   ES_Event : The Event to be posted, ServiceNum says which post list it 
+              goes to (see ES_PostList.h)
+ Returns
+   boolean : False if the multicast queue is full
  Description
-   posts to all of the services' queues
+   Puts a multicast event in the multicast queue once. It is handed to each 
+   service on its list when it is dispatched. 
  Notes
+   Used by the post list functions. As with ES_PostToService the payload 
+   reference goes with the event and is released if the post fails. From the 
+   worker task the event goes to the loop through ToLoop first.
 ****************************************************************************/
-// bool ES_PostAll(ES_Event_t ThisEvent)  
-// {
-//   // add the new event to the queue
-//   return ES_EnQueueEnd(&Queue, ThisEvent); 
-// }
+bool ES_PostMulticast(ES_Event_t ThisEvent)
+{
+  ES_StampEvent(&ThisEvent); 
+  return ES_EnqueueMulticast(ThisEvent); 
+}
+
+/****************************************************************************
+ Function
+   ES_SetEventPending
+ Parameters
+   ES_EventSource_t : the event source that has work for its event checker
+ Returns
+   None
+ Description
+   Called by an ISR or driver callback to mark its event checker as pending,
+   so it is called on the next pass of ES_Run
+ Notes
+   Safe to call from interrupts and other tasks
+****************************************************************************/
+void IRAM_ATTR ES_SetEventPending(ES_EventSource_t Source)
+{
+#ifdef ES_TIMESTAMP_ENABLE
+  __atomic_store_n(&SourceTimes[Source], _HW_GetTimeUs(), __ATOMIC_RELAXED); 
+#endif
+  _HW_Signal_Event_Source((uint8_t)Source); 
+}
 
 /****************************************************************************
  Function
@@ -199,18 +727,100 @@ ES_Return_t ES_Run(void)
  Returns
    boolean : False if the post function failed during execution
  Description
-   posts to one of the services' queues
+   posts to the queue of the service given by ThisEvent.ServiceNum and 
+   marks that service as ready
  Notes
+   The event's payload reference is handed over to the queue. If the post 
+   fails the reference is released, so the caller never has to clean up. 
+   Call ES_Payload_Retain first to post the same payload more than once.
+   Posts between the loop task and the worker task go through ToWorker and 
+   ToLoop, so only those two tasks may post to a service run by the other. 
+   Posts from one task to one service are dispatched in the order they 
+   were made. With ES_TIMESTAMP_ENABLE the event is stamped with the time,
+   see ES_StampEvent.
 ****************************************************************************/
 bool ES_PostToService(ES_Event_t ThisEvent)
 {
-  return ES_EnQueueEnd(&Queue, ThisEvent);  
+  ES_StampEvent(&ThisEvent); 
+  return ES_EnqueuePost(ThisEvent); 
 }
 
 
 //*********************************
 // private functions
 //*********************************
+// ES_PostToService for an event that has already been stamped, so a post 
+// from the worker keeps its time when the loop takes it from ToLoop
+static bool ES_EnqueuePost(ES_Event_t ThisEvent)
+{
+  if(ThisEvent.ServiceNum >= NUM_SERVICES || !bitRead(PresentServices, ThisEvent.ServiceNum))
+  {
+    ES_Payload_Release(ThisEvent.Payload); 
+    return false; 
+  }
+#ifdef ES_WORKER_ENABLE
+  if(_HW_In_Worker())
+  {
+    return ES_WorkerPost(ThisEvent); 
+  }
+  if(bitRead(ES_WORKER_SERVICES, ThisEvent.ServiceNum))
+  {
+    ES_Trace_Post(ThisEvent.ServiceNum, &ThisEvent); 
+    return ES_PostCross(&ToWorker, ThisEvent, false); 
+  }
+#endif
+
+  ES_Profiler_Stamp(&ThisEvent); 
+  bool Success = ES_EnQueueEnd(&EventQueues[ThisEvent.ServiceNum], ThisEvent); 
+  ES_Profiler_Posted(ThisEvent.ServiceNum, Success, EventQueues[ThisEvent.ServiceNum].num_events); 
+  ES_Trace_Post(ThisEvent.ServiceNum, &ThisEvent); 
+  if(Success == false)
+  {
+    ES_Payload_Release(ThisEvent.Payload); 
+    return false; 
+  }
+  bitSet(Ready, ThisEvent.ServiceNum); 
+  return true; 
+}
+
+// ES_PostMulticast for an event that has already been stamped
+static bool ES_EnqueueMulticast(ES_Event_t ThisEvent)
+{
+#ifdef ES_WORKER_ENABLE
+  if(_HW_In_Worker())
+  {
+    return ES_PostCross(&ToLoop, ThisEvent, true); 
+  }
+#endif
+  ES_Profiler_Stamp(&ThisEvent); 
+  bool Success = ES_EnQueueEnd(&MulticastQueue, ThisEvent); 
+  ES_Profiler_Posted(ES_PROFILER_MULTICAST, Success, MulticastQueue.num_events); 
+  ES_Trace_Post(ES_TRACE_MULTICAST, &ThisEvent); 
+  if(Success == false)
+  {
+    ES_Payload_Release(ThisEvent.Payload); 
+    return false; 
+  }
+  return true; 
+}
+
+// Stamps an event with the time it happened: the time its checker's source 
+// signalled when a checker posts it, otherwise now. InChecker and CheckerTime 
+// belong to the loop task, the worker never reads them
+static inline void ES_StampEvent(ES_Event_t *ThisEvent)
+{
+#ifdef ES_TIMESTAMP_ENABLE
+#ifdef ES_WORKER_ENABLE
+  if(_HW_In_Worker())
+  {
+    ThisEvent->TimeStamp = _HW_GetTimeUs(); 
+    return; 
+  }
+#endif
+  ThisEvent->TimeStamp = InChecker ? CheckerTime : _HW_GetTimeUs(); 
+#endif
+}
+
 /****************************************************************************
  Function
    ES_ScanEventCheckers
@@ -218,35 +828,459 @@ bool ES_PostToService(ES_Event_t ThisEvent)
  Returns
    boolean : False if no events were registered 
  Description
-   Run through all the event checker functions to look for any events. This function returns the first time
-   an even checker returns true. The function then resumes again from the start of the list (rather than the next checker) 
+   Calls the event checkers that an event source has flagged as pending, 
+   starting after the last one that found an event, as ES_CHECKER_SCHEDULING
+   says. A checker that finds an event stays pending (it may have more data 
+   waiting), one that comes up empty is dropped until its source signals 
+   again. Every EVENT_CHECKER_POLL_PERIOD ms all checkers are polled as a 
+   fallback. 
  Notes
+   A pending checker called less than its minimum interval ago is skipped, 
+   and ES_Idle waits for it rather than spinning
 ****************************************************************************/
 bool ES_ScanEventCheckers(){
-  for(size_t i=0; i < ARRAY_SIZE(eventCheckerFuncts); i++){
-    if(eventCheckerFuncts[i]()){
-      return 1; 
+  static uint32_t lastPollTime = 0; 
+
+  PendingCheckers |= ES_TakeEventSources(); 
+
+  uint32_t currTime = ES_Timer_GetTime(); 
+  if((uint32_t)(currTime - lastPollTime) >= EVENT_CHECKER_POLL_PERIOD){
+    lastPollTime = currTime; 
+    PendingCheckers = ActiveCheckers; 
+  }
+
+  bool foundEvent = false; 
+  uint8_t checkerNum = NextChecker; 
+  for(uint8_t i = 0; i < EventCheckers::Count; i++)
+  {
+    uint8_t nextNum = (checkerNum + 1 < EventCheckers::Count) ? checkerNum + 1 : 0; 
+    if(ES_RunChecker(checkerNum, currTime))
+    {
+      foundEvent = true; 
+      NextChecker = nextNum; 
+      if(ES_CHECKER_SCHEDULING == ES_CHECKERS_ROUND_ROBIN)
+      {
+        break; 
+      }
     }
+    checkerNum = nextNum; 
   }
-  return 0;   
+  return foundEvent; 
 }
 
+// Calls a pending checker that isn't being held off by its minimum interval,
+// with ES_CHECKERS_WEIGHTED up to its weight times while it keeps finding 
+// events. True if it found any, one that comes up empty stops being pending
+static bool ES_RunChecker(uint8_t CheckerNum, uint32_t CurrTime)
+{
+  uint32_t checkerBit = 1UL << CheckerNum; 
+  if((PendingCheckers & checkerBit) == 0)
+  {
+    return false; 
+  }
+  ES_CheckerStats_t *stats = &CheckerStats[CheckerNum]; 
+  if((int32_t)(CurrTime - CheckerNextTime[CheckerNum]) < 0)
+  {
+    stats->HeldOff++; 
+    return false; 
+  }
+  CheckerNextTime[CheckerNum] = CurrTime + EventCheckers::MinIntervals[CheckerNum]; 
+
+#ifdef ES_TIMESTAMP_ENABLE
+  InChecker = true; 
+  CheckerTime = (SignalledCheckers & checkerBit) ? 
+      __atomic_load_n(&SourceTimes[CheckerNum], __ATOMIC_RELAXED) : _HW_GetTimeUs(); 
+#endif
+  uint8_t calls = (ES_CHECKER_SCHEDULING == ES_CHECKERS_WEIGHTED) ? EventCheckers::Weights[CheckerNum] : 1; 
+  bool foundEvent = false; 
+  while(calls-- > 0)
+  {
+    if(!EventCheckers::Check(CheckerNum))
+    {
+      stats->Misses++; 
+      PendingCheckers &= ~checkerBit; 
+#ifdef ES_TIMESTAMP_ENABLE
+      SignalledCheckers &= ~checkerBit; 
+#endif
+      break; 
+    }
+    stats->Hits++; 
+    foundEvent = true; 
+  }
+#ifdef ES_TIMESTAMP_ENABLE
+  InChecker = false; 
+#endif
+  return foundEvent; 
+}
 
-// Same as event checker above but restarts from the next function rather than the start of the list
-// bool ES_ScanEventCheckers2(){
-//   static size_t i = 0; 
+// Takes the event sources that have signalled since the last call, noting 
+// which checkers' events get their source's time
+static uint32_t ES_TakeEventSources(void)
+{
+  uint32_t sources = _HW_Take_Event_Sources() & ActiveCheckers; 
+#ifdef ES_TIMESTAMP_ENABLE
+  SignalledCheckers |= sources; 
+#endif
+  return sources; 
+}
 
-//   for(i; i < ARRAY_SIZE(eventCheckerFuncts); i++){
-//     if(eventCheckerFuncts[i]()){
-//       i++; 
-//       if(i == ARRAY_SIZE(eventCheckerFuncts))
-//         i = 0; 
-//       return 1; 
-//     }
-//   }
-//   i = 0; 
-//   return 0;   
-// }
+// Ticks until a pending checker may be called, 0 if one can be called now 
+// and UINT32_MAX if none are pending
+static uint32_t ES_TimeToNextChecker(void)
+{
+  uint32_t wait = UINT32_MAX; 
+  uint32_t currTime = ES_Timer_GetTime(); 
+  uint32_t pending = PendingCheckers | ES_TakeEventSources(); 
+  PendingCheckers = pending; 
+  while(pending != 0)
+  {
+    uint8_t checkerNum = __builtin_ctz(pending); 
+    pending &= pending - 1; 
+    int32_t timeLeft = (int32_t)(CheckerNextTime[checkerNum] - currTime); 
+    if(timeLeft <= 0)
+    {
+      return 0; 
+    }
+    if((uint32_t)timeLeft < wait)
+    {
+      wait = (uint32_t)timeLeft; 
+    }
+  }
+  return wait; 
+}
+
+
+
+/****************************************************************************
+ Function
+   ES_DispatchMulticast
+ Parameters
+   ES_Event_t : the multicast event
+ Returns
+   bool : false if any of the run functions returned ES_ERROR
+ Description
+   Hands a multicast event to every service on its list, highest priority 
+   first, then releases its payload
+ Notes
+   The services on the list get it ahead of the events waiting in their own
+   queues, see ES_MulticastIsNext. The worker's services on the list are 
+   handed their own reference to it through ToWorker, so they may run it 
+   before or after the loop's services do
+****************************************************************************/
+static bool ES_DispatchMulticast(ES_Event_t ThisEvent)
+{
+  uint16_t services = ES_PostList_GetMask(ThisEvent) & PresentServices; 
+  bool returnVal = true; 
+
+#ifdef ES_WORKER_ENABLE
+  if(services & ES_WORKER_SERVICES)
+  {
+    ES_Payload_Retain(ThisEvent.Payload); 
+    ES_PostCross(&ToWorker, ThisEvent, true); 
+    services &= ~ES_WORKER_SERVICES; 
+  }
+#endif
+
+  while(services != 0)
+  {
+    uint8_t HighestPrior = ES_GetHighestReady(services); 
+    bitClear(services, HighestPrior); 
+    ThisEvent.ServiceNum = HighestPrior; 
+    ES_Trace_Dispatch(HighestPrior, &ThisEvent); 
+    uint32_t startTime = ES_Profiler_StartRun(); 
+    uint32_t budgetStart = ES_Budget_StartRun(); 
+    ES_EventType_t result = Services::Run(HighestPrior, ThisEvent).EventType; 
+    ES_Budget_EndRun(HighestPrior, &ThisEvent, budgetStart); 
+    ES_Profiler_EndRun(HighestPrior, &ThisEvent, startTime); 
+    ES_Trace_Done(HighestPrior); 
+    ES_FeedWatchdog(); 
+    if(result == ES_ERROR)
+    {
+      returnVal = false; 
+      break; 
+    }
+  }
+
+  ES_Payload_Release(ThisEvent.Payload); 
+  return returnVal; 
+}
+
+/****************************************************************************
+ Function
+   ES_MulticastIsNext
+ Parameters
+   None
+ Returns
+   bool : true if the multicast event at the front of its queue should be 
+          dispatched before the highest priority ready service's next event
+ Description
+   A multicast event has the priority of the highest priority service on 
+   its list, so posting to a low priority service this way doesn't hold up
+   the services above it
+ Notes
+   It wins a tie, so every service on the list gets it before its own 
+   queued events. An event only for the worker's services (or for none that
+   are present) is passed on straight away
+****************************************************************************/
+static bool ES_MulticastIsNext(void)
+{
+  ES_Event_t Front; 
+  if(ES_PeekQueue(&MulticastQueue, &Front) == false)
+  {
+    return false; 
+  }
+  uint16_t services = ES_PostList_GetMask(Front) & PresentServices; 
+#ifdef ES_WORKER_ENABLE
+  services &= ~ES_WORKER_SERVICES; 
+#endif
+  if(Ready == 0 || services == 0)
+  {
+    return true; 
+  }
+  return ES_GetHighestReady(services) >= ES_GetHighestReady(Ready); 
+}
+
+/****************************************************************************
+ Function
+   ES_GetHighestReady
+ Parameters
+   uint16_t : the Ready flags, must be non-zero
+ Returns
+   uint8_t : number of the most significant bit that is set
+ Description
+   Resolves the highest priority ready service in a single step by counting
+   leading zeros (a single NSAU instruction on the ESP32) rather than 
+   scanning the flags bit by bit
+ Notes
+****************************************************************************/
+static inline uint8_t ES_GetHighestReady(uint16_t ReadyFlags)
+{
+  return (uint8_t)(31 - __builtin_clz((uint32_t)ReadyFlags)); 
+}
+
+/****************************************************************************
+ Function
+   ES_FeedWatchdog
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Tells the task watchdog the loop task is still making progress
+ Notes
+   Does nothing without ES_WATCHDOG_TIMEOUT. The worker task isn't watched,
+   its services are there because they block
+****************************************************************************/
+static inline void ES_FeedWatchdog(void)
+{
+#ifdef ES_WATCHDOG_TIMEOUT
+  _HW_Watchdog_Feed(); 
+#endif
+}
+
+#ifdef ES_WORKER_ENABLE
+/****************************************************************************
+ Function
+   ES_PostCross
+ Parameters
+   ES_CrossQueue_t * : ToWorker from the loop task, ToLoop from the worker
+   ES_Event_t : the event
+   bool : true if the event's ServiceNum is a post list
+ Returns
+   bool : false if the ring is full
+ Description
+   Hands a post to the other task and wakes it up
+ Notes
+   The payload reference goes with the event, or is released if the ring 
+   is full
+****************************************************************************/
+static bool ES_PostCross(ES_CrossQueue_t *Queue, ES_Event_t ThisEvent, bool Multicast)
+{
+  if(ES_CrossQueue_Push(Queue, &ThisEvent, Multicast) == false)
+  {
+    ES_Payload_Release(ThisEvent.Payload); 
+    return false; 
+  }
+  if(Queue == &ToWorker)
+  {
+    _HW_Worker_Signal(); 
+  }
+  else
+  {
+    _HW_Loop_Signal(); 
+  }
+  return true; 
+}
+
+/****************************************************************************
+ Function
+   ES_TakeWorkerPosts
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Posts what the worker's services posted to the loop's services and the 
+   multicast queue, in the order they were made
+ Notes
+   Loop task only. The posts are traced and profiled from here on
+****************************************************************************/
+static void ES_TakeWorkerPosts(void)
+{
+  ES_Event_t ThisEvent; 
+  bool Multicast; 
+  while(ES_CrossQueue_Pop(&ToLoop, &ThisEvent, &Multicast))
+  {
+    if(Multicast)
+    {
+      ES_EnqueueMulticast(ThisEvent); 
+    }
+    else
+    {
+      ES_EnqueuePost(ThisEvent); 
+    }
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_WorkerLoop
+ Parameters
+   None
+ Returns
+   Never
+ Description
+   The worker task's ES_Run. Takes the posts in ToWorker and dispatches to 
+   the highest priority ready worker service one event at a time, taking 
+   new posts after each one, then blocks until the loop task posts again.
+ Notes
+   Its run functions may block as long as they need to, the loop task's 
+   services keep running meanwhile. Stale timeouts are dropped the same 
+   way as in ES_Run. The trace and the profiler only follow the loop task, 
+   its dispatches and timer starts aren't recorded
+****************************************************************************/
+static void ES_WorkerLoop(void)
+{
+  for(;;)
+  {
+    // set before taking posts, so the loop never sees an empty ToWorker 
+    // and an idle worker while there is work in flight
+    __atomic_store_n(&WorkerBusy, true, __ATOMIC_SEQ_CST); 
+    ES_WorkerTakePosts(); 
+    while(WorkerReady != 0)
+    {
+      ES_Event_t ThisEvent; 
+      uint8_t HighestPrior = ES_GetHighestReady(WorkerReady); 
+      if(ES_DeQueue(&EventQueues[HighestPrior], &ThisEvent) == false)
+      {
+        bitClear(WorkerReady, HighestPrior); 
+        continue; 
+      }
+      if(ES_isEmpty(&EventQueues[HighestPrior]))
+      {
+        bitClear(WorkerReady, HighestPrior); 
+      }
+      if(ES_Timer_IsStale(ThisEvent) == false)
+      {
+        ES_WorkerDispatch(HighestPrior, ThisEvent); 
+        ES_Payload_Release(ThisEvent.Payload); 
+      }
+      ES_WorkerTakePosts(); 
+    }
+    __atomic_store_n(&WorkerBusy, false, __ATOMIC_SEQ_CST); 
+    _HW_Worker_Wait(ES_IDLE_MAX_TIME);  // returns straight away if signalled since
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_WorkerPost
+ Parameters
+   ES_Event_t : the event, ServiceNum is a service
+ Returns
+   bool : false if the queue or ToLoop is full
+ Description
+   ES_PostToService for the worker task. Posts to its own services go 
+   straight in their queues, posts to the loop's services go through ToLoop
+ Notes
+****************************************************************************/
+static bool ES_WorkerPost(ES_Event_t ThisEvent)
+{
+  if(!bitRead(ES_WORKER_SERVICES, ThisEvent.ServiceNum))
+  {
+    return ES_PostCross(&ToLoop, ThisEvent, false); 
+  }
+  if(ES_EnQueueEnd(&EventQueues[ThisEvent.ServiceNum], ThisEvent) == false)
+  {
+    ES_Payload_Release(ThisEvent.Payload); 
+    return false; 
+  }
+  bitSet(WorkerReady, ThisEvent.ServiceNum); 
+  return true; 
+}
+
+/****************************************************************************
+ Function
+   ES_WorkerTakePosts
+ Parameters
+   None
+ Returns
+   None
+ Description
+   Moves the loop task's posts from ToWorker to the worker services' queues 
+   in the order they were made. Multicast events are dispatched to the 
+   worker's services on their list straight away, as ES_Run does
+ Notes
+   Worker task only
+****************************************************************************/
+static void ES_WorkerTakePosts(void)
+{
+  ES_Event_t ThisEvent; 
+  bool Multicast; 
+  while(ES_CrossQueue_Pop(&ToWorker, &ThisEvent, &Multicast))
+  {
+    if(Multicast == false)
+    {
+      ES_WorkerPost(ThisEvent); 
+      continue; 
+    }
+    uint16_t services = ES_PostList_GetMask(ThisEvent) & PresentServices & ES_WORKER_SERVICES; 
+    while(services != 0)
+    {
+      uint8_t HighestPrior = ES_GetHighestReady(services); 
+      bitClear(services, HighestPrior); 
+      ES_WorkerDispatch(HighestPrior, ThisEvent); 
+    }
+    ES_Payload_Release(ThisEvent.Payload); 
+  }
+}
+
+/****************************************************************************
+ Function
+   ES_WorkerDispatch
+ Parameters
+   uint8_t : a worker service
+   ES_Event_t : the event
+ Returns
+   None
+ Description
+   Runs the service's run function, and fails the loop's next ES_Run if it 
+   returns ES_ERROR
+ Notes
+****************************************************************************/
+static void ES_WorkerDispatch(uint8_t ServiceNum, ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = ServiceNum; 
+  uint32_t budgetStart = ES_Budget_StartRun(); 
+  ES_EventType_t result = Services::Run(ServiceNum, ThisEvent).EventType; 
+  ES_Budget_EndRun(ServiceNum, &ThisEvent, budgetStart); 
+  if(result == ES_ERROR)
+  {
+    __atomic_store_n(&WorkerFailed, true, __ATOMIC_RELEASE); 
+    _HW_Loop_Signal(); 
+  }
+}
+#endif /* ES_WORKER_ENABLE */
 
 
 
@@ -15,7 +15,15 @@
 #include "ES_Event.h"
 #include "ES_ServicesHeaders.h"
 #include "ES_Port.h"
+#include "ES_Payload.h"
+#include "ES_Queue.h"
+#include "ES_PostList.h"
+#include "ES_Profiler.h"
+#include "ES_Budget.h"
+#include "ES_Trace.h"
+#ifndef ES_PORT_POSIX
 #include <Arduino.h>
+#endif
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -35,8 +43,55 @@ typedef enum
 ES_Return_t ES_Initialize(TimerRate_t Rate);
 ES_Return_t ES_Run(void);
 bool ES_PostToService(ES_Event_t ThisEvent);
+void ES_SetEventPending(ES_EventSource_t Source);
+void ES_SetIdleInhibit(uint8_t ServiceNum, bool Inhibit);
+void ES_GetIdleStats(ES_IdleStats_t *Stats);
+bool ES_IsServicePresent(uint8_t ServiceNum);
+bool ES_WaitWorkerIdle(uint32_t MaxWait);
 
-// bool ES_PostAll(ES_Event_t ThisEvent);
+// us time stamps from the same clock as ES_Event_t's TimeStamp. They wrap
+// after ~71 minutes, so only compare two by subtracting them
+static inline uint32_t ES_GetTimeUs(void) { return _HW_GetTimeUs(); }
+
+// when an event happened: its TimeStamp with ES_TIMESTAMP_ENABLE, otherwise
+// the time it is being handled
+static inline uint32_t ES_GetEventTime(const ES_Event_t *ThisEvent)
+{
+#ifdef ES_TIMESTAMP_ENABLE
+  return ThisEvent->TimeStamp;
+#else
+  return _HW_GetTimeUs();
+#endif
+}
+
+// the multicast queue's number for ES_GetQueueStats
+#define ES_QUEUE_MULTICAST NUM_SERVICES
+bool ES_GetQueueStats(uint8_t ServiceNum, ES_QueueStats_t *Stats);
+
+// what an event checker's calls came to, see ES_GetCheckerStats
+typedef struct
+{
+  uint32_t Hits;       // calls that found an event
+  uint32_t Misses;     // calls that came up empty
+  uint32_t HeldOff;    // times it was pending but called too recently
+}ES_CheckerStats_t;
+bool ES_GetCheckerStats(uint8_t CheckerNum, ES_CheckerStats_t *Stats);
+
+// guards data a worker service shares with the loop's services (see
+// ES_WORKER_ENABLE), only hold it to copy the data, never across a wait
+#ifdef ES_WORKER_ENABLE
+static inline void ES_Lock(void) { _HW_Lock(); }
+static inline void ES_Unlock(void) { _HW_Unlock(); }
+#else
+static inline void ES_Lock(void) {}
+static inline void ES_Unlock(void) {}
+#endif
+
+bool ES_PostAll(ES_Event_t ThisEvent);
+bool ES_PostMulticast(ES_Event_t ThisEvent);
+#ifdef ES_TRACE_ENABLE
+ES_Return_t ES_ReplayEvent(ES_Event_t ThisEvent);
+#endif
 // bool ES_PostToServiceLIFO(uint8_t WhichService, ES_Event_t TheEvent);
 
 #endif   // ES_Framework_H
@@ -11,30 +11,16 @@
 #include "HPM_Service.h"
 #include "ES_framework.h"
 #include "ES_Timers.h"
+#include "ES_Coroutine.h"
+#include "UartFrameDriver.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 
+// the kinds of frames the sensor sends, index into HPMFrameFormats
 typedef enum{
-  WAIT_START_STATE,
-  WAIT_STOP_AUTO_STATE,
-  ACK_STATE,
-  WARMUP_STATE,
-  HEAD_STATE,
-  LEN_STATE,
-  CMD_STATE,
-  PM10_DATA_HIGH_STATE,
-  PM10_DATA_LOW_STATE,
-  PM25_DATA_HIGH_STATE,
-  PM25_DATA_LOW_STATE,
-  CHECKSUM_STATE,
-  WAIT_FOR_TMOUT_STATE
-} statusState_t; 
-
-typedef enum{
-  CMD_WAIT_START_STATE,
-  ACK1_STATE,
-  ACK2_STATE
-} commSMStatus_t; 
+  DATA_FRAME=0,
+  ACK_FRAME
+} HPMFrame_t; 
 
 typedef enum{
   READ_FUNC=0,
@@ -61,40 +47,118 @@ typedef enum{
 #define AUTO_SEND_LEN 0x01
 #define STOP_AUTO_SEND_CMD 0x20
 
+// response to a read: head, len, cmd, PM2.5 hi/lo, PM10 hi/lo, checksum
+#define READ_RESPONSE_LEN 8
+#define DATA_FRAME_EXTRA_BYTES 3  // head, len and checksum aren't counted by len
+#define ACK_FRAME_LEN 2
+
 // General config 
 #define SUB_COMM_RETRIES 2
 #define MAX_RETRY_READS 2
+#define ACK_WAIT_TIME 500  // doubled on every resend
 
 //Timer lenghts
 #define SAMPLE_PERIOD 1000  // Amount of time each sample takes
 #define STOP_AUTO_WAIT_TIME 100
 #define WARMUP_WAIT_TIME 20000
+#define PROBE_RESEND_TIME 100  // the probe resends stop auto send this often
+#define PROBE_TOTAL_TIME 300  // longest the probe holds up ES_Initialize
 #define PM_MAX_VALUE 1000
 
 
 /*---------------------------- Module Functions ---------------------------*/
-bool retryRead(uint8_t *retryAttempts, uint16_t *checkSumVal, bool skipWarmup);
+static ES_CoStatus_t readCycle(ES_Event_t ThisEvent);
+static ES_CoStatus_t sendCommand(ES_Event_t ThisEvent, void (*cmdFunc)(), bool *acked);
+static bool isReadReply(ES_Event_t ThisEvent);
+static bool retryRead(void);
 void clearSerial1Buffer();
 uint16_t getChecksum(uint16_t summedVals);
+static bool isValidDataFrame(const uint8_t *frame, uint8_t len);
+static bool isValidAckFrame(const uint8_t *frame, uint8_t len);
 void readPMSensor(); 
 void stopAutoSend();
 void startMeasurements();
-ES_Event_t Comm_StateMachine(ES_Event_t ThisEvent, void (*cmdFunc)());
-bool retryComm(uint8_t *retryAttempts, void (*cmdFunc)());
 void updateRunAvg(runAvg_t *runAvgValues, uint16_t newSensorVal);
+static void serial1RxCallback(void);
 
 
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t MyPriority;
-static statusState_t currStatusState = WAIT_START_STATE;
-static commSMStatus_t currCommSMState = CMD_WAIT_START_STATE; 
+static ES_Co_t readCo;     // the read cycle, RunHPMService resumes it
+static ES_Co_t commCo;     // one command and its ack, run by the read cycle
 static uint8_t numGoodReads = 0;  // would need to reset
+static uint8_t retryAttempts = 0; 
+static bool fanOn = false;        // measurements started and not stopped since
+static bool waitingOnSensor = false; 
 static runAvg_t pm10RunAvg = {.runAvgSum=0, .buff={0}, .oldestIdx=0};
 static runAvg_t pm25RunAvg = {.runAvgSum=0, .buff={0}, .oldestIdx=0};
 static bool sensorConnected = false; 
 static IAQmode_t HPM_mode = STREAM_MODE; 
 
+static const UartFrameFormat_t HPMFrameFormats[] = {
+  {.Header=RECEIVE_BYTE_HEAD, .LenIndex=1, .Len=DATA_FRAME_EXTRA_BYTES, .IsValid=isValidDataFrame},
+  {.Header=POS_ACK, .LenIndex=0, .Len=ACK_FRAME_LEN, .IsValid=isValidAckFrame}
+};
+static UartFrameDriver_t HPMFrames; 
+static ES_TimerHandle_t commTimer = ES_TIMER_INVALID;  // ack timeouts of sendCommand
+
 /*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     ProbeHPMService
+
+ Parameters
+     None
+
+ Returns
+     bool, true if the sensor answered
+
+ Description
+     Called by ES_Initialize before any init function (SERV_3_PROBE), with
+     the sensors powered up. Asks the sensor to stop auto sending and waits 
+     for any bytes back, resending every PROBE_RESEND_TIME, for no more than 
+     PROBE_TOTAL_TIME in all. A unit built without the HPM leaves Serial1 
+     closed and never polls or waits on it
+ Notes
+     Runs before the watchdog is set up and holds up every other service's 
+     init, hence the hard limit. Only waits it out when there is no sensor, 
+     which ES_PROBE_RECHECK_BOOTS keeps to power on and every few boots. 
+     Prints how long the sensor took to answer, so the limit can be checked 
+     against a freshly powered sensor
+****************************************************************************/
+bool ProbeHPMService(void)
+{
+  Serial1.begin(9600);
+  while (!Serial1) {
+    ;
+  } 
+
+  uint32_t startTime = millis(); 
+  while(!Serial1.available() && millis() - startTime < PROBE_TOTAL_TIME)
+  {
+    uint32_t sendTime = millis(); 
+    stopAutoSend(); 
+    while(!Serial1.available() && millis() - sendTime < PROBE_RESEND_TIME 
+        && millis() - startTime < PROBE_TOTAL_TIME)
+    {
+      delay(1); 
+    }
+  }
+  if(!Serial1.available())
+  {
+    IAQ_PRINTF("No HPM sensor\n");
+    Serial1.end(); 
+    return false; 
+  }
+  IAQ_PRINTF("HPM answered the probe after %lu ms\n", (unsigned long)(millis() - startTime));
+
+  while(Serial1.available())
+  {
+    Serial1.read();  // the ack or an auto sent reading
+  }
+  return true; 
+}
+
 /****************************************************************************
  Function
      InitHPMService
@@ -113,6 +177,7 @@ static IAQmode_t HPM_mode = STREAM_MODE;
 bool InitHPMService(uint8_t Priority)
 {
   MyPriority = Priority;
+  ES_Trace_WatchState(MyPriority, &readCo.Resume, sizeof(readCo.Resume));
 
   memset(pm10RunAvg.buff, 0, sizeof(pm10RunAvg.buff));
   memset(pm25RunAvg.buff, 0, sizeof(pm25RunAvg.buff));
@@ -121,6 +186,16 @@ bool InitHPMService(uint8_t Priority)
   while (!Serial1) {
     ;
   } 
+  Serial1.onReceive(serial1RxCallback);  // only check Serial1 once bytes arrive
+  UartFrame_Init(&HPMFrames, &Serial1, HPMFrameFormats, ARRAY_SIZE(HPMFrameFormats), 
+      PostHPMService, ES_SERIAL1); 
+
+  commTimer = ES_Timer_Alloc(PostHPMService);
+  if(commTimer == ES_TIMER_INVALID)
+    return false;
+
+  ES_Event_t initEvent = {.EventType=ES_INIT}; 
+  readCycle(initEvent);  // waits for the first ES_READ_SENSOR
 
   return true; 
 }
@@ -156,262 +231,134 @@ bool PostHPMService(ES_Event_t ThisEvent)
    ES_Event, ES_NO_EVENT if no error ES_ERROR otherwise
 
  Description
-   state machine that handles the serial communication with the HPM sensor. SM reads from
-   HPM sensor every 1 second until it has averaged 3 data points or has made too many 
-   attempts. 
+   handles the serial communication with the HPM sensor. On ES_READ_SENSOR it 
+   starts the fan and reads the sensor every 1 second until it has filled the 
+   running average or has made too many attempts. 
  Notes
+   The protocol itself is the readCycle coroutine, this just resumes it
 ****************************************************************************/
 ES_Event_t RunHPMService(ES_Event_t ThisEvent)
 {
   // Serial.printf("HPM event: %d %d\n", ThisEvent.EventType, ThisEvent.EventParam);
   ES_Event_t ReturnEvent = {.EventType=ES_NO_EVENT};  // asume no errors
-  static uint8_t retryAttempts = 0; 
-  static uint16_t pm25Val, pm10Val = 0; 
-  static uint16_t checkSumVal = 0; 
 
   #ifdef DEBUG_SENSOR
   if(ThisEvent.EventType == ES_SERIAL1)
   {
-    printf("D: %x\n", ThisEvent.EventParam);
+    printf("Frame: %d\n", UartFrame_GetFormat(ThisEvent));
   }
   #endif
 
-  switch (currStatusState)
+  // sent to all the sensors by MainService
+  if(ThisEvent.EventType == IAQ_MODE_EVENT)
   {
-    case WAIT_START_STATE:
-    {
-      if(ThisEvent.EventType == ES_READ_SENSOR)
-      {
-        #ifdef DEBUG_SENSOR
-        printf("Starting\n");
-        #endif
-
-        stopAutoSend(); 
-        currStatusState = WAIT_STOP_AUTO_STATE; 
-        ES_Timer_InitTimer(HPM_TIMER_NUM, STOP_AUTO_WAIT_TIME); 
-      }
-      else if(ThisEvent.EventType == COMMSM_SEND || ThisEvent.EventType == ES_TIMEOUT || ThisEvent.EventType == ES_SERIAL1)
-      {
-        #ifdef DEBUG_SENSOR
-        printf("Comm at start: ");
-        #endif
-        Comm_StateMachine(ThisEvent, startMeasurements); 
-      }
-
-      break;
-    }
-
-    case WAIT_STOP_AUTO_STATE: 
-    {
-      if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        #ifdef DEBUG_SENSOR
-        printf("0: ");
-        #endif
+    setModeHPM((IAQmode_t)ThisEvent.EventParam); 
+    return ReturnEvent; 
+  }
 
-        ES_Event_t startCommEvent = {.EventType=COMMSM_SEND}; 
-        Comm_StateMachine(startCommEvent, startMeasurements); 
-        currStatusState = ACK_STATE; 
-        ES_Timer_InitTimer(HPM_TIMER_NUM, 4000);  // serves as a back-up in case lower SM gets stuck, should never have a timeout, make 2x max comm timer len
-      }
+  readCycle(ThisEvent); 
 
-      break;
-    }
+  // the reply would be lost waking up from light sleep, so stay awake while
+  // waiting on the sensor
+  ES_SetIdleInhibit(MyPriority, waitingOnSensor);
 
-    case ACK_STATE:
-    {
-      if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        currCommSMState = CMD_WAIT_START_STATE; 
-        retryRead(&retryAttempts, &checkSumVal, false); 
-        IAQ_PRINTF("Err: Comm SM didn't respond\n");
-      }
-      else
-      {
-        #ifdef DEBUG_SENSOR
-        printf("1: ");
-        #endif
-        ES_Event_t commReturnEvent = Comm_StateMachine(ThisEvent, startMeasurements); 
-        if(commReturnEvent.EventType == ES_FAIL)
-        {
-          retryRead(&retryAttempts, &checkSumVal, false); 
-        }
-        else if(commReturnEvent.EventType == ES_SUCCESS)
-        {
-          currStatusState = WARMUP_STATE; 
-          ES_Timer_InitTimer(HPM_TIMER_NUM, WARMUP_WAIT_TIME); 
-        } 
-      }
+  return ReturnEvent;
+}
 
-      break;
-    }
-    case WARMUP_STATE: 
-    {
-      if((ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-        || ThisEvent.EventType == ES_READ_SENSOR)
-      {
-        #ifdef DEBUG_SENSOR
-        printf("2: ");
-        #endif
-    
-        clearSerial1Buffer(); 
-        readPMSensor(); 
-        ES_Timer_InitTimer(HPM_TIMER_NUM, SAMPLE_PERIOD);
-        currStatusState = HEAD_STATE; 
-        checkSumVal = 0; 
-      }
-      break;
-    }
-    case HEAD_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL1 && ThisEvent.EventParam == RECEIVE_BYTE_HEAD)
-      {
-        currStatusState = LEN_STATE; 
-        checkSumVal += ThisEvent.EventParam; 
-        #ifdef DEBUG_SENSOR
-        printf("3: ");
-        #endif
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
-      }
-      
-      break;
-    }
 
-    case LEN_STATE: 
-    {
-      if(ThisEvent.EventType == ES_SERIAL1)
-      {
-        currStatusState = CMD_STATE; 
-        checkSumVal += ThisEvent.EventParam; 
-        #ifdef DEBUG_SENSOR
-        printf("4: ");
-        #endif
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
-      }
+// posts an ES_SERIAL1 event for every whole frame received from the sensor
+bool EventCheckerHPM(){
+  return UartFrame_Receive(&HPMFrames); 
+}
 
-      break;
-    }
+void getPMAvg(int16_t *pm10Avg, int16_t *pm25Avg)
+{
+  if(sensorConnected)
+  {
+    *pm10Avg = round((float)pm10RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
+    *pm25Avg = round((float)pm25RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
+  }
+  else
+  {
+    *pm10Avg = -1; 
+    *pm25Avg = -1; 
+  }
 
-    case CMD_STATE: 
-    {
-      if(ThisEvent.EventType == ES_SERIAL1 && ThisEvent.EventParam == READ_MEASUREMENT_CMD)
-      {
-        currStatusState = PM25_DATA_HIGH_STATE; 
-        checkSumVal += ThisEvent.EventParam; 
-        #ifdef DEBUG_SENSOR
-        printf("5: ");
-        #endif
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
-      }
+  IAQ_PRINTF("pm10 run avg: %d  ", *pm10Avg); 
+  IAQ_PRINTF("pm25 run avg: %d\n", *pm25Avg);
+}
 
-      break;
-    }
 
-    case PM25_DATA_HIGH_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL1)
-      {
-        checkSumVal += ThisEvent.EventParam; 
-        pm25Val = ThisEvent.EventParam; 
-        pm25Val <<= 8; 
+void setModeHPM(IAQmode_t newMode)
+{
+  HPM_mode = newMode; 
+}
 
-        currStatusState = PM25_DATA_LOW_STATE;
-        #ifdef DEBUG_SENSOR
-        printf("6: ");
-        #endif
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
-      }
-      
-      break;
-    }
 
-    case PM25_DATA_LOW_STATE: 
-    {
-      if(ThisEvent.EventType == ES_SERIAL1)
-      {
-        checkSumVal += ThisEvent.EventParam; 
-        ThisEvent.EventParam &= 0xFF; 
-        pm25Val += ThisEvent.EventParam; 
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+// runs in the UART driver's task when bytes have been received
+static void serial1RxCallback(void)
+{
+  ES_SetEventPending(HPM_EVENT_SRC); 
+}
 
-        currStatusState = PM10_DATA_HIGH_STATE;
-        #ifdef DEBUG_SENSOR
-        printf("7: ");
-        #endif
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
-      }
+// Waits for ES_READ_SENSOR, starts the fan and waits for it to warm up, then 
+// reads the sensor every SAMPLE_PERIOD until twice the running average has 
+// been read (so the first values are discarded) and stops the fan. In stream
+// mode it keeps reading. A read that fails is retried without restarting the
+// fan.
+static ES_CoStatus_t readCycle(ES_Event_t ThisEvent)
+{
+  static bool acked; 
 
-      break;
-    }
+  ES_CO_BEGIN(&readCo); 
+  for(;;)
+  {
+    ES_CO_AWAIT(&readCo, ThisEvent.EventType == ES_READ_SENSOR); 
 
-    case PM10_DATA_HIGH_STATE:
+    if(!fanOn)
     {
-      if(ThisEvent.EventType == ES_SERIAL1)
-      {
-        checkSumVal += ThisEvent.EventParam; 
-        pm10Val = ThisEvent.EventParam; 
-        pm10Val <<= 8; 
+      #ifdef DEBUG_SENSOR
+      printf("Starting\n");
+      #endif
+      stopAutoSend(); 
+      ES_CO_AWAIT_TIMER(&readCo, ThisEvent, HPM_TIMER_NUM, STOP_AUTO_WAIT_TIME); 
 
-        currStatusState = PM10_DATA_LOW_STATE;
-        #ifdef DEBUG_SENSOR
-        printf("8: ");
-        #endif
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
+      waitingOnSensor = true; 
+      ES_CO_CALL(&readCo, &commCo, sendCommand(ThisEvent, startMeasurements, &acked)); 
+      waitingOnSensor = false; 
+      if(!acked)
       {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
+        retryRead(); 
+        continue; 
       }
-      
-      break;
+      fanOn = true; 
+      ES_CO_AWAIT_TIMER(&readCo, ThisEvent, HPM_TIMER_NUM, WARMUP_WAIT_TIME); 
     }
 
-    case PM10_DATA_LOW_STATE: 
+    ES_Timer_InitPeriodic(HPM_TIMER_NUM, SAMPLE_PERIOD);
+    do
     {
-      if(ThisEvent.EventType == ES_SERIAL1)
-      {
-        checkSumVal += ThisEvent.EventParam; 
-        ThisEvent.EventParam &= 0xFF; 
-        pm10Val += ThisEvent.EventParam; 
-
-        currStatusState = CHECKSUM_STATE; 
-        #ifdef DEBUG_SENSOR
-        printf("9: ");
-        #endif
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
+      #ifdef DEBUG_SENSOR
+      printf("Reading\n");
+      #endif
+      clearSerial1Buffer(); 
+      readPMSensor(); 
+      waitingOnSensor = true; 
+      ES_CO_AWAIT(&readCo, isReadReply(ThisEvent) || ES_Co_IsTimeout(ThisEvent, HPM_TIMER_NUM)); 
+      waitingOnSensor = false; 
+      if(ThisEvent.EventType == ES_TIMEOUT)
       {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
+        break;  // no reply within the sample period
       }
 
-      break;
-    }
-
-    case CHECKSUM_STATE:
-    {
-      if(ThisEvent.EventType == ES_SERIAL1 && ThisEvent.EventParam == getChecksum(checkSumVal))
       {
-        sensorConnected = true; 
+        uint8_t len; 
+        const uint8_t *frame = UartFrame_Get(ThisEvent, &len); 
+        uint16_t pm25Val = ((uint16_t)frame[3] << 8) | frame[4]; 
+        uint16_t pm10Val = ((uint16_t)frame[5] << 8) | frame[6]; 
         #ifdef DEBUG_SENSOR
         printf("HPM 2.5: %d\n", pm25Val);
         printf("HPM 10: %d\n", pm10Val); 
@@ -425,141 +372,117 @@ ES_Event_t RunHPMService(ES_Event_t ThisEvent)
 
         updateRunAvg(&pm10RunAvg, pm10Val); 
         updateRunAvg(&pm25RunAvg, pm25Val); 
-
-        checkSumVal = 0; 
-        retryAttempts = 0; 
-        currStatusState = WAIT_FOR_TMOUT_STATE; 
       }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        retryRead(&retryAttempts, &checkSumVal, true);
-        return ReturnEvent; 
-      }
-      
-      break;
-    }
+      sensorConnected = true; 
+      retryAttempts = 0; 
 
-    case WAIT_FOR_TMOUT_STATE: 
+      ES_CO_AWAIT(&readCo, ES_Co_IsTimeout(ThisEvent, HPM_TIMER_NUM)); 
+      if(HPM_mode == STREAM_MODE)
+        numGoodReads = 0; 
+      else
+        numGoodReads++; 
+    } while(numGoodReads < RUN_AVG_BUFFER_LEN*2);  // twice as long as buffer so first 8 values are discarded
+
+    if(numGoodReads < RUN_AVG_BUFFER_LEN*2)
     {
-      if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == HPM_TIMER_NUM)
-      {
-        if(HPM_mode == STREAM_MODE)
-          numGoodReads = 0; 
-        else
-          numGoodReads++; 
-
-        if(numGoodReads < RUN_AVG_BUFFER_LEN*2)  // twice as long as buffer so first 8 values are discarded
-        {
-          #ifdef DEBUG_SENSOR
-          printf("Again: \n");
-          #endif
-          currStatusState = WARMUP_STATE;
-          ES_Event_t newEvent = {.EventType=ES_READ_SENSOR};
-          PostHPMService(newEvent);
-        }
-        else
-        {
-          currStatusState = WAIT_START_STATE;
-          numGoodReads = 0; 
-          int16_t avgPM10 =  round((float)pm10RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN);
-          int16_t avgPM25  = round((float)pm25RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
-
-          IAQ_PRINTF("Avg PM 10: %d, sum: %d  ", avgPM10, pm10RunAvg.runAvgSum); 
-          IAQ_PRINTF("Avg PM 2.5: %d, sum: %d\n", avgPM25, pm25RunAvg.runAvgSum); 
-          
-          updateHPMVal(avgPM25, avgPM10);
-
-          #ifdef DEBUG_SENSOR
-          printf("Done reading\n");
-          #endif
-
-          //stop the fan now
-          ES_Event_t startCommEvent = {.EventType=COMMSM_SEND}; 
-          Comm_StateMachine(startCommEvent, stopHPMMeasurements); 
-        }
-      }
-      break;
+      retryRead(); 
+      continue; 
     }
-  }
 
-  return ReturnEvent;
-}
+    numGoodReads = 0; 
+    ES_Timer_StopTimer(HPM_TIMER_NUM); 
+    {
+      int16_t avgPM10 =  round((float)pm10RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN);
+      int16_t avgPM25  = round((float)pm25RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
 
+      IAQ_PRINTF("Avg PM 10: %d, sum: %d  ", avgPM10, pm10RunAvg.runAvgSum); 
+      IAQ_PRINTF("Avg PM 2.5: %d, sum: %d\n", avgPM25, pm25RunAvg.runAvgSum); 
+      
+      updateHPMVal(avgPM25, avgPM10);
+    }
 
-bool EventCheckerHPM(){
-  if(Serial1.available())
-  {
-    ES_Event_t newEvent; 
-    newEvent.EventType = ES_SERIAL1; 
-    newEvent.EventParam = Serial1.read(); 
-    PostHPMService(newEvent); 
+    #ifdef DEBUG_SENSOR
+    printf("Done reading\n");
+    #endif
 
-    return true; 
+    //stop the fan now
+    fanOn = false; 
+    waitingOnSensor = true; 
+    ES_CO_CALL(&readCo, &commCo, sendCommand(ThisEvent, stopHPMMeasurements, &acked)); 
+    waitingOnSensor = false; 
   }
-
-  return false; 
+  ES_CO_END(&readCo); 
 }
 
-void getPMAvg(int16_t *pm10Avg, int16_t *pm25Avg)
+// Sends a command and waits for the sensor's ack, resending it with twice 
+// the wait up to SUB_COMM_RETRIES times. Sets *acked once done
+static ES_CoStatus_t sendCommand(ES_Event_t ThisEvent, void (*cmdFunc)(), bool *acked)
 {
-  if(sensorConnected)
-  {
-    *pm10Avg = round((float)pm10RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
-    *pm25Avg = round((float)pm25RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
-  }
-  else
+  static uint8_t attempt; 
+
+  ES_CO_BEGIN(&commCo); 
+  for(attempt = 0; ; attempt++)
   {
-    *pm10Avg = -1; 
-    *pm25Avg = -1; 
+    #ifdef DEBUG_SENSOR
+    printf("Comm attempt %d\n", attempt);
+    #endif
+    clearSerial1Buffer(); 
+    cmdFunc(); 
+    ES_Timer_InitTimer(commTimer, ACK_WAIT_TIME * (0x01 << attempt));
+    ES_CO_AWAIT(&commCo, (ThisEvent.EventType == ES_SERIAL1 && UartFrame_GetFormat(ThisEvent) == ACK_FRAME)
+        || ES_Co_IsTimeout(ThisEvent, commTimer)); 
+    if(ThisEvent.EventType == ES_SERIAL1)
+    {
+      ES_Timer_StopTimer(commTimer); 
+      *acked = true; 
+      ES_CO_RETURN(&commCo); 
+    }
+    if(attempt >= SUB_COMM_RETRIES)
+    {
+      IAQ_PRINTF("Failed sub comm SM\n");
+      *acked = false; 
+      ES_CO_RETURN(&commCo); 
+    }
   }
-
-  IAQ_PRINTF("pm10 run avg: %d  ", *pm10Avg); 
-  IAQ_PRINTF("pm25 run avg: %d\n", *pm25Avg);
+  ES_CO_END(&commCo); 
 }
 
-
-void setModeHPM(IAQmode_t newMode)
+// the sensor's answer to readPMSensor
+static bool isReadReply(ES_Event_t ThisEvent)
 {
-  HPM_mode = newMode; 
-}
-
+  if(ThisEvent.EventType != ES_SERIAL1 || UartFrame_GetFormat(ThisEvent) != DATA_FRAME)
+    return false; 
 
-/***************************************************************************
- private functions
- ***************************************************************************/
+  uint8_t len; 
+  const uint8_t *frame = UartFrame_Get(ThisEvent, &len); 
+  return frame != NULL && len == READ_RESPONSE_LEN && frame[2] == READ_MEASUREMENT_CMD; 
+}
 
-bool retryRead(uint8_t *retryAttempts, uint16_t *checkSumVal, bool skipWarmup)
+// posts ES_READ_SENSOR to try the read cycle again, unless it has already
+// been tried MAX_RETRY_READS times
+static bool retryRead(void)
 {
-  if(retryAttempts == NULL || checkSumVal == NULL)
-    return false; 
-
   sensorConnected = false; 
   if(HPM_mode == STREAM_MODE)
   {
-    *retryAttempts = 0;  // in stream mode don't need to stop trying
+    retryAttempts = 0;  // in stream mode don't need to stop trying
   }
 
-  *checkSumVal = 0; 
   ES_Timer_StopTimer(HPM_TIMER_NUM);  // in case timer is still running
 
-  if(skipWarmup)
-    currStatusState = WARMUP_STATE;  // Fan has already started. No need to retry this
-  else
-    currStatusState = WAIT_START_STATE;
-
-  if(*retryAttempts >= MAX_RETRY_READS)
+  if(retryAttempts >= MAX_RETRY_READS)
   {
     numGoodReads = 0; 
-    *retryAttempts = 0; 
+    retryAttempts = 0; 
     updateHPMVal(-1, -1);
     IAQ_PRINTF("Could not read from HPM sensor\n");
     return false; 
   }
 
   #ifdef DEBUG_SENSOR
-  printf("Retrying: %d\n", *retryAttempts);
+  printf("Retrying: %d\n", retryAttempts);
   #endif
-  *retryAttempts = *retryAttempts + 1; 
+  retryAttempts++; 
   ES_Event_t newEvent = {.EventType=ES_READ_SENSOR};
   PostHPMService(newEvent);
   return true; 
@@ -573,8 +496,9 @@ void clearSerial1Buffer()
 
   while(Serial1.available())
   {
-    ; 
+    Serial1.read(); 
   }
+  UartFrame_Reset(&HPMFrames); 
 }
 
 void stopAutoSend()
@@ -626,114 +550,25 @@ uint16_t getChecksum(uint16_t summedVals)
   return (65536 - (uint32_t)summedVals) % 256; 
 }
 
-
-
-//Lower level state machine used to handle simple pos/neg ack communicataion 
-//with the HPM sensor 
-ES_Event_t Comm_StateMachine(ES_Event_t ThisEvent, void (*cmdFunc)())
+// checksum is (65536 - sum of every other byte) mod 256
+static bool isValidDataFrame(const uint8_t *frame, uint8_t len)
 {
-  #ifdef DEBUG_SENSOR
-  printf("Comm event: %d %d\n", ThisEvent.EventType, ThisEvent.EventParam);
-  #endif
-  ES_Event_t returnEvent = {.EventType=ES_NO_EVENT};
-  static uint8_t retryAttempts = 0; 
-
-  if(cmdFunc == NULL)
-  {
-    returnEvent.EventType = ES_FAIL; 
-    return returnEvent; 
-  }
-
-  switch (currCommSMState)
+  uint16_t sum = 0; 
+  for(uint8_t i=0; i < len-1; i++)
   {
-    case CMD_WAIT_START_STATE:
-    {
-      #ifdef DEBUG_SENSOR
-      printf("Comm 1: \n");
-      #endif
-      if(ThisEvent.EventType == COMMSM_SEND)
-      {
-        clearSerial1Buffer(); 
-        cmdFunc(); 
-        currCommSMState = ACK1_STATE; 
-        ES_Timer_InitTimer(COMMSM_TIMER_NUM, 500 * (0x01 << retryAttempts));
-      }
-      break;
-    }
-
-    case ACK1_STATE: 
-    {
-      #ifdef DEBUG_SENSOR
-      printf("Comm 2: \n");
-      #endif
-      if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == COMMSM_TIMER_NUM)
-      {
-        if(!retryComm(&retryAttempts, cmdFunc))
-        {
-          returnEvent.EventType = ES_FAIL; 
-        }
-      }
-      else if(ThisEvent.EventType == ES_SERIAL1 && ThisEvent.EventParam == POS_ACK)
-      {
-        currCommSMState = ACK2_STATE; 
-      }
-      break;
-    }
-
-    case ACK2_STATE: 
-    {
-      #ifdef DEBUG_SENSOR
-      printf("Comm 3: \n");
-      #endif
-      if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == COMMSM_TIMER_NUM)
-      {
-        if(!retryComm(&retryAttempts, cmdFunc))
-        {
-          returnEvent.EventType = ES_FAIL; 
-          IAQ_PRINTF("Comm fail\n");
-        }
-      }
-      else if(ThisEvent.EventType == ES_SERIAL1 && ThisEvent.EventParam == POS_ACK)
-      {
-        currCommSMState = CMD_WAIT_START_STATE;
-        returnEvent.EventType = ES_SUCCESS;  
-        retryAttempts = 0; 
-        ES_Timer_StopTimer(COMMSM_TIMER_NUM); 
-        #ifdef DEBUG_SENSOR
-        printf("Comm success\n");
-        #endif
-      }
-      break;
-    }
+    sum += frame[i]; 
   }
-
-  return returnEvent;
+  return frame[len-1] == getChecksum(sum); 
 }
 
-
-bool retryComm(uint8_t *retryAttempts, void (*cmdFunc)())
+// positive ack is 0xA5 0xA5
+static bool isValidAckFrame(const uint8_t *frame, uint8_t len)
 {
-  if(retryAttempts == NULL || cmdFunc == NULL)
-    return false; 
-  
-  currCommSMState = CMD_WAIT_START_STATE; 
-  if(*retryAttempts >= SUB_COMM_RETRIES)
-  {
-    *retryAttempts = 0; 
-    ES_Timer_StopTimer(COMMSM_TIMER_NUM);
-    IAQ_PRINTF("Failed sub comm SM\n");
-    return false; 
-  }
+  return len == ACK_FRAME_LEN && frame[1] == POS_ACK; 
+}
+
 
-  #ifdef DEBUG_SENSOR
-  printf("Subcomm retry %d\n", *retryAttempts);
-  #endif
 
-  *retryAttempts = *retryAttempts + 1; 
-  ES_Event_t newEvent = {.EventType=COMMSM_SEND};
-  Comm_StateMachine(newEvent, cmdFunc);
-  return true; 
-}
 /*------------------------------- Footnotes -------------------------------*/
 /*------------------------------ End of file ------------------------------*/
 
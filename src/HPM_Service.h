@@ -13,6 +13,7 @@
 #include <stdint.h>
 
 // Public Function Prototypes
+bool ProbeHPMService(void);
 bool InitHPMService(uint8_t Priority);
 bool PostHPMService(ES_Event_t ThisEvent);
 ES_Event_t RunHPMService(ES_Event_t ThisEvent);
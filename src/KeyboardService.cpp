@@ -97,7 +97,7 @@ ES_Event_t RunKeyboardService(ES_Event_t ThisEvent)
 bool EventCheckerKeyBoard()
 {
   if (Serial.available()){ 
-    ES_Event_t newEvent;
+    ES_Event_t newEvent = {};
     newEvent.EventType = ES_SERIAL;
     newEvent.EventParam = Serial.read();
     PostKeyboardService(newEvent); 
@@ -21,6 +21,7 @@ void updateCO2Val(int16_t CO2_newVal);
 void updateHPMVal(int16_t PM25_newVal, int16_t PM10_newVal);
 void updateSVM30Vals(int16_t eCO2_newVal, int16_t tVOC_newVal, int16_t tm_newVal, int16_t rh_newVal);
 bool mainSMinStreamMode();
+void powerUpSensors();
 
 #endif /* ServMain_H */
 
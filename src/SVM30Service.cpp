@@ -12,6 +12,7 @@
 #include "SVM30Service.h"
 #include "ES_framework.h"
 #include "ES_Timers.h"
+#include "ES_Coroutine.h"
 #include "Wire.h"
 
 /*----------------------------- Module Defines ----------------------------*/
@@ -20,6 +21,8 @@
 #define SVM30_STARTUP_TIME 20
 #define SVM30_RESP_LEN 6
 #define SVM30_WAIT_TIME 20
+#define SVM30_READ_TIMEOUT 100
+#define SVM30_RETRY_TIME 200
 
 // eCO2 and tVOC sensor
 #define SGP30_FLAG true
@@ -41,26 +44,26 @@
 #define SVM30_SAMPLE_READS 16  // total samples to read, including NUM_SAMPLES_SKIP
 #define I2C_SUCCESS 0
 
-typedef enum{
-  INIT_MEASUREMENTS_STATE,
-  WARMUP_STATE,
-  REQUEST_READ_STATE,
-  READ_DATA_STATE
-} SMStatusState_t; 
-
 /*---------------------------- Module Functions ---------------------------*/
 void check_sum(); 
 void printTempRHValues(); 
 void printAirQualityValues(); 
-uint8_t crcCheck(uint8_t* p, int len);
+uint8_t crcCheck(const uint8_t* p, int len);
 void clearI2CBuffer();
-bool retryRead(uint8_t *retryAttempts, uint8_t *bytesRead, uint8_t *data_idx, bool *sensorFlag);
+static ES_CoStatus_t readCycle(ES_Event_t ThisEvent);
+static ES_CoStatus_t readSensor(ES_Event_t ThisEvent, uint8_t addr, uint8_t cmd1, uint8_t cmd2, bool *ok);
+static bool writeCommand(uint8_t addr, uint8_t cmd1, uint8_t cmd2);
+static bool ackAddress(uint8_t addr);
+static bool retryRead(void);
 uint16_t rawDataToRH(uint16_t temp_raw, uint16_t rh_raw);
 uint16_t rawDataToTemp(uint16_t temp_raw);
 
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t MyPriority;
-static SMStatusState_t currSMState = INIT_MEASUREMENTS_STATE; 
+static ES_Co_t cycleCo;    // the read cycle, RunSVM30Service resumes it
+static ES_Co_t readCo;     // one measurement, run by the read cycle
+static uint16_t sensorWords[2];  // the 2 words of the last measurement
+static uint8_t retryAttempts = 0; 
 static IAQmode_t SVM30_mode = STREAM_MODE; 
 static uint8_t numReads = 0;  // num of sensor readings completed for the avg
 static bool sensorConnected = false; 
@@ -70,6 +73,34 @@ static runAvg_t tempRunAvg = {.runAvgSum=0, .buff={0}, .oldestIdx=0};
 static runAvg_t rhRunAvg = {.runAvgSum=0, .buff={0}, .oldestIdx=0};
 
 /*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     ProbeSVM30Service
+
+ Parameters
+     None
+
+ Returns
+     bool, true if both of the SVM30's sensors answered
+
+ Description
+     Called by ES_Initialize before any init function (SERV_1_PROBE), with
+     the sensors powered up. Addresses the SGP30 and the SHTC1 on the I2C 
+     bus, so a unit built without the SVM30 never polls or waits on it
+ Notes
+****************************************************************************/
+bool ProbeSVM30Service(void)
+{
+  Wire.begin();
+  delay(SVM30_STARTUP_TIME); 
+  if(ackAddress(SGP30_ADDR) && ackAddress(SHTC1_ADDR))
+  {
+    return true; 
+  }
+  IAQ_PRINTF("No SVM30 sensor\n");
+  return false; 
+}
+
 /****************************************************************************
  Function
      InitSVM30Service
@@ -88,12 +119,16 @@ static runAvg_t rhRunAvg = {.runAvgSum=0, .buff={0}, .oldestIdx=0};
 bool InitSVM30Service(uint8_t Priority)
 {
   MyPriority = Priority;
+  ES_Trace_WatchState(MyPriority, &cycleCo.Resume, sizeof(cycleCo.Resume));
   Wire.begin();
   memset(eCO2RunAvg.buff, 0, sizeof(eCO2RunAvg.buff));
   memset(tVOCRunAvg.buff, 0, sizeof(tVOCRunAvg.buff));
   memset(tempRunAvg.buff, 0, sizeof(tempRunAvg.buff));
   memset(rhRunAvg.buff, 0, sizeof(rhRunAvg.buff));
 
+  ES_Event_t initEvent = {.EventType=ES_INIT}; 
+  readCycle(initEvent);  // waits for the first ES_READ_SENSOR
+
   return true; 
 }
 
@@ -128,204 +163,24 @@ bool PostSVM30Service(ES_Event_t ThisEvent)
    ES_Event, ES_NO_EVENT if no error ES_ERROR otherwise
 
  Description
-   add your description here
+   reads the SVM30's two sensors over I2C on ES_READ_SENSOR, once a second 
+   until it has SVM30_SAMPLE_READS readings or has made too many attempts
  Notes
+   The protocol itself is the readCycle coroutine, this just resumes it
 ****************************************************************************/
 ES_Event_t RunSVM30Service(ES_Event_t ThisEvent)
 {
   ES_Event_t ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
-  static uint8_t retryAttempts = 0; 
-  static bool SGP30_SHTC1_flag = SGP30_FLAG; 
   
-  switch (currSMState)
+  // sent to all the sensors by MainService
+  if(ThisEvent.EventType == IAQ_MODE_EVENT)
   {
-    case INIT_MEASUREMENTS_STATE:
-    {
-      if(ThisEvent.EventType == ES_READ_SENSOR)
-      {
-        ES_Timer_InitTimer(SVM30_TIMER_NUM, SVM30_STARTUP_TIME); // wait for sensor to power up 
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == SVM30_TIMER_NUM)
-      {
-        clearI2CBuffer();  // clear out buffer just to be safe
-        Wire.beginTransmission(SGP30_ADDR); 
-        Wire.write(SGP30_HEAD);
-        Wire.write(SGP30_INIT_AQ); 
-        uint8_t I2C_resp = Wire.endTransmission();
-        if(I2C_resp != I2C_SUCCESS) 
-        {
-          #ifdef DEBUG_SVM30
-          printf("Init measurement command failed\n");
-          #endif
-          retryRead(&retryAttempts, NULL, NULL, &SGP30_SHTC1_flag); 
-          return ReturnEvent; 
-        }
-
-        #ifdef DEBUG_SVM30
-        printf("Starting SGP30 15sec wait\n");
-        #endif
-        ES_Timer_InitTimer(SVM30_TIMER_NUM, SGP30_WARMUP_TIME);
-        currSMState = WARMUP_STATE; 
-      }
-      break;
-    }
-    case WARMUP_STATE:
-    {
-      if(ThisEvent.EventType == ES_READ_SENSOR || (ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == SVM30_TIMER_NUM))
-      {
-        uint8_t I2C_resp; 
-        clearI2CBuffer();
-        if(SGP30_SHTC1_flag == SGP30_FLAG)
-        {
-          ES_Timer_InitTimer(SVM30_TIMER_NUM, SGP30_SAMPLE_TIME);
-          Wire.beginTransmission(SGP30_ADDR);  
-          Wire.write(SGP30_HEAD);
-          Wire.write(SGP30_MEASURE_AQ); 
-          I2C_resp = Wire.endTransmission();
-        }
-        else
-        {
-          Wire.beginTransmission(SHTC1_ADDR); 
-          Wire.write(TEMP_FIRST1);
-          Wire.write(TEMP_FIRST2); 
-          I2C_resp = Wire.endTransmission();
-        }
-        
-        if(I2C_resp != I2C_SUCCESS) 
-        {
-          #ifdef DEBUG_SVM30
-          printf("Measure command failed\n");
-          #endif
-
-          retryRead(&retryAttempts, NULL, NULL, &SGP30_SHTC1_flag); 
-          return ReturnEvent; 
-        }
-
-        ES_Timer_InitTimer(SVM30_TIMER2_NUM, SVM30_WAIT_TIME);
-        currSMState = REQUEST_READ_STATE;
-      }
-      break;
-    }
-
-    case REQUEST_READ_STATE:  // waiting to send request data after sending init measurement command
-    {
-      if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == SVM30_TIMER2_NUM)
-      {
-        if(SGP30_SHTC1_flag == SGP30_FLAG)
-          Wire.requestFrom(SGP30_ADDR, SVM30_RESP_LEN);
-        else
-          Wire.requestFrom(SHTC1_ADDR, SVM30_RESP_LEN);
-        
-        currSMState = READ_DATA_STATE; 
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == SVM30_TIMER_NUM)
-      {
-        retryRead(&retryAttempts, NULL, NULL, &SGP30_SHTC1_flag); 
-        return ReturnEvent; 
-      }
-      break;
-    } 
-
-    case READ_DATA_STATE:
-    {
-      static uint8_t bytesread = 1;  // bytes read in a single transmission
-      static uint8_t data_idx = 0; 
-      static uint8_t sensorData[4] = {0};  
-
-      if(ThisEvent.EventType == ES_I2C)
-      {
-        // #ifdef DEBUG_SVM30
-        // printf("I2C bytes read (%d): %d\n", bytesread, ThisEvent.EventParam); 
-        // #endif
-
-        if(bytesread % 3 == 0)  // is it a CRC byte?
-        { 
-          uint8_t *startIdx = sensorData + (data_idx-2); 
-          uint8_t crcCheckVal = crcCheck(startIdx, 2);
-          if(crcCheckVal != ThisEvent.EventParam){
-            retryRead(&retryAttempts, &bytesread, &data_idx, &SGP30_SHTC1_flag);
-            return ReturnEvent;  
-          }
-        }
-        else  // otherwise it's a data byte
-        {
-          sensorData[data_idx] = ThisEvent.EventParam; 
-          data_idx++; 
-        }
-
-        if(bytesread == SVM30_RESP_LEN)
-        {          
-          uint16_t dataByte1_raw = (uint16_t)sensorData[0] << 8; 
-          dataByte1_raw |= (uint16_t)sensorData[1]; 
-
-          uint16_t dataByte2_raw = (uint16_t)sensorData[2] << 8; 
-          dataByte2_raw |= (uint16_t)sensorData[3]; 
-          
-          // reset for the next reading
-          bytesread = 1; 
-          data_idx = 0; 
-          currSMState = WARMUP_STATE; 
-          if(SGP30_SHTC1_flag == SGP30_FLAG)  
-          {
-            #ifdef DEBUG_SVM30
-            printf("eCO2: %i  ", dataByte1_raw); 
-            printf("tvoc: %i\n", dataByte2_raw); 
-            #endif
-
-            updateRunAvg(&eCO2RunAvg, dataByte1_raw);  
-            updateRunAvg(&tVOCRunAvg, dataByte2_raw);
-            SGP30_SHTC1_flag = SHTC1_FLAG;  // switch to the other sensor 
-            ES_Event_t NewEvent = {.EventType=ES_READ_SENSOR}; 
-            PostSVM30Service(NewEvent); 
-          }
-          else 
-          {
-            sensorConnected = true; 
-            //now finished reading 2nd sensor
-            SGP30_SHTC1_flag = SGP30_FLAG; 
-            updateRunAvg(&tempRunAvg, rawDataToTemp(dataByte1_raw));
-            updateRunAvg(&rhRunAvg, rawDataToRH(dataByte1_raw, dataByte2_raw));
-            // tm_avg += rawDataToTemp(dataByte1_raw);
-            // rh_avg += rawDataToRH(dataByte1_raw, dataByte2_raw);
-
-            if(SVM30_mode == STREAM_MODE)
-              numReads = 0; 
-            else
-              numReads++; 
-
-            if(numReads >= SVM30_SAMPLE_READS)
-            {
-              int16_t avgeCO2 = round((float)eCO2RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN);
-              int16_t avgtVOC = round((float)tVOCRunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
-              int16_t avgtm   = round((float)tempRunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN);
-              int16_t avgrh   = round((float)rhRunAvg.runAvgSum   / (float)RUN_AVG_BUFFER_LEN); 
-
-              updateSVM30Vals(avgeCO2, avgtVOC, avgtm, avgrh); 
-              IAQ_PRINTF("Avgs:  eCO2:%d  tVOC:%d  tm:%d  rh:%d\n", avgeCO2, avgtVOC, avgtm, avgrh); 
-
-              retryAttempts = 0; 
-              numReads = 0; 
-              currSMState = INIT_MEASUREMENTS_STATE; 
-              ES_Timer_StopTimer(SVM30_TIMER_NUM);
-            }
-          }
-        }else
-        {
-          bytesread++;
-        }
-      }
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == SVM30_TIMER_NUM)
-      {
-        #ifdef DEBUG_SVM30
-        printf("Timed out in READ STATE\n");
-        #endif 
-        retryRead(&retryAttempts, &bytesread, &data_idx, &SGP30_SHTC1_flag); 
-      }
-
-      break;
-    }
+    setModeSVM30((IAQmode_t)ThisEvent.EventParam); 
+    return ReturnEvent; 
   }
+
+  readCycle(ThisEvent); 
   
   return ReturnEvent;
 }
@@ -357,12 +212,23 @@ void getSVM30Avg(int16_t *eCO2Avg, int16_t *tVOCAvg, int16_t *tpAvg, int16_t *rh
 }
 
 
+// posts the whole I2C response as a single ES_I2C event, with the bytes in its
+// payload and the number of bytes read in EventParam
 bool EventChecker_SVM30(){
   if(Wire.available())
   {
-    ES_Event_t newEvent; 
-    newEvent.EventType = ES_I2C; 
-    newEvent.EventParam = Wire.read(); 
+    ES_Event_t newEvent = {.EventType=ES_I2C}; 
+    newEvent.Payload = ES_Payload_Alloc(); 
+    uint8_t *resp = (uint8_t *)ES_Payload_Get(newEvent.Payload); 
+    if(resp == NULL)
+    {
+      return false;  // pool is empty, try again on the next poll
+    }
+
+    while(Wire.available() && newEvent.EventParam < ES_PAYLOAD_SIZE)
+    {
+      resp[newEvent.EventParam++] = Wire.read(); 
+    }
     PostSVM30Service(newEvent); 
 
     return true; 
@@ -374,47 +240,175 @@ bool EventChecker_SVM30(){
 /***************************************************************************
  private functions
  ***************************************************************************/
-bool retryRead(uint8_t *retryAttempts, uint8_t *bytesRead, uint8_t *data_idx, bool *sensorFlag)
+// Waits for ES_READ_SENSOR, starts the SGP30's air quality algorithm after
+// the power up wait, and once it has warmed up reads the SGP30 and then the 
+// SHTC1 every SGP30_SAMPLE_TIME (the SGP30 needs its readings 1s apart) until
+// SVM30_SAMPLE_READS have been read, or forever in stream mode. A failed 
+// reading starts the SGP30 over. 
+static ES_CoStatus_t readCycle(ES_Event_t ThisEvent)
 {
-  if(retryAttempts == NULL)
-    return false; 
-  if(bytesRead != NULL)
-    *bytesRead = 1; 
-  if(data_idx != NULL)
-    *data_idx = 0; 
+  static bool ok; 
+  static bool keepReading; 
 
-  sensorConnected = false; 
+  ES_CO_BEGIN(&cycleCo); 
+  for(;;)
+  {
+    ES_CO_AWAIT(&cycleCo, ThisEvent.EventType == ES_READ_SENSOR); 
+    ES_Timer_InitTimer(SVM30_TIMER_NUM, SVM30_STARTUP_TIME); // wait for sensor to power up 
+
+    keepReading = true; 
+    while(keepReading)
+    {
+      ES_CO_AWAIT(&cycleCo, ES_Co_IsTimeout(ThisEvent, SVM30_TIMER_NUM)); 
+      clearI2CBuffer();  // clear out buffer just to be safe
+      ok = writeCommand(SGP30_ADDR, SGP30_HEAD, SGP30_INIT_AQ); 
+      if(ok)
+      {
+        #ifdef DEBUG_SVM30
+        printf("Starting SGP30 15sec wait\n");
+        #endif
+        ES_CO_AWAIT_TIMER(&cycleCo, ThisEvent, SVM30_TIMER_NUM, SGP30_WARMUP_TIME); 
+        ES_Timer_InitPeriodic(SVM30_TIMER_NUM, SGP30_SAMPLE_TIME);
+      }
+
+      while(ok)
+      {
+        ES_CO_CALL(&cycleCo, &readCo, readSensor(ThisEvent, SGP30_ADDR, SGP30_HEAD, SGP30_MEASURE_AQ, &ok)); 
+        if(!ok)
+          break; 
+        #ifdef DEBUG_SVM30
+        printf("eCO2: %i  ", sensorWords[0]); 
+        printf("tvoc: %i\n", sensorWords[1]); 
+        #endif
+        updateRunAvg(&eCO2RunAvg, sensorWords[0]);  
+        updateRunAvg(&tVOCRunAvg, sensorWords[1]);
+
+        ES_CO_CALL(&cycleCo, &readCo, readSensor(ThisEvent, SHTC1_ADDR, TEMP_FIRST1, TEMP_FIRST2, &ok)); 
+        if(!ok)
+          break; 
+        sensorConnected = true; 
+        updateRunAvg(&tempRunAvg, rawDataToTemp(sensorWords[0]));
+        updateRunAvg(&rhRunAvg, rawDataToRH(sensorWords[0], sensorWords[1]));
+
+        if(SVM30_mode == STREAM_MODE)
+          numReads = 0; 
+        else
+          numReads++; 
+        if(numReads >= SVM30_SAMPLE_READS)
+        {
+          keepReading = false; 
+          break; 
+        }
+        ES_CO_AWAIT(&cycleCo, ES_Co_IsTimeout(ThisEvent, SVM30_TIMER_NUM)); 
+      }
+
+      if(!ok)
+      {
+        keepReading = retryRead(); 
+        if(keepReading)
+          ES_Timer_InitTimer(SVM30_TIMER_NUM, SVM30_RETRY_TIME); 
+      }
+      else
+      {
+        int16_t avgeCO2 = round((float)eCO2RunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN);
+        int16_t avgtVOC = round((float)tVOCRunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN); 
+        int16_t avgtm   = round((float)tempRunAvg.runAvgSum / (float)RUN_AVG_BUFFER_LEN);
+        int16_t avgrh   = round((float)rhRunAvg.runAvgSum   / (float)RUN_AVG_BUFFER_LEN); 
+
+        updateSVM30Vals(avgeCO2, avgtVOC, avgtm, avgrh); 
+        IAQ_PRINTF("Avgs:  eCO2:%d  tVOC:%d  tm:%d  rh:%d\n", avgeCO2, avgtVOC, avgtm, avgrh); 
+
+        retryAttempts = 0; 
+        numReads = 0; 
+        ES_Timer_StopTimer(SVM30_TIMER_NUM);
+      }
+    }
+  }
+  ES_CO_END(&cycleCo); 
+}
+
+// Sends a measure command to one of the SVM30's sensors and reads back its 
+// 2 result words into sensorWords. *ok is false if the sensor didn't ACK 
+// the command, didn't answer in time or the CRCs didn't match
+static ES_CoStatus_t readSensor(ES_Event_t ThisEvent, uint8_t addr, uint8_t cmd1, uint8_t cmd2, bool *ok)
+{
+  ES_CO_BEGIN(&readCo); 
+  *ok = false; 
+  clearI2CBuffer(); 
+  if(!writeCommand(addr, cmd1, cmd2))
+  {
+    #ifdef DEBUG_SVM30
+    printf("Measure command failed\n");
+    #endif
+    ES_CO_RETURN(&readCo); 
+  }
+
+  // the measurement takes SVM30_WAIT_TIME, the read itself is done by the 
+  // time requestFrom returns
+  ES_CO_AWAIT_TIMER(&readCo, ThisEvent, SVM30_TIMER2_NUM, SVM30_WAIT_TIME); 
+  Wire.requestFrom(addr, (uint8_t)SVM30_RESP_LEN);
+  ES_SetEventPending(SVM30_EVENT_SRC);  // bytes are in the Wire buffer
+  ES_CO_AWAIT_EVENT(&readCo, ThisEvent, ES_I2C, SVM30_TIMER2_NUM, SVM30_READ_TIMEOUT); 
 
-  bool skipWarmup = false; 
-  if(*sensorFlag == SHTC1_FLAG)
-    skipWarmup = true;
+  if(ThisEvent.EventType == ES_I2C)
+  {
+    // the response is 2 words, each followed by its CRC
+    const uint8_t *resp = (const uint8_t *)ES_Payload_Get(ThisEvent.Payload); 
+    #ifdef DEBUG_SVM30
+    printf("I2C bytes read: %d\n", ThisEvent.EventParam); 
+    #endif
+
+    if(resp != NULL && ThisEvent.EventParam == SVM30_RESP_LEN && 
+       crcCheck(resp, 2) == resp[2] && crcCheck(resp+3, 2) == resp[5])
+    {
+      sensorWords[0] = ((uint16_t)resp[0] << 8) | resp[1]; 
+      sensorWords[1] = ((uint16_t)resp[3] << 8) | resp[4]; 
+      *ok = true; 
+    }
+  }
+  ES_CO_END(&readCo); 
+}
 
-  if(skipWarmup)
-    currSMState = WARMUP_STATE; 
-  else
-    currSMState = INIT_MEASUREMENTS_STATE; 
+// sends a 2 byte command, false if the sensor didn't ACK it
+static bool writeCommand(uint8_t addr, uint8_t cmd1, uint8_t cmd2)
+{
+  Wire.beginTransmission(addr); 
+  Wire.write(cmd1);
+  Wire.write(cmd2); 
+  return Wire.endTransmission() == I2C_SUCCESS;
+}
+
+// addresses the sensor without a command, false if it didn't ACK
+static bool ackAddress(uint8_t addr)
+{
+  Wire.beginTransmission(addr); 
+  return Wire.endTransmission() == I2C_SUCCESS;
+}
+
+// counts a failed reading, false once there have been too many in a row and
+// the read cycle has been given up
+static bool retryRead(void)
+{
+  sensorConnected = false; 
   
   if(SVM30_mode == STREAM_MODE)
   {
-    *retryAttempts = 0;  // in stream mode don't need to stop trying
+    retryAttempts = 0;  // in stream mode don't need to stop trying
   }
 
-  if(*retryAttempts >= MAX_RETRY_ATTEMPTS)
+  if(retryAttempts >= MAX_RETRY_ATTEMPTS)
   {
-    currSMState = INIT_MEASUREMENTS_STATE; 
     numReads = 0; 
-    *retryAttempts = 0; 
+    retryAttempts = 0; 
     ES_Timer_StopTimer(SVM30_TIMER_NUM);
     ES_Timer_StopTimer(SVM30_TIMER2_NUM); 
-    *sensorFlag = SGP30_FLAG; 
     updateSVM30Vals(-1, -1, -1, -1); 
     IAQ_PRINTF("Could not read from SVM30 sensor\n");
     return false; 
   }
 
-  IAQ_PRINTF("Retrying SVM30 sensor: %d\n", *sensorFlag);
-  ES_Timer_InitTimer(SVM30_TIMER_NUM, 200);
-  *retryAttempts = *retryAttempts + 1; 
+  IAQ_PRINTF("Retrying SVM30 sensor: %d\n", retryAttempts);
+  retryAttempts++; 
   return true; 
 }
 
@@ -437,7 +431,7 @@ uint16_t rawDataToRH(uint16_t temp_raw, uint16_t rh_raw)
   return (uint16_t)round(rh); 
 }
 
-uint8_t crcCheck(uint8_t* p, int len) {
+uint8_t crcCheck(const uint8_t* p, int len) {
 	// fast bit by bit algorithm without augmented zero bytes
   // taken from http://www.zorc.breitbandkatze.de/crctester.c
     
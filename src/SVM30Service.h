@@ -13,6 +13,7 @@
 #include <stdint.h>
 
 // Public Function Prototypes
+bool ProbeSVM30Service(void);
 bool InitSVM30Service(uint8_t Priority);
 bool PostSVM30Service(ES_Event_t ThisEvent);
 ES_Event_t RunSVM30Service(ES_Event_t ThisEvent);
@@ -41,7 +41,7 @@ static uint8_t MyPriority;
 ****************************************************************************/
 bool InitTemplateService(uint8_t Priority)
 {
-  ES_Event_t ThisEvent;
+  ES_Event_t ThisEvent = {};
 
   MyPriority = Priority;
   /********************************************
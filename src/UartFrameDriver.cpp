@@ -0,0 +1,273 @@
+/****************************************************************************
+ Module
+   UartFrameDriver.c
+
+ Description
+   Collects the bytes received on a serial port into frames, checks their
+   header, length and checksum and posts a single event for each good frame.
+   Frames are built straight into a payload block that travels with the
+   event, so the service reads the whole frame rather than getting one event
+   per byte. EventParam holds the frame length (high byte) and format index.
+
+ Notes
+   Bytes wait in the UART driver's receive buffer until the event checker
+   gets to them, so a full ES queue no longer loses data.
+   A frame that fails its length or checksum check is scanned again from
+   the byte after its header, so a good frame starting inside it is kept.
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "UartFrameDriver.h"
+#include "IAQ_util.h"
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define FRAME_PARAM_FORMAT(param) ((param) & 0xFF)
+#define FRAME_PARAM_LEN(param) ((param) >> 8)
+
+/*---------------------------- Module Functions ---------------------------*/
+static void addByte(UartFrameDriver_t *Driver, uint8_t newByte, bool *posted);
+static void endFrame(UartFrameDriver_t *Driver, bool *posted);
+static void resync(UartFrameDriver_t *Driver, bool *posted);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     UartFrame_Init
+
+ Parameters
+     UartFrameDriver_t *Driver : the driver instance to set up
+     HardwareSerial *Port : serial port the frames come in on
+     const UartFrameFormat_t *Formats : the kinds of frames the device sends
+     uint8_t NumFormats : number of entries in Formats
+     bool (*PostFunc)(ES_Event_t) : post function of the service to notify
+     ES_EventType_t EventType : event type to post for each frame
+
+ Returns
+     None.
+
+ Description
+     Sets up a driver instance. The port must already be started.
+ Notes
+****************************************************************************/
+void UartFrame_Init(UartFrameDriver_t *Driver, HardwareSerial *Port,
+    const UartFrameFormat_t *Formats, uint8_t NumFormats,
+    bool (*PostFunc)(ES_Event_t), ES_EventType_t EventType)
+{
+  if(Driver == NULL)
+    return;
+
+  Driver->Port = Port;
+  Driver->Formats = Formats;
+  Driver->NumFormats = NumFormats;
+  Driver->PostFunc = PostFunc;
+  Driver->EventType = EventType;
+  Driver->CurrPayload = ES_NO_PAYLOAD;
+  Driver->NumBadFrames = 0;
+  Driver->NumDroppedBytes = 0;
+  UartFrame_Reset(Driver);
+}
+
+/****************************************************************************
+ Function
+     UartFrame_Receive
+
+ Parameters
+     UartFrameDriver_t *Driver : the driver instance
+
+ Returns
+     bool, true if at least one frame was posted
+
+ Description
+     Feeds every byte waiting on the port through the frame assembler and
+     posts an event for each complete and valid frame. Meant to be called
+     from the service's event checker.
+ Notes
+****************************************************************************/
+bool UartFrame_Receive(UartFrameDriver_t *Driver)
+{
+  bool posted = false;
+  if(Driver == NULL || Driver->Port == NULL)
+    return false;
+
+  while(Driver->Port->available())
+  {
+    addByte(Driver, (uint8_t)Driver->Port->read(), &posted);
+  }
+
+  return posted;
+}
+
+/****************************************************************************
+ Function
+     UartFrame_Reset
+
+ Parameters
+     UartFrameDriver_t *Driver : the driver instance
+
+ Returns
+     None.
+
+ Description
+     Drops any partly received frame, so the next byte is treated as the
+     start of a new one. Frames that were already posted stay valid.
+ Notes
+     The payload block is kept for the next frame
+****************************************************************************/
+void UartFrame_Reset(UartFrameDriver_t *Driver)
+{
+  if(Driver == NULL)
+    return;
+
+  Driver->NumBytes = 0;
+  Driver->FrameLen = 0;
+}
+
+/****************************************************************************
+ Function
+     UartFrame_Get
+
+ Parameters
+     ES_Event_t FrameEvent : the frame event posted by the driver
+     uint8_t *Len : set to the number of bytes in the frame
+
+ Returns
+     const uint8_t *, the frame or NULL if the event doesn't carry one
+
+ Description
+     Gives access to a received frame without copying it. The frame is only
+     valid until the run function returns, unless the service retains the
+     event's payload.
+ Notes
+****************************************************************************/
+const uint8_t *UartFrame_Get(ES_Event_t FrameEvent, uint8_t *Len)
+{
+  if(Len != NULL)
+    *Len = FRAME_PARAM_LEN(FrameEvent.EventParam);
+
+  return (const uint8_t *)ES_Payload_Get(FrameEvent.Payload);
+}
+
+/****************************************************************************
+ Function
+     UartFrame_GetFormat
+
+ Parameters
+     ES_Event_t FrameEvent : the frame event posted by the driver
+
+ Returns
+     uint8_t, index into the driver's format list of the frame's format
+
+ Description
+     Lets a service tell apart the kinds of frames a device sends
+ Notes
+****************************************************************************/
+uint8_t UartFrame_GetFormat(ES_Event_t FrameEvent)
+{
+  return FRAME_PARAM_FORMAT(FrameEvent.EventParam);
+}
+
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+static void addByte(UartFrameDriver_t *Driver, uint8_t newByte, bool *posted)
+{
+  // look for a header to start a new frame
+  if(Driver->NumBytes == 0)
+  {
+    uint8_t i;
+    for(i=0; i < Driver->NumFormats; i++)
+    {
+      if(Driver->Formats[i].Header == newByte)
+        break;
+    }
+    if(i == Driver->NumFormats)
+    {
+      Driver->NumDroppedBytes++;
+      return;
+    }
+    if(Driver->CurrPayload == ES_NO_PAYLOAD)
+    {
+      Driver->CurrPayload = ES_Payload_Alloc();
+      if(Driver->CurrPayload == ES_NO_PAYLOAD)
+      {
+        Driver->NumDroppedBytes++;  // pool is empty, the frame will be lost
+        return;
+      }
+    }
+    Driver->Format = i;
+    Driver->FrameLen = (Driver->Formats[i].LenIndex == 0) ? Driver->Formats[i].Len : 0;
+  }
+
+  const UartFrameFormat_t *format = &Driver->Formats[Driver->Format];
+  uint8_t *frame = (uint8_t *)ES_Payload_Get(Driver->CurrPayload);
+  frame[Driver->NumBytes++] = newByte;
+
+  // length byte of a variable length frame
+  if(Driver->FrameLen == 0 && format->LenIndex != 0 && Driver->NumBytes == format->LenIndex + 1)
+  {
+    uint16_t frameLen = (uint16_t)newByte + format->Len;
+    if(frameLen > UART_FRAME_MAX_LEN || frameLen <= format->LenIndex)
+    {
+      Driver->NumBadFrames++;
+      resync(Driver, posted);
+      return;
+    }
+    Driver->FrameLen = (uint8_t)frameLen;
+  }
+
+  if(Driver->FrameLen != 0 && Driver->NumBytes >= Driver->FrameLen)
+  {
+    endFrame(Driver, posted);
+  }
+}
+
+static void endFrame(UartFrameDriver_t *Driver, bool *posted)
+{
+  const UartFrameFormat_t *format = &Driver->Formats[Driver->Format];
+  const uint8_t *frame = (const uint8_t *)ES_Payload_Get(Driver->CurrPayload);
+
+  if(format->IsValid == NULL || format->IsValid(frame, Driver->NumBytes))
+  {
+    // the frame's payload reference goes with the event
+    ES_Event_t newEvent = {.EventType=Driver->EventType};
+    newEvent.EventParam = ((uint16_t)Driver->NumBytes << 8) | Driver->Format;
+    newEvent.Payload = Driver->CurrPayload;
+    Driver->CurrPayload = ES_NO_PAYLOAD;
+    if(Driver->PostFunc != NULL)
+      Driver->PostFunc(newEvent);
+    else
+      ES_Payload_Release(newEvent.Payload);
+
+    *posted = true;
+  }
+  else
+  {
+    Driver->NumBadFrames++;
+    IAQ_PRINTF("Bad frame: %x\n", frame[0]);
+    resync(Driver, posted);
+    return;
+  }
+
+  UartFrame_Reset(Driver);
+}
+
+// A rejected frame's header may have been a data byte, and the real frame 
+// can start inside it, e.g. when joining a stream mid frame. Its bytes after
+// the header are fed through the assembler again to hunt for the next header
+static void resync(UartFrameDriver_t *Driver, bool *posted)
+{
+  uint8_t rescan[UART_FRAME_MAX_LEN];
+  uint8_t numRescan = Driver->NumBytes - 1;
+  const uint8_t *frame = (const uint8_t *)ES_Payload_Get(Driver->CurrPayload);
+  memcpy(rescan, &frame[1], numRescan);  // the payload block gets reused
+
+  UartFrame_Reset(Driver);
+  for(uint8_t i=0; i < numRescan; i++)
+  {
+    addByte(Driver, rescan[i], posted);
+  }
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
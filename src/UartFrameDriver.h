@@ -0,0 +1,58 @@
+/****************************************************************************
+
+  Header file for the UART frame driver. Assembles the bytes coming in on a
+  serial port into whole frames and posts one event per valid frame.
+
+ ****************************************************************************/
+
+#ifndef UartFrameDriver_H
+#define UartFrameDriver_H
+
+#include "ES_Event.h"
+#include "ES_Payload.h"
+#include <HardwareSerial.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// longest frame any of the sensors send, frames are built in a payload block
+#define UART_FRAME_MAX_LEN ES_PAYLOAD_SIZE
+
+// Describes one kind of frame a device can send. A frame starts with Header.
+// Fixed length frames set LenIndex to 0 and Len to the whole frame length.
+// Variable length frames give the index of their length byte in LenIndex and
+// the number of bytes it doesn't count (header, length, checksum...) in Len
+typedef struct
+{
+  uint8_t Header;
+  uint8_t LenIndex;
+  uint8_t Len;
+  bool (*IsValid)(const uint8_t *Frame, uint8_t Len);  // checksum check, NULL to skip
+}UartFrameFormat_t;
+
+typedef struct
+{
+  HardwareSerial *Port;
+  const UartFrameFormat_t *Formats;
+  uint8_t NumFormats;
+  bool (*PostFunc)(ES_Event_t);
+  ES_EventType_t EventType;
+
+  // assembler state, only touched by the driver
+  uint8_t CurrPayload; // payload block the current frame is built in
+  uint8_t NumBytes;    // bytes in the current frame, 0 while hunting for a header
+  uint8_t FrameLen;    // length of the current frame, 0 until it is known
+  uint8_t Format;      // index of the current frame's format
+  uint16_t NumBadFrames;
+  uint16_t NumDroppedBytes;
+}UartFrameDriver_t;
+
+// Public Function Prototypes
+void UartFrame_Init(UartFrameDriver_t *Driver, HardwareSerial *Port,
+    const UartFrameFormat_t *Formats, uint8_t NumFormats,
+    bool (*PostFunc)(ES_Event_t), ES_EventType_t EventType);
+bool UartFrame_Receive(UartFrameDriver_t *Driver);
+void UartFrame_Reset(UartFrameDriver_t *Driver);
+const uint8_t *UartFrame_Get(ES_Event_t FrameEvent, uint8_t *Len);
+uint8_t UartFrame_GetFormat(ES_Event_t FrameEvent);
+
+#endif /* UartFrameDriver_H */
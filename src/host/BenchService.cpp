@@ -0,0 +1,511 @@
+/****************************************************************************
+ Module
+   BenchService.c
+
+ Description
+   Services that push events through the framework as fast as it will
+   take them, to benchmark the event core on the host build. Ping and pong
+   run in the loop, the worker service in the worker thread
+   (ES_WORKER_ENABLE). They go through the phases in BenchPhase_t one after
+   the other:
+     ping-pong  BENCH_PING bounces between the ping and pong services, so
+                every event switches service
+     chain      the pong service posts BENCH_CHAIN to itself
+     wake       another thread signals BENCH_EVENT_SRC, EventCheckerBench
+                posts BENCH_WAKE and the ping service lets the thread know
+                so it can signal again. Measures the wake up round trip
+     cross      the ping service keeps BENCH_CROSS_WINDOW BENCH_CROSS
+                events in flight to the worker service, which sends each
+                one back
+     timer      the ping service counts BENCH_TIMER_PERIODS timeouts of a
+                periodic timer, so the port's ticks can be checked against
+                the wall clock
+
+ Notes
+   Every event in the first 2 phases is one ES_PostToService and one run
+   function call from ES_Run. Every event in the cross phase also goes
+   through one of the rings between the loop and the worker. That they
+   arrive in order is checked by test/test_cross_queue, not here
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "BenchService.h"
+#include "ES_framework.h"
+#include "ES_Timers.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define BENCH_NUM_WAKES 10000
+#define BENCH_NUM_CROSS 100000
+#define BENCH_CROSS_WINDOW 4    // fits in the ping service's queue
+
+/*---------------------------- Module Functions ---------------------------*/
+static void StartPhase(BenchPhase_t Phase);
+static void EndPhase(void);
+static uint64_t GetTimeNs(void);
+static void *WakeThread(void *Arg);
+static void StartCross(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+static uint8_t PingPriority;
+static uint8_t PongPriority;
+static uint8_t WorkerPriority;
+
+static uint32_t NumEvents = 1000000;
+static BenchPhase_t CurrPhase = BENCH_PHASE_PINGPONG;
+static uint64_t PhaseStart;
+static BenchResult_t Results[BENCH_NUM_PHASES];
+static bool Done = false;
+
+// wake phase hand shake, the thread signals once WakesHandled catches up
+static pthread_t WakeThreadId;
+static uint32_t WakesSignalled = 0;
+static uint32_t WakesHandled = 0;
+
+// cross phase, only the worker service touches WorkerEvents until the phase
+// is over
+static uint32_t WorkerEvents;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     BenchService_SetNumEvents
+
+ Parameters
+     uint32_t : events to send in each of the ping-pong and chain phases
+
+ Returns
+     None
+
+ Description
+     Call before ES_Initialize
+ Notes
+****************************************************************************/
+void BenchService_SetNumEvents(uint32_t Num)
+{
+  NumEvents = Num;
+}
+
+/****************************************************************************
+ Function
+     BenchService_Done
+
+ Parameters
+     None
+
+ Returns
+     bool, true once every phase has finished
+
+ Description
+     Lets main know when to stop calling ES_Run
+ Notes
+****************************************************************************/
+bool BenchService_Done(void)
+{
+  return Done;
+}
+
+/****************************************************************************
+ Function
+     BenchService_GetResult
+
+ Parameters
+     BenchPhase_t : the phase
+
+ Returns
+     const BenchResult_t *, the events dispatched and time taken by the phase
+
+ Description
+     Results are only complete once BenchService_Done returns true
+ Notes
+****************************************************************************/
+const BenchResult_t *BenchService_GetResult(BenchPhase_t Phase)
+{
+  if(Phase >= BENCH_NUM_PHASES)
+  {
+    return NULL;
+  }
+  return &Results[Phase];
+}
+
+/****************************************************************************
+ Function
+     InitBenchPingService
+
+ Parameters
+     uint8_t : the priorty of this service
+
+ Returns
+     bool, false if error in initialization, true otherwise
+
+ Description
+     Saves away the priority and posts the initial transition event, which
+     starts the first phase
+ Notes
+****************************************************************************/
+bool InitBenchPingService(uint8_t Priority)
+{
+  ES_Event_t ThisEvent = {};
+
+  PingPriority = Priority;
+  ThisEvent.EventType = ES_INIT;
+  ThisEvent.ServiceNum = Priority;
+  return ES_PostToService(ThisEvent);
+}
+
+/****************************************************************************
+ Function
+     PostBenchPingService
+
+ Parameters
+     EF_Event_t ThisEvent ,the event to post to the queue
+
+ Returns
+     bool false if the Enqueue operation failed, true otherwise
+
+ Description
+     Posts an event to this service's queue
+ Notes
+****************************************************************************/
+bool PostBenchPingService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = PingPriority;
+  return ES_PostToService(ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    RunBenchPingService
+
+ Parameters
+   ES_Event_t : the event to process
+
+ Returns
+   ES_Event, ES_NO_EVENT if no error ES_ERROR otherwise
+
+ Description
+   Starts the benchmark, sends BENCH_PING back to the pong service and
+   handles the wake and timer phases
+ Notes
+****************************************************************************/
+ES_Event_t RunBenchPingService(ES_Event_t ThisEvent)
+{
+  ES_Event_t ReturnEvent;
+  ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
+
+  switch(ThisEvent.EventType)
+  {
+    case ES_INIT:
+    {
+      StartPhase(BENCH_PHASE_PINGPONG);
+      ES_Event_t PingEvent = {.EventType = BENCH_PING};
+      PostBenchPongService(PingEvent);
+      break;
+    }
+
+    case BENCH_PING:
+    {
+      Results[BENCH_PHASE_PINGPONG].NumEvents++;
+      if(Results[BENCH_PHASE_PINGPONG].NumEvents < NumEvents)
+      {
+        PostBenchPongService(ThisEvent);
+      }
+      else
+      {
+        EndPhase();
+        StartPhase(BENCH_PHASE_CHAIN);
+        ES_Event_t ChainEvent = {.EventType = BENCH_CHAIN};
+        PostBenchPongService(ChainEvent);
+      }
+      break;
+    }
+
+    case BENCH_WAKE:
+    {
+      Results[BENCH_PHASE_WAKE].NumEvents++;
+      __atomic_store_n(&WakesHandled, ThisEvent.EventParam, __ATOMIC_RELEASE);
+      if(Results[BENCH_PHASE_WAKE].NumEvents >= BENCH_NUM_WAKES)
+      {
+        pthread_join(WakeThreadId, NULL);
+        EndPhase();
+        StartCross();
+      }
+      break;
+    }
+
+    case BENCH_CROSS:
+    {
+      Results[BENCH_PHASE_CROSS].NumEvents++;
+      if(Results[BENCH_PHASE_CROSS].NumEvents < BENCH_NUM_CROSS)
+      {
+        if((uint32_t)(Results[BENCH_PHASE_CROSS].NumEvents + BENCH_CROSS_WINDOW) <= BENCH_NUM_CROSS)
+        {
+          PostBenchWorkerService(ThisEvent);
+        }
+      }
+      else
+      {
+        // the worker has handled every event it sent back, so is done with 
+        // its count
+        Results[BENCH_PHASE_CROSS].NumEvents += WorkerEvents;
+        EndPhase();
+        StartPhase(BENCH_PHASE_TIMER);
+        ES_Timer_InitPeriodic(BENCH_TIMER_NUM, BENCH_TIMER_PERIOD);
+      }
+      break;
+    }
+
+    case ES_TIMEOUT:
+    {
+      Results[BENCH_PHASE_TIMER].NumEvents++;
+      if(Results[BENCH_PHASE_TIMER].NumEvents >= BENCH_TIMER_PERIODS)
+      {
+        ES_Timer_StopTimer(BENCH_TIMER_NUM);
+        EndPhase();
+        Done = true;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+  return ReturnEvent;
+}
+
+/****************************************************************************
+ Function
+     InitBenchPongService
+
+ Parameters
+     uint8_t : the priorty of this service
+
+ Returns
+     bool, false if error in initialization, true otherwise
+
+ Description
+     Saves away the priority
+ Notes
+****************************************************************************/
+bool InitBenchPongService(uint8_t Priority)
+{
+  PongPriority = Priority;
+  return true;
+}
+
+/****************************************************************************
+ Function
+     PostBenchPongService
+
+ Parameters
+     EF_Event_t ThisEvent ,the event to post to the queue
+
+ Returns
+     bool false if the Enqueue operation failed, true otherwise
+
+ Description
+     Posts an event to this service's queue
+ Notes
+****************************************************************************/
+bool PostBenchPongService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = PongPriority;
+  return ES_PostToService(ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    RunBenchPongService
+
+ Parameters
+   ES_Event_t : the event to process
+
+ Returns
+   ES_Event, ES_NO_EVENT if no error ES_ERROR otherwise
+
+ Description
+   Sends BENCH_PING back to the ping service and runs the chain phase
+ Notes
+****************************************************************************/
+ES_Event_t RunBenchPongService(ES_Event_t ThisEvent)
+{
+  ES_Event_t ReturnEvent;
+  ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
+
+  switch(ThisEvent.EventType)
+  {
+    case BENCH_PING:
+      Results[BENCH_PHASE_PINGPONG].NumEvents++;
+      PostBenchPingService(ThisEvent);
+      break;
+
+    case BENCH_CHAIN:
+      Results[BENCH_PHASE_CHAIN].NumEvents++;
+      if(Results[BENCH_PHASE_CHAIN].NumEvents < NumEvents)
+      {
+        PostBenchPongService(ThisEvent);
+      }
+      else
+      {
+        EndPhase();
+        StartPhase(BENCH_PHASE_WAKE);
+        pthread_create(&WakeThreadId, NULL, WakeThread, NULL);
+      }
+      break;
+
+    default:
+      break;
+  }
+  return ReturnEvent;
+}
+
+/****************************************************************************
+ Function
+     InitBenchWorkerService
+
+ Parameters
+     uint8_t : the priorty of this service
+
+ Returns
+     bool, false if error in initialization, true otherwise
+
+ Description
+     Saves away the priority
+ Notes
+     Called from the loop like every init function, its events are run by
+     the worker
+****************************************************************************/
+bool InitBenchWorkerService(uint8_t Priority)
+{
+  WorkerPriority = Priority;
+  return true;
+}
+
+/****************************************************************************
+ Function
+     PostBenchWorkerService
+
+ Parameters
+     EF_Event_t ThisEvent ,the event to post to the queue
+
+ Returns
+     bool false if the Enqueue operation failed, true otherwise
+
+ Description
+     Posts an event to this service's queue
+ Notes
+****************************************************************************/
+bool PostBenchWorkerService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = WorkerPriority;
+  return ES_PostToService(ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    RunBenchWorkerService
+
+ Parameters
+   ES_Event_t : the event to process
+
+ Returns
+   ES_Event, ES_NO_EVENT if no error ES_ERROR otherwise
+
+ Description
+   Counts the BENCH_CROSS events and sends each one back
+ Notes
+****************************************************************************/
+ES_Event_t RunBenchWorkerService(ES_Event_t ThisEvent)
+{
+  ES_Event_t ReturnEvent;
+  ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
+
+  switch(ThisEvent.EventType)
+  {
+    case BENCH_CROSS:
+      WorkerEvents++;
+      PostBenchPingService(ThisEvent);
+      break;
+
+    default:
+      break;
+  }
+  return ReturnEvent;
+}
+
+/****************************************************************************
+ Function
+    EventCheckerBench
+
+ Parameters
+   None
+
+ Returns
+   bool, true if an event was posted
+
+ Description
+   Posts BENCH_WAKE to the ping service when the wake thread has signalled
+   BENCH_EVENT_SRC
+ Notes
+****************************************************************************/
+bool EventCheckerBench(void)
+{
+  uint32_t signalled = __atomic_load_n(&WakesSignalled, __ATOMIC_ACQUIRE);
+  if(signalled == __atomic_load_n(&WakesHandled, __ATOMIC_ACQUIRE))
+  {
+    return false;
+  }
+  ES_Event_t ThisEvent = {.EventType = BENCH_WAKE, .EventParam = (uint16_t)signalled};
+  return PostBenchPingService(ThisEvent);
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+static void StartPhase(BenchPhase_t Phase)
+{
+  CurrPhase = Phase;
+  PhaseStart = GetTimeNs();
+}
+
+static void EndPhase(void)
+{
+  Results[CurrPhase].Time = GetTimeNs() - PhaseStart;
+}
+
+// fills the window of BENCH_CROSS events in flight to the worker
+static void StartCross(void)
+{
+  StartPhase(BENCH_PHASE_CROSS);
+  ES_Event_t CrossEvent = {.EventType = BENCH_CROSS};
+  for(uint8_t i = 0; i < BENCH_CROSS_WINDOW; i++)
+  {
+    PostBenchWorkerService(CrossEvent);
+  }
+}
+
+static uint64_t GetTimeNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// signals BENCH_EVENT_SRC, then spins until the ping service has seen it
+static void *WakeThread(void *Arg)
+{
+  for(uint32_t i = 1; i <= BENCH_NUM_WAKES; i++)
+  {
+    __atomic_store_n(&WakesSignalled, (uint16_t)i, __ATOMIC_RELEASE);
+    ES_SetEventPending(BENCH_EVENT_SRC);
+    while(__atomic_load_n(&WakesHandled, __ATOMIC_ACQUIRE) != (uint16_t)i)
+    {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,54 @@
+/****************************************************************************
+
+  Header file for the host benchmark services
+
+ ****************************************************************************/
+
+#ifndef BenchService_H
+#define BenchService_H
+
+#include "ES_Event.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// the timer phase counts this many timeouts of a periodic timer
+#define BENCH_TIMER_PERIOD 5      // ms
+#define BENCH_TIMER_PERIODS 200
+
+typedef struct
+{
+  uint32_t NumEvents;       // events dispatched during the phase
+  uint64_t Time;            // ns the phase took
+}BenchResult_t;
+
+typedef enum
+{
+  BENCH_PHASE_PINGPONG = 0,  // 2 services posting to each other
+  BENCH_PHASE_CHAIN,         // 1 service posting to itself
+  BENCH_PHASE_WAKE,          // event source signalled from another thread
+  BENCH_PHASE_CROSS,         // posts to and from a service run by the worker
+  BENCH_PHASE_TIMER,         // periodic ES timer
+  BENCH_NUM_PHASES
+}BenchPhase_t;
+
+// Public Function Prototypes
+void BenchService_SetNumEvents(uint32_t NumEvents);
+bool BenchService_Done(void);
+const BenchResult_t *BenchService_GetResult(BenchPhase_t Phase);
+
+bool InitBenchPingService(uint8_t Priority);
+bool PostBenchPingService(ES_Event_t ThisEvent);
+ES_Event_t RunBenchPingService(ES_Event_t ThisEvent);
+
+bool InitBenchPongService(uint8_t Priority);
+bool PostBenchPongService(ES_Event_t ThisEvent);
+ES_Event_t RunBenchPongService(ES_Event_t ThisEvent);
+
+bool InitBenchWorkerService(uint8_t Priority);
+bool PostBenchWorkerService(ES_Event_t ThisEvent);
+ES_Event_t RunBenchWorkerService(ES_Event_t ThisEvent);
+
+// Event checkers
+bool EventCheckerBench(void);
+
+#endif /* BenchService_H */
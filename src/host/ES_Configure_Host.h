@@ -0,0 +1,169 @@
+/****************************************************************************
+ Module
+     ES_Configure_Host.h
+ Description
+     ES_Configure.h for the host build ([env:native] in platformio.ini).
+     Pulled in by ES_Configure.h when ES_PORT_POSIX is defined, and sets the
+     framework up with just the benchmark services, since the sensor services
+     need the ESP32's peripherals.
+ Notes
+     Laid out the same as ES_Configure.h, see there for what each setting does
+*****************************************************************************/
+
+#ifndef ES_CONFIGURE_HOST_H
+#define ES_CONFIGURE_HOST_H
+
+
+/****************************************************************************/
+// Name/define the events of interest
+// Universal events occupy the lowest entries, followed by user-defined events
+typedef enum
+{
+  ES_NO_EVENT = 0,
+  ES_ERROR,                 /* used to indicate an error from the service */
+  ES_INIT,                  /* used to transition from initial pseudo-state */
+  ES_TIMEOUT,               /* signals that the timer has expired */
+  ES_FAIL,                  /* used to indicate something was unsuccessful */
+  ES_SUCCESS,               /* used to indicate something was successful */
+  /* User-defined events start here */
+  BENCH_PING,               /* bounced between the two bench services */
+  BENCH_CHAIN,              /* reposted by the pong service to itself */
+  BENCH_WAKE,               /* from the bench event checker, param is the number of wake ups */
+  BENCH_CROSS,              /* between the ping and worker services */
+  ES_NUM_EVENT_TYPES        /* keep last, number of event types */
+}ES_EventType_t;
+
+
+/****************************************************************************/
+// add all event checkers here as ES_CHECKER(function, min interval, weight, service)
+#define EVENT_CHECKER_LIST ES_CHECKER(EventCheckerBench, 0, 1, BENCH_PING_SERV_NUM)
+#define ES_CHECKER_SCHEDULING ES_CHECKERS_WEIGHTED
+
+typedef enum
+{
+  BENCH_EVENT_SRC = 0,      /* signalled by the bench's wake up thread */
+  ES_NUM_EVENT_SOURCES      /* keep last */
+}ES_EventSource_t;
+
+#define EVENT_CHECKER_POLL_PERIOD 50
+
+
+/****************************** Timers **************************************/
+#define TIMER_UNUSED ((pPostFunc)0)
+#define TIMER0_RESP_FUNC PostBenchPingService
+#define TIMER1_RESP_FUNC TIMER_UNUSED
+#define TIMER2_RESP_FUNC TIMER_UNUSED
+#define TIMER3_RESP_FUNC TIMER_UNUSED
+#define TIMER4_RESP_FUNC TIMER_UNUSED
+#define TIMER5_RESP_FUNC TIMER_UNUSED
+#define TIMER6_RESP_FUNC TIMER_UNUSED
+#define TIMER7_RESP_FUNC TIMER_UNUSED
+#define TIMER8_RESP_FUNC TIMER_UNUSED
+#define TIMER9_RESP_FUNC TIMER_UNUSED
+#define TIMER10_RESP_FUNC TIMER_UNUSED
+#define TIMER11_RESP_FUNC TIMER_UNUSED
+#define TIMER12_RESP_FUNC TIMER_UNUSED
+#define TIMER13_RESP_FUNC TIMER_UNUSED
+#define TIMER14_RESP_FUNC TIMER_UNUSED
+#define TIMER15_RESP_FUNC TIMER_UNUSED
+
+#define BENCH_TIMER_NUM 0
+
+#define ES_TIMER_SLACKS \
+
+
+#define ES_TIMER_POOL_SIZE 32
+
+
+/****************************** Payloads ************************************/
+#define ES_PAYLOAD_SIZE 16
+#define ES_PAYLOAD_POOL_SIZE 8
+
+
+/****************************** Idle ****************************************/
+#define ES_LIGHT_SLEEP_MIN_TIME 20
+#define ES_IDLE_MAX_TIME 1000U
+
+
+/****************************** Time Stamps *********************************/
+// #define ES_TIMESTAMP_ENABLE
+
+/****************************** Profiler ************************************/
+// #define ES_PROFILER_ENABLE
+
+/****************************** Run Budgets *********************************/
+// #define ES_BUDGET_ENABLE
+
+/****************************** Trace ***************************************/
+// #define ES_TRACE_ENABLE
+#define ES_TRACE_LEN 512
+#define ES_TRACE_NUM_INPUTS 0
+
+
+/********************************Services********************************************/
+#define MAX_NUM_SERVICES 16
+#define NUM_SERVICES 3
+
+/****************************************************************************/
+// These are the definitions for Service 0
+#define SERV_0_HEADER "host/BenchService.h"
+#define SERV_0_INIT InitBenchPingService
+#define SERV_0_RUN RunBenchPingService
+#define SERV_0_QUEUE_SIZE 4
+#define SERV_0_RUN_BUDGET 100
+#define SERV_0_PROBE ES_NO_PROBE
+#define BENCH_PING_SERV_NUM 0
+
+/****************************************************************************/
+// These are the definitions for Service 1
+#if NUM_SERVICES > 1
+#define SERV_1_HEADER "host/BenchService.h"
+#define SERV_1_INIT InitBenchPongService
+#define SERV_1_RUN RunBenchPongService
+#define SERV_1_QUEUE_SIZE 4
+#define SERV_1_RUN_BUDGET 100
+#define SERV_1_PROBE ES_NO_PROBE
+#define BENCH_PONG_SERV_NUM 1
+#endif
+
+/****************************************************************************/
+// These are the definitions for Service 2, run by the worker thread
+#if NUM_SERVICES > 2
+#define SERV_2_HEADER "host/BenchService.h"
+#define SERV_2_INIT InitBenchWorkerService
+#define SERV_2_RUN RunBenchWorkerService
+#define SERV_2_QUEUE_SIZE 8
+#define SERV_2_RUN_BUDGET 1000
+#define SERV_2_PROBE ES_NO_PROBE
+#define BENCH_WORKER_SERV_NUM 2
+#endif
+
+
+/****************************** Post Lists **********************************/
+#define POST_LIST_00 BENCH_PING_SERV_NUM, BENCH_PONG_SERV_NUM
+#define POST_LIST_01
+#define POST_LIST_02
+#define POST_LIST_03
+#define POST_LIST_04
+#define POST_LIST_05
+#define POST_LIST_06
+#define POST_LIST_07
+
+#define ES_SUBSCRIPTIONS \
+
+#define ES_MULTICAST_QUEUE_SIZE 4
+
+
+/****************************** Queues **************************************/
+#define ES_QUEUE_POLICIES \
+
+
+/****************************** Worker **************************************/
+// a thread stands in for the worker task, the ESP32's core and stack
+// settings don't apply
+#define ES_WORKER_ENABLE
+#define ES_WORKER_SERVICES (1U << BENCH_WORKER_SERV_NUM)
+#define ES_WORKER_QUEUE_SIZE 8
+
+
+#endif /* ES_CONFIGURE_HOST_H */
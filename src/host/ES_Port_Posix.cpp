@@ -0,0 +1,599 @@
+/****************************************************************************/
+/*
+ Module
+   ES_Port_Posix.c
+
+ Revision
+   1.0.1
+
+ Description
+   Host (Linux) port of the hardware specific functions of the Events &
+   Services Framework, so the framework core can run and be benchmarked on
+   a PC. Built by the [env:native] environment in platformio.ini instead of
+   ES_Port.c.
+
+   The ESP32's free running hw timer is emulated with CLOCK_MONOTONIC at the
+   same 40MHz count rate, so the TimerRate_t values mean the same thing. The
+   timer alarm is a timerfd armed for an absolute time, and event sources
+   wake the loop through an eventfd. Instead of the portMUX critical
+   sections the pending source flags are updated with atomics, so
+   _HW_Signal_Event_Source can be called from any thread. The worker task
+   is a thread, woken through its own eventfd.
+
+ Notes
+   There is no light sleep on a host, _HW_Light_Sleep just blocks like
+   _HW_Wait_For_Event but its time is counted as sleep.
+*/
+ /***************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+#include "ES_Configure.h"
+#include "ES_Port.h"
+#include "ES_Timers.h"
+
+// emulated hw timer counts per us, the same 40MHz as the ESP32 port
+#define COUNTS_PER_US 40
+#define NS_PER_COUNT 25
+#define NS_PER_US 1000
+#define NS_PER_SEC 1000000000ULL
+
+// number of emulated hw timer counts in 1 framework tick (the TimerRate_t value)
+static uint32_t CountsPerTick = ES_Timer_RATE_1mS;
+
+// time the emulated counter started at
+static uint64_t StartTime;
+
+// the timer alarm, readable once it has gone off
+static int AlarmFd = -1;
+
+// written to by _HW_Signal_Event_Source to wake up a blocked loop
+static int WakeFd = -1;
+
+// Each bit flags an event source that has work for its event checker. Set
+// by _HW_Signal_Event_Source from any thread, cleared by the main loop
+static uint32_t PendingSources = 0;
+
+// idle accounting, see _HW_Get_Idle_Stats
+static uint64_t LightSleepTime = 0;
+static uint64_t WaitTime = 0;
+static uint32_t NumLightSleeps = 0;
+
+#ifdef ES_WORKER_ENABLE
+// the thread standing in for the worker task and its wake up. InWorker is
+// only set in the worker thread's copy
+static pthread_t WorkerThread;
+static bool WorkerStarted = false;
+static __thread bool InWorker = false;
+static int WorkerWakeFd = -1;
+static void (*WorkerLoopFunc)(void) = NULL;
+
+// shared by the loop and the worker, see _HW_Lock
+static pthread_mutex_t WorkerLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static void *WorkerThreadFunc(void *Arg);
+#endif
+
+static uint64_t GetTimeNs(void);
+static void WaitForFds(uint32_t MaxWaitTicks);
+
+/****************************************************************************
+ Function
+     _HW_Timer_Init
+ Parameters
+     unsigned char Rate set to one of the TMR_RATE_XX values to set the
+     Tick rate
+ Returns
+     None.
+ Description
+     Starts the emulated counter and creates the alarm timer and the event
+     source wake up.
+ Notes
+****************************************************************************/
+void _HW_Timer_Init(TimerRate_t Rate)
+{
+  CountsPerTick = Rate;
+  StartTime = GetTimeNs();
+
+  if(AlarmFd < 0)
+  {
+    AlarmFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  }
+  if(WakeFd < 0)
+  {
+    WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Timer_SetAlarm
+ Parameters
+     uint32_t Tick, the absolute tick count (as returned by _HW_GetTickCount)
+     at which the alarm should go off
+ Returns
+     None.
+ Description
+     Arms the alarm timer for the given tick, replacing any alarm that was
+     already set. A tick that has already been reached fires right away.
+ Notes
+****************************************************************************/
+void _HW_Timer_SetAlarm(uint32_t Tick)
+{
+  uint64_t currTick = (GetTimeNs() - StartTime) / NS_PER_COUNT / CountsPerTick;
+  int32_t ticksLeft = (int32_t)(Tick - (uint32_t)currTick);
+  if(ticksLeft < 0)
+  {
+    ticksLeft = 0;
+  }
+
+  uint64_t alarmTime = StartTime + (currTick + ticksLeft) * CountsPerTick * NS_PER_COUNT;
+  if(ticksLeft == 0)
+  {
+    alarmTime = 1;  // any time in the past, 0 would disarm it
+  }
+  struct itimerspec alarm = {};
+  alarm.it_value.tv_sec = alarmTime / NS_PER_SEC;
+  alarm.it_value.tv_nsec = alarmTime % NS_PER_SEC;
+  timerfd_settime(AlarmFd, TFD_TIMER_ABSTIME, &alarm, NULL);
+}
+
+/****************************************************************************
+ Function
+     _HW_Timer_ClearAlarm
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Disarms the alarm when no ES timers are running
+ Notes
+****************************************************************************/
+void _HW_Timer_ClearAlarm(void)
+{
+  struct itimerspec alarm = {};
+  timerfd_settime(AlarmFd, 0, &alarm, NULL);
+}
+
+/****************************************************************************
+ Function
+     _HW_Process_Pending_Ints
+ Parameters
+     none
+ Returns
+     always true.
+ Description
+     Runs the framework tick response if the alarm has gone off since the
+     last call
+ Notes
+     Reading the timerfd clears it, like TickCount in the ESP32 port
+****************************************************************************/
+bool _HW_Process_Pending_Ints(void)
+{
+  uint64_t expirations;
+  if(read(AlarmFd, &expirations, sizeof(expirations)) == sizeof(expirations))
+  {
+    ES_Timer_Tick_Resp();
+  }
+  return true;  // always return true to allow loop test in ES_Run to proceed
+}
+
+/****************************************************************************
+ Function
+     _HW_GetTickCount()
+ Parameters
+     none
+ Returns
+     uint32_t   count of number of system ticks that have occurred.
+ Description
+     derives the tick count from the emulated free running counter
+ Notes
+****************************************************************************/
+uint32_t _HW_GetTickCount(void)
+{
+  return (uint32_t)((GetTimeNs() - StartTime) / NS_PER_COUNT / CountsPerTick);
+}
+
+/****************************************************************************
+ Function
+     _HW_Skip_To_Tick
+ Parameters
+     uint32_t Tick, the tick count to jump to
+ Returns
+     None.
+ Description
+     Moves the emulated counter on to the start of Tick at once, as if the
+     time in between had gone by. Lets the unit tests check the timer wheel's
+     slot and level rollovers, and the tick count wrapping, without waiting
+     hours for them
+ Notes
+     Host only. Tick must be ahead of the current tick count (modulo 2^32).
+     Starting at a tick boundary leaves a whole tick before the count moves
+     on by itself. The skipped time counts as run time in the idle stats
+****************************************************************************/
+void _HW_Skip_To_Tick(uint32_t Tick)
+{
+  uint64_t now = GetTimeNs();
+  uint64_t currTick = (now - StartTime) / NS_PER_COUNT / CountsPerTick;
+  uint64_t newTick = currTick + (uint32_t)(Tick - (uint32_t)currTick);
+  StartTime = now - newTick * CountsPerTick * NS_PER_COUNT;
+}
+
+/****************************************************************************
+ Function
+     _HW_Signal_Event_Source
+ Parameters
+     uint8_t Source, number of the event source that has work pending
+ Returns
+     None.
+ Description
+     Flags an event source as pending and wakes up the loop
+ Notes
+     Safe to call from any thread
+****************************************************************************/
+void _HW_Signal_Event_Source(uint8_t Source)
+{
+  __atomic_fetch_or(&PendingSources, 1UL << Source, __ATOMIC_RELEASE);
+
+  uint64_t one = 1;
+  if(write(WakeFd, &one, sizeof(one)) != sizeof(one))
+  {
+    return;  // counter is already non-zero, the loop will wake up anyway
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Take_Event_Sources
+ Parameters
+     none
+ Returns
+     uint32_t, one bit set for each source signalled since the last call
+ Description
+     Atomically reads and clears the pending event source flags.
+ Notes
+****************************************************************************/
+uint32_t _HW_Take_Event_Sources(void)
+{
+  uint64_t wakeups;
+  if(read(WakeFd, &wakeups, sizeof(wakeups)) != sizeof(wakeups))
+  {
+    wakeups = 0;  // nothing signalled, nothing to clear
+  }
+  return __atomic_exchange_n(&PendingSources, 0, __ATOMIC_ACQUIRE);
+}
+
+/****************************************************************************
+ Function
+     _HW_Wait_For_Event
+ Parameters
+     uint32_t MaxWaitTicks, longest time to block for
+ Returns
+     None.
+ Description
+     Blocks until the alarm goes off, an event source is signalled or
+     MaxWaitTicks goes by
+ Notes
+****************************************************************************/
+void _HW_Wait_For_Event(uint32_t MaxWaitTicks)
+{
+  uint64_t startTime = GetTimeNs();
+  WaitForFds(MaxWaitTicks);
+  WaitTime += (GetTimeNs() - startTime) / NS_PER_US;
+}
+
+/****************************************************************************
+ Function
+     _HW_Ints_Pending
+ Parameters
+     none
+ Returns
+     bool, true if the alarm or an event source is waiting to be handled
+ Description
+     Lets the framework check that there is really nothing to do before idling
+ Notes
+****************************************************************************/
+bool _HW_Ints_Pending(void)
+{
+  if(__atomic_load_n(&PendingSources, __ATOMIC_ACQUIRE) != 0)
+  {
+    return true;
+  }
+  struct pollfd alarm = {.fd = AlarmFd, .events = POLLIN};
+  return poll(&alarm, 1, 0) > 0;
+}
+
+/****************************************************************************
+ Function
+     _HW_Light_Sleep
+ Parameters
+     uint32_t MaxSleepTicks, longest time to sleep for
+ Returns
+     None.
+ Description
+     Stands in for light sleep: blocks like _HW_Wait_For_Event, but counts
+     the time as sleep so the idle stats match the device's.
+ Notes
+****************************************************************************/
+void _HW_Light_Sleep(uint32_t MaxSleepTicks)
+{
+  if(_HW_Ints_Pending())
+  {
+    return;
+  }
+  uint64_t startTime = GetTimeNs();
+  WaitForFds(MaxSleepTicks);
+  LightSleepTime += (GetTimeNs() - startTime) / NS_PER_US;
+  NumLightSleeps++;
+}
+
+/****************************************************************************
+ Function
+     _HW_Get_Idle_Stats
+ Parameters
+     ES_IdleStats_t *Stats, filled in with the time spent idle and running
+ Returns
+     None.
+ Description
+     Reports how long the loop has spent sleeping, waiting and running
+     since _HW_Timer_Init
+ Notes
+****************************************************************************/
+void _HW_Get_Idle_Stats(ES_IdleStats_t *Stats)
+{
+  if(Stats == NULL)
+  {
+    return;
+  }
+  uint64_t totalTime = (GetTimeNs() - StartTime) / NS_PER_US;
+  Stats->LightSleepTime = LightSleepTime;
+  Stats->WaitTime = WaitTime;
+  Stats->RunTime = totalTime - LightSleepTime - WaitTime;
+  Stats->NumLightSleeps = NumLightSleeps;
+}
+
+/****************************************************************************
+ Function
+     _HW_GetTimeUs
+ Parameters
+     None.
+ Returns
+     uint32_t, us since _HW_Timer_Init
+ Description
+     Time stamps for ES_Event_t, from the emulated free running counter
+ Notes
+****************************************************************************/
+uint32_t _HW_GetTimeUs(void)
+{
+  return (uint32_t)((GetTimeNs() - StartTime) / 1000);
+}
+
+/****************************************************************************
+ Function
+     _HW_GetCycleCount
+ Parameters
+     None.
+ Returns
+     uint32_t, a ns counter standing in for the CPU cycle counter
+ Description
+     Fine grained time stamps for the profiler
+ Notes
+****************************************************************************/
+uint32_t _HW_GetCycleCount(void)
+{
+  return (uint32_t)GetTimeNs();
+}
+
+/****************************************************************************
+ Function
+     _HW_GetCyclesPerUs
+ Parameters
+     None.
+ Returns
+     uint32_t, _HW_GetCycleCount counts in 1us
+ Description
+     Converts _HW_GetCycleCount differences to time
+ Notes
+****************************************************************************/
+uint32_t _HW_GetCyclesPerUs(void)
+{
+  return NS_PER_US;
+}
+
+/****************************************************************************
+ Function
+     ConsoleInit
+ Parameters
+     none
+ Returns
+     none.
+ Description
+     stdout is already there on a host
+ Notes
+ ****************************************************************************/
+void ConsoleInit(void)
+{
+}
+
+#ifdef ES_WORKER_ENABLE
+/****************************************************************************
+ Function
+     _HW_Worker_Start
+ Parameters
+     void (*WorkerLoop)(void), the worker's main function, never returns
+ Returns
+     None.
+ Description
+     Starts the worker thread
+ Notes
+     Only the first call does anything
+****************************************************************************/
+void _HW_Worker_Start(void (*WorkerLoop)(void))
+{
+  if(WorkerStarted)
+  {
+    return;
+  }
+  WorkerWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  WorkerLoopFunc = WorkerLoop;
+  WorkerStarted = true;
+  pthread_create(&WorkerThread, NULL, WorkerThreadFunc, NULL);
+}
+
+/****************************************************************************
+ Function
+     _HW_In_Worker
+ Parameters
+     none
+ Returns
+     bool, true if called from the worker thread
+ Description
+     Lets the framework pick the right queues for a post
+ Notes
+****************************************************************************/
+bool _HW_In_Worker(void)
+{
+  return InWorker;
+}
+
+/****************************************************************************
+ Function
+     _HW_Worker_Wait
+ Parameters
+     uint32_t MaxWaitTicks, longest time to block for
+ Returns
+     None.
+ Description
+     Blocks the worker thread until _HW_Worker_Signal or MaxWaitTicks goes by
+ Notes
+     A signal given before this is called makes it return right away
+****************************************************************************/
+void _HW_Worker_Wait(uint32_t MaxWaitTicks)
+{
+  struct pollfd wake = {.fd = WorkerWakeFd, .events = POLLIN};
+  uint64_t waitUs = ((uint64_t)MaxWaitTicks * CountsPerTick + COUNTS_PER_US - 1) / COUNTS_PER_US;
+  poll(&wake, 1, (int)((waitUs + NS_PER_US - 1) / 1000));
+
+  uint64_t wakeups;
+  if(read(WorkerWakeFd, &wakeups, sizeof(wakeups)) != sizeof(wakeups))
+  {
+    wakeups = 0;  // timed out
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Worker_Signal
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Wakes up the worker thread once the loop has posted to it
+ Notes
+     Does nothing before the worker is started
+****************************************************************************/
+void _HW_Worker_Signal(void)
+{
+  uint64_t one = 1;
+  if(!WorkerStarted || write(WorkerWakeFd, &one, sizeof(one)) != sizeof(one))
+  {
+    return;  // not started yet, or the worker will wake up anyway
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Loop_Signal
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Wakes up the loop once the worker has posted to it
+ Notes
+     Shares the event sources' wake up, _HW_Take_Event_Sources clears it
+****************************************************************************/
+void _HW_Loop_Signal(void)
+{
+  uint64_t one = 1;
+  if(write(WakeFd, &one, sizeof(one)) != sizeof(one))
+  {
+    return;  // counter is already non-zero, the loop will wake up anyway
+  }
+}
+
+/****************************************************************************
+ Function
+     _HW_Lock
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Takes the recursive lock shared by the loop and the worker
+ Notes
+****************************************************************************/
+void _HW_Lock(void)
+{
+  pthread_mutex_lock(&WorkerLock);
+}
+
+/****************************************************************************
+ Function
+     _HW_Unlock
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Gives back the lock taken by _HW_Lock
+ Notes
+****************************************************************************/
+void _HW_Unlock(void)
+{
+  pthread_mutex_unlock(&WorkerLock);
+}
+#endif /* ES_WORKER_ENABLE */
+
+
+//*********************************
+// private functions
+//*********************************
+static uint64_t GetTimeNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * NS_PER_SEC + now.tv_nsec;
+}
+
+// blocks on the alarm and the event source wake up, leaving both to be
+// cleared by the loop
+static void WaitForFds(uint32_t MaxWaitTicks)
+{
+  struct pollfd fds[] = {
+    {.fd = AlarmFd, .events = POLLIN},
+    {.fd = WakeFd, .events = POLLIN}
+  };
+  uint64_t waitUs = ((uint64_t)MaxWaitTicks * CountsPerTick + COUNTS_PER_US - 1) / COUNTS_PER_US;
+  int timeoutMs = (int)((waitUs + NS_PER_US - 1) / 1000);
+  poll(fds, 2, timeoutMs);
+}
+
+#ifdef ES_WORKER_ENABLE
+static void *WorkerThreadFunc(void *Arg)
+{
+  InWorker = true;
+  WorkerLoopFunc();
+  return NULL;
+}
+#endif
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,79 @@
+/****************************************************************************
+ Module
+   main_bench.c
+
+ Description
+   Entry point of the host build ([env:native]). Runs the framework with the
+   benchmark services until they are done and prints events/s for each
+   phase, so changes to the event core can be measured and checked on a PC.
+
+   usage: program [events per phase]
+
+ Notes
+   Exits with 1 if the framework fails or the timer phase is more than 10%
+   off the wall clock. The timer wheel, the order of the events between the
+   loop and the worker and the state machines are checked by the unit
+   tests in test/ ([env:native_test]).
+****************************************************************************/
+#include "ES_framework.h"
+#include "ES_Timers.h"
+#include "BenchService.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_DEFAULT_EVENTS 1000000
+#define BENCH_TIMER_TOLERANCE 10   // % the timer phase may be off by
+
+static const char *PhaseNames[BENCH_NUM_PHASES] = {"ping-pong", "chain", "wake", "cross", "timer"};
+
+int main(int argc, char *argv[])
+{
+  uint32_t numEvents = BENCH_DEFAULT_EVENTS;
+  if(argc > 1)
+  {
+    numEvents = strtoul(argv[1], NULL, 0);
+  }
+  BenchService_SetNumEvents(numEvents);
+
+  TimerRate_t Rate = ES_Timer_RATE_1mS;
+  ES_Return_t returnVal = ES_Initialize(Rate);
+  if(returnVal != Success)
+  {
+    printf("Err: %i\n", returnVal);
+    return 1;
+  }
+
+  while(returnVal == Success && !BenchService_Done())
+  {
+    returnVal = ES_Run();
+  }
+  if(returnVal != Success)
+  {
+    printf("Err: %i\n", returnVal);
+    return 1;
+  }
+
+  printf("phase         events    time ms     events/s   ns/event\n");
+  for(uint8_t i = 0; i < BENCH_NUM_PHASES; i++)
+  {
+    const BenchResult_t *result = BenchService_GetResult((BenchPhase_t)i);
+    double timeNs = (double)result->Time;
+    printf("%-10s  %8u  %9.2f  %11.0f  %9.1f\n", PhaseNames[i], result->NumEvents,
+        timeNs / 1e6, result->NumEvents / (timeNs / 1e9), timeNs / result->NumEvents);
+  }
+
+  ES_Profiler_Print();  // only prints with ES_PROFILER_ENABLE
+  ES_Budget_Print();    // only prints with ES_BUDGET_ENABLE
+
+  // each timeout should come 1 period after the last one
+  const BenchResult_t *timer = BenchService_GetResult(BENCH_PHASE_TIMER);
+  double expected = (double)timer->NumEvents * BENCH_TIMER_PERIOD * 1e6;
+  double error = 100.0 * ((double)timer->Time - expected) / expected;
+  printf("timer error %.2f%%, %u overruns\n", error, ES_Timer_GetOverruns(BENCH_TIMER_NUM));
+  if(error > BENCH_TIMER_TOLERANCE || error < -BENCH_TIMER_TOLERANCE)
+  {
+    return 1;
+  }
+  return 0;
+}
+
@@ -0,0 +1,353 @@
+/****************************************************************************/
+/*
+ Module
+   ES_Port_Sim.c
+
+ Revision
+   1.0.1
+
+ Description
+   Virtual time port of the hardware specific functions of the Events &
+   Services Framework, for the simulator ([env:sim] in platformio.ini).
+   The tick count comes from the simulator's clock and waiting for an
+   event jumps the clock straight to the timer alarm or the next script
+   input, so nothing ever blocks.
+
+ Notes
+   Single threaded, the models and the script signal event sources from
+   the loop itself. Built with ES_PORT_SIM, which leaves ES_WORKER_ENABLE
+   off, so every service runs in the loop
+*/
+ /***************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ES_Configure.h"
+#include "ES_Port.h"
+#include "ES_Timers.h"
+#include "Sim.h"
+
+// emulated hw timer counts per us, the same 40MHz as the ESP32 port
+#define COUNTS_PER_US 40
+
+// us in 1 framework tick
+static uint32_t TickTime = ES_Timer_RATE_1mS / COUNTS_PER_US;
+
+// the timer alarm, AlarmTick is only valid while AlarmSet
+static bool AlarmSet = false;
+static uint32_t AlarmTick;
+
+// Each bit flags an event source that has work for its event checker
+static uint32_t PendingSources = 0;
+
+// idle accounting, see _HW_Get_Idle_Stats
+static uint64_t LightSleepTime = 0;
+static uint64_t WaitTime = 0;
+static uint32_t NumLightSleeps = 0;
+
+static bool AlarmDue(void);
+static void Idle(uint32_t MaxTicks, bool LightSleep);
+
+/****************************************************************************
+ Function
+     _HW_Timer_Init
+ Parameters
+     unsigned char Rate set to one of the TMR_RATE_XX values to set the
+     Tick rate
+ Returns
+     None.
+ Description
+     Ticks count from the start of the boot, like the hw timer
+ Notes
+****************************************************************************/
+void _HW_Timer_Init(TimerRate_t Rate)
+{
+  TickTime = Rate / COUNTS_PER_US;
+  AlarmSet = false;
+}
+
+/****************************************************************************
+ Function
+     _HW_Timer_SetAlarm
+ Parameters
+     uint32_t Tick, the absolute tick count (as returned by _HW_GetTickCount)
+     at which the alarm should go off
+ Returns
+     None.
+ Description
+     Sets the alarm, replacing any alarm that was already set
+ Notes
+****************************************************************************/
+void _HW_Timer_SetAlarm(uint32_t Tick)
+{
+  AlarmTick = Tick;
+  AlarmSet = true;
+}
+
+/****************************************************************************
+ Function
+     _HW_Timer_ClearAlarm
+ Parameters
+     none
+ Returns
+     None.
+ Description
+     Disarms the alarm when no ES timers are running
+ Notes
+****************************************************************************/
+void _HW_Timer_ClearAlarm(void)
+{
+  AlarmSet = false;
+}
+
+/****************************************************************************
+ Function
+     _HW_Process_Pending_Ints
+ Parameters
+     none
+ Returns
+     always true.
+ Description
+     Runs the framework tick response once the clock has reached the alarm
+ Notes
+****************************************************************************/
+bool _HW_Process_Pending_Ints(void)
+{
+  if(AlarmDue())
+  {
+    AlarmSet = false;
+    Sim_Count(SIM_TIMER_ALARMS);
+    ES_Timer_Tick_Resp();
+  }
+  return true;  // always return true to allow loop test in ES_Run to proceed
+}
+
+/****************************************************************************
+ Function
+     _HW_GetTickCount()
+ Parameters
+     none
+ Returns
+     uint32_t   count of number of system ticks that have occurred.
+ Description
+     ticks since the start of the boot, from the simulator's clock
+ Notes
+****************************************************************************/
+uint32_t _HW_GetTickCount(void)
+{
+  return (uint32_t)((Sim_Now() - Sim_BootTime()) / TickTime);
+}
+
+/****************************************************************************
+ Function
+     _HW_Signal_Event_Source
+ Parameters
+     uint8_t Source, number of the event source that has work pending
+ Returns
+     None.
+ Description
+     Flags an event source as pending
+ Notes
+****************************************************************************/
+void _HW_Signal_Event_Source(uint8_t Source)
+{
+  PendingSources |= 1UL << Source;
+}
+
+/****************************************************************************
+ Function
+     _HW_Take_Event_Sources
+ Parameters
+     none
+ Returns
+     uint32_t, one bit set for each source signalled since the last call
+ Description
+     Reads and clears the pending event source flags.
+ Notes
+****************************************************************************/
+uint32_t _HW_Take_Event_Sources(void)
+{
+  uint32_t sources = PendingSources;
+  PendingSources = 0;
+  return sources;
+}
+
+/****************************************************************************
+ Function
+     _HW_Wait_For_Event
+ Parameters
+     uint32_t MaxWaitTicks, longest time to block for
+ Returns
+     None.
+ Description
+     Jumps the clock to the alarm, the next script input or MaxWaitTicks
+     from now, whichever comes first
+ Notes
+****************************************************************************/
+void _HW_Wait_For_Event(uint32_t MaxWaitTicks)
+{
+  Idle(MaxWaitTicks, false);
+}
+
+/****************************************************************************
+ Function
+     _HW_Ints_Pending
+ Parameters
+     none
+ Returns
+     bool, true if the alarm or an event source is waiting to be handled
+ Description
+     Lets the framework check that there is really nothing to do before idling
+ Notes
+****************************************************************************/
+bool _HW_Ints_Pending(void)
+{
+  return PendingSources != 0 || AlarmDue();
+}
+
+/****************************************************************************
+ Function
+     _HW_Light_Sleep
+ Parameters
+     uint32_t MaxSleepTicks, longest time to sleep for
+ Returns
+     None.
+ Description
+     Same as _HW_Wait_For_Event, but the time counts as light sleep
+ Notes
+****************************************************************************/
+void _HW_Light_Sleep(uint32_t MaxSleepTicks)
+{
+  if(_HW_Ints_Pending())
+  {
+    return;
+  }
+  Idle(MaxSleepTicks, true);
+  NumLightSleeps++;
+}
+
+/****************************************************************************
+ Function
+     _HW_Get_Idle_Stats
+ Parameters
+     ES_IdleStats_t *Stats, filled in with the time spent idle and running
+ Returns
+     None.
+ Description
+     Reports how long the loop has spent sleeping, waiting and running
+     since the boot, in virtual time
+ Notes
+****************************************************************************/
+void _HW_Get_Idle_Stats(ES_IdleStats_t *Stats)
+{
+  if(Stats == NULL)
+  {
+    return;
+  }
+  Stats->LightSleepTime = LightSleepTime;
+  Stats->WaitTime = WaitTime;
+  Stats->RunTime = Sim_Now() - Sim_BootTime() - LightSleepTime - WaitTime;
+  Stats->NumLightSleeps = NumLightSleeps;
+}
+
+/****************************************************************************
+ Function
+     _HW_GetTimeUs
+ Parameters
+     None.
+ Returns
+     uint32_t, us since the start of the boot
+ Description
+     Time stamps for ES_Event_t, from the simulator's clock
+ Notes
+****************************************************************************/
+uint32_t _HW_GetTimeUs(void)
+{
+  return (uint32_t)(Sim_Now() - Sim_BootTime());
+}
+
+/****************************************************************************
+ Function
+     _HW_GetCycleCount
+ Parameters
+     None.
+ Returns
+     uint32_t, the virtual clock in us
+ Description
+     Time stamps for the profiler. Run functions take no virtual time, so
+     the profiler only sees queue waits
+ Notes
+****************************************************************************/
+uint32_t _HW_GetCycleCount(void)
+{
+  return (uint32_t)Sim_Now();
+}
+
+/****************************************************************************
+ Function
+     _HW_GetCyclesPerUs
+ Parameters
+     None.
+ Returns
+     uint32_t, _HW_GetCycleCount counts in 1us
+ Description
+     Converts _HW_GetCycleCount differences to time
+ Notes
+****************************************************************************/
+uint32_t _HW_GetCyclesPerUs(void)
+{
+  return 1;
+}
+
+/****************************************************************************
+ Function
+     ConsoleInit
+ Parameters
+     none
+ Returns
+     none.
+ Description
+     stdout is already there on a host
+ Notes
+ ****************************************************************************/
+void ConsoleInit(void)
+{
+}
+
+
+//*********************************
+// private functions
+//*********************************
+static bool AlarmDue(void)
+{
+  return AlarmSet && (int32_t)(_HW_GetTickCount() - AlarmTick) >= 0;
+}
+
+static void Idle(uint32_t MaxTicks, bool LightSleep)
+{
+  uint64_t bootTime = Sim_BootTime();
+  uint64_t until = Sim_Now() + (uint64_t)MaxTicks * TickTime;
+  if(AlarmSet)
+  {
+    uint64_t alarmTime = bootTime + (uint64_t)AlarmTick * TickTime;
+    if(alarmTime < until)
+    {
+      until = alarmTime;
+    }
+  }
+
+  uint64_t startTime = Sim_Now();
+  Sim_Idle(until, LightSleep);
+  Sim_Count(SIM_LOOP_WAKES);
+  if(LightSleep)
+  {
+    LightSleepTime += Sim_Now() - startTime;
+  }
+  else
+  {
+    WaitTime += Sim_Now() - startTime;
+  }
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
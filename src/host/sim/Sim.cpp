@@ -0,0 +1,998 @@
+/****************************************************************************
+ Module
+   Sim.c
+
+ Description
+   Virtual time simulator for the device. Runs the real MainService and
+   CloudService (with models of everything else, see SimModels.c) through
+   a script of inputs, e.g. a day of button presses, sensor readings, WiFi
+   outages and battery levels, and reports how long each part of the device
+   was on.
+
+   usage: program [-v] [-d | -c] [script file]
+          program [-v] -r <trace dump>
+          program -j <trace dump>
+
+   -v prints every boot and deep sleep. -d dumps the ES trace at the end
+   of the simulation, -r replays one (see SimReplay.c) and -j writes one
+   out as Chrome trace event JSON (see SimTrace.c), - reads it from stdin.
+   -c checks the replay against the simulation: it replays the trace of
+   the script it has just run, like -d | -r, and exits with 3 if any
+   dispatch doesn't do what it did the first time.
+
+   Time only moves when the framework idles (ES_Port_Sim.c), a model is
+   busy (ePaper refresh, delay()) or the device is in deep sleep. An idle
+   jumps straight to the next timer deadline or script input, so a day
+   takes seconds.
+
+   Every boot runs in a child process. Deep sleep saves the RTC_DATA_ATTR
+   variables (the shim puts them in the sim_rtc section) and exits the
+   child, and the next boot forks again from a process that never ran the
+   services, so all other variables start from their power on values just
+   like on the ESP32.
+
+ Notes
+   Script format, one input per line, # starts a comment:
+     epoch <unix time>         wall time at the start, for the NTP sync
+     end <hh:mm[:ss]>          length of the simulation, default 24:00
+     <hh:mm[:ss]> co2 <ppm>
+     <hh:mm[:ss]> pm <pm2.5> <pm10>
+     <hh:mm[:ss]> voc <eCO2> <tVOC>
+     <hh:mm[:ss]> climate <temp> <rh>
+     <hh:mm[:ss]> bat <mV>
+     <hh:mm[:ss]> wifi up|down
+     <hh:mm[:ss]> stuck|unstuck co2|hpm|svm30
+     <hh:mm[:ss]> removed|fitted hpm|svm30   from the next boot's probe on
+     <hh:mm[:ss]> button short|long
+   Input times are from the start of the simulation and must not go back.
+   Until the script changes them the readings are a normal room, the
+   battery is charged and the WiFi is up.
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "Sim.h"
+#include "ES_framework.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define SIM_MAX_INPUTS 256
+#define SIM_MAX_PRESSES 8
+#define SIM_LINE_LEN 128
+#define SIM_BOOT_TIME (300 * SIM_US_PER_MS)      // ROM and app start up
+#define SIM_DEFAULT_EPOCH 1672560000             // 2023-01-01 00:00 PST
+#define SIM_DEFAULT_LENGTH (24 * 3600 * SIM_US_PER_SEC)
+
+typedef enum
+{
+  SIM_IN_CO2,
+  SIM_IN_PM,
+  SIM_IN_VOC,
+  SIM_IN_CLIMATE,
+  SIM_IN_BAT,
+  SIM_IN_WIFI,
+  SIM_IN_STUCK,
+  SIM_IN_REMOVED,
+  SIM_IN_BUTTON
+}SimInputType_t;
+
+typedef struct
+{
+  uint64_t Time;
+  SimInputType_t Type;
+  int16_t Val[2];
+}SimInput_t;
+
+// everything that has to survive from one boot to the next, kept in memory
+// shared with the child processes
+typedef struct
+{
+  uint64_t Now;
+  uint64_t BootTime;
+  uint64_t EndTime;
+  time_t Epoch;
+  bool WallSynced;            // the RTC keeps the time across deep sleep
+
+  SimWake_t WakeCause;
+  bool ButtonWake;            // ext0 wake up enabled for this deep sleep
+  bool Slept;                 // the boot ended in deep sleep
+  uint64_t SleepTime;
+  bool RtcSaved;
+  uint32_t BootNum;
+
+  uint32_t NextInput;
+  SimInputs_t Inputs;
+  uint8_t NumPresses;
+  bool PressLong[SIM_MAX_PRESSES];
+
+  bool CompOn[SIM_NUM_COMPONENTS];
+  uint64_t CompSince[SIM_NUM_COMPONENTS];
+  uint64_t CompTime[SIM_NUM_COMPONENTS];
+  uint32_t Counters[SIM_NUM_COUNTERS];
+}SimState_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static bool ParseScript(FILE *Script);
+static bool ParseTime(const char *Str, uint64_t *Time);
+static void AdvanceTo(uint64_t Time, bool Awake);
+static void ApplyInput(const SimInput_t *Input, bool Awake);
+static void ResetState(void);
+static bool Simulate(void);
+static bool CheckReplay(void);
+static void RunBoot(void);
+static void EndBoot(void);
+static void PrintReport(double RealTime);
+static const char *FormatTime(uint64_t Time);
+
+/*---------------------------- Module Variables ---------------------------*/
+// start and end of the RTC_DATA_ATTR variables, provided by the linker
+extern uint8_t __start_sim_rtc[];
+extern uint8_t __stop_sim_rtc[];
+
+static SimState_t *State;
+static uint8_t *RtcImage;
+static uint8_t *PowerOnRtc;         // for -c, the RTC memory before any boot
+static size_t RtcLen;
+static bool Verbose = false;
+static bool DumpTrace = false;
+static bool Checking = false;
+static bool Replaying = false;
+
+static SimInput_t Script[SIM_MAX_INPUTS];
+static uint32_t NumInputs = 0;
+
+static const char *ComponentNames[SIM_NUM_COMPONENTS] = {"cpu awake", "light sleep",
+    "deep sleep", "sensor power", "hpm fan", "wifi", "epaper"};
+static const SimInputs_t DefaultInputs = {.CO2 = 600, .PM25 = 5, .PM10 = 8, .eCO2 = 400,
+    .tVOC = 20, .Temp = 21, .RH = 45, .BatVolt = 4100, .WifiUp = true};
+static const char *SensorNames[SIM_NUM_SENSORS] = {"co2", "hpm", "svm30"};
+
+static const char DefaultScript[] =
+  "# plugged in at midnight and left in auto mode, with a few interruptions\n"
+  "epoch 1672560000\n"
+  "end 24:00\n"
+  "00:05 button short   # stream to auto\n"
+  "07:30 co2 1100\n"
+  "07:30 button short   # wakes up in stream mode\n"
+  "08:10 button short   # back to auto\n"
+  "08:10 pm 35 60\n"
+  "12:00 wifi down\n"
+  "12:40 wifi up\n"
+  "15:00 stuck hpm      # main's backup timer has to end the cycle\n"
+  "15:45 unstuck hpm\n"
+  "20:00 bat 3700\n"
+  "23:30 button short\n"
+  "23:31 button long    # switched off\n";
+
+/*------------------------------ Module Code ------------------------------*/
+int main(int argc, char *argv[])
+{
+  FILE *script = NULL;
+  FILE *dump = NULL;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-v") == 0)
+    {
+      Verbose = true;
+    }
+    else if(strcmp(argv[i], "-d") == 0)
+    {
+      DumpTrace = true;
+    }
+    else if(strcmp(argv[i], "-c") == 0)
+    {
+      Checking = true;
+    }
+    else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+    {
+      // nothing is simulated, the dump is only converted
+      i++;
+      dump = (strcmp(argv[i], "-") == 0) ? stdin : fopen(argv[i], "r");
+      if(dump == NULL)
+      {
+        printf("Can't open %s\n", argv[i]);
+        return 1;
+      }
+      bool exported = SimTrace_ExportJson(dump, stdout);
+      fclose(dump);
+      if(!exported)
+      {
+        fprintf(stderr, "No ES trace records that can be timed\n");
+        return 1;
+      }
+      return 0;
+    }
+    else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+    {
+      Replaying = true;
+      if((dump = fopen(argv[++i], "r")) == NULL)
+      {
+        printf("Can't open %s\n", argv[i]);
+        return 1;
+      }
+    }
+    else if((script = fopen(argv[i], "r")) == NULL)
+    {
+      printf("Can't open %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  RtcLen = __stop_sim_rtc - __start_sim_rtc;
+  State = (SimState_t *)mmap(NULL, sizeof(SimState_t) + RtcLen, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(State == MAP_FAILED)
+  {
+    return 1;
+  }
+  RtcImage = (uint8_t *)(State + 1);
+  ResetState();
+
+  if(Replaying)
+  {
+    // the dump drives the boots, there are no script inputs
+    bool loaded = SimReplay_Load(dump, Verbose);
+    fclose(dump);
+    if(!loaded)
+    {
+      printf("No ES trace with a whole boot in it\n");
+      return 1;
+    }
+    State->EndTime = SIM_FOREVER;
+    State->WakeCause = SimReplay_FirstWake();
+  }
+  else
+  {
+    if(script == NULL)
+    {
+      script = fmemopen((void *)DefaultScript, sizeof(DefaultScript) - 1, "r");
+    }
+    bool parsed = ParseScript(script);
+    fclose(script);
+    if(!parsed)
+    {
+      return 1;
+    }
+  }
+
+  if(Checking)
+  {
+    PowerOnRtc = (uint8_t *)malloc(RtcLen);
+    if(PowerOnRtc == NULL)
+    {
+      return 1;
+    }
+    memcpy(PowerOnRtc, __start_sim_rtc, RtcLen);
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(!Simulate())
+  {
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if(DumpTrace)
+  {
+    memcpy(__start_sim_rtc, RtcImage, RtcLen);  // the trace is in the RTC memory
+    ES_Trace_Dump();
+  }
+  if(Replaying)
+  {
+    return SimReplay_Report() ? 0 : 3;
+  }
+  PrintReport((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+  if(Checking)
+  {
+    return CheckReplay() ? 0 : 3;
+  }
+  return 0;
+}
+
+/****************************************************************************
+ Function
+     Sim_Now
+
+ Parameters
+     None
+
+ Returns
+     uint64_t, us of virtual time since the start of the simulation
+
+ Description
+     The simulation's clock, the port's ticks and millis() come from it
+ Notes
+****************************************************************************/
+uint64_t Sim_Now(void)
+{
+  return State->Now;
+}
+
+/****************************************************************************
+ Function
+     Sim_BootTime
+
+ Parameters
+     None
+
+ Returns
+     uint64_t, virtual time the current boot started at
+
+ Description
+     For millis() and micros(), which start from 0 at every boot
+ Notes
+****************************************************************************/
+uint64_t Sim_BootTime(void)
+{
+  return State->BootTime;
+}
+
+/****************************************************************************
+ Function
+     Sim_Busy
+
+ Parameters
+     uint64_t : how long the CPU is blocked for
+
+ Returns
+     None
+
+ Description
+     Moves the clock forward for a model that holds up the loop, like an
+     ePaper refresh or a delay()
+ Notes
+     Script inputs that come up in the meantime are applied
+****************************************************************************/
+void Sim_Busy(uint64_t Time)
+{
+  AdvanceTo(State->Now + Time, true);
+}
+
+/****************************************************************************
+ Function
+     Sim_Idle
+
+ Parameters
+     uint64_t : time to idle until
+     bool : true if the device is in light sleep rather than just blocked
+
+ Returns
+     None
+
+ Description
+     Jumps the clock to the given time, or to the next script input or the
+     end of the simulation if that comes first
+ Notes
+****************************************************************************/
+void Sim_Idle(uint64_t Until, bool LightSleep)
+{
+  if(State->NextInput < NumInputs && Script[State->NextInput].Time < Until)
+  {
+    Until = Script[State->NextInput].Time;
+  }
+  if(Until > State->EndTime)
+  {
+    Until = State->EndTime;
+  }
+  if(Until <= State->Now)
+  {
+    return;
+  }
+
+  if(LightSleep)
+  {
+    Sim_SetComponent(SIM_CPU, false);
+    Sim_SetComponent(SIM_LIGHT_SLEEP, true);
+  }
+  AdvanceTo(Until, true);
+  if(LightSleep)
+  {
+    Sim_SetComponent(SIM_LIGHT_SLEEP, false);
+    Sim_SetComponent(SIM_CPU, true);
+  }
+}
+
+/****************************************************************************
+ Function
+     Sim_GetInputs
+
+ Parameters
+     None
+
+ Returns
+     const SimInputs_t *, the sensor readings, battery and WiFi as the
+     script has set them so far
+
+ Description
+     Read by the models and the shim
+ Notes
+****************************************************************************/
+const SimInputs_t *Sim_GetInputs(void)
+{
+  return &State->Inputs;
+}
+
+/****************************************************************************
+ Function
+     Sim_TakeButtonPress
+
+ Parameters
+     bool * : set to true for a long press
+
+ Returns
+     bool, false if there are no presses waiting
+
+ Description
+     Takes the oldest scripted button press, for the button model
+ Notes
+****************************************************************************/
+bool Sim_TakeButtonPress(bool *LongPress)
+{
+  if(State->NumPresses == 0)
+  {
+    return false;
+  }
+  *LongPress = State->PressLong[0];
+  State->NumPresses--;
+  memmove(&State->PressLong[0], &State->PressLong[1], State->NumPresses * sizeof(bool));
+  return true;
+}
+
+/****************************************************************************
+ Function
+     Sim_SetComponent
+
+ Parameters
+     SimComponent_t : the part of the device
+     bool : true if it is now on
+
+ Returns
+     None
+
+ Description
+     Adds up the virtual time each component is on for
+ Notes
+****************************************************************************/
+void Sim_SetComponent(SimComponent_t Component, bool On)
+{
+  if(On && !State->CompOn[Component])
+  {
+    State->CompSince[Component] = State->Now;
+  }
+  else if(!On && State->CompOn[Component])
+  {
+    State->CompTime[Component] += State->Now - State->CompSince[Component];
+  }
+  State->CompOn[Component] = On;
+}
+
+/****************************************************************************
+ Function
+     Sim_Count
+
+ Parameters
+     SimCounter_t : what happened
+
+ Returns
+     None
+
+ Description
+     Counts it for the report
+ Notes
+****************************************************************************/
+void Sim_Count(SimCounter_t Counter)
+{
+  State->Counters[Counter]++;
+}
+
+/****************************************************************************
+ Function
+     Sim_GetWakeCause
+
+ Parameters
+     None
+
+ Returns
+     SimWake_t, why the device booted
+
+ Description
+     For esp_sleep_get_wakeup_cause()
+ Notes
+****************************************************************************/
+SimWake_t Sim_GetWakeCause(void)
+{
+  return State->WakeCause;
+}
+
+/****************************************************************************
+ Function
+     Sim_EnableButtonWake
+
+ Parameters
+     None
+
+ Returns
+     None
+
+ Description
+     Lets a button press end the next deep sleep
+ Notes
+****************************************************************************/
+void Sim_EnableButtonWake(void)
+{
+  State->ButtonWake = true;
+}
+
+/****************************************************************************
+ Function
+     Sim_DeepSleep
+
+ Parameters
+     uint64_t : time to sleep for, SIM_FOREVER to only wake on the button
+
+ Returns
+     Doesn't
+
+ Description
+     Saves the RTC memory and ends the boot. Everything but the RTC is
+     powered down, so every component goes off
+ Notes
+****************************************************************************/
+void Sim_DeepSleep(uint64_t Time)
+{
+  if(Replaying)
+  {
+    SimReplay_EndBoot();
+  }
+  State->Slept = true;
+  State->SleepTime = Time;
+  if(Verbose)
+  {
+    printf("[%s] deep sleep %s\n", FormatTime(State->Now),
+        (Time == SIM_FOREVER) ? "until button" : FormatTime(Time));
+  }
+  EndBoot();
+}
+
+/****************************************************************************
+ Function
+     Sim_GetWallTime
+
+ Parameters
+     None
+
+ Returns
+     time_t, what time() gives on the device
+
+ Description
+     Counts up from 0 at the start of the simulation, like the ESP32's RTC
+     after power on, until the time has been synced over NTP
+ Notes
+****************************************************************************/
+time_t Sim_GetWallTime(void)
+{
+  time_t wallTime = State->Now / SIM_US_PER_SEC;
+  if(State->WallSynced)
+  {
+    wallTime += State->Epoch;
+  }
+  return wallTime;
+}
+
+/****************************************************************************
+ Function
+     Sim_SyncWallTime
+
+ Parameters
+     None
+
+ Returns
+     None
+
+ Description
+     Sets the wall time from the script's epoch, for the NTP model
+ Notes
+****************************************************************************/
+void Sim_SyncWallTime(void)
+{
+  State->WallSynced = true;
+}
+
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+// the power on state, before the script or the dump is loaded
+static void ResetState(void)
+{
+  memset(State, 0, sizeof(SimState_t));
+  State->EndTime = SIM_DEFAULT_LENGTH;
+  State->Epoch = SIM_DEFAULT_EPOCH;
+  State->WakeCause = SIM_WAKE_POWER_ON;
+  State->Inputs = DefaultInputs;
+}
+
+// runs the boots, each in a child process, until the end of the script or
+// the dump. False if a boot failed
+static bool Simulate(void)
+{
+  AdvanceTo(0, false);
+  while(State->Now < State->EndTime && (!Replaying || State->BootNum < SimReplay_NumBoots()))
+  {
+    if(State->RtcSaved)
+    {
+      memcpy(__start_sim_rtc, RtcImage, RtcLen);
+    }
+
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0)
+    {
+      RunBoot();
+    }
+    int status;
+    if(child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      printf("[%s] boot failed\n", FormatTime(State->Now));
+      return false;
+    }
+    State->RtcSaved = true;
+    State->BootNum++;
+    if(Replaying)
+    {
+      // on to the dump's next boot, however this one ended. A boot that
+      // didn't sleep was reset
+      State->WakeCause = SIM_WAKE_POWER_ON;
+      if(State->Slept)
+      {
+        bool forever = (State->SleepTime == SIM_FOREVER);
+        Sim_SetComponent(SIM_DEEP_SLEEP, true);
+        State->Now += forever ? 0 : State->SleepTime;
+        Sim_SetComponent(SIM_DEEP_SLEEP, false);
+        State->WakeCause = forever ? SIM_WAKE_BUTTON : SIM_WAKE_TIMER;
+      }
+      State->Slept = false;
+      continue;
+    }
+    if(!State->Slept)
+    {
+      break;  // ran to the end
+    }
+
+    // deep sleep until the timer, or the button if it can wake the device
+    uint64_t wakeTime = (State->SleepTime == SIM_FOREVER) ? SIM_FOREVER : State->Now + State->SleepTime;
+    SimWake_t wakeCause = SIM_WAKE_TIMER;
+    Sim_SetComponent(SIM_DEEP_SLEEP, true);
+    while(State->NextInput < NumInputs)
+    {
+      const SimInput_t *input = &Script[State->NextInput];
+      if(input->Time >= wakeTime || input->Time >= State->EndTime)
+      {
+        break;
+      }
+      State->NextInput++;
+      if(input->Type == SIM_IN_BUTTON && State->ButtonWake)
+      {
+        wakeTime = input->Time;
+        wakeCause = SIM_WAKE_BUTTON;
+        break;
+      }
+      ApplyInput(input, false);
+    }
+    State->Now = (wakeTime < State->EndTime) ? wakeTime : State->EndTime;
+    Sim_SetComponent(SIM_DEEP_SLEEP, false);
+
+    State->WakeCause = wakeCause;
+    State->Slept = false;
+    State->ButtonWake = false;
+  }
+  return true;
+}
+
+// -c, replays the trace of the simulation that has just run from the RTC
+// memory's power on values, the same as -d | -r
+static bool CheckReplay(void)
+{
+  FILE *dump = tmpfile();
+  if(dump == NULL)
+  {
+    return false;
+  }
+  memcpy(__start_sim_rtc, RtcImage, RtcLen);
+  fflush(stdout);
+  int out = dup(STDOUT_FILENO);
+  dup2(fileno(dump), STDOUT_FILENO);
+  ES_Trace_Dump();
+  fflush(stdout);
+  dup2(out, STDOUT_FILENO);
+  close(out);
+  rewind(dump);
+
+  memcpy(__start_sim_rtc, PowerOnRtc, RtcLen);
+  ResetState();
+  NumInputs = 0;
+  Replaying = true;
+  bool loaded = SimReplay_Load(dump, Verbose);
+  fclose(dump);
+  if(!loaded)
+  {
+    printf("No ES trace with a whole boot in it\n");
+    return false;
+  }
+  State->EndTime = SIM_FOREVER;
+  State->WakeCause = SimReplay_FirstWake();
+  return Simulate() && SimReplay_Report();
+}
+
+// Runs one boot of the device in the child process, until it goes into
+// deep sleep or the simulation ends
+static void RunBoot(void)
+{
+  State->BootTime = State->Now;
+  Sim_Count(SIM_BOOTS);
+  if(State->WakeCause == SIM_WAKE_TIMER)
+    Sim_Count(SIM_TIMER_WAKES);
+  else if(State->WakeCause == SIM_WAKE_BUTTON)
+    Sim_Count(SIM_BUTTON_WAKES);
+  if(Verbose)
+  {
+    const char *causes[] = {"power on", "timer", "button"};
+    printf("[%s] boot, %s\n", FormatTime(State->Now), causes[State->WakeCause]);
+  }
+
+  Sim_SetComponent(SIM_CPU, true);
+  Sim_Busy(SIM_BOOT_TIME);
+
+  if(Replaying)
+  {
+    SimReplay_StartBoot(State->BootNum);
+  }
+  ES_Return_t returnVal = ES_Initialize(ES_Timer_RATE_1mS);
+  if(Replaying && returnVal == Success)
+  {
+    SimReplay_RunBoot();
+    EndBoot();
+  }
+  while(returnVal == Success && State->Now < State->EndTime)
+  {
+    returnVal = ES_Run();
+  }
+  if(returnVal != Success)
+  {
+    printf("[%s] framework error %d\n", FormatTime(State->Now), returnVal);
+    fflush(stdout);
+    _exit(2);
+  }
+  EndBoot();
+}
+
+static void EndBoot(void)
+{
+  memcpy(RtcImage, __start_sim_rtc, __stop_sim_rtc - __start_sim_rtc);
+  for(uint8_t i = 0; i < SIM_NUM_COMPONENTS; i++)
+  {
+    Sim_SetComponent((SimComponent_t)i, false);
+  }
+  fflush(stdout);
+  _exit(0);
+}
+
+// moves the clock, applying the script inputs on the way
+static void AdvanceTo(uint64_t Time, bool Awake)
+{
+  while(State->NextInput < NumInputs && Script[State->NextInput].Time <= Time)
+  {
+    const SimInput_t *input = &Script[State->NextInput++];
+    if(input->Time > State->Now)
+    {
+      State->Now = input->Time;
+    }
+    ApplyInput(input, Awake);
+  }
+  if(Time > State->Now)
+  {
+    State->Now = Time;
+  }
+}
+
+static void ApplyInput(const SimInput_t *Input, bool Awake)
+{
+  SimInputs_t *inputs = &State->Inputs;
+  switch(Input->Type)
+  {
+    case SIM_IN_CO2:
+      inputs->CO2 = Input->Val[0];
+      break;
+    case SIM_IN_PM:
+      inputs->PM25 = Input->Val[0];
+      inputs->PM10 = Input->Val[1];
+      break;
+    case SIM_IN_VOC:
+      inputs->eCO2 = Input->Val[0];
+      inputs->tVOC = Input->Val[1];
+      break;
+    case SIM_IN_CLIMATE:
+      inputs->Temp = Input->Val[0];
+      inputs->RH = Input->Val[1];
+      break;
+    case SIM_IN_BAT:
+      inputs->BatVolt = Input->Val[0];
+      break;
+    case SIM_IN_WIFI:
+      inputs->WifiUp = Input->Val[0];
+      break;
+    case SIM_IN_STUCK:
+      inputs->Stuck[Input->Val[0]] = Input->Val[1];
+      break;
+    case SIM_IN_REMOVED:
+      inputs->Removed[Input->Val[0]] = Input->Val[1];
+      break;
+    case SIM_IN_BUTTON:
+      // presses while the device is off and can't be woken are lost
+      if(Awake && State->NumPresses < SIM_MAX_PRESSES)
+      {
+        Sim_Count(SIM_BUTTON_PRESSES);
+        State->PressLong[State->NumPresses++] = Input->Val[0];
+        ES_SetEventPending(BUTTON_EVENT_SRC);
+      }
+      break;
+  }
+}
+
+static bool ParseScript(FILE *File)
+{
+  char line[SIM_LINE_LEN];
+  uint32_t lineNum = 0;
+  uint64_t lastTime = 0;
+
+  while(fgets(line, sizeof(line), File) != NULL)
+  {
+    lineNum++;
+    char *comment = strchr(line, '#');
+    if(comment != NULL)
+    {
+      *comment = '\0';
+    }
+
+    char first[16], cmd[16], arg1[16] = "", arg2[16] = "";
+    int numArgs = sscanf(line, "%15s %15s %15s %15s", first, cmd, arg1, arg2);
+    if(numArgs <= 0)
+    {
+      continue;  // blank line
+    }
+
+    if(strcmp(first, "epoch") == 0 && numArgs == 2)
+    {
+      State->Epoch = strtoll(cmd, NULL, 10);
+      continue;
+    }
+    if(strcmp(first, "end") == 0 && numArgs == 2 && ParseTime(cmd, &State->EndTime))
+    {
+      continue;
+    }
+
+    SimInput_t *input = &Script[NumInputs];
+    bool valid = NumInputs < SIM_MAX_INPUTS && numArgs >= 3 && ParseTime(first, &input->Time)
+        && input->Time >= lastTime;
+    if(valid)
+    {
+      input->Val[0] = atoi(arg1);
+      input->Val[1] = atoi(arg2);
+      if(strcmp(cmd, "co2") == 0)
+        input->Type = SIM_IN_CO2;
+      else if(strcmp(cmd, "pm") == 0 && numArgs == 4)
+        input->Type = SIM_IN_PM;
+      else if(strcmp(cmd, "voc") == 0 && numArgs == 4)
+        input->Type = SIM_IN_VOC;
+      else if(strcmp(cmd, "climate") == 0 && numArgs == 4)
+        input->Type = SIM_IN_CLIMATE;
+      else if(strcmp(cmd, "bat") == 0)
+        input->Type = SIM_IN_BAT;
+      else if(strcmp(cmd, "wifi") == 0)
+      {
+        input->Type = SIM_IN_WIFI;
+        input->Val[0] = (strcmp(arg1, "up") == 0);
+        valid = input->Val[0] || strcmp(arg1, "down") == 0;
+      }
+      else if(strcmp(cmd, "stuck") == 0 || strcmp(cmd, "unstuck") == 0)
+      {
+        input->Type = SIM_IN_STUCK;
+        input->Val[0] = SIM_NUM_SENSORS;
+        for(uint8_t i = 0; i < SIM_NUM_SENSORS; i++)
+        {
+          if(strcmp(arg1, SensorNames[i]) == 0)
+            input->Val[0] = i;
+        }
+        input->Val[1] = (strcmp(cmd, "stuck") == 0);
+        valid = input->Val[0] < SIM_NUM_SENSORS;
+      }
+      else if(strcmp(cmd, "removed") == 0 || strcmp(cmd, "fitted") == 0)
+      {
+        input->Type = SIM_IN_REMOVED;
+        input->Val[0] = SIM_NUM_SENSORS;
+        for(uint8_t i = 0; i < SIM_NUM_SENSORS; i++)
+        {
+          if(strcmp(arg1, SensorNames[i]) == 0)
+            input->Val[0] = i;
+        }
+        input->Val[1] = (strcmp(cmd, "removed") == 0);
+        valid = input->Val[0] < SIM_NUM_SENSORS && input->Val[0] != SIM_CO2;  // the CO2 sensor has no probe
+      }
+      else if(strcmp(cmd, "button") == 0)
+      {
+        input->Type = SIM_IN_BUTTON;
+        input->Val[0] = (strcmp(arg1, "long") == 0);
+        valid = input->Val[0] || strcmp(arg1, "short") == 0;
+      }
+      else
+        valid = false;
+    }
+
+    if(!valid)
+    {
+      printf("script line %u: can't make sense of it\n", lineNum);
+      return false;
+    }
+    lastTime = input->Time;
+    NumInputs++;
+  }
+  return true;
+}
+
+// hh:mm or hh:mm:ss to us
+static bool ParseTime(const char *Str, uint64_t *Time)
+{
+  unsigned hr, min, sec = 0;
+  if(sscanf(Str, "%u:%u:%u", &hr, &min, &sec) < 2 || min >= 60 || sec >= 60)
+  {
+    return false;
+  }
+  *Time = ((uint64_t)hr * 3600 + min * 60 + sec) * SIM_US_PER_SEC;
+  return true;
+}
+
+static void PrintReport(double RealTime)
+{
+  printf("simulated %s in %.2f s\n", FormatTime(State->Now), RealTime);
+  printf("component       on time        %%\n");
+  for(uint8_t i = 0; i < SIM_NUM_COMPONENTS; i++)
+  {
+    printf("%-13s  %s  %6.2f\n", ComponentNames[i], FormatTime(State->CompTime[i]),
+        100.0 * State->CompTime[i] / State->Now);
+  }
+
+  const uint32_t *counters = State->Counters;
+  printf("boots %u (%u timer, %u button), button presses %u\n", counters[SIM_BOOTS],
+      counters[SIM_TIMER_WAKES], counters[SIM_BUTTON_WAKES], counters[SIM_BUTTON_PRESSES]);
+  printf("cloud writes %u, failed %u\n", counters[SIM_CLOUD_WRITES], counters[SIM_CLOUD_FAILS]);
+  printf("screen refreshes %u full, %u partial\n", counters[SIM_FULL_REFRESHES],
+      counters[SIM_PARTIAL_REFRESHES]);
+
+  // per minute out of deep sleep, to see what the timers' slack saves
+  double awakeMins = (State->CompTime[SIM_CPU] + State->CompTime[SIM_LIGHT_SLEEP]) / (60.0 * SIM_US_PER_SEC);
+  if(awakeMins > 0)
+  {
+    printf("loop wakeups %u (%.1f/min), timer alarms %u (%.1f/min)\n", counters[SIM_LOOP_WAKES],
+        counters[SIM_LOOP_WAKES] / awakeMins, counters[SIM_TIMER_ALARMS],
+        counters[SIM_TIMER_ALARMS] / awakeMins);
+  }
+}
+
+// hh:mm:ss.sss, in static buffers so at most two per printf
+static const char *FormatTime(uint64_t Time)
+{
+  static char str[2][24];
+  static uint8_t which = 0;
+  which ^= 1;
+  uint64_t ms = Time / SIM_US_PER_MS;
+  snprintf(str[which], sizeof(str[which]), "%3llu:%02llu:%02llu.%03llu", (unsigned long long)(ms / 3600000),
+      (unsigned long long)(ms / 60000 % 60), (unsigned long long)(ms / 1000 % 60), (unsigned long long)(ms % 1000));
+  return str[which];
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,121 @@
+/****************************************************************************
+ Module
+     Sim.h
+ Description
+     header file for the virtual time simulator ([env:sim] in
+     platformio.ini). The simulator runs the real MainService and
+     CloudService on a host against models of the sensors, button, ePaper,
+     WiFi and battery, with a virtual clock that jumps straight to the next
+     timer deadline or script input whenever the framework idles.
+ Notes
+     All times are us of virtual time since the start of the simulation
+*****************************************************************************/
+#ifndef Sim_H
+#define Sim_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "ES_Trace.h"
+
+#define SIM_US_PER_MS 1000ULL
+#define SIM_US_PER_SEC 1000000ULL
+#define SIM_FOREVER UINT64_MAX
+
+// parts of the device whose on-time is reported
+typedef enum
+{
+  SIM_CPU = 0,          // awake, not in light or deep sleep
+  SIM_LIGHT_SLEEP,
+  SIM_DEEP_SLEEP,
+  SIM_SENSOR_PWR,       // sensor power rail (PWR_EN_PIN)
+  SIM_HPM_FAN,
+  SIM_WIFI,             // radio on
+  SIM_EPAPER,           // refreshing
+  SIM_NUM_COMPONENTS
+}SimComponent_t;
+
+// things that are counted over the simulation
+typedef enum
+{
+  SIM_BOOTS = 0,
+  SIM_TIMER_WAKES,
+  SIM_BUTTON_WAKES,
+  SIM_BUTTON_PRESSES,
+  SIM_CLOUD_WRITES,
+  SIM_CLOUD_FAILS,
+  SIM_FULL_REFRESHES,
+  SIM_PARTIAL_REFRESHES,
+  SIM_LOOP_WAKES,       // the framework coming out of light sleep or a wait
+  SIM_TIMER_ALARMS,     // the timer alarm going off
+  SIM_NUM_COUNTERS
+}SimCounter_t;
+
+typedef enum
+{
+  SIM_WAKE_POWER_ON = 0,
+  SIM_WAKE_TIMER,
+  SIM_WAKE_BUTTON
+}SimWake_t;
+
+// sensors that can be made to stop answering or be taken out from the script
+typedef enum
+{
+  SIM_CO2 = 0,
+  SIM_HPM,
+  SIM_SVM30,
+  SIM_NUM_SENSORS
+}SimSensor_t;
+
+// the world as the script has set it up so far
+typedef struct
+{
+  int16_t CO2;
+  int16_t PM25;
+  int16_t PM10;
+  int16_t eCO2;
+  int16_t tVOC;
+  int16_t Temp;
+  int16_t RH;
+  uint16_t BatVolt;         // mV
+  bool WifiUp;
+  bool Stuck[SIM_NUM_SENSORS];
+  bool Removed[SIM_NUM_SENSORS];  // not found by its service's probe
+}SimInputs_t;
+
+// virtual clock
+uint64_t Sim_Now(void);
+uint64_t Sim_BootTime(void);
+void Sim_Busy(uint64_t Time);
+void Sim_Idle(uint64_t Until, bool LightSleep);
+
+// script inputs
+const SimInputs_t *Sim_GetInputs(void);
+bool Sim_TakeButtonPress(bool *LongPress);
+
+// accounting
+void Sim_SetComponent(SimComponent_t Component, bool On);
+void Sim_Count(SimCounter_t Counter);
+
+// device
+SimWake_t Sim_GetWakeCause(void);
+void Sim_EnableButtonWake(void);
+void Sim_DeepSleep(uint64_t Time);
+time_t Sim_GetWallTime(void);
+void Sim_SyncWallTime(void);
+
+// trace dumps, SimTrace.c
+uint32_t SimTrace_Load(FILE *Dump, ES_TraceRecord_t **Records, uint32_t *Dropped);
+bool SimTrace_ExportJson(FILE *Dump, FILE *Json);
+
+// trace replay, SimReplay.c
+bool SimReplay_Load(FILE *Dump, bool PrintDispatches);
+uint32_t SimReplay_NumBoots(void);
+SimWake_t SimReplay_FirstWake(void);
+void SimReplay_StartBoot(uint32_t Boot);
+void SimReplay_RunBoot(void);
+void SimReplay_EndBoot(void);
+bool SimReplay_Report(void);
+
+#endif /* Sim_H */
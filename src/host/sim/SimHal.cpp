@@ -0,0 +1,236 @@
+/****************************************************************************
+ Module
+   SimHal.c
+
+ Description
+   The Arduino-ESP32 core, WiFi and InfluxDB functions used by MainService,
+   CloudService and IAQ_util, on the simulator's clock and script inputs.
+   Turning things on and off is passed on to Sim_SetComponent for the on
+   time report.
+
+ Notes
+   time() is redirected here with the linker's --wrap=time, so the device
+   code keeps using the C library's time functions
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "Sim.h"
+#include "Arduino.h"
+#include "WiFi.h"
+#include "esp_wifi.h"
+#include "esp_bt.h"
+#include "driver/adc.h"
+#include "InfluxDbClient.h"
+#include "ES_Configure.h"
+#include <stdarg.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define SIM_WIFI_CONNECT_TIME (2 * SIM_US_PER_SEC)   // association and DHCP
+#define SIM_NTP_TIME (1 * SIM_US_PER_SEC)
+#define BAT_OFFSET 350    // same as IAQ_util.c, so getBatVolt() gives the script's mV
+
+/*---------------------------- Module Variables ---------------------------*/
+HardwareSerial Serial;
+WiFiClass WiFi;
+
+static bool WifiOn = false;
+static uint64_t WifiStartTime;
+static bool NtpPending = false;
+static uint64_t NtpStartTime;
+
+/*------------------------------ Module Code ------------------------------*/
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  if(pin == PWR_EN_PIN)
+  {
+    Sim_SetComponent(SIM_SENSOR_PWR, val == HIGH);
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  return LOW;
+}
+
+uint16_t analogRead(uint8_t pin)
+{
+  return (Sim_GetInputs()->BatVolt + BAT_OFFSET) / 2;
+}
+
+unsigned long millis(void)
+{
+  return (Sim_Now() - Sim_BootTime()) / SIM_US_PER_MS;
+}
+
+unsigned long micros(void)
+{
+  return Sim_Now() - Sim_BootTime();
+}
+
+void delay(uint32_t ms)
+{
+  Sim_Busy(ms * SIM_US_PER_MS);
+}
+
+size_t sim_strlcpy(char *dst, const char *src, size_t size)
+{
+  size_t len = strlen(src);
+  if(size != 0)
+  {
+    size_t copyLen = (len < size) ? len : size - 1;
+    memcpy(dst, src, copyLen);
+    dst[copyLen] = '\0';
+  }
+  return len;
+}
+
+int HardwareSerial::printf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int len = vprintf(format, args);
+  va_end(args);
+  return len;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+  switch(Sim_GetWakeCause())
+  {
+    case SIM_WAKE_TIMER:
+      return ESP_SLEEP_WAKEUP_TIMER;
+    case SIM_WAKE_BUTTON:
+      return ESP_SLEEP_WAKEUP_EXT0;
+    default:
+      return ESP_SLEEP_WAKEUP_UNDEFINED;
+  }
+}
+
+int esp_sleep_enable_ext0_wakeup(gpio_num_t gpio_num, int level)
+{
+  if(gpio_num == BUTTON_PIN)
+  {
+    Sim_EnableButtonWake();
+  }
+  return 0;
+}
+
+void esp_deep_sleep(uint64_t time_in_us)
+{
+  Sim_DeepSleep(time_in_us);
+  abort();  // Sim_DeepSleep ends the boot
+}
+
+void esp_deep_sleep_start(void)
+{
+  Sim_DeepSleep(SIM_FOREVER);
+  abort();
+}
+
+// the time syncs a moment after the request if the WiFi is connected
+void configTzTime(const char *tz, const char *server1, const char *server2, const char *server3)
+{
+  setenv("TZ", tz, 1);
+  tzset();
+  NtpPending = true;
+  NtpStartTime = Sim_Now();
+}
+
+extern "C" time_t __wrap_time(time_t *t)
+{
+  if(NtpPending && Sim_Now() - NtpStartTime >= SIM_NTP_TIME && WiFi.status() == WL_CONNECTED)
+  {
+    NtpPending = false;
+    Sim_SyncWallTime();
+  }
+  time_t now = Sim_GetWallTime();
+  if(t != NULL)
+  {
+    *t = now;
+  }
+  return now;
+}
+
+void adc_power_on(void)
+{
+}
+
+void adc_power_off(void)
+{
+}
+
+bool btStop(void)
+{
+  return true;
+}
+
+int esp_wifi_set_ps(wifi_ps_type_t type)
+{
+  return 0;
+}
+
+bool WiFiClass::mode(wifi_mode_t mode)
+{
+  WifiOn = (mode != WIFI_OFF);
+  Sim_SetComponent(SIM_WIFI, WifiOn);
+  return true;
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase)
+{
+  if(!WifiOn)
+  {
+    mode(WIFI_STA);
+  }
+  WifiStartTime = Sim_Now();
+  return WL_DISCONNECTED;
+}
+
+wl_status_t WiFiClass::status(void)
+{
+  if(WifiOn && Sim_GetInputs()->WifiUp && Sim_Now() - WifiStartTime >= SIM_WIFI_CONNECT_TIME)
+  {
+    return WL_CONNECTED;
+  }
+  return WL_DISCONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifiOff)
+{
+  if(wifiOff)
+  {
+    mode(WIFI_OFF);
+  }
+  return true;
+}
+
+bool InfluxDBClient::setWriteOptions(WritePrecision precision, uint16_t batchSize, uint16_t bufferSize,
+    uint16_t flushInterval, bool preserveConnection)
+{
+  BatchSize = batchSize;
+  return true;
+}
+
+// like the library, points are buffered until there is a batch to send
+bool InfluxDBClient::writePoint(Point &point)
+{
+  NumBuffered++;
+  if(NumBuffered < BatchSize)
+  {
+    return true;
+  }
+  if(WiFi.status() != WL_CONNECTED)
+  {
+    Sim_Count(SIM_CLOUD_FAILS);
+    return false;
+  }
+  NumBuffered = 0;
+  Sim_Count(SIM_CLOUD_WRITES);
+  return true;
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
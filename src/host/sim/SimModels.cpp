@@ -0,0 +1,405 @@
+/****************************************************************************
+ Module
+   SimModels.c
+
+ Description
+   Models of the sensor services, the button service and the ePaper driver
+   for the simulator. They have the same functions as the modules they
+   replace, so MainService and CloudService run unchanged.
+
+   The sensor models take as long as the real services to answer (warm up,
+   then one sample a second, averaging 16 in auto mode) and hand the
+   script's current readings to MainService. A sensor the script has made
+   stuck never answers, and one it has removed isn't found by its probe. The button model posts the script's presses and the
+   ePaper model holds up the loop for as long as a refresh takes.
+
+ Notes
+   Timings are from the real services, see the defines below
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "Sim.h"
+#include "ES_framework.h"
+#include "ES_Timers.h"
+#include "MainService.h"
+#include "HPM_Service.h"
+#include "CO2_Service.h"
+#include "SVM30Service.h"
+#include "ButtonService.h"
+#include "ePaperDriver.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// CO2_Service.c: CO2_WARMUP_TIME, then CO2_POLLING_TIME
+#define CO2_WARMUP_TIME 180000U
+#define CO2_SAMPLE_TIME 1000
+// HPM_Service.c: STOP_AUTO_WAIT_TIME + WARMUP_WAIT_TIME, then SAMPLE_PERIOD
+#define HPM_WARMUP_TIME 20100U
+#define HPM_SAMPLE_TIME 1000
+// SVM30Service.c: SVM30_STARTUP_TIME + SGP30_WARMUP_TIME, then SGP30_SAMPLE_TIME
+#define SVM30_WARMUP_TIME 16020U
+#define SVM30_SAMPLE_TIME 1000
+// all three average RUN_AVG_BUFFER_LEN*2 samples in auto mode
+#define AUTO_NUM_SAMPLES (RUN_AVG_BUFFER_LEN * 2)
+
+// ePaper.cpp: a full refresh every PARTIAL_REFRESH_LIMIT refreshes
+#define PARTIAL_REFRESH_LIMIT 8
+#define FULL_REFRESH_TIME (3000 * SIM_US_PER_MS)
+#define PARTIAL_REFRESH_TIME (500 * SIM_US_PER_MS)
+
+typedef enum
+{
+  SENSOR_OFF,
+  SENSOR_WARMUP,
+  SENSOR_SAMPLING
+}SensorState_t;
+
+typedef struct
+{
+  SimSensor_t Sensor;
+  uint8_t TimerNum;
+  uint32_t WarmupTime;
+  uint32_t SampleTime;
+  bool UsesUart;              // replies would be lost in light sleep
+  void (*Report)(const SimInputs_t *Inputs);
+
+  uint8_t Priority;
+  IAQmode_t Mode;
+  SensorState_t State;
+  uint8_t NumSamples;
+}SensorModel_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static ES_Event_t RunSensorModel(SensorModel_t *Model, ES_Event_t ThisEvent);
+static void ReportCO2(const SimInputs_t *Inputs);
+static void ReportHPM(const SimInputs_t *Inputs);
+static void ReportSVM30(const SimInputs_t *Inputs);
+static void RefreshScreen(bool ForceFullRefresh);
+
+/*---------------------------- Module Variables ---------------------------*/
+static SensorModel_t CO2Model = {.Sensor = SIM_CO2, .TimerNum = CO2_TIMER_NUM,
+    .WarmupTime = CO2_WARMUP_TIME, .SampleTime = CO2_SAMPLE_TIME, .UsesUart = true, .Report = ReportCO2};
+static SensorModel_t HPMModel = {.Sensor = SIM_HPM, .TimerNum = HPM_TIMER_NUM,
+    .WarmupTime = HPM_WARMUP_TIME, .SampleTime = HPM_SAMPLE_TIME, .UsesUart = true, .Report = ReportHPM};
+static SensorModel_t SVM30Model = {.Sensor = SIM_SVM30, .TimerNum = SVM30_TIMER_NUM,
+    .WarmupTime = SVM30_WARMUP_TIME, .SampleTime = SVM30_SAMPLE_TIME, .UsesUart = false, .Report = ReportSVM30};
+
+static uint8_t ButtonPriority;
+
+RTC_DATA_ATTR uint8_t refreshCounter = 1;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     InitCO2Service, PostCO2Service, RunCO2Service, EventCheckerCO2,
+     setModeCO2, getCO2Avg
+
+ Description
+     CO2 sensor model
+****************************************************************************/
+bool InitCO2Service(uint8_t Priority)
+{
+  CO2Model.Priority = Priority;
+  ES_Trace_WatchState(Priority, &CO2Model.State, sizeof(CO2Model.State));
+  return true;
+}
+
+bool PostCO2Service(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = CO2Model.Priority;
+  return ES_PostToService(ThisEvent);
+}
+
+ES_Event_t RunCO2Service(ES_Event_t ThisEvent)
+{
+  return RunSensorModel(&CO2Model, ThisEvent);
+}
+
+bool EventCheckerCO2()
+{
+  return false;
+}
+
+void setModeCO2(IAQmode_t newMode)
+{
+  CO2Model.Mode = newMode;
+}
+
+void getCO2Avg(int16_t *CO2Avg)
+{
+  *CO2Avg = Sim_GetInputs()->CO2;
+}
+
+/****************************************************************************
+ Function
+     ProbeHPMService, InitHPMService, PostHPMService, RunHPMService, 
+     EventCheckerHPM, setModeHPM, getPMAvg, stopHPMMeasurements
+
+ Description
+     HPM particulate sensor model, runs the fan while measuring
+****************************************************************************/
+bool ProbeHPMService(void)
+{
+  return !Sim_GetInputs()->Removed[SIM_HPM];
+}
+
+bool InitHPMService(uint8_t Priority)
+{
+  HPMModel.Priority = Priority;
+  ES_Trace_WatchState(Priority, &HPMModel.State, sizeof(HPMModel.State));
+  return true;
+}
+
+bool PostHPMService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = HPMModel.Priority;
+  return ES_PostToService(ThisEvent);
+}
+
+ES_Event_t RunHPMService(ES_Event_t ThisEvent)
+{
+  if(ThisEvent.EventType == ES_READ_SENSOR && HPMModel.State == SENSOR_OFF)
+  {
+    Sim_SetComponent(SIM_HPM_FAN, true);
+  }
+  ES_Event_t ReturnEvent = RunSensorModel(&HPMModel, ThisEvent);
+  if(HPMModel.State == SENSOR_OFF)
+  {
+    Sim_SetComponent(SIM_HPM_FAN, false);
+  }
+  return ReturnEvent;
+}
+
+bool EventCheckerHPM()
+{
+  return false;
+}
+
+void setModeHPM(IAQmode_t newMode)
+{
+  HPMModel.Mode = newMode;
+}
+
+void getPMAvg(int16_t *pm10Avg, int16_t *pm25Avg)
+{
+  *pm10Avg = Sim_GetInputs()->PM10;
+  *pm25Avg = Sim_GetInputs()->PM25;
+}
+
+void stopHPMMeasurements()
+{
+  Sim_SetComponent(SIM_HPM_FAN, false);
+}
+
+/****************************************************************************
+ Function
+     ProbeSVM30Service, InitSVM30Service, PostSVM30Service, RunSVM30Service, 
+     EventChecker_SVM30, setModeSVM30, getSVM30Avg
+
+ Description
+     SVM30 VOC, temperature and humidity sensor model
+****************************************************************************/
+bool ProbeSVM30Service(void)
+{
+  return !Sim_GetInputs()->Removed[SIM_SVM30];
+}
+
+bool InitSVM30Service(uint8_t Priority)
+{
+  SVM30Model.Priority = Priority;
+  ES_Trace_WatchState(Priority, &SVM30Model.State, sizeof(SVM30Model.State));
+  return true;
+}
+
+bool PostSVM30Service(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = SVM30Model.Priority;
+  return ES_PostToService(ThisEvent);
+}
+
+ES_Event_t RunSVM30Service(ES_Event_t ThisEvent)
+{
+  return RunSensorModel(&SVM30Model, ThisEvent);
+}
+
+bool EventChecker_SVM30()
+{
+  return false;
+}
+
+void setModeSVM30(IAQmode_t newMode)
+{
+  SVM30Model.Mode = newMode;
+}
+
+void getSVM30Avg(int16_t *eCO2Avg, int16_t *tVOCAvg, int16_t *tpAvg, int16_t *rhAvg)
+{
+  const SimInputs_t *inputs = Sim_GetInputs();
+  *eCO2Avg = inputs->eCO2;
+  *tVOCAvg = inputs->tVOC;
+  *tpAvg = inputs->Temp;
+  *rhAvg = inputs->RH;
+}
+
+/****************************************************************************
+ Function
+     InitButtonService, PostButtonService, RunButtonService,
+     EventCheckerButton
+
+ Description
+     Button model, posts the script's presses to MainService
+****************************************************************************/
+bool InitButtonService(uint8_t Priority)
+{
+  ButtonPriority = Priority;
+  return true;
+}
+
+bool PostButtonService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = ButtonPriority;
+  return ES_PostToService(ThisEvent);
+}
+
+ES_Event_t RunButtonService(ES_Event_t ThisEvent)
+{
+  ES_Event_t ReturnEvent = {.EventType = ES_NO_EVENT};
+  return ReturnEvent;
+}
+
+bool EventCheckerButton()
+{
+  bool longPress;
+  if(!Sim_TakeButtonPress(&longPress))
+  {
+    return false;
+  }
+  ES_Event_t newEvent = {.EventType = ES_SW_BUTTON_PRESS};
+  newEvent.EventParam = longPress ? LONG_BT_PRESS : SHORT_BT_PRESS;
+  PostMainService(newEvent);
+  return true;
+}
+
+/****************************************************************************
+ Function
+     initePaper, updateScreenSensorVals, ePaperPrintfAlert,
+     ePaperChangeHdln, ePaperChangeMode, updateEpaperTime
+
+ Description
+     ePaper model, only the refreshes take time
+****************************************************************************/
+bool initePaper()
+{
+  return true;
+}
+
+void updateScreenSensorVals(IAQsensorVals_t *newVals, bool forceFullRefresh, bool clearHdln)
+{
+  RefreshScreen(forceFullRefresh);
+}
+
+void ePaperPrintfAlert(const char * title, const char * line1, const char * line2)
+{
+  RefreshScreen(true);
+}
+
+void ePaperChangeHdln(const char *txt, IAQscreenRefresh_t scrnRefreshType, IAQmode_t newMode)
+{
+  if(scrnRefreshType != NO_SCREEN_REFRESH)
+  {
+    RefreshScreen(scrnRefreshType == FULL_SCREEN_REFRESH);
+  }
+}
+
+void ePaperChangeMode(IAQmode_t currMode)
+{
+}
+
+time_t updateEpaperTime(const time_t timeToPrint)
+{
+  if(timeToPrint != 0)
+  {
+    return timeToPrint;
+  }
+  return isTimeSynced() ? time(NULL) : 0;
+}
+
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+// Warms up on ES_READ_SENSOR, then samples every SampleTime. In auto mode it
+// reports after AUTO_NUM_SAMPLES samples and turns off, in stream mode it
+// keeps sampling for MainService to poll
+static ES_Event_t RunSensorModel(SensorModel_t *Model, ES_Event_t ThisEvent)
+{
+  ES_Event_t ReturnEvent = {.EventType = ES_NO_EVENT};
+
+  if(ThisEvent.EventType == IAQ_MODE_EVENT)
+  {
+    Model->Mode = (IAQmode_t)ThisEvent.EventParam;
+  }
+  else if(ThisEvent.EventType == ES_READ_SENSOR && Model->State == SENSOR_OFF)
+  {
+    Model->State = SENSOR_WARMUP;
+    Model->NumSamples = 0;
+    ES_Timer_InitTimer(Model->TimerNum, Model->WarmupTime);
+  }
+  else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == Model->TimerNum)
+  {
+    if(Model->State == SENSOR_WARMUP)
+    {
+      Model->State = SENSOR_SAMPLING;
+      ES_Timer_InitPeriodic(Model->TimerNum, Model->SampleTime);
+    }
+    else if(Model->State == SENSOR_SAMPLING && Model->Mode == AUTO_MODE
+        && !Sim_GetInputs()->Stuck[Model->Sensor] && ++Model->NumSamples >= AUTO_NUM_SAMPLES)
+    {
+      Model->State = SENSOR_OFF;
+      ES_Timer_StopTimer(Model->TimerNum);
+      Model->Report(Sim_GetInputs());
+    }
+  }
+
+  if(Model->UsesUart)
+  {
+    ES_SetIdleInhibit(Model->Priority, Model->State == SENSOR_SAMPLING);
+  }
+  return ReturnEvent;
+}
+
+static void ReportCO2(const SimInputs_t *Inputs)
+{
+  updateCO2Val(Inputs->CO2);
+}
+
+static void ReportHPM(const SimInputs_t *Inputs)
+{
+  updateHPMVal(Inputs->PM25, Inputs->PM10);
+}
+
+static void ReportSVM30(const SimInputs_t *Inputs)
+{
+  updateSVM30Vals(Inputs->eCO2, Inputs->tVOC, Inputs->Temp, Inputs->RH);
+}
+
+// Epd::updateScreen, blocks until the panel is done
+static void RefreshScreen(bool ForceFullRefresh)
+{
+  if(ForceFullRefresh)
+  {
+    refreshCounter = PARTIAL_REFRESH_LIMIT;
+  }
+  bool fullRefresh = (refreshCounter % PARTIAL_REFRESH_LIMIT == 0);
+  if(fullRefresh)
+  {
+    refreshCounter = 0;
+  }
+  refreshCounter++;
+
+  Sim_Count(fullRefresh ? SIM_FULL_REFRESHES : SIM_PARTIAL_REFRESHES);
+  Sim_SetComponent(SIM_EPAPER, true);
+  Sim_Busy(fullRefresh ? FULL_REFRESH_TIME : PARTIAL_REFRESH_TIME);
+  Sim_SetComponent(SIM_EPAPER, false);
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,458 @@
+/****************************************************************************
+ Module
+   SimReplay.c
+
+ Description
+   Replays an ES trace dump (ES_Trace_Dump, from the device's Serial output
+   or the simulator's -d) into the services that the simulator runs for
+   real, MainService and CloudService. Every boot in the dump becomes a boot
+   of the simulator. Each of the boot's dispatches to those services is
+   handed to the run function again with ES_ReplayEvent, with the virtual
+   clock set to the time it happened, and what the run function posted,
+   which timers it started or stopped and the state it ended up in are
+   compared against what the dump says it did on the device. Dispatches to
+   the modelled services are skipped. The timers the replayed dispatches
+   start run and expire as they did on the device, but their timeouts are
+   only replayed from the dump.
+
+   usage: program -r <dump file> [-v]
+
+ Notes
+   Only what goes through the framework is in the trace, plus the inputs
+   the services record with ES_Trace_Input (WiFi status, time sync,
+   battery, wake cause), which the replay hands back to them in place of
+   the models'. Readings a sensor service hands to MainService by calling
+   it and payload contents are not, so the replay uses the models' values.
+
+   The replay starts from the first boot in the dump with every RTC_DATA_ATTR
+   variable at its power on value. If the ring had wrapped, earlier boots
+   may have left those variables differently on the device, and the first
+   mismatches can come from that rather than from a bug. If the last boot
+   filled the ring, its dispatches are replayed up to the last whole one.
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "Sim.h"
+#include "ES_framework.h"
+#include "ES_Trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+// the services the simulator doesn't model
+#define REPLAY_SERVICES ((1U << MAIN_SERV_NUM) | (1U << CLOUD_SERV_NUM))
+#define REPLAY_MAX_OPS 32       // records compared per dispatch
+
+typedef struct
+{
+  uint32_t Boots;
+  uint32_t Dispatches;
+  uint32_t Skipped;
+  uint32_t Mismatches;
+  uint32_t Errors;
+}ReplayTotals_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static bool IsOp(const ES_TraceRecord_t *Record);
+static bool IsInput(const ES_TraceRecord_t *Record, uint8_t Input);
+static uint16_t ReplayInput(uint8_t Input, uint16_t Value);
+static void CheckDispatch(uint32_t ExpectedEnd);
+static const char *FormatRecord(const ES_TraceRecord_t *Record);
+
+/*---------------------------- Module Variables ---------------------------*/
+static ES_TraceRecord_t *Records;
+static uint32_t NumRecords;
+static uint32_t *BootStarts;      // index of each BOOT record, plus NumRecords
+static uint32_t NumBoots;
+static uint32_t Dropped;          // records the last boot couldn't fit
+static ReplayTotals_t *Totals;    // shared with the boots' processes
+static bool Verbose;
+
+// the boot being replayed
+static uint32_t BootNum;
+static uint32_t BootStart;
+static uint32_t BootEnd;
+
+// the dispatch being checked, for SimReplay_EndBoot
+static bool InDispatch = false;
+static uint32_t DispatchIndex;
+static uint32_t ProducedStart;
+
+// the records ReplayInput looks in, the init functions' or the dispatch's,
+// and where it has got to with each input
+static uint32_t InputsEnd;
+static uint32_t InputNext[ES_TRACE_NUM_INPUTS];
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     SimReplay_Load
+
+ Parameters
+     FILE * : the dump, anything outside the "ES trace begin" and "ES trace
+              end" lines is ignored. If there are several, the last is used
+     bool : print every replayed dispatch
+
+ Returns
+     bool, false if there is no dump or no boot in it
+
+ Description
+     Reads the dump (SimTrace_Load) and splits it into boots. Records before
+     the first BOOT are from a boot the ring only has the end of and are
+     dropped
+ Notes
+     Call before the first boot, the totals are shared with the boots
+****************************************************************************/
+bool SimReplay_Load(FILE *Dump, bool PrintDispatches)
+{
+  Verbose = PrintDispatches;
+  NumRecords = SimTrace_Load(Dump, &Records, &Dropped);
+
+  BootStarts = (uint32_t *)malloc((NumRecords + 1) * sizeof(uint32_t));
+  if(BootStarts == NULL)
+  {
+    return false;
+  }
+  NumBoots = 0;
+  for(uint32_t i = 0; i < NumRecords; i++)
+  {
+    if(ES_Trace_Kind(&Records[i]) == ES_TRACE_BOOT)
+    {
+      BootStarts[NumBoots++] = i;
+    }
+  }
+  BootStarts[NumBoots] = NumRecords;
+
+  Totals = (ReplayTotals_t *)mmap(NULL, sizeof(ReplayTotals_t), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(Totals == MAP_FAILED)
+  {
+    return false;
+  }
+  memset(Totals, 0, sizeof(ReplayTotals_t));
+  return NumBoots != 0;
+}
+
+/****************************************************************************
+ Function
+     SimReplay_NumBoots
+
+ Parameters
+     None
+
+ Returns
+     uint32_t, number of whole boots in the dump
+
+ Description
+     The simulator runs this many boots
+ Notes
+****************************************************************************/
+uint32_t SimReplay_NumBoots(void)
+{
+  return NumBoots;
+}
+
+/****************************************************************************
+ Function
+     SimReplay_FirstWake
+
+ Parameters
+     None
+
+ Returns
+     SimWake_t, power on if the dump starts with the first boot since power
+     on, otherwise a timer wake
+
+ Description
+     The wake cause for the first replayed boot
+ Notes
+****************************************************************************/
+SimWake_t SimReplay_FirstWake(void)
+{
+  return (Records[BootStarts[0]].Param == 1) ? SIM_WAKE_POWER_ON : SIM_WAKE_TIMER;
+}
+
+/****************************************************************************
+ Function
+     SimReplay_StartBoot
+
+ Parameters
+     uint32_t : which boot of the dump
+
+ Returns
+     None
+
+ Description
+     Hands the init functions the inputs they read on the device, call
+     before ES_Initialize
+ Notes
+****************************************************************************/
+void SimReplay_StartBoot(uint32_t Boot)
+{
+  BootNum = Boot;
+  BootStart = BootStarts[Boot];
+  BootEnd = BootStarts[Boot + 1];
+
+  InputsEnd = BootStart + 1;
+  while(InputsEnd < BootEnd && ES_Trace_Kind(&Records[InputsEnd]) != ES_TRACE_DISPATCH)
+  {
+    InputsEnd++;
+  }
+  for(uint8_t i = 0; i < ES_TRACE_NUM_INPUTS; i++)
+  {
+    InputNext[i] = BootStart + 1;
+  }
+  ES_Trace_SetInputSource(ReplayInput);
+}
+
+/****************************************************************************
+ Function
+     SimReplay_RunBoot
+
+ Parameters
+     None
+
+ Returns
+     None
+
+ Description
+     Replays the boot's dispatches to the real services, once ES_Initialize
+     has run. Returns at the end of the boot's records, or doesn't if a run
+     function puts the device into deep sleep
+ Notes
+****************************************************************************/
+void SimReplay_RunBoot(void)
+{
+  uint32_t cyclesPerUs = Records[BootStart].Type ? Records[BootStart].Type : 1;
+  uint32_t syncTicks = 0;
+  uint32_t syncCycles = Records[BootStart].Time;
+  Totals->Boots++;
+  if(Verbose)
+  {
+    printf("boot %u of the dump (device boot %u)\n", BootNum + 1, Records[BootStart].Param);
+  }
+
+  for(uint32_t i = BootStart + 1; i < BootEnd; i++)
+  {
+    const ES_TraceRecord_t *record = &Records[i];
+    if(ES_Trace_Kind(record) == ES_TRACE_SYNC)
+    {
+      syncTicks = ((uint32_t)ES_Trace_Num(record) << 24) | ((uint32_t)record->Type << 16) | record->Param;
+      syncCycles = record->Time;
+      continue;
+    }
+    if(ES_Trace_Kind(record) != ES_TRACE_DISPATCH)
+    {
+      continue;  // the init functions' and the loop's own posts and timers
+    }
+
+    // the dispatch's records end at its DONE
+    uint8_t serviceNum = ES_Trace_Num(record);
+    uint32_t done = i + 1;
+    while(done < BootEnd && !(ES_Trace_Kind(&Records[done]) == ES_TRACE_DONE && ES_Trace_Num(&Records[done]) == serviceNum))
+    {
+      done++;
+    }
+    if(!(REPLAY_SERVICES & (1U << serviceNum)))
+    {
+      Totals->Skipped++;
+      i = done;
+      continue;
+    }
+    if(done == BootEnd && BootNum == NumBoots - 1 && Dropped != 0)
+    {
+      if(Verbose)
+      {
+        printf("  %u records didn't fit in the ring, the rest of the boot isn't replayed\n", Dropped);
+      }
+      break;
+    }
+
+    uint64_t sinceBoot = (uint64_t)syncTicks * SIM_US_PER_MS + (uint32_t)(record->Time - syncCycles) / cyclesPerUs;
+    Sim_Idle(Sim_BootTime() + sinceBoot, false);
+    _HW_Process_Pending_Ints();  // time the replay's timers out, ES_ReplayEvent drops the timeouts
+
+    ES_Event_t ThisEvent = {.EventType = (ES_EventType_t)record->Type, .EventParam = record->Param,
+        .ServiceNum = serviceNum};
+    if(Verbose)
+    {
+      printf("  +%9.3f s  %s\n", sinceBoot / 1e6, FormatRecord(record));
+    }
+    Totals->Dispatches++;
+    InDispatch = true;
+    DispatchIndex = i;
+    ProducedStart = ES_Trace_GetHead() + 1;  // after its own DISPATCH
+    InputsEnd = done;
+    for(uint8_t in = 0; in < ES_TRACE_NUM_INPUTS; in++)
+    {
+      InputNext[in] = i + 1;
+    }
+    if(ES_ReplayEvent(ThisEvent) != Success)
+    {
+      printf("  %s returned ES_ERROR\n", FormatRecord(record));
+      Totals->Errors++;
+    }
+    CheckDispatch(done);
+    InDispatch = false;
+    i = done;
+  }
+}
+
+/****************************************************************************
+ Function
+     SimReplay_EndBoot
+
+ Parameters
+     None
+
+ Returns
+     None
+
+ Description
+     Called when the replayed boot goes into deep sleep, finishes checking
+     the dispatch that did it against the rest of the dump's boot
+ Notes
+****************************************************************************/
+void SimReplay_EndBoot(void)
+{
+  if(InDispatch)
+  {
+    CheckDispatch(BootEnd);
+    InDispatch = false;
+  }
+}
+
+/****************************************************************************
+ Function
+     SimReplay_Report
+
+ Parameters
+     None
+
+ Returns
+     bool, true if every replayed dispatch did what the dump says
+
+ Description
+     Prints the totals, in the parent once every boot has run
+ Notes
+****************************************************************************/
+bool SimReplay_Report(void)
+{
+  printf("replayed %u boots, %u dispatches (%u to models skipped), %u mismatched, %u errors\n",
+      Totals->Boots, Totals->Dispatches, Totals->Skipped, Totals->Mismatches, Totals->Errors);
+  return Totals->Mismatches == 0 && Totals->Errors == 0;
+}
+
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+// the records that are something the run function did
+static bool IsOp(const ES_TraceRecord_t *Record)
+{
+  uint8_t kind = ES_Trace_Kind(Record);
+  if(kind == ES_TRACE_STATE && ES_Trace_Num(Record) == ES_TRACE_INPUT)
+    return false;
+  return kind != ES_TRACE_SYNC && kind != ES_TRACE_DONE && kind != ES_TRACE_BOOT;
+}
+
+static bool IsInput(const ES_TraceRecord_t *Record, uint8_t Input)
+{
+  return ES_Trace_Kind(Record) == ES_TRACE_STATE && ES_Trace_Num(Record) == ES_TRACE_INPUT
+      && Record->Type == Input;
+}
+
+// the input source while a boot is replayed. The device only recorded an
+// input when it changed, so a read with no record of its own in the
+// dispatch got the value of the input's last record
+static uint16_t ReplayInput(uint8_t Input, uint16_t Value)
+{
+  for(uint32_t i = InputNext[Input]; i < InputsEnd; i++)
+  {
+    if(IsInput(&Records[i], Input))
+    {
+      InputNext[Input] = i + 1;
+      return Records[i].Param;
+    }
+  }
+  for(uint32_t i = InputNext[Input]; i > BootStart; i--)
+  {
+    if(IsInput(&Records[i - 1], Input))
+      return Records[i - 1].Param;
+  }
+  return Value;  // the boot never read it on the device
+}
+
+// compares what the replayed run function did with the dump's records from
+// the dispatch up to ExpectedEnd, ignoring the times
+static void CheckDispatch(uint32_t ExpectedEnd)
+{
+  ES_TraceRecord_t expected[REPLAY_MAX_OPS], produced[REPLAY_MAX_OPS];
+  uint8_t numExpected = 0, numProduced = 0;
+
+  for(uint32_t i = DispatchIndex + 1; i < ExpectedEnd && numExpected < REPLAY_MAX_OPS; i++)
+  {
+    if(IsOp(&Records[i]))
+      expected[numExpected++] = Records[i];
+  }
+  ES_TraceRecord_t record;
+  for(uint32_t i = ProducedStart; ES_Trace_Get(i, &record) && numProduced < REPLAY_MAX_OPS; i++)
+  {
+    if(IsOp(&record))
+      produced[numProduced++] = record;
+  }
+
+  bool match = (numExpected == numProduced);
+  for(uint8_t i = 0; match && i < numExpected; i++)
+  {
+    match = expected[i].KindNum == produced[i].KindNum && expected[i].Type == produced[i].Type
+        && expected[i].Param == produced[i].Param;
+  }
+  if(match)
+  {
+    return;
+  }
+
+  Totals->Mismatches++;
+  printf("  mismatch after %s\n", FormatRecord(&Records[DispatchIndex]));
+  for(uint8_t i = 0; i < numExpected || i < numProduced; i++)
+  {
+    printf("    device: %-36s", (i < numExpected) ? FormatRecord(&expected[i]) : "");
+    printf("replay: %s\n", (i < numProduced) ? FormatRecord(&produced[i]) : "");
+  }
+}
+
+static const char *FormatRecord(const ES_TraceRecord_t *Record)
+{
+  static char str[48];
+  uint8_t num = ES_Trace_Num(Record);
+  switch(ES_Trace_Kind(Record))
+  {
+    case ES_TRACE_POST:
+      if(num == ES_TRACE_MULTICAST)
+        snprintf(str, sizeof(str), "post all %u/%u", Record->Type, Record->Param);
+      else
+        snprintf(str, sizeof(str), "post %u %u/%u", num, Record->Type, Record->Param);
+      break;
+    case ES_TRACE_DISPATCH:
+      snprintf(str, sizeof(str), "dispatch %u %u/%u", num, Record->Type, Record->Param);
+      break;
+    case ES_TRACE_TIMER_START:
+      snprintf(str, sizeof(str), "start timer %u %u", Record->Type, ((uint32_t)num << 16) | Record->Param);
+      break;
+    case ES_TRACE_TIMER_STOP:
+      snprintf(str, sizeof(str), "stop timer %u", Record->Type);
+      break;
+    case ES_TRACE_STATE:
+      snprintf(str, sizeof(str), "state %u %u", num, Record->Param);
+      break;
+    default:
+      snprintf(str, sizeof(str), "kind %u", ES_Trace_Kind(Record));
+      break;
+  }
+  return str;
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
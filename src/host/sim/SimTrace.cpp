@@ -0,0 +1,572 @@
+/****************************************************************************
+ Module
+   SimTrace.c
+
+ Description
+   Reads ES trace dumps (ES_Trace_Dump, from the device's Serial output or
+   the simulator's -d) for the replay, and turns them into Chrome trace
+   event JSON that Perfetto (ui.perfetto.dev) or chrome://tracing open as a
+   timeline.
+
+   usage: program -j <dump file> > trace.json
+          program -d [script file] | program -j - > trace.json
+
+   The timeline has a track per service with a slice for every dispatch,
+   from the DISPATCH to the DONE, named after the event, and an arrow from
+   where the event was posted. The service's watched state (see
+   ES_Trace_WatchState) gets a track of its own with a slice per state, so
+   a sensor's warm up, the wait for WiFi or a publish show up as one span.
+   Each timer has a track with a slice from when it was started until it
+   timed out, was stopped or was started again. Posts from outside a run
+   function (event checkers, timers) are instants on the "ES_Run" track.
+   Inputs (see ES_Trace_Input) are counters, "input <n>".
+
+ Notes
+   Times are since the first boot in the dump, or the first SYNC if the
+   ring had already lost the start of that boot. The dump doesn't say how
+   long the device was in deep sleep, so each boot starts SIM_TRACE_BOOT_GAP
+   after the last record of the one before it.
+
+   Arrows are found by matching each dispatch against the earlier posts to
+   its queue, so a post that was lost to a full queue or dropped as a stale
+   timeout just doesn't get one.
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "Sim.h"
+#include "ES_framework.h"
+#include "ES_Trace.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define SIM_TRACE_LINE_LEN 128
+#define SIM_TRACE_BOOT_GAP SIM_US_PER_SEC
+#define SIM_TRACE_TIMERS 16
+#define SIM_TRACE_POSTS 16      // posts remembered per queue for the arrows
+#define SIM_TRACE_NO_SERVICE 0xFF
+
+// track (thread) ids
+#define SIM_TRACE_PID 1
+#define SIM_TRACE_RUN_TID 1
+#define SIM_TRACE_SERVICE_TID(n) (10 + (n))
+#define SIM_TRACE_STATE_TID(n) (30 + (n))
+#define SIM_TRACE_TIMER_TID(n) (50 + (n))
+
+#define SIM_STR(x) SIM_STR2(x)
+#define SIM_STR2(x) #x
+
+typedef struct
+{
+  uint64_t Time;
+  uint8_t Type;
+  uint16_t Param;
+  uint8_t Tid;              // track the post came from
+}SimTracePost_t;
+
+typedef struct
+{
+  SimTracePost_t Posts[SIM_TRACE_POSTS];
+  uint8_t NumPosts;
+}SimTraceQueue_t;
+
+typedef struct
+{
+  bool Open;
+  uint64_t Since;
+  uint16_t Value;           // event param, state or timer ticks
+  uint8_t Type;
+}SimTraceSpan_t;
+
+/*---------------------------- Module Functions ---------------------------*/
+static void EmitEvent(const char *Format, ...);
+static void PushPost(SimTraceQueue_t *Queue, const SimTracePost_t *Post);
+static bool TakePost(SimTraceQueue_t *Queue, uint8_t Type, uint16_t Param, SimTracePost_t *Post);
+static void EmitFlow(const SimTracePost_t *Post, uint8_t ServiceNum, uint64_t Time);
+static void EndDispatch(uint8_t ServiceNum, uint64_t Time);
+static void EndState(uint8_t ServiceNum, uint64_t Time);
+static void EndTimer(uint8_t Timer, uint64_t Time);
+static void EndBoot(uint64_t Time);
+static const char *EventName(uint8_t Type);
+static const char *ServiceName(uint8_t ServiceNum);
+
+/*---------------------------- Module Variables ---------------------------*/
+static const char *const EventNames[] = {ES_EVENT_NAMES};
+static_assert(ARRAY_SIZE(EventNames) == ES_NUM_EVENT_TYPES, "ES_EVENT_NAMES doesn't match ES_EventType_t");
+
+// the run functions' names, less the "Run"
+static const char *const ServiceNames[NUM_SERVICES] =
+{
+  SIM_STR(SERV_0_RUN),
+#if NUM_SERVICES > 1
+  SIM_STR(SERV_1_RUN),
+#endif
+#if NUM_SERVICES > 2
+  SIM_STR(SERV_2_RUN),
+#endif
+#if NUM_SERVICES > 3
+  SIM_STR(SERV_3_RUN),
+#endif
+#if NUM_SERVICES > 4
+  SIM_STR(SERV_4_RUN),
+#endif
+#if NUM_SERVICES > 5
+  SIM_STR(SERV_5_RUN),
+#endif
+#if NUM_SERVICES > 6
+  SIM_STR(SERV_6_RUN),
+#endif
+#if NUM_SERVICES > 7
+  SIM_STR(SERV_7_RUN),
+#endif
+#if NUM_SERVICES > 8
+  SIM_STR(SERV_8_RUN),
+#endif
+#if NUM_SERVICES > 9
+  SIM_STR(SERV_9_RUN),
+#endif
+#if NUM_SERVICES > 10
+  SIM_STR(SERV_10_RUN),
+#endif
+#if NUM_SERVICES > 11
+  SIM_STR(SERV_11_RUN),
+#endif
+#if NUM_SERVICES > 12
+  SIM_STR(SERV_12_RUN),
+#endif
+#if NUM_SERVICES > 13
+  SIM_STR(SERV_13_RUN),
+#endif
+#if NUM_SERVICES > 14
+  SIM_STR(SERV_14_RUN),
+#endif
+#if NUM_SERVICES > 15
+  SIM_STR(SERV_15_RUN),
+#endif
+};
+
+static FILE *Out;
+static bool FirstEvent;
+static uint32_t NextFlowId;
+
+static SimTraceQueue_t Queues[NUM_SERVICES + 1];    // + the multicast queue
+static SimTraceSpan_t Dispatches[NUM_SERVICES];
+static SimTraceSpan_t States[NUM_SERVICES];
+static SimTraceSpan_t Timers[SIM_TRACE_TIMERS];
+static uint8_t TimerOwners[SIM_TRACE_TIMERS];      // whose timeouts it posts
+static uint32_t TimersUsed;
+static uint8_t Running;                             // service in a dispatch
+
+// the multicast event being handed out and who has had it
+static SimTracePost_t Multicast;
+static uint32_t MulticastServices;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     SimTrace_Load
+
+ Parameters
+     FILE * : the dump, anything outside the "ES trace begin" and "ES trace
+              end" lines is ignored. If there are several, the last is used
+     ES_TraceRecord_t ** : set to the records, malloc'ed
+     uint32_t * : set to the number of the last boot's records that didn't
+                  fit in the ring, can be NULL
+
+ Returns
+     uint32_t, the number of records
+
+ Description
+     Reads a dump back into records
+ Notes
+****************************************************************************/
+uint32_t SimTrace_Load(FILE *Dump, ES_TraceRecord_t **Records, uint32_t *Dropped)
+{
+  char line[SIM_TRACE_LINE_LEN];
+  bool inDump = false;
+  uint32_t capacity = 0;
+  uint32_t numRecords = 0;
+  *Records = NULL;
+  if(Dropped != NULL)
+    *Dropped = 0;
+
+  while(fgets(line, sizeof(line), Dump) != NULL)
+  {
+    unsigned len, dropped = 0;
+    if(sscanf(line, "ES trace begin %u, %u dropped", &len, &dropped) >= 1)
+    {
+      if(Dropped != NULL)
+        *Dropped = dropped;
+      free(*Records);
+      capacity = len;
+      *Records = (ES_TraceRecord_t *)malloc((capacity + 1) * sizeof(ES_TraceRecord_t));
+      numRecords = 0;
+      inDump = (*Records != NULL);
+      continue;
+    }
+    if(strncmp(line, "ES trace end", 12) == 0)
+    {
+      inDump = false;
+      continue;
+    }
+
+    ES_TraceRecord_t record;
+    unsigned time, kindNum, type, param;
+    if(inDump && numRecords < capacity
+        && sscanf(line, " %8x%2x%2x%4x", &time, &kindNum, &type, &param) == 4)
+    {
+      record.Time = time;
+      record.KindNum = (uint8_t)kindNum;
+      record.Type = (uint8_t)type;
+      record.Param = (uint16_t)param;
+      (*Records)[numRecords++] = record;
+    }
+  }
+  return numRecords;
+}
+
+/****************************************************************************
+ Function
+     SimTrace_ExportJson
+
+ Parameters
+     FILE * : the dump, as for SimTrace_Load
+     FILE * : where the JSON goes
+
+ Returns
+     bool, false if there is nothing in the dump that can be timed
+
+ Description
+     Writes the dump's boots out as a Chrome trace event timeline, see the
+     module description for the tracks
+ Notes
+****************************************************************************/
+bool SimTrace_ExportJson(FILE *Dump, FILE *Json)
+{
+  ES_TraceRecord_t *records;
+  uint32_t numRecords = SimTrace_Load(Dump, &records, NULL);
+
+  Out = Json;
+  FirstEvent = true;
+  NextFlowId = 1;
+  Running = SIM_TRACE_NO_SERVICE;
+  memset(TimerOwners, SIM_TRACE_NO_SERVICE, sizeof(TimerOwners));
+  TimersUsed = 0;
+  fprintf(Out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  // a dump that starts part way through a boot is timed from its first
+  // SYNC, with the cycles per us of the next BOOT
+  uint64_t bootStart = 0, now = 0;
+  uint32_t cyclesPerUs = 1, syncTicks = 0, syncCycles = 0;
+  bool timed = false;
+  for(uint32_t i = 0; i < numRecords; i++)
+  {
+    if(ES_Trace_Kind(&records[i]) == ES_TRACE_BOOT && records[i].Type != 0)
+    {
+      cyclesPerUs = records[i].Type;
+      break;
+    }
+  }
+
+  for(uint32_t i = 0; i < numRecords; i++)
+  {
+    const ES_TraceRecord_t *record = &records[i];
+    uint8_t num = ES_Trace_Num(record);
+    ES_TraceKind_t kind = ES_Trace_Kind(record);
+
+    if(kind == ES_TRACE_BOOT)
+    {
+      if(timed)
+      {
+        EndBoot(now);
+        bootStart = now + SIM_TRACE_BOOT_GAP;
+      }
+      timed = true;
+      cyclesPerUs = record->Type ? record->Type : 1;
+      syncTicks = 0;
+      syncCycles = record->Time;
+      now = bootStart;
+      EmitEvent("\"name\":\"boot %u\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%llu,\"pid\":%u,\"tid\":%u",
+          record->Param, (unsigned long long)now, SIM_TRACE_PID, SIM_TRACE_RUN_TID);
+      continue;
+    }
+
+    if(kind == ES_TRACE_SYNC)
+    {
+      syncTicks = ((uint32_t)num << 24) | ((uint32_t)record->Type << 16) | record->Param;
+      syncCycles = record->Time;
+      if(!timed)
+      {
+        // the partial boot's time 0 is the first SYNC, not the boot
+        bootStart = 0 - (uint64_t)syncTicks * SIM_US_PER_MS;
+        timed = true;
+      }
+    }
+    if(!timed)
+    {
+      continue;
+    }
+    now = bootStart + (uint64_t)syncTicks * SIM_US_PER_MS + (uint32_t)(record->Time - syncCycles) / cyclesPerUs;
+
+    switch(kind)
+    {
+      case ES_TRACE_POST:
+      {
+        if(num > NUM_SERVICES)
+          break;
+        SimTracePost_t post = {now, record->Type, record->Param, SIM_TRACE_RUN_TID};
+        if(Running != SIM_TRACE_NO_SERVICE)
+        {
+          post.Tid = SIM_TRACE_SERVICE_TID(Running);
+        }
+        else
+        {
+          EmitEvent("\"name\":\"post %s to %s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,\"pid\":%u,\"tid\":%u,"
+              "\"args\":{\"param\":%u}", EventName(record->Type),
+              (num == ES_TRACE_MULTICAST) ? "multicast" : ServiceName(num),
+              (unsigned long long)now, SIM_TRACE_PID, SIM_TRACE_RUN_TID, record->Param);
+          // a timeout from the timer tick is the end of the timer's span
+          if(record->Type == ES_TIMEOUT && record->Param < SIM_TRACE_TIMERS && num < NUM_SERVICES)
+          {
+            TimerOwners[record->Param] = num;
+            EndTimer((uint8_t)record->Param, now);
+          }
+        }
+        PushPost(&Queues[num], &post);
+        break;
+      }
+
+      case ES_TRACE_DISPATCH:
+      {
+        if(num >= NUM_SERVICES)
+          break;
+        // a multicast event goes to each service on its list in turn, 
+        // ahead of the events waiting in their own queues
+        SimTracePost_t post;
+        bool found = true;
+        if(MulticastServices != 0 && !(MulticastServices & (1U << num))
+            && Multicast.Type == record->Type && Multicast.Param == record->Param)
+        {
+          post = Multicast;
+          MulticastServices |= 1U << num;
+        }
+        else if(TakePost(&Queues[ES_TRACE_MULTICAST], record->Type, record->Param, &post))
+        {
+          Multicast = post;
+          MulticastServices = 1U << num;
+        }
+        else
+        {
+          MulticastServices = 0;
+          found = TakePost(&Queues[num], record->Type, record->Param, &post);
+        }
+        if(found)
+        {
+          EmitFlow(&post, num, now);
+        }
+
+        Dispatches[num].Open = true;
+        Dispatches[num].Since = now;
+        Dispatches[num].Type = record->Type;
+        Dispatches[num].Value = record->Param;
+        Running = num;
+        break;
+      }
+
+      case ES_TRACE_DONE:
+        if(num < NUM_SERVICES)
+          EndDispatch(num, now);
+        Running = SIM_TRACE_NO_SERVICE;
+        break;
+
+      case ES_TRACE_TIMER_START:
+        if(record->Type < SIM_TRACE_TIMERS)
+        {
+          EndTimer(record->Type, now);
+          TimersUsed |= 1U << record->Type;
+          Timers[record->Type].Open = true;
+          Timers[record->Type].Since = now;
+          Timers[record->Type].Value = record->Param;
+          Timers[record->Type].Type = num;       // time bits 16-20
+        }
+        break;
+
+      case ES_TRACE_TIMER_STOP:
+        if(record->Type < SIM_TRACE_TIMERS)
+          EndTimer(record->Type, now);
+        break;
+
+      case ES_TRACE_STATE:
+        if(num < NUM_SERVICES)
+        {
+          EndState(num, now);
+          States[num].Open = true;
+          States[num].Since = now;
+          States[num].Value = record->Param;
+        }
+        else if(num == ES_TRACE_INPUT)
+        {
+          EmitEvent("\"name\":\"input %u\",\"ph\":\"C\",\"ts\":%llu,\"pid\":%u,\"args\":{\"value\":%u}",
+              record->Type, (unsigned long long)now, SIM_TRACE_PID, record->Param);
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+  if(timed)
+  {
+    EndBoot(now);
+  }
+
+  // track names
+  EmitEvent("\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"ES device\"}", SIM_TRACE_PID);
+  EmitEvent("\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"ES_Run\"}",
+      SIM_TRACE_PID, SIM_TRACE_RUN_TID);
+  for(uint8_t i = 0; i < NUM_SERVICES; i++)
+  {
+    EmitEvent("\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}",
+        SIM_TRACE_PID, SIM_TRACE_SERVICE_TID(i), ServiceName(i));
+    EmitEvent("\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s state\"}",
+        SIM_TRACE_PID, SIM_TRACE_STATE_TID(i), ServiceName(i));
+  }
+  for(uint8_t i = 0; i < SIM_TRACE_TIMERS; i++)
+  {
+    if(TimerOwners[i] != SIM_TRACE_NO_SERVICE)
+      EmitEvent("\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"timer %u (%s)\"}",
+          SIM_TRACE_PID, SIM_TRACE_TIMER_TID(i), i, ServiceName(TimerOwners[i]));
+    else if(TimersUsed & (1U << i))
+      EmitEvent("\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"timer %u\"}",
+          SIM_TRACE_PID, SIM_TRACE_TIMER_TID(i), i);
+  }
+  fprintf(Out, "\n]}\n");
+
+  free(records);
+  return timed;
+}
+
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+// one element of traceEvents, Format is what goes between the braces
+static void EmitEvent(const char *Format, ...)
+{
+  va_list args;
+  va_start(args, Format);
+  fprintf(Out, "%s{", FirstEvent ? "" : ",\n");
+  vfprintf(Out, Format, args);
+  fprintf(Out, "}");
+  va_end(args);
+  FirstEvent = false;
+}
+
+static void PushPost(SimTraceQueue_t *Queue, const SimTracePost_t *Post)
+{
+  if(Queue->NumPosts == SIM_TRACE_POSTS)
+  {
+    memmove(&Queue->Posts[0], &Queue->Posts[1], (SIM_TRACE_POSTS - 1) * sizeof(SimTracePost_t));
+    Queue->NumPosts--;
+  }
+  Queue->Posts[Queue->NumPosts++] = *Post;
+}
+
+// the oldest matching post, the ones before it were never dispatched
+static bool TakePost(SimTraceQueue_t *Queue, uint8_t Type, uint16_t Param, SimTracePost_t *Post)
+{
+  for(uint8_t i = 0; i < Queue->NumPosts; i++)
+  {
+    if(Queue->Posts[i].Type == Type && Queue->Posts[i].Param == Param)
+    {
+      *Post = Queue->Posts[i];
+      Queue->NumPosts -= i + 1;
+      memmove(&Queue->Posts[0], &Queue->Posts[i + 1], Queue->NumPosts * sizeof(SimTracePost_t));
+      return true;
+    }
+  }
+  return false;
+}
+
+// an arrow from the post to the dispatch
+static void EmitFlow(const SimTracePost_t *Post, uint8_t ServiceNum, uint64_t Time)
+{
+  EmitEvent("\"name\":\"post\",\"cat\":\"post\",\"ph\":\"s\",\"id\":%u,\"ts\":%llu,\"pid\":%u,\"tid\":%u",
+      NextFlowId, (unsigned long long)Post->Time, SIM_TRACE_PID, Post->Tid);
+  EmitEvent("\"name\":\"post\",\"cat\":\"post\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%u,\"ts\":%llu,\"pid\":%u,\"tid\":%u",
+      NextFlowId, (unsigned long long)Time, SIM_TRACE_PID, SIM_TRACE_SERVICE_TID(ServiceNum));
+  NextFlowId++;
+}
+
+static void EndDispatch(uint8_t ServiceNum, uint64_t Time)
+{
+  SimTraceSpan_t *span = &Dispatches[ServiceNum];
+  if(!span->Open)
+    return;
+  span->Open = false;
+  char name[48];
+  if(span->Type == ES_TIMEOUT)
+    snprintf(name, sizeof(name), "%s %u", EventName(span->Type), span->Value);
+  else
+    snprintf(name, sizeof(name), "%s", EventName(span->Type));
+  EmitEvent("\"name\":\"%s\",\"cat\":\"dispatch\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%u,\"tid\":%u,"
+      "\"args\":{\"param\":%u}", name, (unsigned long long)span->Since, (unsigned long long)(Time - span->Since),
+      SIM_TRACE_PID, SIM_TRACE_SERVICE_TID(ServiceNum), span->Value);
+}
+
+static void EndState(uint8_t ServiceNum, uint64_t Time)
+{
+  SimTraceSpan_t *span = &States[ServiceNum];
+  if(!span->Open)
+    return;
+  span->Open = false;
+  EmitEvent("\"name\":\"state %u\",\"cat\":\"state\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%u,\"tid\":%u",
+      span->Value, (unsigned long long)span->Since, (unsigned long long)(Time - span->Since),
+      SIM_TRACE_PID, SIM_TRACE_STATE_TID(ServiceNum));
+}
+
+static void EndTimer(uint8_t Timer, uint64_t Time)
+{
+  SimTraceSpan_t *span = &Timers[Timer];
+  if(!span->Open)
+    return;
+  span->Open = false;
+  EmitEvent("\"name\":\"%u ticks\",\"cat\":\"timer\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%u,\"tid\":%u",
+      ((uint32_t)span->Type << 16) | span->Value, (unsigned long long)span->Since,
+      (unsigned long long)(Time - span->Since), SIM_TRACE_PID, SIM_TRACE_TIMER_TID(Timer));
+}
+
+// deep sleep ends whatever was going on
+static void EndBoot(uint64_t Time)
+{
+  for(uint8_t i = 0; i < NUM_SERVICES; i++)
+  {
+    EndDispatch(i, Time);
+    EndState(i, Time);
+  }
+  for(uint8_t i = 0; i < SIM_TRACE_TIMERS; i++)
+  {
+    EndTimer(i, Time);
+  }
+  memset(Queues, 0, sizeof(Queues));
+  MulticastServices = 0;
+  Running = SIM_TRACE_NO_SERVICE;
+}
+
+static const char *EventName(uint8_t Type)
+{
+  static char name[16];
+  if(Type < ARRAY_SIZE(EventNames))
+    return EventNames[Type];
+  snprintf(name, sizeof(name), "event %u", Type);
+  return name;
+}
+
+static const char *ServiceName(uint8_t ServiceNum)
+{
+  const char *name = ServiceNames[ServiceNum];
+  return (strncmp(name, "Run", 3) == 0) ? name + 3 : name;
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
@@ -0,0 +1,80 @@
+/****************************************************************************
+ Module
+     Arduino.h
+ Description
+     Stands in for the Arduino-ESP32 core when the device code is built for
+     the simulator. Only declares what the simulated modules use, the
+     functions are in SimHal.c
+ Notes
+*****************************************************************************/
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// RTC_DATA_ATTR variables go in their own section so the simulator can
+// keep them across deep sleep (see Sim.c)
+#define RTC_DATA_ATTR __attribute__((section("sim_rtc")))
+#define IRAM_ATTR
+
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+uint16_t analogRead(uint8_t pin);
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(uint32_t ms);
+void configTzTime(const char *tz, const char *server1, const char *server2 = nullptr,
+    const char *server3 = nullptr);
+
+// newlib has it, glibc only from 2.38
+size_t sim_strlcpy(char *dst, const char *src, size_t size);
+#define strlcpy sim_strlcpy
+
+// esp_sleep.h
+typedef enum
+{
+  ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+  ESP_SLEEP_WAKEUP_ALL,
+  ESP_SLEEP_WAKEUP_EXT0,
+  ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER
+}esp_sleep_wakeup_cause_t;
+
+typedef enum
+{
+  GPIO_NUM_26 = 26
+}gpio_num_t;
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+int esp_sleep_enable_ext0_wakeup(gpio_num_t gpio_num, int level);
+void esp_deep_sleep(uint64_t time_in_us) __attribute__((noreturn));
+void esp_deep_sleep_start(void) __attribute__((noreturn));
+
+class HardwareSerial
+{
+public:
+  void begin(unsigned long baud) {}
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char *str) { return fputs(str, stdout); }
+  size_t println(const char *str) { return puts(str); }
+  operator bool() const { return true; }
+};
+extern HardwareSerial Serial;
+
+#endif /* SIM_ARDUINO_H */
@@ -0,0 +1,2 @@
+// simulator shim, Serial is declared with the rest of the core in Arduino.h
+#include "Arduino.h"
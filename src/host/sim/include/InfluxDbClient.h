@@ -0,0 +1,55 @@
+/****************************************************************************
+ Module
+     InfluxDbClient.h
+ Description
+     simulator shim for the InfluxDB client library. A write goes through
+     if the WiFi is connected, or is buffered when batching, see SimHal.c
+ Notes
+*****************************************************************************/
+#ifndef SIM_INFLUXDB_CLIENT_H
+#define SIM_INFLUXDB_CLIENT_H
+
+#include "Arduino.h"
+
+enum class WritePrecision
+{
+  NoTime = 0,
+  S,
+  MS,
+  US,
+  NS
+};
+
+class Point
+{
+public:
+  Point(const char *measurement) {}
+  void clearTags(void) {}
+  void addTag(const char *name, const char *value) {}
+  void clearFields(void) {}
+  void addField(const char *name, int value) {}
+  void setTime(time_t timestamp) {}
+};
+
+class HTTPOptions
+{
+public:
+  HTTPOptions &httpReadTimeout(int readTimeoutMs) { return *this; }
+};
+
+class InfluxDBClient
+{
+public:
+  void setConnectionParamsV1(const char *serverUrl, const char *db, const char *user,
+      const char *password, const char *certInfo) {}
+  bool setHTTPOptions(const HTTPOptions &other) { return true; }
+  bool setWriteOptions(WritePrecision precision, uint16_t batchSize = 1, uint16_t bufferSize = 5,
+      uint16_t flushInterval = 60, bool preserveConnection = true);
+  bool writePoint(Point &point);
+
+private:
+  uint16_t BatchSize = 1;
+  uint16_t NumBuffered = 0;
+};
+
+#endif /* SIM_INFLUXDB_CLIENT_H */
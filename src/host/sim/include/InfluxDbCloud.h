@@ -0,0 +1,2 @@
+// simulator shim, the cloud certificates aren't needed
+#include "InfluxDbClient.h"
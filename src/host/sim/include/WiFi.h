@@ -0,0 +1,38 @@
+/****************************************************************************
+ Module
+     WiFi.h
+ Description
+     simulator shim for the Arduino-ESP32 WiFi library. Connects after
+     SIM_WIFI_CONNECT_TIME if the script has the WiFi up, see SimHal.c
+ Notes
+*****************************************************************************/
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum
+{
+  WIFI_OFF = 0,
+  WIFI_STA
+}wifi_mode_t;
+
+typedef enum
+{
+  WL_IDLE_STATUS = 0,
+  WL_CONNECTED = 3,
+  WL_DISCONNECTED = 6
+}wl_status_t;
+
+class WiFiClass
+{
+public:
+  bool setAutoConnect(bool autoConnect) { return true; }
+  bool mode(wifi_mode_t mode);
+  wl_status_t begin(const char *ssid, const char *passphrase);
+  wl_status_t status(void);
+  bool disconnect(bool wifiOff = false);
+};
+extern WiFiClass WiFi;
+
+#endif /* SIM_WIFI_H */
@@ -0,0 +1,8 @@
+// simulator stand in for the untracked credentials.h, nothing connects
+#define WIFI_SSID "sim"
+#define WIFI_PASSWORD "sim"
+#define INFLUXDB_URL "http://localhost:8086"
+#define INFLUXDB_DB_NAME "sim"
+#define INFLUXDB_USER "sim"
+#define INFLUXDB_PWD "sim"
+#define TZ_INFO "PST8PDT"
@@ -0,0 +1,6 @@
+// simulator shim
+#ifndef SIM_DRIVER_ADC_H
+#define SIM_DRIVER_ADC_H
+void adc_power_on(void);
+void adc_power_off(void);
+#endif
@@ -0,0 +1,5 @@
+// simulator shim, btStop is really in esp32-hal-bt.h
+#ifndef SIM_ESP_BT_H
+#define SIM_ESP_BT_H
+bool btStop(void);
+#endif
@@ -0,0 +1,11 @@
+// simulator shim
+#ifndef SIM_ESP_WIFI_H
+#define SIM_ESP_WIFI_H
+typedef enum
+{
+  WIFI_PS_NONE,
+  WIFI_PS_MIN_MODEM,
+  WIFI_PS_MAX_MODEM
+}wifi_ps_type_t;
+int esp_wifi_set_ps(wifi_ps_type_t type);
+#endif
@@ -0,0 +1,6 @@
+// simulator shim, the Feather ESP32's pins
+#ifndef SIM_PINS_ARDUINO_H
+#define SIM_PINS_ARDUINO_H
+#include <stdint.h>
+static const uint8_t A13 = 15;
+#endif
@@ -0,0 +1 @@
+// simulator shim, nothing in it is used
@@ -0,0 +1,176 @@
+/****************************************************************************
+ Module
+     ES_Configure_Test.h
+ Description
+     ES_Configure.h for the unit tests ([env:native_test] in platformio.ini).
+     Pulled in by ES_Configure.h when ES_PORT_POSIX and ES_UNIT_TEST are
+     defined, and sets the framework up with the test services, which log
+     what they are handed for the tests in test/ to check.
+ Notes
+     Laid out the same as ES_Configure.h, see there for what each setting does
+*****************************************************************************/
+
+#ifndef ES_CONFIGURE_TEST_H
+#define ES_CONFIGURE_TEST_H
+
+
+/****************************************************************************/
+// Name/define the events of interest
+// Universal events occupy the lowest entries, followed by user-defined events
+typedef enum
+{
+  ES_NO_EVENT = 0,
+  ES_ERROR,                 /* used to indicate an error from the service */
+  ES_INIT,                  /* used to transition from initial pseudo-state */
+  ES_TIMEOUT,               /* signals that the timer has expired */
+  ES_FAIL,                  /* used to indicate something was unsuccessful */
+  ES_SUCCESS,               /* used to indicate something was successful */
+  /* User-defined events start here */
+  TEST_A,                   /* no queue policy, the post fails when the queue is full */
+  TEST_B,                   /* only to the high service with ES_PostAll */
+  TEST_COALESCE,            /* ES_QUEUE_COALESCE */
+  TEST_DROP,                /* ES_QUEUE_DROP_OLDEST */
+  ES_NUM_EVENT_TYPES        /* keep last, number of event types */
+}ES_EventType_t;
+
+
+/****************************************************************************/
+// add all event checkers here as ES_CHECKER(function, min interval, weight, service)
+#define EVENT_CHECKER_LIST ES_CHECKER(EventCheckerTest, 0, 1, TEST_LOW_SERV_NUM)
+#define ES_CHECKER_SCHEDULING ES_CHECKERS_WEIGHTED
+
+typedef enum
+{
+  TEST_EVENT_SRC = 0,       /* never signalled, the tests post to the services directly */
+  ES_NUM_EVENT_SOURCES      /* keep last */
+}ES_EventSource_t;
+
+#define EVENT_CHECKER_POLL_PERIOD 50
+
+
+/****************************** Timers **************************************/
+#define TIMER_UNUSED ((pPostFunc)0)
+#define TIMER0_RESP_FUNC PostTestLowService
+#define TIMER1_RESP_FUNC PostTestWorkerService
+#define TIMER2_RESP_FUNC TIMER_UNUSED
+#define TIMER3_RESP_FUNC TIMER_UNUSED
+#define TIMER4_RESP_FUNC TIMER_UNUSED
+#define TIMER5_RESP_FUNC TIMER_UNUSED
+#define TIMER6_RESP_FUNC TIMER_UNUSED
+#define TIMER7_RESP_FUNC TIMER_UNUSED
+#define TIMER8_RESP_FUNC TIMER_UNUSED
+#define TIMER9_RESP_FUNC TIMER_UNUSED
+#define TIMER10_RESP_FUNC TIMER_UNUSED
+#define TIMER11_RESP_FUNC TIMER_UNUSED
+#define TIMER12_RESP_FUNC TIMER_UNUSED
+#define TIMER13_RESP_FUNC TIMER_UNUSED
+#define TIMER14_RESP_FUNC TIMER_UNUSED
+#define TIMER15_RESP_FUNC TIMER_UNUSED
+
+#define TEST_LOW_TIMER_NUM 0
+#define TEST_WORKER_TIMER_NUM 1
+
+#define ES_TIMER_SLACKS \
+
+
+#define ES_TIMER_POOL_SIZE 32
+
+
+/****************************** Payloads ************************************/
+#define ES_PAYLOAD_SIZE 16
+#define ES_PAYLOAD_POOL_SIZE 8
+
+
+/****************************** Idle ****************************************/
+// short, so an ES_Run with nothing to do doesn't hold up a test for long
+#define ES_LIGHT_SLEEP_MIN_TIME 20
+#define ES_IDLE_MAX_TIME 10U
+
+
+/****************************** Time Stamps *********************************/
+// #define ES_TIMESTAMP_ENABLE
+
+/****************************** Profiler ************************************/
+// #define ES_PROFILER_ENABLE
+
+/****************************** Run Budgets *********************************/
+// #define ES_BUDGET_ENABLE
+
+/****************************** Trace ***************************************/
+// #define ES_TRACE_ENABLE
+#define ES_TRACE_LEN 512
+#define ES_TRACE_NUM_INPUTS 0
+
+
+/********************************Services********************************************/
+#define MAX_NUM_SERVICES 16
+#define NUM_SERVICES 3
+
+/****************************************************************************/
+// These are the definitions for Service 0
+#define SERV_0_HEADER "host/test/TestService.h"
+#define SERV_0_INIT InitTestLowService
+#define SERV_0_RUN RunTestLowService
+#define SERV_0_QUEUE_SIZE 4
+#define SERV_0_RUN_BUDGET 1000
+#define SERV_0_PROBE ES_NO_PROBE
+#define TEST_LOW_SERV_NUM 0
+
+/****************************************************************************/
+// These are the definitions for Service 1
+#if NUM_SERVICES > 1
+#define SERV_1_HEADER "host/test/TestService.h"
+#define SERV_1_INIT InitTestHighService
+#define SERV_1_RUN RunTestHighService
+#define SERV_1_QUEUE_SIZE 4
+#define SERV_1_RUN_BUDGET 1000
+#define SERV_1_PROBE ES_NO_PROBE
+#define TEST_HIGH_SERV_NUM 1
+#endif
+
+/****************************************************************************/
+// These are the definitions for Service 2, run by the worker thread
+#if NUM_SERVICES > 2
+#define SERV_2_HEADER "host/test/TestService.h"
+#define SERV_2_INIT InitTestWorkerService
+#define SERV_2_RUN RunTestWorkerService
+#define SERV_2_QUEUE_SIZE 4
+#define SERV_2_RUN_BUDGET 1000
+#define SERV_2_PROBE ES_NO_PROBE
+#define TEST_WORKER_SERV_NUM 2
+#endif
+
+
+/****************************** Post Lists **********************************/
+#define POST_LIST_00 TEST_LOW_SERV_NUM, TEST_HIGH_SERV_NUM
+#define POST_LIST_01 TEST_LOW_SERV_NUM
+#define POST_LIST_02 TEST_LOW_SERV_NUM, TEST_HIGH_SERV_NUM, TEST_WORKER_SERV_NUM
+#define POST_LIST_03
+#define POST_LIST_04
+#define POST_LIST_05
+#define POST_LIST_06
+#define POST_LIST_07
+
+#define ES_SUBSCRIPTIONS \
+  ES_SUBSCRIBE(TEST_B, TEST_HIGH_SERV_NUM)
+
+#define ES_MULTICAST_QUEUE_SIZE 4
+
+
+/****************************** Queues **************************************/
+// ES_TIMEOUT as in ES_Configure.h, so the timer tests see what the device does,
+// and one event type for each policy on its own for test_queue_policies
+#define ES_QUEUE_POLICIES \
+  ES_QUEUE_POLICY(ES_TIMEOUT, ES_QUEUE_COALESCE | ES_QUEUE_DROP_OLDEST) \
+  ES_QUEUE_POLICY(TEST_COALESCE, ES_QUEUE_COALESCE) \
+  ES_QUEUE_POLICY(TEST_DROP, ES_QUEUE_DROP_OLDEST)
+
+
+/****************************** Worker **************************************/
+// a thread stands in for the worker task, as in ES_Configure_Host.h
+#define ES_WORKER_ENABLE
+#define ES_WORKER_SERVICES (1U << TEST_WORKER_SERV_NUM)
+#define ES_WORKER_QUEUE_SIZE 8
+
+
+#endif /* ES_CONFIGURE_TEST_H */
@@ -0,0 +1,414 @@
+/****************************************************************************
+ Module
+   TestService.c
+
+ Description
+   Services for the unit tests in test/ ([env:native_test]). The low and
+   high services run in the loop, the worker service in the worker thread
+   (ES_WORKER_ENABLE). None of them does anything on its own: each logs
+   every event it is handed, with what the payload pool looked like at the
+   time, and calls the hook the test has set for it, if any. The tests post
+   events, run the framework and check the log.
+
+ Notes
+   The log is shared by the loop and the worker and guarded by ES_Lock. A
+   hook runs in the task that runs its service, so a hook of the worker
+   service must not call the Unity asserts, which only work in the test's
+   own thread
+****************************************************************************/
+/*----------------------------- Include Files -----------------------------*/
+#include "TestService.h"
+#include "ES_framework.h"
+#include <string.h>
+
+/*----------------------------- Module Defines ----------------------------*/
+#define TEST_WORKER_WAIT 1000     // ms TestService_RunUntilIdle waits on the worker
+
+/*---------------------------- Module Functions ---------------------------*/
+static ES_Event_t LogDispatch(uint8_t ServiceNum, ES_Event_t ThisEvent);
+
+/*---------------------------- Module Variables ---------------------------*/
+static uint8_t LowPriority;
+static uint8_t HighPriority;
+static uint8_t WorkerPriority;
+
+static TestDispatch_t Log[TEST_LOG_LEN];
+static uint32_t NumDispatches = 0;
+static TestHook_t *Hooks[NUM_SERVICES];
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     TestService_Reset
+
+ Parameters
+     None
+
+ Returns
+     None
+
+ Description
+     Clears the log and the hooks, called by each test's setUp
+ Notes
+     Only while the worker is idle
+****************************************************************************/
+void TestService_Reset(void)
+{
+  ES_Lock();
+  NumDispatches = 0;
+  memset(Hooks, 0, sizeof(Hooks));
+  ES_Unlock();
+}
+
+/****************************************************************************
+ Function
+     TestService_SetHook
+
+ Parameters
+     uint8_t : the service number
+     TestHook_t * : called with each event the service is handed, NULL for
+                    none
+
+ Returns
+     None
+
+ Description
+     Lets a test act from inside a run function, e.g. post or restart a
+     timer while other events are still waiting
+ Notes
+****************************************************************************/
+void TestService_SetHook(uint8_t ServiceNum, TestHook_t *Hook)
+{
+  if(ServiceNum >= NUM_SERVICES)
+  {
+    return;
+  }
+  ES_Lock();
+  Hooks[ServiceNum] = Hook;
+  ES_Unlock();
+}
+
+/****************************************************************************
+ Function
+     TestService_GetNumDispatches
+
+ Parameters
+     None
+
+ Returns
+     uint32_t, the run function calls since TestService_Reset
+
+ Description
+     Includes the ones past TEST_LOG_LEN that weren't logged
+ Notes
+****************************************************************************/
+uint32_t TestService_GetNumDispatches(void)
+{
+  ES_Lock();
+  uint32_t num = NumDispatches;
+  ES_Unlock();
+  return num;
+}
+
+/****************************************************************************
+ Function
+     TestService_GetDispatch
+
+ Parameters
+     uint8_t : which run function call, 0 for the first since
+               TestService_Reset
+
+ Returns
+     TestDispatch_t, what the service was handed. Its EventType is
+     ES_NO_EVENT if there was no such call, or it wasn't logged
+
+ Description
+     The calls are in the order they were made, the loop's and the worker's
+     interleaved
+ Notes
+****************************************************************************/
+TestDispatch_t TestService_GetDispatch(uint8_t Num)
+{
+  TestDispatch_t dispatch = {};
+  ES_Lock();
+  if(Num < NumDispatches && Num < TEST_LOG_LEN)
+  {
+    dispatch = Log[Num];
+  }
+  ES_Unlock();
+  return dispatch;
+}
+
+/****************************************************************************
+ Function
+     TestService_RunUntilIdle
+
+ Parameters
+     None
+
+ Returns
+     bool, false if ES_Run failed or the worker didn't finish in time
+
+ Description
+     Calls ES_Run and waits for the worker until a round of both runs
+     nothing, so everything the test posted, and everything that posted in
+     turn, has been handled
+ Notes
+     Each ES_Run idles for up to ES_IDLE_MAX_TIME at the end
+****************************************************************************/
+bool TestService_RunUntilIdle(void)
+{
+  uint32_t lastNum;
+  do
+  {
+    lastNum = TestService_GetNumDispatches();
+    if(ES_Run() != Success || ES_WaitWorkerIdle(TEST_WORKER_WAIT) == false)
+    {
+      return false;
+    }
+  }while(TestService_GetNumDispatches() != lastNum);
+  return true;
+}
+
+/****************************************************************************
+ Function
+     InitTestLowService
+
+ Parameters
+     uint8_t : the priorty of this service
+
+ Returns
+     bool, false if error in initialization, true otherwise
+
+ Description
+     Saves away the priority
+ Notes
+****************************************************************************/
+bool InitTestLowService(uint8_t Priority)
+{
+  LowPriority = Priority;
+  return true;
+}
+
+/****************************************************************************
+ Function
+     PostTestLowService
+
+ Parameters
+     EF_Event_t ThisEvent ,the event to post to the queue
+
+ Returns
+     bool false if the Enqueue operation failed, true otherwise
+
+ Description
+     Posts an event to this service's queue
+ Notes
+****************************************************************************/
+bool PostTestLowService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = LowPriority;
+  return ES_PostToService(ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    RunTestLowService
+
+ Parameters
+   ES_Event_t : the event to process
+
+ Returns
+   ES_Event, always ES_NO_EVENT
+
+ Description
+   Logs the event and calls the service's hook
+ Notes
+****************************************************************************/
+ES_Event_t RunTestLowService(ES_Event_t ThisEvent)
+{
+  return LogDispatch(LowPriority, ThisEvent);
+}
+
+/****************************************************************************
+ Function
+     InitTestHighService
+
+ Parameters
+     uint8_t : the priorty of this service
+
+ Returns
+     bool, false if error in initialization, true otherwise
+
+ Description
+     Saves away the priority
+ Notes
+****************************************************************************/
+bool InitTestHighService(uint8_t Priority)
+{
+  HighPriority = Priority;
+  return true;
+}
+
+/****************************************************************************
+ Function
+     PostTestHighService
+
+ Parameters
+     EF_Event_t ThisEvent ,the event to post to the queue
+
+ Returns
+     bool false if the Enqueue operation failed, true otherwise
+
+ Description
+     Posts an event to this service's queue
+ Notes
+****************************************************************************/
+bool PostTestHighService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = HighPriority;
+  return ES_PostToService(ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    RunTestHighService
+
+ Parameters
+   ES_Event_t : the event to process
+
+ Returns
+   ES_Event, always ES_NO_EVENT
+
+ Description
+   Logs the event and calls the service's hook
+ Notes
+****************************************************************************/
+ES_Event_t RunTestHighService(ES_Event_t ThisEvent)
+{
+  return LogDispatch(HighPriority, ThisEvent);
+}
+
+/****************************************************************************
+ Function
+     InitTestWorkerService
+
+ Parameters
+     uint8_t : the priorty of this service
+
+ Returns
+     bool, false if error in initialization, true otherwise
+
+ Description
+     Saves away the priority
+ Notes
+     Called from the loop like every init function, its events are run by
+     the worker
+****************************************************************************/
+bool InitTestWorkerService(uint8_t Priority)
+{
+  WorkerPriority = Priority;
+  return true;
+}
+
+/****************************************************************************
+ Function
+     PostTestWorkerService
+
+ Parameters
+     EF_Event_t ThisEvent ,the event to post to the queue
+
+ Returns
+     bool false if the Enqueue operation failed, true otherwise
+
+ Description
+     Posts an event to this service's queue
+ Notes
+****************************************************************************/
+bool PostTestWorkerService(ES_Event_t ThisEvent)
+{
+  ThisEvent.ServiceNum = WorkerPriority;
+  return ES_PostToService(ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    RunTestWorkerService
+
+ Parameters
+   ES_Event_t : the event to process
+
+ Returns
+   ES_Event, always ES_NO_EVENT
+
+ Description
+   Logs the event and calls the service's hook
+ Notes
+   Runs in the worker thread
+****************************************************************************/
+ES_Event_t RunTestWorkerService(ES_Event_t ThisEvent)
+{
+  return LogDispatch(WorkerPriority, ThisEvent);
+}
+
+/****************************************************************************
+ Function
+    EventCheckerTest
+
+ Parameters
+   None
+
+ Returns
+   bool, always false
+
+ Description
+   The framework needs at least one event checker, the tests post their
+   events straight to the services
+ Notes
+****************************************************************************/
+bool EventCheckerTest(void)
+{
+  return false;
+}
+
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+// Logs what a service's run function was handed, then calls its hook
+// outside the lock, so the hook can post and take the lock itself
+static ES_Event_t LogDispatch(uint8_t ServiceNum, ES_Event_t ThisEvent)
+{
+  ES_Event_t ReturnEvent;
+  ReturnEvent.EventType = ES_NO_EVENT;
+
+  TestDispatch_t dispatch = {};
+  dispatch.ServiceNum = ServiceNum;
+  dispatch.EventType = ThisEvent.EventType;
+  dispatch.EventParam = ThisEvent.EventParam;
+  dispatch.Payload = ThisEvent.Payload;
+  const void *payload = ES_Payload_Get(ThisEvent.Payload);
+  if(payload != NULL)
+  {
+    memcpy(&dispatch.PayloadData, payload, sizeof(dispatch.PayloadData));
+  }
+  ES_PayloadStats_t stats;
+  ES_Payload_GetStats(&stats);
+  dispatch.PayloadsInUse = stats.InUse;
+
+  ES_Lock();
+  if(NumDispatches < TEST_LOG_LEN)
+  {
+    Log[NumDispatches] = dispatch;
+  }
+  NumDispatches++;
+  TestHook_t *hook = Hooks[ServiceNum];
+  ES_Unlock();
+
+  if(hook != NULL)
+  {
+    hook(ThisEvent);
+  }
+  return ReturnEvent;
+}
+
+/*------------------------------- Footnotes -------------------------------*/
+/*------------------------------ End of file ------------------------------*/
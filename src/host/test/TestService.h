@@ -0,0 +1,55 @@
+/****************************************************************************
+
+  Header file for the unit test services
+
+ ****************************************************************************/
+
+#ifndef TestService_H
+#define TestService_H
+
+#include "ES_Event.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// the most dispatches TestService_GetDispatch keeps, later ones are counted
+// but not logged
+#define TEST_LOG_LEN 64
+
+// what a service was handed by one call of its run function
+typedef struct
+{
+  uint8_t ServiceNum;
+  ES_EventType_t EventType;
+  uint16_t EventParam;
+  uint8_t Payload;
+  uint32_t PayloadData;     // first 4 bytes of the payload, 0 without one
+  uint8_t PayloadsInUse;    // payload blocks in use while it ran
+}TestDispatch_t;
+
+// called by a service's run function after logging the event, in the task
+// that runs the service
+typedef void TestHook_t(ES_Event_t ThisEvent);
+
+// Public Function Prototypes
+void TestService_Reset(void);
+void TestService_SetHook(uint8_t ServiceNum, TestHook_t *Hook);
+uint32_t TestService_GetNumDispatches(void);
+TestDispatch_t TestService_GetDispatch(uint8_t Num);
+bool TestService_RunUntilIdle(void);
+
+bool InitTestLowService(uint8_t Priority);
+bool PostTestLowService(ES_Event_t ThisEvent);
+ES_Event_t RunTestLowService(ES_Event_t ThisEvent);
+
+bool InitTestHighService(uint8_t Priority);
+bool PostTestHighService(ES_Event_t ThisEvent);
+ES_Event_t RunTestHighService(ES_Event_t ThisEvent);
+
+bool InitTestWorkerService(uint8_t Priority);
+bool PostTestWorkerService(ES_Event_t ThisEvent);
+ES_Event_t RunTestWorkerService(ES_Event_t ThisEvent);
+
+// Event checkers
+bool EventCheckerTest(void);
+
+#endif /* TestService_H */
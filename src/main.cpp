@@ -10,6 +10,28 @@
     bool pinState = false; 
 #endif
 
+// #define IDLE_STATS_DEBUG
+#ifdef IDLE_STATS_DEBUG
+    #define IDLE_STATS_PERIOD 60000  // ms between printouts
+#endif
+
+// dumps the dispatch profile when ES_PROFILER_ENABLE is set in ES_Configure.h
+#ifdef ES_PROFILER_ENABLE
+    #define PROFILER_PRINT_PERIOD 60000  // ms between printouts
+#endif
+
+// lists the services that ran over their run budget when ES_BUDGET_ENABLE is
+// set in ES_Configure.h
+#ifdef ES_BUDGET_ENABLE
+    #define BUDGET_PRINT_PERIOD 600000  // ms between printouts
+#endif
+
+// dumps the event trace when this is sent over Serial, or the framework 
+// fails, when ES_TRACE_ENABLE is set in ES_Configure.h
+#ifdef ES_TRACE_ENABLE
+    #define TRACE_DUMP_CMD 't'
+#endif
+
 ES_Return_t ES_returnVal; 
 
 void setup() {
@@ -41,10 +63,76 @@ void loop(){
   if(ES_returnVal == Success)
     ES_returnVal = ES_Run(); 
 
+  #ifdef IDLE_STATS_DEBUG
+    static uint32_t lastStatsTime = 0; 
+    static uint32_t lastWakeups = 0; 
+    static uint32_t lastAlarms = 0; 
+    uint32_t statsPeriod = millis() - lastStatsTime; 
+    if(statsPeriod >= IDLE_STATS_PERIOD)
+    {
+      lastStatsTime = millis(); 
+      ES_IdleStats_t stats; 
+      ES_GetIdleStats(&stats); 
+      Serial.printf("Sleep: %llu ms (%u), wait: %llu ms, run: %llu ms\n", 
+          stats.LightSleepTime / 1000, stats.NumLightSleeps, 
+          stats.WaitTime / 1000, stats.RunTime / 1000); 
+
+      // wakeups per minute since the last printout, see ES_TIMER_SLACKS
+      Serial.printf("Wakeups/min: %u, timer alarms/min: %u\n", 
+          (uint32_t)((uint64_t)(stats.NumWakeups - lastWakeups) * 60000 / statsPeriod), 
+          (uint32_t)((uint64_t)(stats.NumTimerAlarms - lastAlarms) * 60000 / statsPeriod)); 
+      lastWakeups = stats.NumWakeups; 
+      lastAlarms = stats.NumTimerAlarms; 
+
+      // only the queues that have had to coalesce, drop or reject a post
+      for(uint8_t i = 0; i <= ES_QUEUE_MULTICAST; i++)
+      {
+        ES_QueueStats_t queueStats; 
+        if(ES_GetQueueStats(i, &queueStats) && (queueStats.Coalesced | queueStats.DroppedOldest | queueStats.Rejected))
+        {
+          Serial.printf("Queue %u: coalesced %u, dropped %u, rejected %u, high water %u\n", i, 
+              queueStats.Coalesced, queueStats.DroppedOldest, queueStats.Rejected, queueStats.HighWater); 
+        }
+      }
+
+      // event checker hits and misses, see EVENT_CHECKER_LIST
+      ES_CheckerStats_t checkerStats; 
+      for(uint8_t i = 0; ES_GetCheckerStats(i, &checkerStats); i++)
+      {
+        Serial.printf("Checker %u: hits %u, misses %u, held off %u\n", i, 
+            checkerStats.Hits, checkerStats.Misses, checkerStats.HeldOff); 
+      }
+    }
+  #endif
+
+  #ifdef ES_PROFILER_ENABLE
+    static uint32_t lastProfileTime = 0; 
+    if(millis() - lastProfileTime >= PROFILER_PRINT_PERIOD)
+    {
+      lastProfileTime = millis(); 
+      ES_Profiler_Print(); 
+    }
+  #endif
+
+  #ifdef ES_BUDGET_ENABLE
+    static uint32_t lastBudgetTime = 0; 
+    if(millis() - lastBudgetTime >= BUDGET_PRINT_PERIOD)
+    {
+      lastBudgetTime = millis(); 
+      ES_Budget_Print(); 
+    }
+  #endif
+
+  #ifdef ES_TRACE_ENABLE
+    if(Serial.available() && Serial.read() == TRACE_DUMP_CMD)
+      ES_Trace_Dump(); 
+  #endif
+
   if(ES_returnVal != Success && !sentFlag)
   {
     // digitalWrite(BUILTIN_LED, HIGH);  // turn light on for debugging 
     Serial.printf("Err: %i\n", ES_returnVal);
+    ES_Trace_Dump(); 
     Serial.println("******Stopping code*******");
     sentFlag = true; 
   }
@@ -13,6 +13,7 @@
 #include "IAQ_util.h"
 #include "ES_framework.h"
 #include "ES_Timers.h"
+#include "ES_Hsm.h"
 #include "CloudService.h"
 #include <WiFi.h>
 #include <driver/adc.h>
@@ -21,7 +22,6 @@
 
 
 /*----------------------------- Module Defines ----------------------------*/
-#define ALL_SENSORS_READ 0x07
 #define BAT_LOW_THRES 3500  // voltage at which to go into hibernation mode
 
 #define AUTO_MODE_TIMER_LEN 300000U  // Time in ms. Back up timer for timeouts 
@@ -30,6 +30,7 @@
 #define DEEP_SLEEP_TIME 900000000UL  // Length of time to go into deep sleep for in auto mode
 
 #define WIFI_TIMEOUT_LEN  36000U  // ms
+#define WORKER_STOP_TIME (CLOUD_WRITE_MAX_TIME + 1000U)  // ms, an InfluxDB write in flight and the rest of its run
 #define BAT_POLLING_PERIOD 1000  // updates battery run avg and low volt check at this interval 
 
 #define CLOUD_COUNTER_LEN 50  // Cloud updates every this many screen refreshes (make 5+)   
@@ -42,10 +43,13 @@ typedef enum
   SVM30Idx
 }sensorIdx_t;
 
+// index into MainStates, parents first
 typedef enum
 {
+  TOP_STATE = 0,          // low battery and switching off, in every state
   START_STATE,
   AUTO_STATE,
+  STREAMING_STATE,        // a short press goes back to auto from both stream states
   STREAM_STATE,
   STREAM_CLOUD_STATE
 }statusState_t; 
@@ -55,18 +59,79 @@ typedef enum
 void initPins();
 void sensorsPwrEnable(bool turnOn);
 void setFlagBit(sensorIdx_t sensorBitIdx);
+uint8_t getPresentSensors();
 void shutdownIAQ(bool timedShtdwn);
 void shutdownBat();
 void changeSensorsIAQMode(IAQmode_t currIAQMode);
 void startSensorsSM();
+static bool isBatLow(ES_Event_t ThisEvent);
+static void lowBatOff(ES_Event_t ThisEvent);
+static void switchOff(ES_Event_t ThisEvent);
+static void powerSensors(ES_Event_t ThisEvent);
+static bool isTimerWakeup(ES_Event_t ThisEvent);
+static void startAuto(ES_Event_t ThisEvent);
+static void startStream(ES_Event_t ThisEvent);
+static void startReadings(IAQmode_t currIAQMode, uint32_t timerLen);
+static void sendReadings(ES_Event_t ThisEvent);
+static void showReadingsAndSleep(ES_Event_t ThisEvent);
+static void backupTimedOut(ES_Event_t ThisEvent);
+static void autoToStream(ES_Event_t ThisEvent);
+static void streamToAuto(ES_Event_t ThisEvent);
+static bool needsTimeSync(ES_Event_t ThisEvent);
+static void syncCloud(ES_Event_t ThisEvent);
+static void updateStream(ES_Event_t ThisEvent);
+static void startWifiTimeout(ES_Event_t ThisEvent);
+static void endCloudSync(ES_Event_t ThisEvent);
+static void pollSensors(void);
+static void countStreamUpdate(void);
 
 /*---------------------------- Module Variables ---------------------------*/
 static uint8_t MyPriority;
 static uint8_t sensorReads_flag = 0x00; 
-static statusState_t currSMState = START_STATE; 
+static uint8_t allSensorsRead = 0x00;  // a bit per sensor found by its probe, see setFlagBit
+static ES_Hsm_t mainHsm; 
+static uint8_t cloudUpdateCounter = 0; 
 RTC_DATA_ATTR IAQsensorVals_t sensorReads = {.eCO2=-1, .tVOC=-1, .PM25=-1, .PM10=-1, .CO2=-1, .temp=-1, .rh=-1}; 
 RTC_DATA_ATTR time_t lastUpdateTime = 0;  // last time screen sensor values were updated
 
+static constexpr ES_HsmTransition_t TopTransitions[] = {
+  // event              target               param                guard          action
+  {ES_TIMEOUT,          ES_HSM_NONE,         BAT_TIMER_NUM,       isBatLow,      lowBatOff},
+  {ES_SW_BUTTON_PRESS,  ES_HSM_NONE,         LONG_BT_PRESS,       NULL,          switchOff}
+};
+static constexpr ES_HsmTransition_t StartTransitions[] = {
+  {ES_INIT,             AUTO_STATE,          ES_HSM_ANY_PARAM,    isTimerWakeup, startAuto},
+  {ES_INIT,             STREAM_STATE,        ES_HSM_ANY_PARAM,    NULL,          startStream}
+};
+static constexpr ES_HsmTransition_t AutoTransitions[] = {
+  {SENSORS_READ_EVENT,  ES_HSM_NONE,         ES_HSM_ANY_PARAM,    NULL,          sendReadings},
+  {CLOUD_UPDATED_EVENT, ES_HSM_NONE,         ES_HSM_ANY_PARAM,    NULL,          showReadingsAndSleep},
+  {ES_TIMEOUT,          ES_HSM_NONE,         MAIN_SERV_TIMER_NUM, NULL,          backupTimedOut},
+  {ES_SW_BUTTON_PRESS,  STREAM_STATE,        SHORT_BT_PRESS,      NULL,          autoToStream}
+};
+static constexpr ES_HsmTransition_t StreamingTransitions[] = {
+  {ES_SW_BUTTON_PRESS,  AUTO_STATE,          SHORT_BT_PRESS,      NULL,          streamToAuto}
+};
+static constexpr ES_HsmTransition_t StreamTransitions[] = {
+  {ES_TIMEOUT,          STREAM_CLOUD_STATE,  MAIN_SERV_TIMER_NUM, needsTimeSync, syncCloud},
+  {ES_TIMEOUT,          ES_HSM_NONE,         MAIN_SERV_TIMER_NUM, NULL,          updateStream}
+};
+static constexpr ES_HsmTransition_t StreamCloudTransitions[] = {
+  {CLOUD_UPDATED_EVENT, STREAM_STATE,        ES_HSM_ANY_PARAM,    NULL,          endCloudSync},
+  {ES_TIMEOUT,          STREAM_STATE,        MAIN_SERV_TIMER_NUM, NULL,          endCloudSync}
+};
+
+static constexpr ES_HsmState_t MainStates[] = {
+  // parent          transitions                                  entry             exit
+  {ES_HSM_NONE,      ES_HSM_TRANSITIONS(TopTransitions),          NULL,             NULL},          // TOP_STATE
+  {TOP_STATE,        ES_HSM_TRANSITIONS(StartTransitions),        NULL,             powerSensors},  // START_STATE
+  {TOP_STATE,        ES_HSM_TRANSITIONS(AutoTransitions),         NULL,             NULL},          // AUTO_STATE
+  {TOP_STATE,        ES_HSM_TRANSITIONS(StreamingTransitions),    NULL,             NULL},          // STREAMING_STATE
+  {STREAMING_STATE,  ES_HSM_TRANSITIONS(StreamTransitions),       NULL,             NULL},          // STREAM_STATE
+  {STREAMING_STATE,  ES_HSM_TRANSITIONS(StreamCloudTransitions),  startWifiTimeout, NULL}           // STREAM_CLOUD_STATE
+};
+ES_HSM_CHECK(MainStates);
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -85,20 +150,27 @@ RTC_DATA_ATTR time_t lastUpdateTime = 0;  // last time screen sensor values were
 ****************************************************************************/
 bool InitMainService(uint8_t Priority)
 {
-  ES_Event_t ThisEvent;
+  ES_Event_t ThisEvent = {};
   MyPriority = Priority;
+  ThisEvent.EventType = ES_INIT;
+  if(!ES_Hsm_Start(&mainHsm, MainStates, START_STATE, ThisEvent))
+  {
+    return false;
+  }
+  ES_Trace_WatchState(MyPriority, &mainHsm.Current, sizeof(mainHsm.Current));
   
   initPins(); 
+  allSensorsRead = getPresentSensors(); 
   initePaper();
   adc_power_on();
   btStop();  // Make sure bluetooth is off
-  ES_Timer_InitTimer(BAT_TIMER_NUM, BAT_POLLING_PERIOD); 
+  ES_Timer_InitPeriodic(BAT_TIMER_NUM, BAT_POLLING_PERIOD); 
 
   for(uint8_t i=0; i<RUN_AVG_BUFFER_LEN; i++)
   {
     getBatVolt();  // fill up running avg buffer to curr val 
   }
-  if(getBatVolt() < BAT_LOW_THRES)
+  if(ES_Trace_Input(BAT_VOLT_INPUT, getBatVolt()) < BAT_LOW_THRES)
   {
     shutdownBat(); 
     return false; 
@@ -166,193 +238,11 @@ ES_Event_t RunMainService(ES_Event_t ThisEvent)
 {
   ES_Event_t ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
-  static uint8_t cloudUpdateCounter = 0; 
 
-  if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == BAT_TIMER_NUM)
-  {
-    ES_Timer_InitTimer(BAT_TIMER_NUM, BAT_POLLING_PERIOD); 
-    if(getBatVolt() < BAT_LOW_THRES)
-    {
-      shutdownBat(); 
-      return ReturnEvent; 
-    }    
-  }
-  if(ThisEvent.EventType == ES_SW_BUTTON_PRESS && ThisEvent.EventParam == LONG_BT_PRESS)
+  if(ES_Hsm_Dispatch(&mainHsm, ThisEvent) == ES_HSM_TOO_DEEP)
   {
-    memset(&sensorReads,  -1, sizeof(sensorReads)); 
-    lastUpdateTime = 1;  // No time will be shown at wakeup
-    ePaperChangeHdln("Device OFF", NO_SCREEN_REFRESH, NO_MODE);
-    updateEpaperTime(0); 
-    updateScreenSensorVals(&sensorReads, true, false);
-    shutdownIAQ(false); 
-    return ReturnEvent; 
+    ReturnEvent.EventType = ES_ERROR;
   }
-
-  switch (currSMState)
-  {
-    case START_STATE: 
-    {
-      if(ThisEvent.EventType == ES_INIT)
-      {
-        sensorsPwrEnable(true); 
-        uint32_t timerLen; 
-        IAQmode_t currIAQMode = STREAM_MODE; 
-
-        esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
-        if(wakeup_reason == ESP_SLEEP_WAKEUP_TIMER)
-        {
-          currSMState = AUTO_STATE; 
-          timerLen = AUTO_MODE_TIMER_LEN;  // backup timer 
-          currIAQMode = AUTO_MODE;
-
-          ePaperChangeHdln("Reading...", NO_SCREEN_REFRESH, currIAQMode);
-          IAQ_PRINTF("Updating screen 1: %lu\n", lastUpdateTime);
-          updateEpaperTime(lastUpdateTime); 
-          updateScreenSensorVals(&sensorReads, false, false);  // load last sensor data
-        } 
-        else
-        {
-          currSMState = STREAM_STATE; 
-          timerLen = WARMUP_TIMER_LEN;  // polling timer
-          currIAQMode = STREAM_MODE; 
-          ePaperChangeHdln("Warming up...", NO_SCREEN_REFRESH, currIAQMode);
-          IAQ_PRINTF("Updating screen 2: %lu\n", lastUpdateTime);
-          updateEpaperTime(lastUpdateTime); 
-          updateScreenSensorVals(&sensorReads, true, false);
-        }
-
-        changeSensorsIAQMode(currIAQMode); 
-        startSensorsSM(); 
-        ES_TimerReturn_t returnVal = ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, timerLen);  // CO2 sensor has 3 min warmup time
-        IAQ_PRINTF("Going into %s\n", (currIAQMode == STREAM_MODE)? "STREAM MODE" : "AUTO MODE"); 
-        if(returnVal == ES_Timer_ERR)
-        {
-          IAQ_PRINTF("Main timer err\n");
-        }
-      }
-      break;
-    }
-
-    case AUTO_STATE:
-    {
-      if(ThisEvent.EventType == SENSORS_READ_EVENT)  // Wait until have heard back from all sensors
-      {
-        IAQ_PRINTF("All sensors read\n"); 
-        updateCloudSensorVals(&sensorReads);  // update values to be sent to cloud
-        ES_Event_t newEvent = {.EventType=ES_INIT};
-        PostCloudService(newEvent);
-      }
-      else if(ThisEvent.EventType == CLOUD_UPDATED_EVENT)
-      {
-        lastUpdateTime = updateEpaperTime(0);
-        IAQ_PRINTF("Updating screen 3: %lu\n", lastUpdateTime);
-        updateScreenSensorVals(&sensorReads, true, true);
-        shutdownIAQ(true); 
-      } 
-      else if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == MAIN_SERV_TIMER_NUM)
-      {
-        // 1+ sensor or cloud service didn't respond in time
-        IAQ_PRINTF("Main backup timer timedout\n");
-        shutdownIAQ(true); 
-      }
-      else if(ThisEvent.EventType == ES_SW_BUTTON_PRESS && ThisEvent.EventParam == SHORT_BT_PRESS)
-      {
-        IAQ_PRINTF("Changing to stream from auto\n");
-
-        currSMState = STREAM_STATE; 
-        changeSensorsIAQMode(STREAM_MODE); 
-
-        if(sensorReads_flag != 0)
-        {
-          IAQ_PRINTF("Starting stream from beginning\n");
-          ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, WARMUP_TIMER_LEN);
-          startSensorsSM();  // one of the sensors finished, so restart its SM
-        }
-        else
-        {
-          IAQ_PRINTF("Starting stream not from beginning\n");
-          ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, STREAM_MODE_TIMER_LEN);
-        }
-        ePaperChangeHdln("Warming up...", PARTIAL_SCREEN_REFRESH, STREAM_MODE);
-      }
-      break;
-    }
-
-    case STREAM_STATE: 
-    {
-      if(ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == MAIN_SERV_TIMER_NUM)
-      {
-        ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, STREAM_MODE_TIMER_LEN);  // screen update timer for stream
-        // Poll the sensors for their latest values 
-        getPMAvg(&(sensorReads.PM10), &(sensorReads.PM25));
-        getSVM30Avg(&(sensorReads.eCO2), &(sensorReads.tVOC), &(sensorReads.temp), &(sensorReads.rh)); 
-        getCO2Avg(&(sensorReads.CO2));
-
-        if(isTimeSynced())
-        {
-          lastUpdateTime = updateEpaperTime(0);
-          updateScreenSensorVals(&sensorReads, false, true);  
-          if(cloudUpdateCounter % CLOUD_COUNTER_LEN == 0)
-          {
-            updateCloudSensorVals(&sensorReads); 
-            ES_Event_t newEvent = {.EventType=ES_INIT};
-            PostCloudService(newEvent);
-          }
-        }
-        else
-        {
-          IAQ_PRINTF("Time not synced, so connecting to wifi\n");
-          if(cloudUpdateCounter % CLOUD_COUNTER_LEN == 0)
-          {
-            updateCloudSensorVals(&sensorReads); 
-            ES_Event_t newEvent = {.EventType=ES_INIT};
-            PostCloudService(newEvent);
-            currSMState = STREAM_CLOUD_STATE; 
-            ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, WIFI_TIMEOUT_LEN);  // serves as backup timeout timer
-          }else
-          {
-            lastUpdateTime = updateEpaperTime(0);
-            updateScreenSensorVals(&sensorReads, false, true);
-          } 
-        }
-        cloudUpdateCounter++; 
-        if(cloudUpdateCounter % CLOUD_COUNTER_LEN == 0)
-          cloudUpdateCounter = 0; 
-
-      }else if(ThisEvent.EventType == ES_SW_BUTTON_PRESS && ThisEvent.EventParam == SHORT_BT_PRESS)
-      {
-        IAQ_PRINTF("Changing to Auto from stream, partial refresh\n");
-        currSMState = AUTO_STATE; 
-        changeSensorsIAQMode(AUTO_MODE); 
-        ePaperChangeHdln("Reading...", PARTIAL_SCREEN_REFRESH, AUTO_MODE); 
-        ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, AUTO_MODE_TIMER_LEN); 
-      }
-      
-      break;  
-    }
-
-    case STREAM_CLOUD_STATE:
-    {
-      if(ThisEvent.EventType == CLOUD_UPDATED_EVENT || (ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == MAIN_SERV_TIMER_NUM))
-      {
-        IAQ_PRINTF("Updating screen 6\n");
-        lastUpdateTime = updateEpaperTime(0);
-        updateScreenSensorVals(&sensorReads, false, true);
-        currSMState = STREAM_STATE; 
-        ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, STREAM_MODE_TIMER_LEN);
-      }
-      else if(ThisEvent.EventType == ES_SW_BUTTON_PRESS && ThisEvent.EventParam == SHORT_BT_PRESS)
-      {
-        IAQ_PRINTF("Changing to Auto from stream clould state, partial refresh\n");
-        currSMState = AUTO_STATE; 
-        changeSensorsIAQMode(AUTO_MODE); 
-        ePaperChangeHdln("Reading...", PARTIAL_SCREEN_REFRESH, AUTO_MODE); 
-        ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, AUTO_MODE_TIMER_LEN); 
-      }
-      break;
-    }
-  }
-  
   return ReturnEvent;
 }
 
@@ -379,12 +269,15 @@ void updateSVM30Vals(int16_t eCO2_newVal, int16_t tVOC_newVal, int16_t tm_newVal
   setFlagBit(SVM30Idx); 
 } 
 
+// ES_PROBE_SETUP, the sensors have to be powered for their probes
+void powerUpSensors()
+{
+  initPins(); 
+}
+
 bool mainSMinStreamMode()
 {
-  if(currSMState == STREAM_STATE)
-    return true; 
-  else 
-    return false; 
+  return ES_Hsm_GetState(&mainHsm) == STREAM_STATE; 
 }
 
 
@@ -401,7 +294,12 @@ void shutdownIAQ(bool timedShtdwn)
   getCurrTime(str, 20, NULL); 
   IAQ_PRINTF(str); 
 
-  stopHPMMeasurements();  // turns off HPM fan
+  if(ES_IsServicePresent(HPM_SERV_NUM))
+    stopHPMMeasurements();  // turns off HPM fan
+  // CloudService runs in the worker task and may be in the middle of a write,
+  // let it finish before the WiFi goes, but don't hang on a stuck one
+  if(!ES_WaitWorkerIdle(WORKER_STOP_TIME))
+    IAQ_PRINTF("Worker still busy, shutting down anyway\n");
   WiFi.disconnect(true);
   WiFi.mode(WIFI_OFF);
   adc_power_off();
@@ -423,7 +321,7 @@ void setFlagBit(sensorIdx_t sensorBitIdx)
   
   sensorReads_flag |= 0x01 << sensorBitIdx; 
 
-  if(sensorReads_flag == ALL_SENSORS_READ)
+  if(sensorReads_flag == allSensorsRead)
   {
     ES_Timer_StopTimer(MAIN_SERV_TIMER_NUM);
     sensorReads_flag = 0x00; 
@@ -432,20 +330,48 @@ void setFlagBit(sensorIdx_t sensorBitIdx)
   }
 }
 
+// the sensors whose services ES_Initialize found, as bits of sensorIdx_t. A 
+// sensor the unit was built without never reports, so it is left out of the 
+// reads to wait on and its readings stay unknown
+uint8_t getPresentSensors()
+{
+  static const uint8_t sensorServNums[] = {CO2_SERV_NUM, HPM_SERV_NUM, SVM30_SERV_NUM};  // by sensorIdx_t
+  uint8_t present = 0x00; 
+  for(uint8_t i=0; i<ARRAY_SIZE(sensorServNums); i++)
+  {
+    if(ES_IsServicePresent(sensorServNums[i]))
+      present |= 0x01 << i; 
+  }
+
+  if(!(present & (0x01 << HPMIdx)))
+  {
+    sensorReads.PM25 = -1; 
+    sensorReads.PM10 = -1; 
+  }
+  if(!(present & (0x01 << SVM30Idx)))
+  {
+    sensorReads.eCO2 = -1; 
+    sensorReads.tVOC = -1; 
+    sensorReads.temp = -1; 
+    sensorReads.rh = -1; 
+  }
+  return present; 
+}
+
+// the sensor services subscribe to IAQ_MODE_EVENT (ES_SUBSCRIPTIONS), they 
+// get it before any event already waiting in their own queues
 void changeSensorsIAQMode(IAQmode_t currIAQMode)
 {
   sensorReads_flag = 0; 
-  setModeHPM(currIAQMode); 
-  setModeSVM30(currIAQMode); 
-  setModeCO2(currIAQMode); 
+  ES_Event_t NewEvent = {.EventType=IAQ_MODE_EVENT, .EventParam=currIAQMode};
+  ES_PostAll(NewEvent); 
 }
 
+// post list 00 is the sensor services
 void startSensorsSM()
 {
   ES_Event_t NewEvent = {.EventType=ES_READ_SENSOR};
-  PostHPMService(NewEvent); 
-  PostSVM30Service(NewEvent);  // Worst case senario, could hang for 60 secs 
-  PostCO2Service(NewEvent); 
+  ES_PostList00(NewEvent);  // Worst case senario, SVM30 could hang for 60 secs 
 }
 
 void initPins()
@@ -474,6 +400,184 @@ void shutdownBat()
   shutdownIAQ(true);  // check back in periodically
 }
 
+//*********************************
+// MainStates guards and actions
+//*********************************
+static bool isBatLow(ES_Event_t ThisEvent)
+{
+  return ES_Trace_Input(BAT_VOLT_INPUT, getBatVolt()) < BAT_LOW_THRES; 
+}
+
+static void lowBatOff(ES_Event_t ThisEvent)
+{
+  shutdownBat(); 
+}
+
+static void switchOff(ES_Event_t ThisEvent)
+{
+  memset(&sensorReads,  -1, sizeof(sensorReads)); 
+  lastUpdateTime = 1;  // No time will be shown at wakeup
+  ePaperChangeHdln("Device OFF", NO_SCREEN_REFRESH, NO_MODE);
+  updateEpaperTime(0); 
+  updateScreenSensorVals(&sensorReads, true, false);
+  shutdownIAQ(false); 
+}
+
+static void powerSensors(ES_Event_t ThisEvent)
+{
+  sensorsPwrEnable(true); 
+}
+
+static bool isTimerWakeup(ES_Event_t ThisEvent)
+{
+  return ES_Trace_Input(WAKE_CAUSE_INPUT, esp_sleep_get_wakeup_cause()) == ESP_SLEEP_WAKEUP_TIMER; 
+}
+
+static void startAuto(ES_Event_t ThisEvent)
+{
+  ePaperChangeHdln("Reading...", NO_SCREEN_REFRESH, AUTO_MODE);
+  IAQ_PRINTF("Updating screen 1: %lu\n", lastUpdateTime);
+  updateEpaperTime(lastUpdateTime); 
+  updateScreenSensorVals(&sensorReads, false, false);  // load last sensor data
+  startReadings(AUTO_MODE, AUTO_MODE_TIMER_LEN);  // backup timer 
+}
+
+static void startStream(ES_Event_t ThisEvent)
+{
+  ePaperChangeHdln("Warming up...", NO_SCREEN_REFRESH, STREAM_MODE);
+  IAQ_PRINTF("Updating screen 2: %lu\n", lastUpdateTime);
+  updateEpaperTime(lastUpdateTime); 
+  updateScreenSensorVals(&sensorReads, true, false);
+  startReadings(STREAM_MODE, WARMUP_TIMER_LEN);  // polling timer
+}
+
+static void startReadings(IAQmode_t currIAQMode, uint32_t timerLen)
+{
+  changeSensorsIAQMode(currIAQMode); 
+  startSensorsSM(); 
+  ES_TimerReturn_t returnVal = ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, timerLen);  // CO2 sensor has 3 min warmup time
+  IAQ_PRINTF("Going into %s\n", (currIAQMode == STREAM_MODE)? "STREAM MODE" : "AUTO MODE"); 
+  if(returnVal == ES_Timer_ERR)
+  {
+    IAQ_PRINTF("Main timer err\n");
+  }
+}
+
+// Wait until have heard back from all sensors
+static void sendReadings(ES_Event_t ThisEvent)
+{
+  IAQ_PRINTF("All sensors read\n"); 
+  updateCloudSensorVals(&sensorReads);  // update values to be sent to cloud
+  ES_Event_t newEvent = {.EventType=ES_INIT};
+  PostCloudService(newEvent);
+}
+
+static void showReadingsAndSleep(ES_Event_t ThisEvent)
+{
+  lastUpdateTime = updateEpaperTime(0);
+  IAQ_PRINTF("Updating screen 3: %lu\n", lastUpdateTime);
+  updateScreenSensorVals(&sensorReads, true, true);
+  shutdownIAQ(true); 
+}
+
+// 1+ sensor or cloud service didn't respond in time
+static void backupTimedOut(ES_Event_t ThisEvent)
+{
+  IAQ_PRINTF("Main backup timer timedout\n");
+  shutdownIAQ(true); 
+}
+
+static void autoToStream(ES_Event_t ThisEvent)
+{
+  IAQ_PRINTF("Changing to stream from auto\n");
+  changeSensorsIAQMode(STREAM_MODE); 
+
+  if(sensorReads_flag != 0)
+  {
+    IAQ_PRINTF("Starting stream from beginning\n");
+    ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, WARMUP_TIMER_LEN);
+    startSensorsSM();  // one of the sensors finished, so restart its SM
+  }
+  else
+  {
+    IAQ_PRINTF("Starting stream not from beginning\n");
+    ES_Timer_InitPeriodic(MAIN_SERV_TIMER_NUM, STREAM_MODE_TIMER_LEN);
+  }
+  ePaperChangeHdln("Warming up...", PARTIAL_SCREEN_REFRESH, STREAM_MODE);
+}
+
+// from either stream state
+static void streamToAuto(ES_Event_t ThisEvent)
+{
+  IAQ_PRINTF("Changing to Auto from stream, partial refresh\n");
+  changeSensorsIAQMode(AUTO_MODE); 
+  ePaperChangeHdln("Reading...", PARTIAL_SCREEN_REFRESH, AUTO_MODE); 
+  ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, AUTO_MODE_TIMER_LEN); 
+}
+
+// the screen can't show the time until wifi has synced it
+static bool needsTimeSync(ES_Event_t ThisEvent)
+{
+  return !ES_Trace_Input(TIME_SYNCED_INPUT, isTimeSynced()) && cloudUpdateCounter % CLOUD_COUNTER_LEN == 0; 
+}
+
+static void syncCloud(ES_Event_t ThisEvent)
+{
+  pollSensors(); 
+  IAQ_PRINTF("Time not synced, so connecting to wifi\n");
+  updateCloudSensorVals(&sensorReads); 
+  ES_Event_t newEvent = {.EventType=ES_INIT};
+  PostCloudService(newEvent);
+  countStreamUpdate(); 
+}
+
+static void updateStream(ES_Event_t ThisEvent)
+{
+  pollSensors(); 
+  if(!isTimeSynced())
+    IAQ_PRINTF("Time not synced, so connecting to wifi\n");
+  lastUpdateTime = updateEpaperTime(0);
+  updateScreenSensorVals(&sensorReads, false, true);  
+  if(ES_Trace_Input(TIME_SYNCED_INPUT, isTimeSynced()) && cloudUpdateCounter % CLOUD_COUNTER_LEN == 0)
+  {
+    updateCloudSensorVals(&sensorReads); 
+    ES_Event_t newEvent = {.EventType=ES_INIT};
+    PostCloudService(newEvent);
+  }
+  countStreamUpdate(); 
+}
+
+static void startWifiTimeout(ES_Event_t ThisEvent)
+{
+  ES_Timer_InitTimer(MAIN_SERV_TIMER_NUM, WIFI_TIMEOUT_LEN);  // serves as backup timeout timer
+}
+
+static void endCloudSync(ES_Event_t ThisEvent)
+{
+  IAQ_PRINTF("Updating screen 6\n");
+  lastUpdateTime = updateEpaperTime(0);
+  updateScreenSensorVals(&sensorReads, false, true);
+  ES_Timer_InitPeriodic(MAIN_SERV_TIMER_NUM, STREAM_MODE_TIMER_LEN);
+}
+
+// Poll the sensors for their latest values 
+static void pollSensors(void)
+{
+  // screen update timer for stream, periodic from the first update after warmup
+  if(ES_Timer_IsRunning(MAIN_SERV_TIMER_NUM) != ES_Timer_ACTIVE)
+    ES_Timer_InitPeriodic(MAIN_SERV_TIMER_NUM, STREAM_MODE_TIMER_LEN);
+  getPMAvg(&(sensorReads.PM10), &(sensorReads.PM25));
+  getSVM30Avg(&(sensorReads.eCO2), &(sensorReads.tVOC), &(sensorReads.temp), &(sensorReads.rh)); 
+  getCO2Avg(&(sensorReads.CO2));
+}
+
+static void countStreamUpdate(void)
+{
+  cloudUpdateCounter++; 
+  if(cloudUpdateCounter % CLOUD_COUNTER_LEN == 0)
+    cloudUpdateCounter = 0; 
+}
+
 /*------------------------------- Footnotes -------------------------------*/
 /*------------------------------ End of file ------------------------------*/
 
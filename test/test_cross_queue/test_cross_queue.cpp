@@ -0,0 +1,232 @@
+/****************************************************************************
+ Module
+   test_cross_queue.cpp
+
+ Description
+   Unit tests of the rings between the loop and the worker (ES_CrossQueue.h)
+   and of the posts that go through them: a ring hands events over in the
+   order they were pushed, also while another thread pops, and the events
+   the loop posts to the worker service, and the ones it posts back, are
+   run in the order they were posted
+
+ Notes
+   pio test -e native_test -f test_cross_queue
+   The round trip keeps CROSS_WINDOW events in flight like the benchmark's
+   cross phase. The worker service's hook can't assert, so both sides
+   count the events that came out of order and the test checks the counts
+****************************************************************************/
+#include <unity.h>
+#include "ES_framework.h"
+#include "ES_CrossQueue.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define CROSS_RING_SIZE 4
+#define CROSS_NUM_THREAD 100000   // events the producer thread pushes
+#define CROSS_NUM_TRIP 1000       // events sent to the worker and back
+#define CROSS_WINDOW 4            // fits in the low service's queue
+
+static ES_CrossSlot_t RingSlots[CROSS_RING_SIZE];
+static ES_CrossQueue_t Ring = {0, 0, CROSS_RING_SIZE, RingSlots};
+
+// round trip, the next sequence numbers each side sends and expects. Only
+// the worker's hook touches WorkerNext and WorkerOutOfOrder until it's over
+static uint16_t LoopNextSent;
+static uint16_t LoopNextBack;
+static uint32_t LoopOutOfOrder;
+static uint16_t WorkerNext;
+static uint32_t WorkerOutOfOrder;
+
+static ES_Event_t MakeEvent(uint16_t EventParam);
+static void *PushThread(void *Arg);
+static void SendBack(ES_Event_t ThisEvent);
+static void SendNext(ES_Event_t ThisEvent);
+
+void setUp(void)
+{
+  TestService_Reset();
+  TEST_ASSERT_EQUAL(Success, ES_Initialize(ES_Timer_RATE_1mS));
+  ES_CrossQueue_Init(&Ring);
+  LoopNextSent = 0;
+  LoopNextBack = 0;
+  LoopOutOfOrder = 0;
+  WorkerNext = 0;
+  WorkerOutOfOrder = 0;
+}
+
+void tearDown(void)
+{
+  ES_WaitWorkerIdle(1000);
+}
+
+void test_ring_pops_in_push_order(void)
+{
+  ES_Event_t pushed;
+  ES_Event_t popped;
+  bool multicast;
+  TEST_ASSERT_TRUE(ES_CrossQueue_IsEmpty(&Ring));
+  TEST_ASSERT_FALSE(ES_CrossQueue_Pop(&Ring, &popped, &multicast));
+
+  // around the ring a few times, so the slots wrap
+  uint16_t nextPushed = 0;
+  uint16_t nextPopped = 0;
+  for(uint8_t round = 0; round < 3 * CROSS_RING_SIZE; round++)
+  {
+    for(pushed = MakeEvent(nextPushed); ES_CrossQueue_Push(&Ring, &pushed, nextPushed & 1); )
+    {
+      pushed = MakeEvent(++nextPushed);
+    }
+    TEST_ASSERT_EQUAL_UINT16(nextPopped + CROSS_RING_SIZE, nextPushed);   // full
+    for(uint8_t i = 0; i < 3; i++)
+    {
+      TEST_ASSERT_TRUE(ES_CrossQueue_Pop(&Ring, &popped, &multicast));
+      TEST_ASSERT_EQUAL_UINT16(nextPopped, popped.EventParam);
+      TEST_ASSERT_EQUAL(nextPopped & 1, multicast);
+      nextPopped++;
+    }
+  }
+  while(ES_CrossQueue_Pop(&Ring, &popped, &multicast))
+  {
+    TEST_ASSERT_EQUAL_UINT16(nextPopped++, popped.EventParam);
+  }
+  TEST_ASSERT_EQUAL_UINT16(nextPushed, nextPopped);
+  TEST_ASSERT_TRUE(ES_CrossQueue_IsEmpty(&Ring));
+}
+
+void test_ring_across_counter_wrap(void)
+{
+  // Head and Tail count up freely, so they wrap at some point
+  Ring.Head = UINT32_MAX - 1;
+  Ring.Tail = UINT32_MAX - 1;
+  ES_Event_t ThisEvent;
+  bool multicast;
+  for(uint16_t i = 0; i < CROSS_RING_SIZE; i++)
+  {
+    ThisEvent = MakeEvent(i);
+    TEST_ASSERT_TRUE(ES_CrossQueue_Push(&Ring, &ThisEvent, false));
+  }
+  ThisEvent = MakeEvent(9);
+  TEST_ASSERT_FALSE(ES_CrossQueue_Push(&Ring, &ThisEvent, false));
+  for(uint16_t i = 0; i < CROSS_RING_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(ES_CrossQueue_Pop(&Ring, &ThisEvent, &multicast));
+    TEST_ASSERT_EQUAL_UINT16(i, ThisEvent.EventParam);
+  }
+  TEST_ASSERT_TRUE(ES_CrossQueue_IsEmpty(&Ring));
+}
+
+void test_ring_in_order_between_threads(void)
+{
+  pthread_t producer;
+  TEST_ASSERT_EQUAL(0, pthread_create(&producer, NULL, PushThread, NULL));
+
+  ES_Event_t popped;
+  bool multicast;
+  uint32_t outOfOrder = 0;
+  for(uint32_t next = 0; next < CROSS_NUM_THREAD; )
+  {
+    if(ES_CrossQueue_Pop(&Ring, &popped, &multicast))
+    {
+      if(popped.EventParam != (uint16_t)next)
+        outOfOrder++;
+      next++;
+    }
+    else
+    {
+      sched_yield();   // the producer may share the CPU
+    }
+  }
+  pthread_join(producer, NULL);
+  TEST_ASSERT_EQUAL_UINT32(0, outOfOrder);
+  TEST_ASSERT_TRUE(ES_CrossQueue_IsEmpty(&Ring));
+}
+
+void test_posts_to_worker_run_in_order(void)
+{
+  for(uint16_t i = 0; i < SERV_2_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(PostTestWorkerService(MakeEvent(i)));
+  }
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT32(SERV_2_QUEUE_SIZE, TestService_GetNumDispatches());
+  for(uint16_t i = 0; i < SERV_2_QUEUE_SIZE; i++)
+  {
+    TestDispatch_t dispatch = TestService_GetDispatch(i);
+    TEST_ASSERT_EQUAL_UINT8(TEST_WORKER_SERV_NUM, dispatch.ServiceNum);
+    TEST_ASSERT_EQUAL_UINT16(i, dispatch.EventParam);
+  }
+}
+
+void test_round_trip_through_worker_in_order(void)
+{
+  // the worker sends each event back to the low service, which sends the
+  // next one until CROSS_NUM_TRIP have been
+  TestService_SetHook(TEST_WORKER_SERV_NUM, SendBack);
+  TestService_SetHook(TEST_LOW_SERV_NUM, SendNext);
+  for(uint8_t i = 0; i < CROSS_WINDOW; i++)
+  {
+    TEST_ASSERT_TRUE(PostTestWorkerService(MakeEvent(LoopNextSent++)));
+  }
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT32(2 * CROSS_NUM_TRIP, TestService_GetNumDispatches());
+  TEST_ASSERT_EQUAL_UINT16(CROSS_NUM_TRIP, WorkerNext);
+  TEST_ASSERT_EQUAL_UINT16(CROSS_NUM_TRIP, LoopNextBack);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, WorkerOutOfOrder, "out of order at the worker");
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, LoopOutOfOrder, "out of order back at the loop");
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ring_pops_in_push_order);
+  RUN_TEST(test_ring_across_counter_wrap);
+  RUN_TEST(test_ring_in_order_between_threads);
+  RUN_TEST(test_posts_to_worker_run_in_order);
+  RUN_TEST(test_round_trip_through_worker_in_order);
+  return UNITY_END();
+}
+
+static ES_Event_t MakeEvent(uint16_t EventParam)
+{
+  ES_Event_t ThisEvent = {};
+  ThisEvent.EventType = TEST_A;
+  ThisEvent.EventParam = EventParam;
+  return ThisEvent;
+}
+
+// the producer side of test_ring_in_order_between_threads, yields while
+// the ring is full
+static void *PushThread(void *Arg)
+{
+  for(uint32_t i = 0; i < CROSS_NUM_THREAD; )
+  {
+    ES_Event_t ThisEvent = MakeEvent((uint16_t)i);
+    if(ES_CrossQueue_Push(&Ring, &ThisEvent, false))
+      i++;
+    else
+      sched_yield();
+  }
+  return NULL;
+}
+
+// the worker service's hook, runs in the worker thread
+static void SendBack(ES_Event_t ThisEvent)
+{
+  if(ThisEvent.EventParam != WorkerNext)
+    WorkerOutOfOrder++;
+  WorkerNext++;
+  PostTestLowService(ThisEvent);
+}
+
+static void SendNext(ES_Event_t ThisEvent)
+{
+  if(ThisEvent.EventParam != LoopNextBack)
+    LoopOutOfOrder++;
+  LoopNextBack++;
+  if(LoopNextSent < CROSS_NUM_TRIP)
+  {
+    PostTestWorkerService(MakeEvent(LoopNextSent++));
+  }
+}
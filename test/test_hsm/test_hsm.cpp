@@ -0,0 +1,289 @@
+/****************************************************************************
+ Module
+   test_hsm.cpp
+
+ Description
+   Unit tests of the table driven state machines (ES_Hsm.c). A small
+   machine, TOP holding A and B and A holding A1 and A2, is started in a
+   state and handed one event, and each test checks which exit, transition
+   and entry actions ran in what order, where the machine ended up and
+   whether ES_Hsm_Dispatch took the event. A chain of states one deeper
+   than ES_HSM_MAX_DEPTH checks that a state too deep to enter fails
+   without running any action
+
+ Notes
+   pio test -e native_test -f test_hsm
+   The log spells out the actions: -n for the exit action of state n, *
+   for the transition's action, +n for the entry action of state n
+****************************************************************************/
+#include <unity.h>
+#include "ES_framework.h"
+#include "ES_Hsm.h"
+#include <stdio.h>
+#include <string.h>
+
+// The test machine's states, TOP holds A and B, A holds A1 and A2
+typedef enum
+{
+  HSM_TOP,
+  HSM_A,
+  HSM_A1,
+  HSM_A2,
+  HSM_B
+}HsmTestState_t;
+
+static void LogHsmEntry(ES_Event_t ThisEvent);
+static void LogHsmExit(ES_Event_t ThisEvent);
+static void LogHsmAction(ES_Event_t ThisEvent);
+static bool HsmGuardFails(ES_Event_t ThisEvent);
+static void StartIn(HsmTestState_t State);
+static void ExpectDispatch(ES_EventType_t EventType, uint16_t EventParam, ES_HsmResult_t Result,
+    const char *Actions, HsmTestState_t State);
+static void CountDeepAction(ES_Event_t ThisEvent);
+
+static constexpr ES_HsmTransition_t HsmTopTransitions[] = {
+  // event     target       param             guard          action
+  {ES_TIMEOUT, HSM_A1,      5,                NULL,          LogHsmAction},  // into a substate from the top
+  {ES_SUCCESS, ES_HSM_NONE, ES_HSM_ANY_PARAM, NULL,          LogHsmAction}   // internal
+};
+static constexpr ES_HsmTransition_t HsmATransitions[] = {
+  {ES_FAIL,    HSM_B,       1,                NULL,          LogHsmAction},
+  {ES_FAIL,    HSM_A,       2,                NULL,          LogHsmAction}   // to itself from a substate
+};
+static constexpr ES_HsmTransition_t HsmA1Transitions[] = {
+  {ES_FAIL,    HSM_A1,      1,                HsmGuardFails, LogHsmAction},  // A's is taken instead
+  {ES_FAIL,    HSM_A2,      3,                NULL,          LogHsmAction},  // to a sibling
+  {ES_FAIL,    HSM_A,       4,                NULL,          LogHsmAction}   // to its parent
+};
+static constexpr ES_HsmTransition_t HsmA2Transitions[] = {
+  {ES_FAIL,    HSM_A2,      5,                NULL,          LogHsmAction}   // self
+};
+static constexpr ES_HsmTransition_t HsmBTransitions[] = {
+  {ES_FAIL,    HSM_B,       6,                NULL,          LogHsmAction}   // self
+};
+
+static constexpr ES_HsmState_t HsmTestStates[] = {
+  // parent      transitions                              entry        exit
+  {ES_HSM_NONE,  ES_HSM_TRANSITIONS(HsmTopTransitions),   LogHsmEntry, LogHsmExit},  // HSM_TOP
+  {HSM_TOP,      ES_HSM_TRANSITIONS(HsmATransitions),     LogHsmEntry, LogHsmExit},  // HSM_A
+  {HSM_A,        ES_HSM_TRANSITIONS(HsmA1Transitions),    LogHsmEntry, LogHsmExit},  // HSM_A1
+  {HSM_A,        ES_HSM_TRANSITIONS(HsmA2Transitions),    LogHsmEntry, LogHsmExit},  // HSM_A2
+  {HSM_TOP,      ES_HSM_TRANSITIONS(HsmBTransitions),     LogHsmEntry, LogHsmExit}   // HSM_B
+};
+ES_HSM_CHECK(HsmTestStates);
+
+static ES_Hsm_t HsmTest;
+static char HsmLog[32];   // what the actions ran, see the notes above
+
+// A chain of states each inside the one before, the last one too deep for
+// ES_HSM_CHECK. The top takes ES_FAIL to the last state, which has to
+// enter the whole chain, and the one before it takes it to the last state
+// as its substate, which only leaves and enters the one before again
+#define DEEP_NUM_STATES (ES_HSM_MAX_DEPTH + 1)
+#define DEEP_LAST (DEEP_NUM_STATES - 1)
+static constexpr ES_HsmTransition_t DeepTopTransitions[] = {
+  {ES_FAIL,    DEEP_LAST,   1,                NULL,          CountDeepAction}
+};
+static constexpr ES_HsmTransition_t DeepInnerTransitions[] = {
+  {ES_FAIL,    DEEP_LAST,   2,                NULL,          CountDeepAction}
+};
+static constexpr ES_HsmState_t DeepStates[DEEP_NUM_STATES] = {
+  {ES_HSM_NONE, ES_HSM_TRANSITIONS(DeepTopTransitions), CountDeepAction, CountDeepAction},
+  {0, 0, NULL, CountDeepAction, CountDeepAction},
+  {1, 0, NULL, CountDeepAction, CountDeepAction},
+  {2, 0, NULL, CountDeepAction, CountDeepAction},
+  {3, 0, NULL, CountDeepAction, CountDeepAction},
+  {4, 0, NULL, CountDeepAction, CountDeepAction},
+  {5, 0, NULL, CountDeepAction, CountDeepAction},
+  {6, ES_HSM_TRANSITIONS(DeepInnerTransitions), CountDeepAction, CountDeepAction},
+  {7, 0, NULL, CountDeepAction, CountDeepAction}
+};
+static_assert(ES_HSM_MAX_DEPTH == 8, "DeepStates is written out for a depth of 8");
+static_assert(!ES_Hsm_StatesValid(DeepStates, DEEP_NUM_STATES), "ES_HSM_CHECK rejects DeepStates");
+
+static ES_Hsm_t HsmDeep;
+static uint8_t DeepActions;   // every entry, exit and transition action counts
+
+void setUp(void)
+{
+  HsmLog[0] = '\0';
+  DeepActions = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_start_enters_every_parent(void)
+{
+  ES_Event_t ThisEvent = {.EventType = ES_INIT};
+  TEST_ASSERT_TRUE(ES_Hsm_Start(&HsmTest, HsmTestStates, HSM_A1, ThisEvent));
+  TEST_ASSERT_EQUAL_STRING("+0+1+2", HsmLog);
+  TEST_ASSERT_EQUAL_UINT8(HSM_A1, ES_Hsm_GetState(&HsmTest));
+  TEST_ASSERT_TRUE(ES_Hsm_IsIn(&HsmTest, HSM_TOP));
+  TEST_ASSERT_TRUE(ES_Hsm_IsIn(&HsmTest, HSM_A));
+  TEST_ASSERT_FALSE(ES_Hsm_IsIn(&HsmTest, HSM_B));
+}
+
+void test_transition_to_sibling(void)
+{
+  StartIn(HSM_A1);
+  ExpectDispatch(ES_FAIL, 3, ES_HSM_TAKEN, "-2*+3", HSM_A2);
+}
+
+void test_self_transition_reenters(void)
+{
+  StartIn(HSM_A2);
+  ExpectDispatch(ES_FAIL, 5, ES_HSM_TAKEN, "-3*+3", HSM_A2);
+}
+
+void test_parent_transition_to_itself_from_substate(void)
+{
+  StartIn(HSM_A2);
+  ExpectDispatch(ES_FAIL, 2, ES_HSM_TAKEN, "-3-1*+1", HSM_A);
+}
+
+void test_wrong_param_not_taken(void)
+{
+  StartIn(HSM_A);
+  ExpectDispatch(ES_TIMEOUT, 6, ES_HSM_NOT_TAKEN, "", HSM_A);
+}
+
+void test_top_transition_down_two_levels(void)
+{
+  StartIn(HSM_A);
+  ExpectDispatch(ES_TIMEOUT, 5, ES_HSM_TAKEN, "-1-0*+0+1+2", HSM_A1);
+}
+
+void test_transition_to_parent_reenters_it(void)
+{
+  StartIn(HSM_A1);
+  ExpectDispatch(ES_FAIL, 4, ES_HSM_TAKEN, "-2-1*+1", HSM_A);
+}
+
+void test_failed_guard_falls_through_to_parent(void)
+{
+  StartIn(HSM_A1);
+  ExpectDispatch(ES_FAIL, 1, ES_HSM_TAKEN, "-2-1*+4", HSM_B);
+}
+
+void test_self_transition_of_top_level_substate(void)
+{
+  StartIn(HSM_B);
+  ExpectDispatch(ES_FAIL, 6, ES_HSM_TAKEN, "-4*+4", HSM_B);
+}
+
+void test_internal_transition_any_param(void)
+{
+  StartIn(HSM_B);
+  ExpectDispatch(ES_SUCCESS, 123, ES_HSM_TAKEN, "*", HSM_B);
+}
+
+void test_unhandled_event_not_taken(void)
+{
+  // A's transition for it doesn't apply in B, nor does TOP have one
+  StartIn(HSM_B);
+  ExpectDispatch(ES_FAIL, 4, ES_HSM_NOT_TAKEN, "", HSM_B);
+}
+
+void test_start_fails_if_too_deep(void)
+{
+  ES_Event_t ThisEvent = {.EventType = ES_INIT};
+  TEST_ASSERT_FALSE(ES_Hsm_Start(&HsmDeep, DeepStates, DEEP_LAST, ThisEvent));
+  TEST_ASSERT_EQUAL_UINT8(0, DeepActions);
+  TEST_ASSERT_EQUAL_UINT8(ES_HSM_NONE, ES_Hsm_GetState(&HsmDeep));
+
+  // the deepest state that fits is fine
+  TEST_ASSERT_TRUE(ES_Hsm_Start(&HsmDeep, DeepStates, DEEP_LAST - 1, ThisEvent));
+  TEST_ASSERT_EQUAL_UINT8(ES_HSM_MAX_DEPTH, DeepActions);
+  TEST_ASSERT_EQUAL_UINT8(DEEP_LAST - 1, ES_Hsm_GetState(&HsmDeep));
+}
+
+void test_dispatch_too_deep_runs_nothing(void)
+{
+  ES_Event_t ThisEvent = {.EventType = ES_INIT};
+  TEST_ASSERT_TRUE(ES_Hsm_Start(&HsmDeep, DeepStates, DEEP_LAST - 1, ThisEvent));
+  DeepActions = 0;
+
+  // from the top the whole chain would have to be entered again
+  ThisEvent.EventType = ES_FAIL;
+  ThisEvent.EventParam = 1;
+  TEST_ASSERT_EQUAL(ES_HSM_TOO_DEEP, ES_Hsm_Dispatch(&HsmDeep, ThisEvent));
+  TEST_ASSERT_EQUAL_UINT8(0, DeepActions);
+  TEST_ASSERT_EQUAL_UINT8(DEEP_LAST - 1, ES_Hsm_GetState(&HsmDeep));
+
+  // into the same state as a substate only two states are entered
+  ThisEvent.EventParam = 2;
+  TEST_ASSERT_EQUAL(ES_HSM_TAKEN, ES_Hsm_Dispatch(&HsmDeep, ThisEvent));
+  TEST_ASSERT_EQUAL_UINT8(4, DeepActions);   // an exit, the action and two entries
+  TEST_ASSERT_EQUAL_UINT8(DEEP_LAST, ES_Hsm_GetState(&HsmDeep));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_start_enters_every_parent);
+  RUN_TEST(test_transition_to_sibling);
+  RUN_TEST(test_self_transition_reenters);
+  RUN_TEST(test_parent_transition_to_itself_from_substate);
+  RUN_TEST(test_wrong_param_not_taken);
+  RUN_TEST(test_top_transition_down_two_levels);
+  RUN_TEST(test_transition_to_parent_reenters_it);
+  RUN_TEST(test_failed_guard_falls_through_to_parent);
+  RUN_TEST(test_self_transition_of_top_level_substate);
+  RUN_TEST(test_internal_transition_any_param);
+  RUN_TEST(test_unhandled_event_not_taken);
+  RUN_TEST(test_start_fails_if_too_deep);
+  RUN_TEST(test_dispatch_too_deep_runs_nothing);
+  return UNITY_END();
+}
+
+// starts the machine in State and clears the log of its entry actions
+static void StartIn(HsmTestState_t State)
+{
+  ES_Event_t ThisEvent = {.EventType = ES_INIT};
+  TEST_ASSERT_TRUE(ES_Hsm_Start(&HsmTest, HsmTestStates, State, ThisEvent));
+  TEST_ASSERT_EQUAL_UINT8(State, ES_Hsm_GetState(&HsmTest));
+  HsmLog[0] = '\0';
+}
+
+// dispatches one event and checks what it did
+static void ExpectDispatch(ES_EventType_t EventType, uint16_t EventParam, ES_HsmResult_t Result,
+    const char *Actions, HsmTestState_t State)
+{
+  ES_Event_t ThisEvent = {};
+  ThisEvent.EventType = EventType;
+  ThisEvent.EventParam = EventParam;
+  TEST_ASSERT_EQUAL_MESSAGE(Result, ES_Hsm_Dispatch(&HsmTest, ThisEvent), "result");
+  TEST_ASSERT_EQUAL_STRING_MESSAGE(Actions, HsmLog, "actions");
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(State, ES_Hsm_GetState(&HsmTest), "state");
+}
+
+// the entry action runs with Current already the state being entered
+static void LogHsmEntry(ES_Event_t ThisEvent)
+{
+  size_t len = strlen(HsmLog);
+  snprintf(HsmLog + len, sizeof(HsmLog) - len, "+%u", ES_Hsm_GetState(&HsmTest));
+}
+
+// and the exit action with Current still the state being left
+static void LogHsmExit(ES_Event_t ThisEvent)
+{
+  size_t len = strlen(HsmLog);
+  snprintf(HsmLog + len, sizeof(HsmLog) - len, "-%u", ES_Hsm_GetState(&HsmTest));
+}
+
+static void LogHsmAction(ES_Event_t ThisEvent)
+{
+  strncat(HsmLog, "*", sizeof(HsmLog) - strlen(HsmLog) - 1);
+}
+
+static bool HsmGuardFails(ES_Event_t ThisEvent)
+{
+  return false;
+}
+
+static void CountDeepAction(ES_Event_t ThisEvent)
+{
+  DeepActions++;
+}
@@ -0,0 +1,197 @@
+/****************************************************************************
+ Module
+   test_multicast.cpp
+
+ Description
+   Unit tests of multicast posts (ES_PostList.c, ES_DispatchMulticast and
+   ES_MulticastIsNext in ES_framework.c): the services on a list get the
+   event highest priority first, the event has the priority of the highest
+   service on its list when ES_Run picks between it and the unicast posts,
+   and a failed multicast post releases its payload
+
+ Notes
+   pio test -e native_test -f test_multicast
+   Only the loop's services are checked for order, the worker service runs
+   its copy whenever the worker thread gets to it
+****************************************************************************/
+#include <unity.h>
+#include "ES_framework.h"
+
+// a dispatch the log should have, in order
+typedef struct
+{
+  uint8_t ServiceNum;
+  uint16_t EventParam;
+}Expected_t;
+
+static ES_Event_t MakeEvent(ES_EventType_t EventType, uint16_t EventParam);
+static void ExpectDispatches(const Expected_t *Expected, uint8_t Num);
+static void PostListFromWorker(ES_Event_t ThisEvent);
+
+void setUp(void)
+{
+  TestService_Reset();
+  TEST_ASSERT_EQUAL(Success, ES_Initialize(ES_Timer_RATE_1mS));
+}
+
+void tearDown(void)
+{
+  ES_WaitWorkerIdle(1000);
+}
+
+void test_list_delivered_in_priority_order(void)
+{
+  TEST_ASSERT_TRUE(ES_PostList00(MakeEvent(TEST_A, 1)));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  const Expected_t expected[] = {{TEST_HIGH_SERV_NUM, 1}, {TEST_LOW_SERV_NUM, 1}};
+  ExpectDispatches(expected, 2);
+}
+
+void test_multicasts_keep_their_order(void)
+{
+  ES_PostList00(MakeEvent(TEST_A, 1));
+  ES_PostList01(MakeEvent(TEST_A, 2));
+  ES_PostList00(MakeEvent(TEST_A, 3));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  const Expected_t expected[] = {
+    {TEST_HIGH_SERV_NUM, 1}, {TEST_LOW_SERV_NUM, 1},
+    {TEST_LOW_SERV_NUM, 2},
+    {TEST_HIGH_SERV_NUM, 3}, {TEST_LOW_SERV_NUM, 3}
+  };
+  ExpectDispatches(expected, 5);
+}
+
+void test_multicast_ahead_of_its_services_queued_events(void)
+{
+  // the list's highest service is the high one, so the multicast goes before
+  // everything queued for the high service and the low one
+  PostTestLowService(MakeEvent(TEST_A, 1));
+  ES_PostList00(MakeEvent(TEST_A, 2));
+  PostTestHighService(MakeEvent(TEST_A, 3));
+  PostTestLowService(MakeEvent(TEST_A, 4));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  const Expected_t expected[] = {
+    {TEST_HIGH_SERV_NUM, 2}, {TEST_LOW_SERV_NUM, 2},
+    {TEST_HIGH_SERV_NUM, 3},
+    {TEST_LOW_SERV_NUM, 1}, {TEST_LOW_SERV_NUM, 4}
+  };
+  ExpectDispatches(expected, 5);
+}
+
+void test_multicast_waits_for_higher_service(void)
+{
+  // a list of only the low service doesn't hold up the high one
+  PostTestHighService(MakeEvent(TEST_A, 1));
+  ES_PostList01(MakeEvent(TEST_A, 2));
+  PostTestLowService(MakeEvent(TEST_A, 3));
+  PostTestHighService(MakeEvent(TEST_A, 4));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  const Expected_t expected[] = {
+    {TEST_HIGH_SERV_NUM, 1}, {TEST_HIGH_SERV_NUM, 4},
+    {TEST_LOW_SERV_NUM, 2}, {TEST_LOW_SERV_NUM, 3}
+  };
+  ExpectDispatches(expected, 4);
+}
+
+void test_post_all_goes_to_subscribers(void)
+{
+  TEST_ASSERT_TRUE(ES_PostAll(MakeEvent(TEST_B, 1)));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  const Expected_t expected[] = {{TEST_HIGH_SERV_NUM, 1}};
+  ExpectDispatches(expected, 1);
+}
+
+void test_post_all_without_subscribers_goes_to_every_service(void)
+{
+  TEST_ASSERT_TRUE(ES_PostAll(MakeEvent(TEST_A, 1)));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT32(NUM_SERVICES, TestService_GetNumDispatches());
+  uint8_t services = 0;
+  for(uint8_t i = 0; i < NUM_SERVICES; i++)
+  {
+    services |= 1U << TestService_GetDispatch(i).ServiceNum;
+  }
+  TEST_ASSERT_EQUAL_UINT8((1U << NUM_SERVICES) - 1, services);
+}
+
+void test_multicast_from_worker(void)
+{
+  // the worker's post goes through ToLoop and is dispatched by the loop
+  TestService_SetHook(TEST_WORKER_SERV_NUM, PostListFromWorker);
+  PostTestWorkerService(MakeEvent(TEST_A, 1));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  const Expected_t expected[] = {
+    {TEST_WORKER_SERV_NUM, 1},
+    {TEST_HIGH_SERV_NUM, 2}, {TEST_LOW_SERV_NUM, 2}
+  };
+  ExpectDispatches(expected, 3);
+}
+
+void test_failed_multicast_releases_payload(void)
+{
+  for(uint8_t i = 0; i < ES_MULTICAST_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(ES_PostList00(MakeEvent(TEST_A, i)));
+  }
+  ES_Event_t ThisEvent = MakeEvent(TEST_A, ES_MULTICAST_QUEUE_SIZE);
+  ThisEvent.Payload = ES_Payload_Alloc();
+  TEST_ASSERT_FALSE(ES_PostList00(ThisEvent));
+
+  ES_PayloadStats_t payloads;
+  ES_Payload_GetStats(&payloads);
+  TEST_ASSERT_EQUAL_UINT8(0, payloads.InUse);
+  ES_QueueStats_t stats;
+  TEST_ASSERT_TRUE(ES_GetQueueStats(ES_QUEUE_MULTICAST, &stats));
+  TEST_ASSERT_EQUAL_UINT32(1, stats.Rejected);
+
+  // the ones that got in are still delivered
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+  TEST_ASSERT_EQUAL_UINT32(2 * ES_MULTICAST_QUEUE_SIZE, TestService_GetNumDispatches());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_list_delivered_in_priority_order);
+  RUN_TEST(test_multicasts_keep_their_order);
+  RUN_TEST(test_multicast_ahead_of_its_services_queued_events);
+  RUN_TEST(test_multicast_waits_for_higher_service);
+  RUN_TEST(test_post_all_goes_to_subscribers);
+  RUN_TEST(test_post_all_without_subscribers_goes_to_every_service);
+  RUN_TEST(test_multicast_from_worker);
+  RUN_TEST(test_failed_multicast_releases_payload);
+  return UNITY_END();
+}
+
+static ES_Event_t MakeEvent(ES_EventType_t EventType, uint16_t EventParam)
+{
+  ES_Event_t ThisEvent = {};
+  ThisEvent.EventType = EventType;
+  ThisEvent.EventParam = EventParam;
+  return ThisEvent;
+}
+
+// checks the log holds exactly the expected dispatches, in order
+static void ExpectDispatches(const Expected_t *Expected, uint8_t Num)
+{
+  TEST_ASSERT_EQUAL_UINT32(Num, TestService_GetNumDispatches());
+  for(uint8_t i = 0; i < Num; i++)
+  {
+    TestDispatch_t dispatch = TestService_GetDispatch(i);
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(Expected[i].ServiceNum, dispatch.ServiceNum, "service");
+    TEST_ASSERT_EQUAL_UINT16_MESSAGE(Expected[i].EventParam, dispatch.EventParam, "param");
+  }
+}
+
+// the worker service's hook, runs in the worker thread
+static void PostListFromWorker(ES_Event_t ThisEvent)
+{
+  ES_PostList00(MakeEvent(TEST_A, ThisEvent.EventParam + 1));
+}
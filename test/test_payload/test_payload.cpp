@@ -0,0 +1,218 @@
+/****************************************************************************
+ Module
+   test_payload.cpp
+
+ Description
+   Unit tests of the payload pool (ES_Payload.c): the in use count and
+   high-water mark, and that the framework releases an event's reference
+   once the last service it went to has run, or when its post fails
+
+ Notes
+   pio test -e native_test -f test_payload
+****************************************************************************/
+#include <unity.h>
+#include "ES_framework.h"
+#include <string.h>
+#include <unistd.h>
+
+// set by a test to keep the worker service's run function from returning
+static bool HoldWorker = false;
+
+static uint8_t AllocWith(uint32_t Data);
+static ES_Event_t MakeEvent(ES_EventType_t EventType, uint8_t Payload);
+static uint8_t PayloadsInUse(void);
+static void RetainPayload(ES_Event_t ThisEvent);
+static void WaitForRelease(ES_Event_t ThisEvent);
+
+void setUp(void)
+{
+  TestService_Reset();
+  TEST_ASSERT_EQUAL(Success, ES_Initialize(ES_Timer_RATE_1mS));
+}
+
+void tearDown(void)
+{
+  __atomic_store_n(&HoldWorker, false, __ATOMIC_RELEASE);
+  ES_WaitWorkerIdle(1000);
+}
+
+void test_alloc_tracks_in_use_and_high_water(void)
+{
+  uint8_t blocks[3];
+  for(uint8_t i = 0; i < 3; i++)
+  {
+    blocks[i] = ES_Payload_Alloc();
+    TEST_ASSERT_TRUE(blocks[i] != ES_NO_PAYLOAD);
+  }
+  ES_Payload_Release(blocks[0]);
+  ES_Payload_Release(blocks[1]);
+
+  ES_PayloadStats_t stats;
+  ES_Payload_GetStats(&stats);
+  TEST_ASSERT_EQUAL_UINT8(1, stats.InUse);
+  TEST_ASSERT_EQUAL_UINT8(3, stats.HighWater);
+
+  blocks[0] = ES_Payload_Alloc();
+  ES_Payload_GetStats(&stats);
+  TEST_ASSERT_EQUAL_UINT8(2, stats.InUse);
+  TEST_ASSERT_EQUAL_UINT8(3, stats.HighWater);   // not a new high
+
+  ES_Payload_Release(blocks[0]);
+  ES_Payload_Release(blocks[2]);
+  ES_Payload_GetStats(&stats);
+  TEST_ASSERT_EQUAL_UINT8(0, stats.InUse);
+  TEST_ASSERT_EQUAL_UINT8(3, stats.HighWater);
+}
+
+void test_alloc_fails_when_pool_empty(void)
+{
+  uint8_t blocks[ES_PAYLOAD_POOL_SIZE];
+  for(uint8_t i = 0; i < ES_PAYLOAD_POOL_SIZE; i++)
+  {
+    blocks[i] = ES_Payload_Alloc();
+    TEST_ASSERT_TRUE(blocks[i] != ES_NO_PAYLOAD);
+  }
+  TEST_ASSERT_EQUAL_UINT8(ES_NO_PAYLOAD, ES_Payload_Alloc());
+
+  ES_PayloadStats_t stats;
+  ES_Payload_GetStats(&stats);
+  TEST_ASSERT_EQUAL_UINT8(ES_PAYLOAD_POOL_SIZE, stats.HighWater);
+  TEST_ASSERT_EQUAL_UINT16(1, stats.NumAllocFails);
+
+  // a released block is handed out again
+  ES_Payload_Release(blocks[3]);
+  TEST_ASSERT_EQUAL_UINT8(blocks[3], ES_Payload_Alloc());
+}
+
+void test_retained_block_kept_until_last_release(void)
+{
+  uint8_t block = AllocWith(0x1234);
+  ES_Payload_Retain(block);
+  ES_Payload_Release(block);
+  TEST_ASSERT_EQUAL_UINT8(1, PayloadsInUse());
+  ES_Payload_Release(block);
+  TEST_ASSERT_EQUAL_UINT8(0, PayloadsInUse());
+}
+
+void test_posted_payload_released_after_run(void)
+{
+  TEST_ASSERT_TRUE(PostTestLowService(MakeEvent(TEST_A, AllocWith(0xCAFE))));
+  TEST_ASSERT_EQUAL_UINT8(1, PayloadsInUse());
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT32(1, TestService_GetNumDispatches());
+  TestDispatch_t dispatch = TestService_GetDispatch(0);
+  TEST_ASSERT_EQUAL_UINT32(0xCAFE, dispatch.PayloadData);
+  TEST_ASSERT_EQUAL_UINT8(1, dispatch.PayloadsInUse);
+  TEST_ASSERT_EQUAL_UINT8(0, PayloadsInUse());
+}
+
+void test_service_keeps_payload_it_retains(void)
+{
+  TestService_SetHook(TEST_LOW_SERV_NUM, RetainPayload);
+  uint8_t block = AllocWith(0xBEEF);
+  PostTestLowService(MakeEvent(TEST_A, block));
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT8(1, PayloadsInUse());
+  TEST_ASSERT_EQUAL_UINT32(0xBEEF, *(uint32_t *)ES_Payload_Get(block));
+  ES_Payload_Release(block);
+  TEST_ASSERT_EQUAL_UINT8(0, PayloadsInUse());
+}
+
+void test_failed_post_releases_payload(void)
+{
+  for(uint8_t i = 0; i < SERV_0_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(PostTestLowService(MakeEvent(TEST_A, ES_NO_PAYLOAD)));
+  }
+  TEST_ASSERT_FALSE(PostTestLowService(MakeEvent(TEST_A, AllocWith(1))));
+  TEST_ASSERT_EQUAL_UINT8(0, PayloadsInUse());
+
+  // and to a service that doesn't exist
+  ES_Event_t ThisEvent = MakeEvent(TEST_A, AllocWith(2));
+  ThisEvent.ServiceNum = NUM_SERVICES;
+  TEST_ASSERT_FALSE(ES_PostToService(ThisEvent));
+  TEST_ASSERT_EQUAL_UINT8(0, PayloadsInUse());
+
+  ES_PayloadStats_t stats;
+  ES_Payload_GetStats(&stats);
+  TEST_ASSERT_EQUAL_UINT8(1, stats.HighWater);
+}
+
+void test_multicast_payload_released_after_last_service(void)
+{
+  // the worker service holds on to its run until the loop's services are done
+  __atomic_store_n(&HoldWorker, true, __ATOMIC_RELEASE);
+  TestService_SetHook(TEST_WORKER_SERV_NUM, WaitForRelease);
+  TEST_ASSERT_TRUE(ES_PostList02(MakeEvent(TEST_A, AllocWith(0xF00D))));
+  TEST_ASSERT_EQUAL(Success, ES_Run());
+  TEST_ASSERT_EQUAL_UINT8(1, PayloadsInUse());
+
+  __atomic_store_n(&HoldWorker, false, __ATOMIC_RELEASE);
+  TEST_ASSERT_TRUE(ES_WaitWorkerIdle(1000));
+  TEST_ASSERT_EQUAL_UINT8(0, PayloadsInUse());
+
+  // every service on the list was handed the data
+  TEST_ASSERT_EQUAL_UINT32(3, TestService_GetNumDispatches());
+  uint8_t services = 0;
+  for(uint8_t i = 0; i < 3; i++)
+  {
+    TestDispatch_t dispatch = TestService_GetDispatch(i);
+    TEST_ASSERT_EQUAL_UINT32(0xF00D, dispatch.PayloadData);
+    TEST_ASSERT_EQUAL_UINT8(1, dispatch.PayloadsInUse);
+    services |= 1U << dispatch.ServiceNum;
+  }
+  TEST_ASSERT_EQUAL_UINT8(0x07, services);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_alloc_tracks_in_use_and_high_water);
+  RUN_TEST(test_alloc_fails_when_pool_empty);
+  RUN_TEST(test_retained_block_kept_until_last_release);
+  RUN_TEST(test_posted_payload_released_after_run);
+  RUN_TEST(test_service_keeps_payload_it_retains);
+  RUN_TEST(test_failed_post_releases_payload);
+  RUN_TEST(test_multicast_payload_released_after_last_service);
+  return UNITY_END();
+}
+
+// a block holding Data in its first 4 bytes
+static uint8_t AllocWith(uint32_t Data)
+{
+  uint8_t block = ES_Payload_Alloc();
+  TEST_ASSERT_TRUE(block != ES_NO_PAYLOAD);
+  memcpy(ES_Payload_Get(block), &Data, sizeof(Data));
+  return block;
+}
+
+static ES_Event_t MakeEvent(ES_EventType_t EventType, uint8_t Payload)
+{
+  ES_Event_t ThisEvent = {};
+  ThisEvent.EventType = EventType;
+  ThisEvent.Payload = Payload;
+  return ThisEvent;
+}
+
+static uint8_t PayloadsInUse(void)
+{
+  ES_PayloadStats_t stats;
+  ES_Payload_GetStats(&stats);
+  return stats.InUse;
+}
+
+static void RetainPayload(ES_Event_t ThisEvent)
+{
+  ES_Payload_Retain(ThisEvent.Payload);
+}
+
+// the worker service's hook, runs in the worker thread
+static void WaitForRelease(ES_Event_t ThisEvent)
+{
+  while(__atomic_load_n(&HoldWorker, __ATOMIC_ACQUIRE))
+  {
+    usleep(100);
+  }
+}
@@ -0,0 +1,199 @@
+/****************************************************************************
+ Module
+   test_queue_policies.cpp
+
+ Description
+   Unit tests of the queue policies (ES_QUEUE_POLICIES, ES_EnQueueEnd in
+   ES_Queue.c): a COALESCE event replaces an identical one that is still
+   waiting, a DROP_OLDEST event pushes out the oldest waiting event of its
+   own type when the queue is full, and any other post to a full queue is
+   rejected. Each case checks the queue's stats as well
+
+ Notes
+   pio test -e native_test -f test_queue_policies
+   The tests work on a queue of their own, TEST_COALESCE and TEST_DROP have
+   their policies in ES_Configure_Test.h, TEST_A has none
+****************************************************************************/
+#include <unity.h>
+#include "ES_framework.h"
+#include "ES_Queue.h"
+
+#define TEST_QUEUE_SIZE 4
+
+static ES_Event_t QueueArray[TEST_QUEUE_SIZE];
+static ES_Queue_t Queue = {0, 0, TEST_QUEUE_SIZE, QueueArray};
+
+static ES_Event_t MakeEvent(ES_EventType_t EventType, uint16_t EventParam);
+static void ExpectQueue(const ES_Event_t *Expected, uint8_t Num);
+static uint8_t PayloadsInUse(void);
+
+void setUp(void)
+{
+  TestService_Reset();
+  TEST_ASSERT_EQUAL(Success, ES_Initialize(ES_Timer_RATE_1mS));
+  ES_InitQueue(&Queue);
+}
+
+void tearDown(void)
+{
+}
+
+void test_coalesce_replaces_waiting_event_in_place(void)
+{
+  ES_Event_t replaced = MakeEvent(TEST_COALESCE, 1);
+  replaced.Payload = ES_Payload_Alloc();
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, replaced));
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_A, 2)));
+  ES_Event_t newer = MakeEvent(TEST_COALESCE, 1);
+  newer.Payload = ES_Payload_Alloc();
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, newer));
+
+  // the newer event sits where the first one was, with its own payload
+  const ES_Event_t expected[] = {newer, MakeEvent(TEST_A, 2)};
+  ExpectQueue(expected, 2);
+  TEST_ASSERT_EQUAL_UINT32(1, Queue.stats.Coalesced);
+  TEST_ASSERT_EQUAL_UINT8(1, PayloadsInUse());
+  ES_Payload_Release(newer.Payload);
+}
+
+void test_coalesce_appends_if_param_differs(void)
+{
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_COALESCE, 1)));
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_COALESCE, 2)));
+
+  const ES_Event_t expected[] = {MakeEvent(TEST_COALESCE, 1), MakeEvent(TEST_COALESCE, 2)};
+  ExpectQueue(expected, 2);
+  TEST_ASSERT_EQUAL_UINT32(0, Queue.stats.Coalesced);
+}
+
+void test_coalesce_appends_if_service_differs(void)
+{
+  ES_Event_t other = MakeEvent(TEST_COALESCE, 1);
+  other.ServiceNum = TEST_HIGH_SERV_NUM;
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_COALESCE, 1)));
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, other));
+
+  TEST_ASSERT_EQUAL_UINT8(2, Queue.num_events);
+  TEST_ASSERT_EQUAL_UINT32(0, Queue.stats.Coalesced);
+}
+
+void test_drop_oldest_drops_only_its_own_type(void)
+{
+  // the queue is full, the oldest events are of other types
+  ES_Event_t dropped = MakeEvent(TEST_DROP, 3);
+  dropped.Payload = ES_Payload_Alloc();
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(ES_TIMEOUT, 1)));
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_A, 2)));
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, dropped));
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_DROP, 4)));
+  TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_DROP, 5)));
+
+  const ES_Event_t expected[] = {
+    MakeEvent(ES_TIMEOUT, 1), MakeEvent(TEST_A, 2),
+    MakeEvent(TEST_DROP, 4), MakeEvent(TEST_DROP, 5)
+  };
+  ExpectQueue(expected, 4);
+  TEST_ASSERT_EQUAL_UINT32(1, Queue.stats.DroppedOldest);
+  TEST_ASSERT_EQUAL_UINT32(0, Queue.stats.Rejected);
+  TEST_ASSERT_EQUAL_UINT8(0, PayloadsInUse());
+}
+
+void test_drop_oldest_rejected_without_own_type_waiting(void)
+{
+  // ES_TIMEOUT may drop too, but only timeouts
+  for(uint8_t i = 0; i < TEST_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(ES_TIMEOUT, i)));
+  }
+  ES_Event_t refused = MakeEvent(TEST_DROP, 9);
+  refused.Payload = ES_Payload_Alloc();
+  TEST_ASSERT_FALSE(ES_EnQueueEnd(&Queue, refused));
+
+  TEST_ASSERT_EQUAL_UINT8(TEST_QUEUE_SIZE, Queue.num_events);
+  TEST_ASSERT_EQUAL_UINT32(0, Queue.stats.DroppedOldest);
+  TEST_ASSERT_EQUAL_UINT32(1, Queue.stats.Rejected);
+  // a failed post leaves the payload to the caller
+  TEST_ASSERT_EQUAL_UINT8(1, PayloadsInUse());
+  ES_Payload_Release(refused.Payload);
+}
+
+void test_reject_fails_post_to_full_queue(void)
+{
+  for(uint8_t i = 0; i < TEST_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_DROP, i)));
+  }
+  TEST_ASSERT_FALSE(ES_EnQueueEnd(&Queue, MakeEvent(TEST_A, 9)));
+  TEST_ASSERT_FALSE(ES_EnQueueFront(&Queue, MakeEvent(TEST_A, 10)));
+
+  // TEST_A has no policy, the waiting events stay as they were
+  const ES_Event_t expected[] = {
+    MakeEvent(TEST_DROP, 0), MakeEvent(TEST_DROP, 1),
+    MakeEvent(TEST_DROP, 2), MakeEvent(TEST_DROP, 3)
+  };
+  ExpectQueue(expected, 4);
+  TEST_ASSERT_EQUAL_UINT32(2, Queue.stats.Rejected);
+  TEST_ASSERT_EQUAL_UINT32(0, Queue.stats.DroppedOldest);
+  TEST_ASSERT_EQUAL_UINT8(TEST_QUEUE_SIZE, Queue.stats.HighWater);
+}
+
+void test_service_queue_counts_rejected_posts(void)
+{
+  // the same through a service's post function and ES_GetQueueStats
+  for(uint8_t i = 0; i < SERV_0_QUEUE_SIZE; i++)
+  {
+    TEST_ASSERT_TRUE(PostTestLowService(MakeEvent(TEST_A, i)));
+  }
+  TEST_ASSERT_FALSE(PostTestLowService(MakeEvent(TEST_A, 9)));
+
+  ES_QueueStats_t stats;
+  TEST_ASSERT_TRUE(ES_GetQueueStats(TEST_LOW_SERV_NUM, &stats));
+  TEST_ASSERT_EQUAL_UINT32(1, stats.Rejected);
+  TEST_ASSERT_EQUAL_UINT8(SERV_0_QUEUE_SIZE, stats.HighWater);
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+  TEST_ASSERT_EQUAL_UINT32(SERV_0_QUEUE_SIZE, TestService_GetNumDispatches());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_coalesce_replaces_waiting_event_in_place);
+  RUN_TEST(test_coalesce_appends_if_param_differs);
+  RUN_TEST(test_coalesce_appends_if_service_differs);
+  RUN_TEST(test_drop_oldest_drops_only_its_own_type);
+  RUN_TEST(test_drop_oldest_rejected_without_own_type_waiting);
+  RUN_TEST(test_reject_fails_post_to_full_queue);
+  RUN_TEST(test_service_queue_counts_rejected_posts);
+  return UNITY_END();
+}
+
+static ES_Event_t MakeEvent(ES_EventType_t EventType, uint16_t EventParam)
+{
+  ES_Event_t ThisEvent = {};
+  ThisEvent.EventType = EventType;
+  ThisEvent.EventParam = EventParam;
+  ThisEvent.Payload = ES_NO_PAYLOAD;
+  return ThisEvent;
+}
+
+// checks the queue holds exactly the expected events, front first, and
+// empties it
+static void ExpectQueue(const ES_Event_t *Expected, uint8_t Num)
+{
+  ES_Event_t waiting;
+  TEST_ASSERT_EQUAL_UINT8(Num, Queue.num_events);
+  for(uint8_t i = 0; i < Num; i++)
+  {
+    TEST_ASSERT_TRUE(ES_DeQueue(&Queue, &waiting));
+    TEST_ASSERT_EQUAL_MESSAGE(Expected[i].EventType, waiting.EventType, "type");
+    TEST_ASSERT_EQUAL_UINT16_MESSAGE(Expected[i].EventParam, waiting.EventParam, "param");
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(Expected[i].Payload, waiting.Payload, "payload");
+  }
+}
+
+static uint8_t PayloadsInUse(void)
+{
+  ES_PayloadStats_t stats;
+  ES_Payload_GetStats(&stats);
+  return stats.InUse;
+}
@@ -0,0 +1,145 @@
+/****************************************************************************
+ Module
+   test_stale_timeout.cpp
+
+ Description
+   Unit tests of the stale timeout filter (ES_Timer_IsStale, checked by
+   ES_Run and the worker loop before each dispatch). A timeout that is still
+   waiting in a queue when its timer is stopped or started again carries an
+   old TimerGen and must never reach the service
+
+ Notes
+   pio test -e native_test -f test_stale_timeout
+   FireDueTimers jumps the clock to the next deadline and runs the tick
+   response, so the timeout is posted but not dispatched yet
+****************************************************************************/
+#include <unity.h>
+#include "ES_framework.h"
+#include "ES_Timers.h"
+#include <unistd.h>
+
+// set by a test to keep the worker service's run function from returning
+static bool HoldWorker = false;
+
+static void FireDueTimers(void);
+static void RestartLowTimer(ES_Event_t ThisEvent);
+static void WaitForRelease(ES_Event_t ThisEvent);
+
+void setUp(void)
+{
+  TestService_Reset();
+  TEST_ASSERT_EQUAL(Success, ES_Initialize(ES_Timer_RATE_1mS));
+}
+
+void tearDown(void)
+{
+  __atomic_store_n(&HoldWorker, false, __ATOMIC_RELEASE);
+  ES_WaitWorkerIdle(1000);
+}
+
+void test_timeout_delivered_if_timer_left_alone(void)
+{
+  ES_Timer_InitTimer(TEST_LOW_TIMER_NUM, 5);
+  FireDueTimers();
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT32(1, TestService_GetNumDispatches());
+  TestDispatch_t dispatch = TestService_GetDispatch(0);
+  TEST_ASSERT_EQUAL(ES_TIMEOUT, dispatch.EventType);
+  TEST_ASSERT_EQUAL_UINT16(TEST_LOW_TIMER_NUM, dispatch.EventParam);
+}
+
+void test_timeout_dropped_if_stopped_while_queued(void)
+{
+  ES_Timer_InitTimer(TEST_LOW_TIMER_NUM, 5);
+  FireDueTimers();
+  ES_Timer_StopTimer(TEST_LOW_TIMER_NUM);
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  ES_QueueStats_t stats;
+  ES_GetQueueStats(TEST_LOW_SERV_NUM, &stats);
+  TEST_ASSERT_EQUAL_UINT8(1, stats.HighWater);   // it was queued
+  TEST_ASSERT_EQUAL_UINT32(0, TestService_GetNumDispatches());
+}
+
+void test_timeout_dropped_if_restarted_while_queued(void)
+{
+  ES_Timer_InitTimer(TEST_LOW_TIMER_NUM, 5);
+  FireDueTimers();
+  ES_Timer_InitTimer(TEST_LOW_TIMER_NUM, 1000);
+  TEST_ASSERT_EQUAL(Success, ES_Run());
+  TEST_ASSERT_EQUAL_UINT32(0, TestService_GetNumDispatches());
+
+  // only the restarted timer's own timeout gets through
+  FireDueTimers();
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+  TEST_ASSERT_EQUAL_UINT32(1, TestService_GetNumDispatches());
+  TEST_ASSERT_EQUAL(ES_TIMEOUT, TestService_GetDispatch(0).EventType);
+}
+
+void test_timeout_dropped_if_restarted_by_higher_service(void)
+{
+  // the high service runs first and restarts the low service's timer while
+  // its timeout waits behind
+  TestService_SetHook(TEST_HIGH_SERV_NUM, RestartLowTimer);
+  ES_Timer_InitTimer(TEST_LOW_TIMER_NUM, 5);
+  FireDueTimers();
+  ES_Event_t ThisEvent = {.EventType = TEST_A};
+  PostTestHighService(ThisEvent);
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT32(1, TestService_GetNumDispatches());
+  TEST_ASSERT_EQUAL_UINT8(TEST_HIGH_SERV_NUM, TestService_GetDispatch(0).ServiceNum);
+  TEST_ASSERT_EQUAL(ES_Timer_ACTIVE, ES_Timer_IsRunning(TEST_LOW_TIMER_NUM));
+}
+
+void test_timeout_dropped_by_worker_if_stopped_while_queued(void)
+{
+  // the worker service is held up in a run while its timeout is posted
+  // and the timer stopped
+  __atomic_store_n(&HoldWorker, true, __ATOMIC_RELEASE);
+  TestService_SetHook(TEST_WORKER_SERV_NUM, WaitForRelease);
+  ES_Event_t ThisEvent = {.EventType = TEST_A};
+  PostTestWorkerService(ThisEvent);
+  ES_Timer_InitTimer(TEST_WORKER_TIMER_NUM, 5);
+  FireDueTimers();
+  ES_Timer_StopTimer(TEST_WORKER_TIMER_NUM);
+  __atomic_store_n(&HoldWorker, false, __ATOMIC_RELEASE);
+  TEST_ASSERT_TRUE(TestService_RunUntilIdle());
+
+  TEST_ASSERT_EQUAL_UINT32(1, TestService_GetNumDispatches());
+  TEST_ASSERT_EQUAL(TEST_A, TestService_GetDispatch(0).EventType);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_timeout_delivered_if_timer_left_alone);
+  RUN_TEST(test_timeout_dropped_if_stopped_while_queued);
+  RUN_TEST(test_timeout_dropped_if_restarted_while_queued);
+  RUN_TEST(test_timeout_dropped_if_restarted_by_higher_service);
+  RUN_TEST(test_timeout_dropped_by_worker_if_stopped_while_queued);
+  return UNITY_END();
+}
+
+static void FireDueTimers(void)
+{
+  uint32_t deadline;
+  TEST_ASSERT_TRUE(ES_Timer_GetNextDeadline(&deadline));
+  _HW_Skip_To_Tick(deadline);
+  ES_Timer_Tick_Resp();
+}
+
+static void RestartLowTimer(ES_Event_t ThisEvent)
+{
+  ES_Timer_InitTimer(TEST_LOW_TIMER_NUM, 1000);
+}
+
+// the worker service's hook, runs in the worker thread
+static void WaitForRelease(ES_Event_t ThisEvent)
+{
+  while(__atomic_load_n(&HoldWorker, __ATOMIC_ACQUIRE))
+  {
+    usleep(100);
+  }
+}
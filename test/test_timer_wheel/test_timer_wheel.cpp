@@ -0,0 +1,220 @@
+/****************************************************************************
+ Module
+   test_timer_wheel.cpp
+
+ Description
+   Unit tests of the timer wheel (ES_Timers.c). Each test jumps the clock
+   (_HW_Skip_To_Tick) to a tick where the wheel's slots and levels roll
+   over, starts a timer of each of WheelLengths and steps from deadline to
+   deadline. At every step the next deadline has to be the earliest timer
+   still to go off, and every timer has to go off at its deadline (or the
+   tick after, if the clock moved on by itself meanwhile). The slack tests
+   check that timers with slack go off with an earlier alarm once their
+   deadline is reached, and at their deadline plus slack otherwise
+
+ Notes
+   pio test -e native_test -f test_timer_wheel
+   The timers' post function records the timeouts straight from the tick
+   response, ES_Run isn't called
+****************************************************************************/
+#include <unity.h>
+#include "ES_framework.h"
+#include "ES_Timers.h"
+#include <stdio.h>
+
+// lengths around each level's span
+static const uint32_t WheelLengths[] = {1, 2, 63, 64, 65, 4095, 4096, 4097, 262144, 262145, 1UL << 24, (1UL << 24) + 1};
+#define WHEEL_NUM_TIMERS (sizeof(WheelLengths) / sizeof(WheelLengths[0]))
+
+static uint32_t WheelFiredAt[ES_TIMER_POOL_SIZE];  // tick each timer went off at
+static bool WheelFired[ES_TIMER_POOL_SIZE];        // set by the post function
+
+static void CheckWheelFrom(uint32_t Start);
+static ES_TimerHandle_t StartWithSlack(uint32_t Time, uint16_t Slack);
+static void FireAt(uint32_t Tick);
+static bool RecordWheelTimeout(ES_Event_t ThisEvent);
+
+void setUp(void)
+{
+  TestService_Reset();
+  TEST_ASSERT_EQUAL(Success, ES_Initialize(ES_Timer_RATE_1mS));
+}
+
+void tearDown(void)
+{
+}
+
+// 1 of the wheel's base 64 digits is 63, the timers cross slot 63
+void test_wheel_across_slot_rollover(void)
+{
+  CheckWheelFrom(0x0100003F);
+}
+
+// 2 digits are 63, the timers cross into level 1's next slot
+void test_wheel_across_level_1_rollover(void)
+{
+  CheckWheelFrom(0x02000FFF);
+}
+
+void test_wheel_across_level_2_rollover(void)
+{
+  CheckWheelFrom(0x0303FFFF);
+}
+
+void test_wheel_across_level_3_rollover(void)
+{
+  CheckWheelFrom(0x04FFFFFF);
+}
+
+// and the tick count itself wraps
+void test_wheel_across_tick_count_wrap(void)
+{
+  CheckWheelFrom(0xFFFFFFFF);
+}
+
+void test_slack_timers_go_off_with_earlier_alarm(void)
+{
+  _HW_Skip_To_Tick(0x00100000);
+  ES_TimerHandle_t plain = StartWithSlack(130, 0);
+  ES_TimerHandle_t early = StartWithSlack(120, 30);      // deadline passed at 130
+  ES_TimerHandle_t later = StartWithSlack(200, 50);      // deadline still to come
+  ES_TimerHandle_t stopped = StartWithSlack(110, 30);
+  ES_TimerHandle_t restarted = StartWithSlack(100, 25);
+  ES_Timer_StopTimer(stopped);
+  ES_Timer_InitTimer(restarted, 140);                    // goes off at 140 to 165 now
+
+  uint32_t deadline;
+  TEST_ASSERT_TRUE(ES_Timer_GetNextDeadline(&deadline));
+  TEST_ASSERT_EQUAL_UINT32(0x00100000 + 130, deadline);
+  FireAt(deadline);
+  TEST_ASSERT_TRUE(WheelFired[plain]);
+  TEST_ASSERT_TRUE(WheelFired[early]);
+  TEST_ASSERT_FALSE(WheelFired[later]);
+  TEST_ASSERT_FALSE(WheelFired[stopped]);
+  TEST_ASSERT_FALSE(WheelFired[restarted]);
+  TEST_ASSERT_EQUAL_UINT32(1, ES_Timer_GetNumAlarms());
+
+  // nothing else wakes the timers left, so each goes off at its expiry
+  TEST_ASSERT_TRUE(ES_Timer_GetNextDeadline(&deadline));
+  TEST_ASSERT_EQUAL_UINT32(0x00100000 + 165, deadline);
+  FireAt(deadline);
+  TEST_ASSERT_TRUE(WheelFired[restarted]);
+  TEST_ASSERT_FALSE(WheelFired[later]);
+  TEST_ASSERT_TRUE(ES_Timer_GetNextDeadline(&deadline));
+  TEST_ASSERT_EQUAL_UINT32(0x00100000 + 250, deadline);
+  FireAt(deadline);
+  TEST_ASSERT_TRUE(WheelFired[later]);
+  TEST_ASSERT_FALSE(WheelFired[stopped]);
+  TEST_ASSERT_FALSE(ES_Timer_GetNextDeadline(&deadline));
+}
+
+void test_slack_timers_go_off_in_deadline_order(void)
+{
+  // started latest deadline first, the slack list keeps them sorted
+  _HW_Skip_To_Tick(0x00200000);
+  ES_TimerHandle_t timers[4];
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    timers[i] = StartWithSlack(1000 - 50 * i, 100);
+  }
+  ES_TimerHandle_t wakeup = StartWithSlack(920, 0);
+
+  // the alarm at 920 takes the two whose deadline has been reached
+  uint32_t deadline;
+  TEST_ASSERT_TRUE(ES_Timer_GetNextDeadline(&deadline));
+  TEST_ASSERT_EQUAL_UINT32(0x00200000 + 920, deadline);
+  FireAt(deadline);
+  TEST_ASSERT_TRUE(WheelFired[wakeup]);
+  TEST_ASSERT_FALSE(WheelFired[timers[0]]);
+  TEST_ASSERT_FALSE(WheelFired[timers[1]]);
+  TEST_ASSERT_TRUE(WheelFired[timers[2]]);
+  TEST_ASSERT_TRUE(WheelFired[timers[3]]);
+  TEST_ASSERT_TRUE(ES_Timer_GetNextDeadline(&deadline));
+  TEST_ASSERT_EQUAL_UINT32(0x00200000 + 1050, deadline);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_wheel_across_slot_rollover);
+  RUN_TEST(test_wheel_across_level_1_rollover);
+  RUN_TEST(test_wheel_across_level_2_rollover);
+  RUN_TEST(test_wheel_across_level_3_rollover);
+  RUN_TEST(test_wheel_across_tick_count_wrap);
+  RUN_TEST(test_slack_timers_go_off_with_earlier_alarm);
+  RUN_TEST(test_slack_timers_go_off_in_deadline_order);
+  return UNITY_END();
+}
+
+// Runs the wheel from Start until a timer of each of WheelLengths has gone off
+static void CheckWheelFrom(uint32_t Start)
+{
+  ES_TimerHandle_t timers[WHEEL_NUM_TIMERS];
+  bool done[WHEEL_NUM_TIMERS] = {};
+  char message[64];
+  uint32_t deadline;
+
+  for(uint8_t i = 0; i < WHEEL_NUM_TIMERS; i++)
+  {
+    timers[i] = ES_Timer_Alloc(RecordWheelTimeout);
+    TEST_ASSERT_TRUE_MESSAGE(timers[i] != ES_TIMER_INVALID, "pool too small");
+    WheelFired[timers[i]] = false;
+  }
+  _HW_Skip_To_Tick(Start);
+  for(uint8_t i = 0; i < WHEEL_NUM_TIMERS; i++)
+  {
+    ES_Timer_InitTimer(timers[i], WheelLengths[i]);
+  }
+
+  for(uint8_t left = WHEEL_NUM_TIMERS; left > 0; )
+  {
+    uint32_t expected = UINT32_MAX;  // ticks after Start
+    for(uint8_t i = 0; i < WHEEL_NUM_TIMERS; i++)
+    {
+      if(!done[i] && WheelLengths[i] < expected)
+        expected = WheelLengths[i];
+    }
+    TEST_ASSERT_TRUE_MESSAGE(ES_Timer_GetNextDeadline(&deadline), "no next deadline");
+    snprintf(message, sizeof(message), "next deadline, %u timers left", left);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected, deadline - Start, message);
+
+    _HW_Skip_To_Tick(deadline);
+    ES_Timer_Tick_Resp();
+    for(uint8_t i = 0; i < WHEEL_NUM_TIMERS; i++)
+    {
+      if(done[i] || !WheelFired[timers[i]])
+        continue;
+      done[i] = true;
+      left--;
+      snprintf(message, sizeof(message), "timer of %u not on time", WheelLengths[i]);
+      TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(1, WheelFiredAt[timers[i]] - Start - WheelLengths[i], message);
+    }
+  }
+  TEST_ASSERT_FALSE(ES_Timer_GetNextDeadline(&deadline));
+}
+
+// allocates a timer with the given slack and starts it
+static ES_TimerHandle_t StartWithSlack(uint32_t Time, uint16_t Slack)
+{
+  ES_TimerHandle_t Timer = ES_Timer_Alloc(RecordWheelTimeout);
+  TEST_ASSERT_TRUE_MESSAGE(Timer != ES_TIMER_INVALID, "pool too small");
+  WheelFired[Timer] = false;
+  ES_Timer_SetSlack(Timer, Slack);
+  ES_Timer_InitTimer(Timer, Time);
+  return Timer;
+}
+
+// jumps the clock to Tick and runs the tick response
+static void FireAt(uint32_t Tick)
+{
+  _HW_Skip_To_Tick(Tick);
+  ES_Timer_Tick_Resp();
+}
+
+// the timers' post function, called straight from the tick response
+static bool RecordWheelTimeout(ES_Event_t ThisEvent)
+{
+  WheelFiredAt[ThisEvent.EventParam] = ES_Timer_GetTime();
+  WheelFired[ThisEvent.EventParam] = true;
+  return true;
+}